@@ -1,6 +1,8 @@
 /*
  * Header for the color ASCII table application. The application simply display all
  * the ASCII characters
+ * The table is pure text, so it is written in the character grid of the VGA text mode: the screen needs no
+ * frame buffer and each line is rendered from the grid while it is displayed
  *
  *  Created on: Jan 5, 2022
  *      Author: Andrea Monzani [Mat 952817]
@@ -9,10 +11,10 @@
 #ifndef INC_APP_ASCII_TABLE_H_
 #define INC_APP_ASCII_TABLE_H_
 
-#include <screen/screen.h>
+#include <vga/vgascreenbuffer.h>
 
- /// Initialize the ASCII table application on the specified screen buffer
-void AsciiTableInitialize(ScreenBuffer* screenBuffer);
+ /// Initialize the ASCII table application on the specified character grid
+void AsciiTableInitialize(VgaTextBuffer* textBuffer);
 /// Input process function
 void AsciiTableProcessInput(char command);
 /// Closes the application
@@ -31,6 +31,18 @@ typedef enum _BmpIdentifier {
     BmpIdentifierBM = 0x4D42
 } BmpIdentifier;
 
+/// Resize algorithms used when the bitmap size differs from the screen size
+typedef enum _BmpScaleMode {
+    /// Each screen pixel takes the color of the nearest bitmap pixel. Fastest mode, but it aliases when
+    /// the bitmap is much larger than the screen
+    BmpScaleNearest,
+    /// Each screen pixel is the average of the bitmap pixels it covers (area averaging).
+    /// Best quality for shrinking photos
+    BmpScaleBox,
+    /// Each screen pixel is interpolated from the 4 nearest bitmap pixels
+    BmpScaleBilinear
+} BmpScaleMode;
+
 /// BMP file description struct
 typedef struct _Bmp {
     /// Handle to the BMP file
@@ -57,6 +69,8 @@ BmpResult BmpReadFromFile(FIL* file, Bmp* pBmp);
 /// Display a BMP image to the entire screen
 /// @param cpBmp Pointer to the BMP description
 /// @param cpScreenBuffer Destination screen buffer
+/// @param scaleMode Resize algorithm used when the bitmap size differs from the screen size
+/// @param dither Dithering applied when converting the image to the screen colors
 /// @return Status of the operation
-BmpResult BmpDisplay(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer);
+BmpResult BmpDisplay(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer, BmpScaleMode scaleMode, ScreenDither dither);
 #endif /* INC_APP_BMP_H_ */
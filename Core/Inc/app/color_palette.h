@@ -3,6 +3,8 @@
  * row and all the 256 green values by column.
  * The red level can be changed by using the UART '+' and '-' inputs
  * For the 8bpp mode, the red has only 4 "levels"
+ * On a palettized screen (4bpp or 2bpp) the application draws a swatch for each palette entry once, then the
+ * red level only reprograms the palette
  *
  *  Created on: Nov 29, 2021
  *      Author: Andrea Monzani [Mat 952817]
@@ -19,6 +19,7 @@
 #define CRC16_ZERO 0
 
 #include <stdint.h>
+#include <stddef.h>
 
 /// Initialize the CRC16 object
 void Crc16Initialize();
@@ -26,4 +27,12 @@ void Crc16Initialize();
 /// Accumulate the CRC using a provided data byte
 uint16_t Crc16Add(uint16_t crc, uint8_t data);
 
+/// Accumulate the CRC of a block of data. Four bytes are processed at a time, so this is much faster than
+/// calling Crc16Add for each byte
+/// @param crc Current CRC value
+/// @param pData Data pointer
+/// @param count Number of bytes to read from the pointer
+/// @return Updated CRC value
+uint16_t Crc16Update(uint16_t crc, const uint8_t* pData, size_t count);
+
 #endif /* INC_CRC_CRC16_H_ */
@@ -34,5 +34,11 @@ uint8_t Crc7Add(uint8_t crc, uint8_t data);
 /// @param count Number of bytes to read from the pointer
 /// @return Data CRC
 uint8_t Crc7Calculate(const uint8_t *pData, size_t count);
+/// Accumulate the CRC of a stream of data to a current existing CRC value (incremental calculation)
+/// @param crc Current CRC value
+/// @param pData Data pointer
+/// @param count Number of bytes to read from the pointer
+/// @return Updated CRC value
+uint8_t Crc7Update(uint8_t crc, const uint8_t *pData, size_t count);
 
 #endif /* CRC7_H_ */
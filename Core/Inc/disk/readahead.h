@@ -0,0 +1,56 @@
+/*
+ * This file contains the headers of the sequential read-ahead layer placed between FatFs and the storage task.
+ *
+ * Reads that continue the previous one form a sequential stream: when a stream is detected, the sectors following
+ * the last read are prefetched asynchronously (a single multiple block read) into a window of sector buffers while
+ * the client processes the data it received. Following reads are served from the window when possible.
+ * Multiple sector reads into buffers allocated with ralloc bypass the window: the card data is transferred by the
+ * DMA directly into the client buffer, without any copy.
+ *
+ * @remarks The layer is not thread safe: it must be used by a single task (the FatFs client)
+ *
+ *  Created on: Oct 16, 2026
+ */
+
+#ifndef INC_DISK_READAHEAD_H_
+#define INC_DISK_READAHEAD_H_
+
+#include <typedefs.h>
+#include <sd/sd.h>
+
+/// Read-ahead counters
+typedef struct _ReadAheadStatistics {
+    /// Sectors served from the prefetched window
+    UInt32 hitSectors;
+    /// Sectors read from the card on demand
+    UInt32 missSectors;
+    /// Sectors prefetched from the card
+    UInt32 prefetchedSectors;
+    /// Prefetched sectors dropped without being used
+    UInt32 discardedSectors;
+    /// Sectors read directly into the client buffer, bypassing the window
+    UInt32 directSectors;
+    /// Prefetches already completed when the client needed them (the whole transfer overlapped the client work)
+    UInt32 readyPrefetches;
+} ReadAheadStatistics;
+
+/// Allocates the prefetch window
+/// \remarks The window is allocated in the core coupled memory, it does not use the RAM reserved to the DMA targets
+void ReadAheadInitialize();
+
+/// Reads sectors, serving them from the prefetched window when possible. Multiple sector reads into a DMA-reachable
+/// buffer are always read from the card
+/// \param buffer Destination buffer
+/// \param sector First sector to read
+/// \param count Number of sectors to read
+/// \return Status of the operation
+SdStatus ReadAheadRead(BYTE* buffer, UInt32 sector, UInt32 count);
+
+/// Waits for a running prefetch and drops the prefetched sectors
+/// \remarks Must be called before the card is re-initialized
+void ReadAheadInvalidate();
+
+/// Returns the read-ahead counters
+void ReadAheadGetStatistics(ReadAheadStatistics* statistics);
+
+#endif /* INC_DISK_READAHEAD_H_ */
@@ -0,0 +1,62 @@
+/*
+ * This file contains the headers of the LRU cache of single sectors placed under the FatFs disk layer.
+ *
+ * FatFs keeps only one sector window per volume, so FAT and directory sectors are read again from the card
+ * each time a directory is enumerated. The cache keeps the most recently used single sectors in a dedicated pool:
+ * -> Sectors read into the FatFs window (FAT, directories, boot sector) are metadata and they are kept preferentially:
+ *    a data sector never evicts a metadata one
+ * -> Multiple sector reads (file data) bypass the cache
+ * The cache is write-through capable: a write path must update the cached copies with SectorCacheWrite before writing
+ * the card
+ *
+ * @remarks The cache is not thread safe: it must be used by a single task (the FatFs client)
+ *
+ *  Created on: Oct 16, 2026
+ */
+
+#ifndef INC_DISK_SECTORCACHE_H_
+#define INC_DISK_SECTORCACHE_H_
+
+#include <typedefs.h>
+#include <sd/sd.h>
+
+/// Number of sectors kept in the cache
+#define SECTOR_CACHE_SLOTS 8
+
+/// Sector cache counters
+typedef struct _SectorCacheStatistics {
+    /// Metadata sectors served from the cache
+    UInt32 metadataHits;
+    /// Metadata sectors read from the card
+    UInt32 metadataMisses;
+    /// Data sectors served from the cache
+    UInt32 dataHits;
+    /// Data sectors read from the card
+    UInt32 dataMisses;
+} SectorCacheStatistics;
+
+/// Defines the FatFs window buffer: sectors read into this buffer are considered metadata
+/// \param window The win field of the mounted FATFS object
+void SectorCacheSetMetadataWindow(const BYTE* window);
+
+/// Reads sectors, serving single sectors from the cache when possible
+/// \param buffer Destination buffer
+/// \param sector First sector to read
+/// \param count Number of sectors to read
+/// \return Status of the operation
+SdStatus SectorCacheRead(BYTE* buffer, UInt32 sector, UInt32 count);
+
+/// Updates the cached copies of sectors that are going to be written
+/// \param buffer Data of the sectors
+/// \param sector First written sector
+/// \param count Number of written sectors
+void SectorCacheWrite(const BYTE* buffer, UInt32 sector, UInt32 count);
+
+/// Drops all the cached sectors
+/// \remarks Must be called before the card is re-initialized
+void SectorCacheInvalidate();
+
+/// Returns the cache counters
+void SectorCacheGetStatistics(SectorCacheStatistics* statistics);
+
+#endif /* INC_DISK_SECTORCACHE_H_ */
@@ -0,0 +1,70 @@
+/*
+ * This file contains the headers of the storage task, the only task that accesses the SD card data.
+ *
+ * Clients submit read requests (sector, count, buffer) through a queue and are notified on completion with
+ * a thread flag and/or a callback. Requests for adjacent sectors that are waiting in the queue are merged in
+ * a single multiple block read, each one still transferred into its own buffer.
+ *
+ * The scheduler is cooperative: a submitted request is not served until the client blocks or yields. An
+ * asynchronous client must yield after the submission to let the task start the transfer, then it keeps running
+ * while the task waits for the block DMA. A synchronous client (StorageRead) only moves the transfer to the task,
+ * it does not overlap it with any work. Merges happen only when several requests are queued before the task runs
+ *
+ * @remarks Card initialization (power cycle and connection) is still performed by the caller, when no read
+ * request is pending
+ *
+ *  Created on: Oct 16, 2026
+ */
+
+#ifndef INC_DISK_STORAGE_H_
+#define INC_DISK_STORAGE_H_
+
+#include <typedefs.h>
+#include <cmsis_os2.h>
+#include <sd/sd.h>
+
+/// Thread flag set on the notified thread when a request is completed
+#define STORAGE_FLAG_REQUEST_COMPLETED 0x10
+
+typedef struct _StorageRequest StorageRequest;
+
+/// Delegate definition for the callback invoked when a request is completed
+/// \remarks The callback runs in the storage task, so it should only signal the client
+typedef void (*StorageCompletionCallback)(StorageRequest* request);
+
+/// Read request. The structure is owned by the storage task from the submission to the completion
+struct _StorageRequest {
+    /// First sector to read
+    UInt32 sector;
+    /// Number of sectors to read
+    UInt32 count;
+    /// Destination buffer (count sectors)
+    BYTE* buffer;
+    /// Thread to notify with STORAGE_FLAG_REQUEST_COMPLETED. Can be NULL
+    osThreadId_t notifyThread;
+    /// Callback invoked on completion. Can be NULL
+    StorageCompletionCallback callback;
+    /// Client data for the callback
+    void* context;
+    /// Result of the request, valid once completed
+    volatile SdStatus status;
+};
+
+/// Creates the storage task and its request queue
+/// \remarks Must be called after the kernel initialization and before the kernel is started
+void StorageInitialize();
+
+/// Submits a read request without waiting for its completion
+/// \param request Request to submit. It must stay valid until completion
+/// \return False if the request cannot be queued
+BOOL StorageReadAsync(StorageRequest* request);
+
+/// Reads sectors and waits for the completion
+/// \param buffer Destination buffer
+/// \param sector First sector to read
+/// \param count Number of sectors to read
+/// \return Status of the operation
+/// \remarks Before the kernel is started, the card is accessed directly
+SdStatus StorageRead(BYTE* buffer, UInt32 sector, UInt32 count);
+
+#endif /* INC_DISK_STORAGE_H_ */
@@ -0,0 +1,43 @@
+/*
+ * Cache of the glyph bitmaps converted in a run-length encoded form
+ *
+ * Glyph rows are stored as a sequence of runs. Each run starts with a header byte: the two MSBs define the
+ * run type, the remaining bits the run length in pixels
+ * -> Skip runs cover transparent pixels that must not be drawn
+ * -> Solid runs cover pixels with full coverage that can be filled with the pen color
+ * -> Blend runs are followed by the coverage level of each pixel
+ * A zero byte ends the row (trailing transparent pixels are not stored)
+ *
+ * The runs do not depend on the pen color, which is applied by the driver when the glyph is drawn.
+ * Least recently used glyphs are evicted when the cache is full
+ *
+ *  Created on: Oct 16, 2026
+ */
+#ifndef INC_FONTS_GLYPHCACHE_H_
+#define INC_FONTS_GLYPHCACHE_H_
+
+#include <typedefs.h>
+#include <fonts/glyph.h>
+
+/// Mask of the run type in the run header
+#define GLYPH_RUN_TYPE_MASK 0xC0
+/// Mask of the run length in the run header
+#define GLYPH_RUN_LENGTH_MASK 0x3F
+/// Run of transparent pixels
+#define GLYPH_RUN_SKIP 0x00
+/// Run of fully covered pixels
+#define GLYPH_RUN_SOLID 0x40
+/// Run of partially covered pixels, followed by the coverage levels
+#define GLYPH_RUN_BLEND 0x80
+/// Marker of the end of a glyph row
+#define GLYPH_RUN_END_OF_ROW 0x00
+
+/// Returns the run-length encoded rows of a glyph, encoding it on the first use
+/// @param character Character of the glyph
+/// @param metrics Glyph metrics, as returned by GetGlyphOutline()
+/// @param data Glyph bitmap, as returned by GetGlyphOutline()
+/// @return Pointer to the runs of the first row or NULL if the glyph cannot be cached (it is too large). The
+/// pointer is valid until the next call to the function
+PCBYTE GlyphCacheGetRuns(char character, const GlyphMetrics* metrics, PCBYTE data);
+
+#endif /* INC_FONTS_GLYPHCACHE_H_ */
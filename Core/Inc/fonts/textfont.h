@@ -0,0 +1,30 @@
+/*
+ * Fixed-pitch 1bpp version of the hp_simplified font, used by the character-cell text mode
+ *
+ * Every character is converted into a cell of TEXT_FONT_CELL_WIDTH x TEXT_FONT_CELL_HEIGHT pixels. Each cell row
+ * is stored in a single byte, where bit 0 is the leftmost pixel. The glyph advance is box-filtered onto the cell
+ * width (narrower glyphs are centered) and a pixel is lit when the glyph covers at least half of it, so that the
+ * scanout can render a text line with a couple of table lookups per cell.
+ *
+ *  Created on: Oct 16, 2026
+ */
+#ifndef INC_FONTS_TEXTFONT_H_
+#define INC_FONTS_TEXTFONT_H_
+
+#include <typedefs.h>
+
+/// Width of a character cell in pixels (one bit per pixel in a byte)
+#define TEXT_FONT_CELL_WIDTH 8
+/// Height of a character cell in pixels
+#define TEXT_FONT_CELL_HEIGHT 20
+/// Number of characters supported by the font
+#define TEXT_FONT_CHARACTERS 128
+/// Size of the buffer filled by TextFontBuildCells()
+#define TEXT_FONT_CELLS_SIZE (TEXT_FONT_CHARACTERS * TEXT_FONT_CELL_HEIGHT)
+
+/// Converts the font glyphs into 1bpp character cells
+/// @param cells Destination buffer of TEXT_FONT_CELLS_SIZE bytes. The rows of the character c start at
+/// cells[c * TEXT_FONT_CELL_HEIGHT]
+void TextFontBuildCells(BYTE* cells);
+
+#endif /* INC_FONTS_TEXTFONT_H_ */
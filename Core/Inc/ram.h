@@ -9,6 +9,7 @@
 #define INC_RAM_H_
 
 #include <stddef.h>
+#include <typedefs.h>
 
 /// Allocates a new block of data in the ram_data section
 /// @param size Size of the memory block, in bytes
@@ -24,4 +25,12 @@ void* ralloc(size_t size);
 /// @param ptr Pointer of the block
 /// @param size Size of the block to be released in bytes
 void rfree(void* ptr, size_t size);
+
+/// Returns the size of the largest block that can still be allocated
+/// @return Free space in bytes
+size_t ravailable();
+
+/// Checks whether a pointer belongs to the ram_data section
+/// @return True if the address is inside the section, so the DMA controllers can access it
+BOOL rcontains(const void* ptr);
 #endif /* INC_RAM_H_ */
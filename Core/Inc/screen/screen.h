@@ -13,6 +13,10 @@
  * -> Filled Rect
  * -> Text/Char drawing and measurement
  *
+ * Shape drawing functions keep track of the modified screen areas in the buffer dirty region (if the driver
+ * provides one). The ScreenPresent function hands the region to the driver, which can then update only the changed
+ * parts of the displayed frame
+ *
  *  Created on: Oct 18, 2021
  *      Author: Andrea Monzani [Mat 952817]
  */
@@ -34,7 +38,11 @@ typedef enum _Bpp {
     /// A single byte define the color for a single pixel
     Bpp8,
     /// Standard 24 bits per pixels (one byte per color)
-    Bpp24
+    Bpp24,
+    /// Palettized mode: each pixel is a 4 bits index in a 16 colors palette (two pixels per byte)
+    Bpp4,
+    /// Palettized mode: each pixel is a 2 bits index in a 4 colors palette (four pixels per byte)
+    Bpp2
 } Bpp;
 
 /// Definition for a point. Buffer size is limited to a Int16 size (with our max resolution
@@ -52,6 +60,27 @@ typedef struct _SizeS {
     Int16 height;
 } SizeS, * PSizeS;
 
+/// Definition for a rectangle using its edges coordinates
+/// \remarks Left and top edges are included in the rectangle, right and bottom ones are excluded
+typedef struct _RectS {
+    Int16 left;
+    Int16 top;
+    Int16 right;
+    Int16 bottom;
+} RectS, * PRectS;
+
+/// Max number of distinct rectangles tracked in a dirty region. When the limit is reached,
+/// the rectangles are merged together
+#define SCREEN_DIRTY_RECTANGLES 8
+
+/// Set of screen areas modified since the last present
+typedef struct _ScreenDirtyRegion {
+    /// Number of valid rectangles
+    BYTE count;
+    /// Modified areas. Rectangles are clipped to the screen bounds and they never overlap nor touch each other
+    RectS rectangles[SCREEN_DIRTY_RECTANGLES];
+} ScreenDirtyRegion;
+
 /// Definition of a screen color with ARGB components at 32bpp
 /// Native frame buffer implementation will convert this into its native 
 /// format 
@@ -74,8 +103,35 @@ typedef struct _Pen {
     ARGB8Color color;
 } Pen;
 
+/// Dithering applied when 24bit pixels are converted to a native format with less color levels
+typedef enum _ScreenDither {
+    /// Colors are truncated to the nearest lower native level
+    ScreenDitherNone,
+    /// Ordered (Bayer 4x4) dithering. Stateless and cheap, but it leaves a visible cross-hatch pattern
+    ScreenDitherOrdered,
+    /// Floyd-Steinberg error diffusion. The quantization error is diffused to the following pixels of the line
+    /// and to the next line, so the best results are obtained by blitting adjacent lines one after the other
+    ScreenDitherErrorDiffusion
+} ScreenDither;
+
+/// Max coverage level of a pixel in a blended span. A pixel with this coverage is drawn with the pen color,
+/// a pixel with zero coverage is left untouched
+/// \remarks The value matches the levels of our glyph bitmaps
+#define SCREEN_COVERAGE_MAX 64
+
 /// Delegate definition for the native callback used to draw a pixel on the screen
 typedef void (*DrawPixelCallback)(PointS point, const Pen* pen);
+/// Delegate definition for the native callback used to fill the horizontal span [xStart; xEnd) of a line
+typedef void (*SpanFillCallback)(Int16 y, Int16 xStart, Int16 xEnd, const Pen* pen);
+/// Delegate definition for the native callback used to copy a line of 24bit pixels on the screen
+/// \remarks Source pixels are stored as B, G, R bytes (the same order of the bitmap scanlines)
+typedef void (*SpanBlitCallback)(Int16 y, Int16 x, PCBYTE source, Int16 count, ScreenDither dither);
+/// Delegate definition for the native callback used to blend the pen color on a line using a coverage level for each pixel
+/// \remarks Coverage levels range from 0 to SCREEN_COVERAGE_MAX (included)
+typedef void (*SpanBlendCallback)(Int16 y, Int16 x, PCBYTE coverage, Int16 count, const Pen* pen);
+/// Delegate definition for the native callback used to make visible the content drawn until now
+/// \param region Screen areas modified since the last present. NULL if the driver does not track them
+typedef void (*PresentFrameCallback)(const ScreenDirtyRegion* region);
 
 /// Main screen buffer information structure
 typedef struct _ScreenBuffer {
@@ -93,7 +149,20 @@ typedef struct _ScreenBuffer {
     DrawPixelCallback DrawPackCallback;
     /// Size of the group of pixels that the optimized driver draw callback supports. The value indicates the power of two of the pack size
     /// packSizePower == 0 -> packSize = 1; packSizePower == 1 -> packSize = 2; packSizePower == 2 -> packSize = 4;  
+    /// Palettized modes store more pixels in a word, so their packs are larger (8 pixels at 4bpp, 16 pixels at 2bpp)
     BYTE packSizePower;
+    /// Fills an horizontal span of pixels. Drivers can write multiple pixels at a time and compute the pixel address only once
+    SpanFillCallback DrawSpanCallback;
+    /// Copies an horizontal span of 24bit pixels, converting them to the native format
+    SpanBlitCallback BlitSpanCallback;
+    /// Blends the pen color over an horizontal span of pixels
+    SpanBlendCallback BlendSpanCallback;
+    /// Makes the drawn content visible on the screen. Buffered drivers will exchange their buffers here
+    /// \remarks The reference can be NULL if the driver draws directly on the displayed buffer
+    PresentFrameCallback PresentCallback;
+    /// Region modified since the last present
+    /// \remarks The reference is NULL if the driver does not need the information (all the draw calls are immediately visible)
+    ScreenDirtyRegion* dirtyRegion;
 } ScreenBuffer, * PScreenBuffer;
 
 /// Clears the underlying screen buffer using the color specified in the pen
@@ -104,18 +173,24 @@ void ScreenClear(const ScreenBuffer* buffer, const Pen* pen);
 /// \param size Size of the rectangle
 /// \param pen Pen informations
 void ScreenFillRectangle(const ScreenBuffer* buffer, PointS point, SizeS size, const Pen* pen);
+/// Precomputes the font metrics used by the string functions
+/// \remarks Must be called once at startup, before any string is measured or drawn
+void ScreenInitializeFont();
 /// Returns the max height that a character can have in the screen
 UInt16 ScreenGetCharMaxHeight();
 /// Measure the smallest rectangle enclosing a string
 void ScreenMeasureString(const char* str, SizeS* size);
 /// Draw a string on the screen buffer at the specified point using the specified pen
 void ScreenDrawString(const ScreenBuffer* buffer, const char* str, PointS point, const Pen* pen);
+/// Draw a string on the screen buffer and returns its size, with a single pass over the string
+/// \param size [Out] Same size returned by ScreenMeasureString. Can be NULL
+void ScreenDrawStringMeasured(const ScreenBuffer* buffer, const char* str, PointS point, const Pen* pen, SizeS* size);
 /// Lower lever abstraction API for drawing a single pixel on the screen using the underlying hardware API
 /// \param buffer Pointer to the current ScreenBuffer we are drawing on
 /// \param point Pixel position on the screen
 /// \param pixel Pixel color
 /// \remarks The function (to avoid too much overhead) WILL NOT perform any checks on the parameter passed to it if called directly
-/// The behavior is undefined in such case
+/// The behavior is undefined in such case. The modified area is not tracked: the caller must use ScreenInvalidateRectangle
 void ScreenDrawPixel(const ScreenBuffer* buffer, PointS point, const Pen* pen);
 /// "Optmized" lower lever abstraction API for drawing a pack of pixel on the screen using the underlying hardware API given the
 /// specified pack size
@@ -124,5 +199,41 @@ void ScreenDrawPixel(const ScreenBuffer* buffer, PointS point, const Pen* pen);
 /// \remarks The function (to avoid too much overhead) WILL NOT perform any checks on the parameter passed to it if called directly.
 /// The behavior is undefined in such case
 void ScreenDrawPixelPack(const ScreenBuffer* buffer, PointS point, const Pen* pen);
+/// Lower lever abstraction API for filling the pixels [xStart; xEnd) of a screen line
+/// \param buffer Pointer to the current ScreenBuffer we are drawing on
+/// \param y Line of the span
+/// \param xStart First pixel of the span
+/// \param xEnd Pixel following the last one of the span
+/// \param pen Pen informations
+/// \remarks Like ScreenDrawPixel, the span must be inside the screen and the modified area is not tracked
+void ScreenDrawSpan(const ScreenBuffer* buffer, Int16 y, Int16 xStart, Int16 xEnd, const Pen* pen);
+/// Lower lever abstraction API for copying 24bit pixels on a screen line
+/// \param buffer Pointer to the current ScreenBuffer we are drawing on
+/// \param y Line of the span
+/// \param x First pixel of the span
+/// \param source Source pixels, stored in B, G, R order
+/// \param count Number of pixels to copy
+/// \param dither Dithering applied when converting the pixels to the native format
+/// \remarks Like ScreenDrawPixel, the span must be inside the screen and the modified area is not tracked
+void ScreenBlitSpan(const ScreenBuffer* buffer, Int16 y, Int16 x, PCBYTE source, Int16 count, ScreenDither dither);
+/// Lower lever abstraction API for blending the pen color over a screen line
+/// \param buffer Pointer to the current ScreenBuffer we are drawing on
+/// \param y Line of the span
+/// \param x First pixel of the span
+/// \param coverage Coverage of each pixel, from 0 to SCREEN_COVERAGE_MAX
+/// \param count Number of pixels in the span
+/// \param pen Pen informations
+/// \remarks Like ScreenDrawPixel, the span must be inside the screen and the modified area is not tracked
+void ScreenBlendSpan(const ScreenBuffer* buffer, Int16 y, Int16 x, PCBYTE coverage, Int16 count, const Pen* pen);
+/// Marks a screen area as modified so that it will be updated at the next present
+/// \param buffer Pointer to the current ScreenBuffer we are drawing on
+/// \param point Origin of the modified area
+/// \param size Size of the modified area
+/// \remarks Shape drawing functions already invalidate their area. The function must be used only when drawing with the pixel APIs
+void ScreenInvalidateRectangle(const ScreenBuffer* buffer, PointS point, SizeS size);
+/// Makes visible on the screen all the draw calls performed until now
+/// \param buffer Pointer to the current ScreenBuffer we are drawing on
+/// \remarks Applications should call this function once a complete frame has been drawn. The dirty region is reset
+void ScreenPresent(const ScreenBuffer* buffer);
 
 #endif /* INC_SCREEN_SCREEN_H_ */
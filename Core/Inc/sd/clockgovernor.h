@@ -0,0 +1,52 @@
+/*
+ * This file contains the headers of the SD SPI clock governor.
+ * The governor chooses the SPI prescaler used for the data transfers: it starts from the fastest rate allowed by
+ * the card TRAN_SPEED and it tracks the outcome of each read
+ * -> When too many reads in an observation window fail (CRC errors or timeouts), the clock is slowed down by one step
+ * -> After a number of clean reads at a slower rate, the next faster rate is probed again. If the probe fails,
+ *    the governor falls back and waits twice as long before the next probe
+ *
+ * The governor only takes decisions: applying the prescaler to the SPI peripheral is up to the caller
+ *
+ *  Created on: Oct 16, 2026
+ */
+
+#ifndef INC_SD_CLOCKGOVERNOR_H_
+#define INC_SD_CLOCKGOVERNOR_H_
+
+#include <typedefs.h>
+
+/// Slowest SPI prescaler (BR field value). The SPI clock is the bus frequency divided by 2^(prescaler + 1)
+#define SD_GOVERNOR_SLOWEST_PRESCALER 7
+
+/// State of the clock governor
+typedef struct _SdClockGovernor {
+    /// Fastest prescaler allowed by the card TRAN_SPEED
+    BYTE fastestPrescaler;
+    /// Prescaler currently in use
+    BYTE prescaler;
+    /// True while a faster rate is being probed after a fallback
+    BOOL probing;
+    /// Reads performed in the current observation window
+    UInt16 windowReads;
+    /// Failed reads in the current observation window
+    UInt16 windowErrors;
+    /// Consecutive clean reads at the current rate
+    UInt32 cleanReads;
+    /// Clean reads needed before probing the next faster rate
+    UInt32 probeInterval;
+} SdClockGovernor;
+
+/// Initializes the governor with the fastest prescaler allowed by the card
+/// @param governor Governor to initialize
+/// @param busFrequency Frequency of the bus the SPI peripheral is connected to (Hz)
+/// @param maxTransferSpeed Max transfer speed of the card (Hz), as read from the CSD
+void SdClockGovernorInitialize(SdClockGovernor* governor, UInt32 busFrequency, UInt32 maxTransferSpeed);
+
+/// Reports the outcome of a read operation
+/// @param governor Governor
+/// @param failed True if the read failed with an error that can be caused by the bus speed (CRC error or timeout)
+/// @return True if the prescaler has changed and must be applied to the SPI peripheral
+BOOL SdClockGovernorReportRead(SdClockGovernor* governor, BOOL failed);
+
+#endif /* INC_SD_CLOCKGOVERNOR_H_ */
@@ -83,6 +83,14 @@ UInt32 SdCsdGetMaxTransferRate(PCCsdRegister pCSD);
 /// @param pCSD Pointer to a CSD register structure
 /// @return Valid pointer assumed
 UInt16 SdCsdGetMaxReadDataBlockLength(PCCsdRegister pCSD);
+/// Get the card capacity in 512 bytes sectors
+/// @param pCSD Pointer to a CSD register structure
+/// @return Valid pointer assumed
+UInt32 SdCsdGetSectorCount(PCCsdRegister pCSD);
+/// Get the size of an erasable sector, in 512 bytes sectors
+/// @param pCSD Pointer to a CSD register structure
+/// @return Valid pointer assumed
+UInt32 SdCsdGetEraseSectorSize(PCCsdRegister pCSD);
 /// @brief Dumps a validation status on the console
 /// @param result Validation status
 void SdCsdDumpValidationResult(SdCsdValidation result);
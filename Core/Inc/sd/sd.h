@@ -48,6 +48,8 @@ typedef enum _SdStatus {
     SdStatusReadCCError = -14,
     /// Data operation reported a failed ECC correction
     SdStatusECCFailed = -15,
+    /// DMA reported an error while transferring a data block
+    SdStatusDMAError = -16,
 } SdStatus;
 
 /// SD Card version
@@ -80,9 +82,33 @@ typedef struct _SDDescription {
     UInt32 MaxTransferSpeed;
     /// Max block length for the read transactions calculated from CSD
     UInt16 BlockLen;
+    /// Card capacity in 512 bytes sectors calculated from CSD
+    UInt32 SectorCount;
+    /// Size of an erasable sector in 512 bytes sectors calculated from CSD
+    UInt32 EraseSectorSize;
 } SDDescription;
 typedef const SDDescription* PCSDDescription;
 
+/// Counters of the driver activity, used to measure the storage throughput on the board
+typedef struct _SdStatistics {
+    /// Tick of the last reset of the counters
+    UInt32 startTick;
+    /// Commands sent to the card
+    UInt32 commands;
+    /// Single block read transactions (CMD17)
+    UInt32 singleBlockReads;
+    /// Multiple block read transactions (CMD18)
+    UInt32 multipleBlockReads;
+    /// Sectors successfully read
+    UInt32 sectors;
+    /// Read transactions failed due to a data CRC mismatch
+    UInt32 corruptedReads;
+    /// Bus speed changes applied by the clock governor
+    UInt32 clockChanges;
+    /// Core clock cycles spent in the read transactions, from the card selection to its release
+    UInt64 readCycles;
+} SdStatistics;
+
 /// Initialize the SD SPI interface using the specified devices
 /// \param powerGPIO GPIO pin port that will be used as power (needed due to the power cicle timing requirement)
 /// \param powerPin Pin number for the GPIO
@@ -114,10 +140,42 @@ SdStatus SdReadSector(BYTE* destination, UInt32 sector);
 /// \return Status of the operation
 SdStatus SdReadSectors(BYTE* destination, UInt32 sector, UInt32 count);
 
+/// Starts a multiple block read from the specified sector. Blocks are then received with SdReadSectorsNext,
+/// possibly into different buffers, and the read must always be closed with SdReadSectorsEnd
+/// \param sector Sector where to start the read operation
+/// \return Status of the operation
+SdStatus SdReadSectorsBegin(UInt32 sector);
+
+/// Reads the next sequential sectors of the read started with SdReadSectorsBegin
+/// \param destination Destination buffer
+/// \param count Number of sectors to read
+/// \return Status of the operation. Once a step fails, all the following ones return the same error
+SdStatus SdReadSectorsNext(BYTE* destination, UInt32 count);
+
+/// Closes the read started with SdReadSectorsBegin (even if it failed)
+/// \remarks The stop command is sent whenever the card accepted the read, so the card is ready for the next command
+/// also after a corrupted block
+/// \return Status of the whole read operation
+SdStatus SdReadSectorsEnd();
+
 /// Prints the status code description
 /// @param status Error code from the SD
 void SdDumpStatusCode(SdStatus status);
 
+/// Returns the description of the attached SD card
+/// \remarks The description is filled with zeroes until a connection succeeds
+PCSDDescription SdGetCardDescription();
+
+/// Returns the counters of the driver activity since the last reset
+/// @param statistics [Out] Destination of the counters
+void SdGetStatistics(SdStatistics* statistics);
+
+/// Resets the counters of the driver activity
+void SdResetStatistics();
+
+/// Prints the driver activity since the last reset: commands per second, read throughput and cycles per sector
+void SdDumpStatistics();
+
 /// @brief Completly shudown the SPI interface and the the power
 /// @return Status of the operation. Should always be SdStatusOk
 SdStatus SdShutdown();
@@ -48,7 +48,8 @@ typedef enum _EdidTiming {
     EdidTiming640x480At75Hz = 2,
     EdidTiming800x600At56Hz = 1, 
     EdidTiming800x600At60Hz = 0,
-	EdidTiming1024x728At60Hz = 11,
+    EdidTiming800x600At72Hz = 15,
+	EdidTiming1024x768At60Hz = 11,
 } EdidTiming;
 
 /// Digital input definition
@@ -5,7 +5,17 @@
  * stores it internally later retrieve the necessary data inside the interrupt handlers.
  * The desired screen setup is specified via the VgaVisualizationInfo structure, passed as parameter to the function
  *
- * Frame timings are described by the VgaVideoFrameInfo structure
+ * In the palettized modes (4bpp and 2bpp) the frame buffer stores the palette index of each pixel. The line DMA
+ * always outputs 8bpp pixels, so each line is expanded through the palette into a small line buffer while the
+ * previous line is displayed. The same RAM holds two or four times the pixels of the 8bpp mode
+ *
+ * The text mode (VgaCreateTextBuffer) has no frame buffer at all: the application writes characters and colors in a
+ * grid of cells and each line is rendered from the grid and a 1bpp copy of the font while the previous line is
+ * displayed, as in the palettized modes. A screen of text takes a few KB instead of a whole frame buffer
+ *
+ * Frame timings are described by the VgaVideoFrameInfo structure. The driver knows the standard VESA timings of
+ * a few modes: VgaSelectMode picks the largest one that the monitor supports (from its EDID), that can be generated
+ * from the current timers clock and whose frame buffer fits in the free RAM
  *
  *  Created on: Nov 1, 2021
  *      Author: Andrea Monzani [Mat 952817]
@@ -15,7 +25,8 @@
 #define INC_VGA_VGASCREENBUFFER_H_
 
 #include <typedefs.h>
-#include <screen\screen.h>
+#include <screen/screen.h>
+#include <vga/edid.h>
 #include <stm32f4xx_hal.h>
 
  // ##### Public struct and enums declarations #####
@@ -55,8 +66,16 @@ typedef struct _VgaVisualizationInfo {
     VgaVideoFrameInfo FrameSignals;
     /// Scaling to be applied to the provided resolution
     BYTE Scaling;
+    /// Number of lines of the frame buffer. The lines are stretched over the visible lines of the frame, so any
+    /// height up to the visible lines is supported (ex. 150 or 200 lines on a 600 lines frame)
+    /// \remarks Zero selects the visible lines divided by the scaling
+    UInt16 Height;
     /// BitsPerPixels that must be used
     Bpp BitsPerPixel;
+    /// Requests a second (back) frame buffer. All the draw calls are redirected to the back buffer and
+    /// the buffers are exchanged during the vertical blanking with VgaSwapBuffers
+    /// \remarks If there is not enough memory for the second buffer, the driver falls back to a single buffer
+    BOOL DoubleBuffered;
 
     TIM_HandleTypeDef* mainTimer;
     TIM_HandleTypeDef* hSyncTimer;
@@ -64,19 +83,66 @@ typedef struct _VgaVisualizationInfo {
     DMA_HandleTypeDef* lineDMA;
 } VgaVisualizationInfo;
 
+/// Builds the attribute of a text cell from the palette indexes of the foreground and of the background
+#define VGA_TEXT_ATTRIBUTE(foreground, background) ((BYTE)(((foreground) & 0x0F) | (((background) & 0x0F) << 4)))
+
+/// Character cell of the text mode
+typedef struct _VgaTextCell {
+    /// ASCII character displayed in the cell
+    char Character;
+    /// Palette index of the foreground (low nibble) and of the background (high nibble). See VGA_TEXT_ATTRIBUTE
+    BYTE Attribute;
+} VgaTextCell;
+
+/// Character grid of the text mode
+typedef struct _VgaTextBuffer {
+    /// Number of cells in a row
+    UInt16 Columns;
+    /// Number of rows
+    UInt16 Rows;
+    /// Cells of the grid, row by row. The application can modify them at any time, the changes are displayed from
+    /// the next rendered line
+    VgaTextCell* Cells;
+} VgaTextBuffer;
+
 // ##### Public fileds declarations #####
 
+extern VgaVideoFrameInfo VideoFrame640x480at60Hz;
+extern VgaVideoFrameInfo VideoFrame800x600at56Hz;
 extern VgaVideoFrameInfo VideoFrame800x600at60Hz;
+extern VgaVideoFrameInfo VideoFrame800x600at72Hz;
+extern VgaVideoFrameInfo VideoFrame1024x768at60Hz;
 // ##### Public functions declarations #####
 
+/// Selects the video mode with the largest frame buffer that can be displayed
+/// @param edid EDID of the connected monitor. NULL if all the modes must be considered supported
+/// @param visualizationInfo [In/Out] BitsPerPixel and DoubleBuffered must be set (8bpp or palettized). FrameSignals and Scaling are
+/// filled with the selected mode and Height is reset to the default value
+/// @return VgaErrorNotSupported if no mode can be displayed
+/// \remarks The frame buffers must fit in the RAM that is free when the function is called. When DoubleBuffered is set, the
+/// largest mode where both the buffers fit is selected. If no mode fits two buffers, DoubleBuffered is cleared and the
+/// largest single buffered mode is selected
+VgaError VgaSelectMode(const Edid* edid, VgaVisualizationInfo* visualizationInfo);
 /// Creates a new ScreenBuffer from VGA initialization parameters and registers it as a working buffer
 /// @param visualizationInfo VGA output parameters
 /// @param screenBuffer Filled ScreenBuffer struct with the relative data
 /// @return VGA operation status
+/// \remarks If the current clock tree cannot generate the scaled pixel clock, the PLL and the APB dividers are
+/// reprogrammed and VgaClockTreeChangedCallback is called
 VgaError VgaCreateScreenBuffer(const VgaVisualizationInfo* visualizationInfo, ScreenBuffer** screenBuffer);
 /// Releases all the resources associated with the ScreenbBuffer instance
 /// @return VGA operation status
 VgaError VgaReleaseScreenBuffer(ScreenBuffer* screenBuffer);
+/// Creates a character grid from VGA initialization parameters and registers it as the displayed buffer
+/// @param visualizationInfo VGA output parameters. BitsPerPixel and DoubleBuffered are ignored: the cells use the
+/// 16 colors of the 4bpp palette, that can be changed with VgaSetPalette. The grid has a cell of 8x20 pixels
+/// for each 8 pixels of the scaled line and each 20 lines of the buffer height
+/// @param textBuffer [Out] Character grid, cleared with spaces in light gray on black
+/// @return VGA operation status
+VgaError VgaCreateTextBuffer(const VgaVisualizationInfo* visualizationInfo, VgaTextBuffer** textBuffer);
+/// Releases all the resources associated with the character grid
+/// @return VGA operation status
+VgaError VgaReleaseTextBuffer(VgaTextBuffer* textBuffer);
 /// Dumps the active buffer timers frequencies
 VgaError VgaDumpTimersFrequencies();
 /// Enable the display output of the VGA driver
@@ -91,5 +157,26 @@ VgaError VgaResumeOutput();
 /// Completly disable VGA output (sync signals are no more generated)
 /// @return Status of the operation
 VgaError VgaStopOutput();
+/// Exchanges the front and the back buffer at the next vertical blanking
+/// @return Status of the operation
+/// \remarks The function waits until the exchange has been performed, so it is safe to draw in the new back buffer
+/// as soon as the function returns. If the output is stopped, the exchange is immediate.
+/// After the exchange the back buffer contains the previously displayed frame, so the function should be used only
+/// by renderers that redraw the whole frame. ScreenPresent swaps the buffers too, but then copies the modified areas
+/// into the new back buffer, so it keeps the two buffers aligned. The two must not be mixed on the same buffer: after
+/// a swap the back buffer is stale outside the redrawn areas, so the modified areas recorded until the swap are dropped.
+/// If the buffer is not double buffered, the function does nothing
+VgaError VgaSwapBuffers();
+/// Sets the palette of the palettized modes
+/// @param colors Palette colors. The alpha component is ignored
+/// @param count Number of colors: 16 for the 4bpp and the text modes, 4 for the 2bpp mode
+/// @return Status of the operation
+/// \remarks The pixels store the palette index, so the pixels already drawn change color immediately. The first entry
+/// is also output in the line borders, so it should be black. Drawing colors are mapped to the nearest palette entry
+VgaError VgaSetPalette(const ARGB8Color* colors, BYTE count);
+/// Called when the creation of a buffer has changed the system clock tree to generate its pixel clock
+/// \remarks SystemCoreClock and the HAL tick are already updated. The application must update the peripherals whose
+/// timings depend on the bus clocks (the kernel tick, the baud rates, ...). The default implementation does nothing
+void VgaClockTreeChangedCallback();
 
 #endif /* INC_VGA_VGASCREENBUFFER_H_ */
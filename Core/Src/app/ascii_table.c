@@ -1,100 +1,88 @@
 #include <app/ascii_table.h>
 #include <intmath.h>
+#include <string.h>
 
-/// Active screen buffer pointer
-static ScreenBuffer* _pActiveBuffer = NULL;
-/// Size of the title box
-static int _titleBoxHeight = 0;
+/// Number of characters displayed by the table
+#define ASCII_TABLE_CHARACTERS 128
+/// Characters in a row of the table, when the grid is wide enough
+#define ASCII_TABLE_MAX_ROW_CHARACTERS 16
+/// Title bar: white on brown, the palette color nearest to the orange of the bitmap modes
+#define ASCII_TABLE_TITLE_ATTRIBUTE VGA_TEXT_ATTRIBUTE(15, 6)
+/// Table characters: white on black
+#define ASCII_TABLE_CHAR_ATTRIBUTE VGA_TEXT_ATTRIBUTE(15, 0)
+
+/// Active character grid pointer
+static VgaTextBuffer* _pActiveBuffer = NULL;
 
 /* Forward section */
 
-/// Draws all the available characters on the screen
+/// Draws all the available characters on the grid
 static void DrawTable();
 
 /// Draws the application title bar
 static void DrawApplicationTitle();
 
+/// Writes a cell of the grid
+static void SetCell(UInt16 column, UInt16 row, char character, BYTE attribute);
+
 /* Private section */
 
+void SetCell(UInt16 column, UInt16 row, char character, BYTE attribute) {
+    VgaTextCell* cell = &_pActiveBuffer->Cells[(row * _pActiveBuffer->Columns) + column];
+    cell->Character = character;
+    cell->Attribute = attribute;
+}
+
 void DrawApplicationTitle() {
     const char* title = "ASCII table";
-    const int padding = 3;
-
-    // Title measurement
-    SizeS titleStrBox = { 0 };
-    ScreenMeasureString(title, &titleStrBox);
-
-    // Title box dimension calc
-    _titleBoxHeight = titleStrBox.height + (padding * 2);
-    SizeS titleBox = titleStrBox;
-    titleBox.height = (Int16)_titleBoxHeight;
-    titleBox.width = _pActiveBuffer->screenSize.width;
-
-    Pen pen = { 0 };
-    pen.color.argb = SCREEN_RGB(0xFF, 0x6F, 0);
-
-    // Title box filling
-    PointS point = { 0 };
-    ScreenFillRectangle(_pActiveBuffer, point, titleBox, &pen);
 
-    // Text drawing inside the box
-    point.x = (Int16)((_pActiveBuffer->screenSize.width / 2) - (titleStrBox.width / 2));
-    point.y = (Int16)padding;
+    // Title bar filling
+    for (UInt16 column = 0; column < _pActiveBuffer->Columns; column++) {
+        SetCell(column, 0, ' ', ASCII_TABLE_TITLE_ATTRIBUTE);
+    }
 
-    pen.color.argb = SCREEN_RGB(0xFF, 0xFF, 0xFF);
-    ScreenDrawString(_pActiveBuffer, title, point, &pen);
+    // Text drawing inside the bar. The title is cut if the grid is too narrow
+    int titleLength = MIN((int)strlen(title), (int)_pActiveBuffer->Columns);
+    UInt16 column = (UInt16)((_pActiveBuffer->Columns - titleLength) / 2);
+    for (int i = 0; i < titleLength; i++) {
+        SetCell((UInt16)(column + i), 0, title[i], ASCII_TABLE_TITLE_ATTRIBUTE);
+    }
 }
 
 void DrawTable() {
-    // Screen support only string drawing. No big deal, we create a one char fake string
-    char string[2] = { '\0', '\0' };
-
-    // We clear the screen
-    Pen pen = { 0 };
-    pen.color.argb = SCREEN_RGB(0, 0, 0);
-    ScreenClear(_pActiveBuffer, &pen);
+    // We clear the grid
+    for (UInt16 row = 0; row < _pActiveBuffer->Rows; row++) {
+        for (UInt16 column = 0; column < _pActiveBuffer->Columns; column++) {
+            SetCell(column, row, ' ', ASCII_TABLE_CHAR_ATTRIBUTE);
+        }
+    }
 
     DrawApplicationTitle();
 
-    SizeS charSize = { 0 };
-    int lineHeight = 0;
-    pen.color.argb = SCREEN_RGB(0xFF, 0xFF, 0xFF);
-    // Let' s draw with a little offset to the screen borders
-    const int yPadding = 5;
-    const int xOffset = 5;
-
-    PointS point;
-    point.x = (Int16)xOffset;
-    point.y = (Int16)(yPadding + _titleBoxHeight);
+    // Each character is followed by two spaces. On narrow grids a single space is left, and the rows get shorter
+    UInt16 cellWidth = _pActiveBuffer->Columns >= (ASCII_TABLE_MAX_ROW_CHARACTERS * 3) ? 3 : 2;
+    UInt16 rowCharacters = (UInt16)MIN(ASCII_TABLE_MAX_ROW_CHARACTERS, _pActiveBuffer->Columns / cellWidth);
+    // The table is centered, leaving an empty row below the title
+    UInt16 firstColumn = (UInt16)((_pActiveBuffer->Columns - (rowCharacters * cellWidth) + 1) / 2);
+    const UInt16 firstRow = 2;
 
-    // Let's iterate over the available ASCII chars
-    for (char i = 0; i < 128; i++)
+    // Let's iterate over the available ASCII chars. The rows that do not fit in the grid are not displayed
+    for (int i = 0; i < ASCII_TABLE_CHARACTERS; i++)
     {
-        // We setup the string and we measure it
-        string[0] = i;
-        ScreenMeasureString(string, &charSize);
-
-        // If string bounding box goes out of screen, let' s start a new line
-        if ((point.x + charSize.width) > _pActiveBuffer->screenSize.width) {
-            point.x = (Int16)xOffset;
-            point.y = (Int16)(point.y + lineHeight + yPadding);
-            // We reset also the max height since characters may change
-            lineHeight = 0;
+        UInt16 row = (UInt16)(firstRow + (i / rowCharacters));
+        if (row >= _pActiveBuffer->Rows) {
+            break;
         }
-
-        ScreenDrawString(_pActiveBuffer, string, point, &pen);
-
-        // We update max height and drawing position
-        lineHeight = MAX(lineHeight, charSize.height);
-        point.x = (Int16)(point.x + charSize.width);
+        UInt16 column = (UInt16)(firstColumn + ((i % rowCharacters) * cellWidth));
+        SetCell(column, row, (char)i, ASCII_TABLE_CHAR_ATTRIBUTE);
     }
 }
 
 /* Public section */
 
-void AsciiTableInitialize(ScreenBuffer* screenBuffer)
+void AsciiTableInitialize(VgaTextBuffer* textBuffer)
 {
-    _pActiveBuffer = screenBuffer;
+    _pActiveBuffer = textBuffer;
     DrawTable();
 }
 
@@ -1,5 +1,8 @@
 #include <app/bmp.h>
 #include <assertion.h>
+#include <ram.h>
+#include <intmath.h>
+#include <string.h>
 
 /// The BITMAPFILEHEADER structure contains information about the type, size, and layout of a file
 /// that contains a DIB.
@@ -40,7 +43,61 @@ typedef struct tagBITMAPINFOHEADER {
 /// Offset of the DIB interface from the start of the file
 #define DIB_OFFSET 14
 #define BI_RGB 0L
-
+/// Size of the buffer used to read the scanlines from the file. The buffer contains multiple complete scanlines
+/// so that each f_read transfers more sectors at once
+/// \remarks Buffer is enlarged if a single scanline does not fit in it
+#define BMP_READ_BUFFER_SIZE 2048
+/// Sector size of the volume. Scanlines are read in whole sectors
+#define BMP_SECTOR_SIZE _MIN_SS
+/// 1.31 fixed point reciprocal of n, rounded up
+#define BMP_RECIPROCAL(n) ((UInt32)((0x80000000UL + (n) - 1) / (n)))
+/// Division of x by n rounded to the nearest integer (halves up), using the reciprocal of n. The result is exact
+/// while (x + n / 2) * (n - 1) is below 2^31, which covers the sums of n 8 bit components up to n = 2900
+#define BMP_ROUNDED_DIVIDE(x, n, reciprocal) ((UInt32)(((UInt64)((x) + ((n) >> 1)) * (reciprocal)) >> 31))
+/// Max number of source rows averaged in a single screen line by the box filter. The limit comes
+/// from the 16 bit column accumulators
+#define BMP_BOX_MAX_ROWS (UINT16_MAX / 0xFF)
+/// Number of items of the cluster link map table. The table holds the size plus two items for each fragment
+/// of the file, so up to 31 fragments are supported
+#define BMP_LINK_MAP_SIZE 64
+
+/// Streaming reader of the bitmap scanlines
+/// \remarks Scanlines are stored bottom-up in the file, so the "file row" 0 is the bottom line of the image.
+/// Rows can only be requested in increasing file order.
+/// The buffer is always filled with whole sectors starting at a sector boundary: FatFs transfers them directly
+/// into the buffer (with the DMA) without passing through the file window, and the rows are used in place
+typedef struct _BmpRowReader {
+    /// Bitmap that is being read
+    const Bmp* bmp;
+    /// Buffer containing the file data. The size is a multiple of the sector size
+    BYTE* buffer;
+    /// Size of the buffer
+    size_t bufferSize;
+    /// File offset of the first byte in the buffer
+    FSIZE_t bufferOffset;
+    /// Number of valid bytes in the buffer
+    UInt32 bufferedBytes;
+} BmpRowReader;
+
+/// Exact integer DDA of the bilinear sample positions along an axis
+/// \remarks The center of the screen pixel i is at ((2 * i + 1) * size - screenSize) / (2 * screenSize) bitmap pixels.
+/// The position is kept in 1/256 of bitmap pixel as a quotient and a remainder of the division by the screen size,
+/// so the weights are exact for any size and do not drift along the line
+typedef struct _BmpBilinearDda {
+    /// Position of the current sample in 1/256 of bitmap pixel, rounded down. Negative before the first pixel center
+    Int32 position;
+    /// Remainder of the position, in 1/screenSize of position unit
+    Int32 remainder;
+    /// Distance between two samples (256 * size / screenSize) as quotient and remainder
+    Int32 stepQuotient;
+    Int32 stepRemainder;
+    /// Size of the screen along the axis
+    Int32 screenSize;
+} BmpBilinearDda;
+
+/// Builds the cluster link map of the file, so that the following seeks and cluster changes do not walk the FAT
+/// \remarks If the file is too fragmented, the file keeps using the FAT chain
+static void EnableFastSeek(FIL* file);
 /// Validates the bitmap identifier in the Bmp description
 static BmpResult ValidateIdentifier(const Bmp* pBmp);
 /// Reads the image data offset from the BMP file in the Bmp description
@@ -48,118 +105,433 @@ static BmpResult ValidateIdentifier(const Bmp* pBmp);
 static BmpResult ReadBufferOffset(Bmp* pBmp);
 /// Reads the bitmap informations using the windows bitmap headers
 static BmpResult ReadWindowsBitmapInfoHeader(Bmp* pBmp);
+/// Allocates the reader buffer and seeks to the first scanline of the bitmap
+/// @return Status of the operation. In case of failure, the reader must not be released
+static BmpResult BmpRowReaderOpen(BmpRowReader* reader, const Bmp* cpBmp);
+/// Returns a pointer to a scanline, reading more data from the file if necessary
+/// @param fileRow Row index in file order (bottom-up)
+/// @param row [Out] Pointer to the scanline data, valid until the next call
+static BmpResult BmpRowReaderGetRow(BmpRowReader* reader, UInt32 fileRow, PCBYTE* row);
+/// Releases the reader buffer
+static void BmpRowReaderClose(BmpRowReader* reader);
 /// Display a bitmap on the screen that have the exact resolution of the destination frame buffer
-static BmpResult FastDisplayBitmap(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer);
-/// Display a bitmap on the screen applying a resize algorithm
-static BmpResult SlowDisplayBitmap(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer);
+static BmpResult FastDisplayBitmap(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer, ScreenDither dither);
+/// Display a bitmap on the screen applying a nearest neighbour resize
+/// @param rowBuffer Buffer of at least 3 * screen width bytes where a screen line is prepared
+static BmpResult SlowDisplayBitmap(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer, BYTE* rowBuffer, ScreenDither dither);
+/// Display a bitmap on the screen applying an area averaging resize
+/// @param rowBuffer Buffer of at least 3 * screen width bytes where a screen line is prepared
+static BmpResult BoxDisplayBitmap(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer, BYTE* rowBuffer, ScreenDither dither);
+/// Averages the pixels of a bitmap scanline in the screen columns and adds the result to the column accumulators
+static void AccumulateBoxRow(const Bmp* cpBmp, PCBYTE row, UInt16* accumulators, Int16 screenWidth);
+/// Display a bitmap on the screen applying a bilinear resize
+/// @param rowBuffer Buffer of at least 3 * screen width bytes where a screen line is prepared
+static BmpResult BilinearDisplayBitmap(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer, BYTE* rowBuffer, ScreenDither dither);
+/// Reads a bitmap scanline and interpolates it horizontally to the screen width
+static BmpResult LoadBilinearLine(BmpRowReader* reader, UInt32 fileRow, BYTE* line, Int16 screenWidth);
+/// Initializes the DDA at the sample of a screen coordinate
+/// @param size Bitmap size along the axis
+static void BilinearDdaInitialize(BmpBilinearDda* dda, UInt32 size, Int16 screenSize, Int16 screenCoordinate);
+/// Moves the DDA to the sample of the next screen coordinate
+static void BilinearDdaNext(BmpBilinearDda* dda);
+/// Moves the DDA to the sample of the previous screen coordinate
+static void BilinearDdaPrevious(BmpBilinearDda* dda);
+
+/// Cluster link map of the open bitmap. Only one bitmap is open at a time
+static DWORD _linkMap[BMP_LINK_MAP_SIZE];
+
+void EnableFastSeek(FIL* file) {
+    // The first item is the table size. FatFs replaces it with the number of items used
+    file->cltbl = _linkMap;
+    _linkMap[0] = BMP_LINK_MAP_SIZE;
+    if (f_lseek(file, CREATE_LINKMAP) != FR_OK) {
+        // FR_NOT_ENOUGH_CORE: too many fragments. Seeks will walk the cluster chain as usual
+        file->cltbl = NULL;
+    }
+}
 
-BmpResult FastDisplayBitmap(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer) {
-    // We seek to the data section of the BMP
-    FRESULT result = f_lseek(cpBmp->fileHandle, cpBmp->dataOffset);
-    if (result != FR_OK) {
+BmpResult BmpRowReaderOpen(BmpRowReader* reader, const Bmp* cpBmp) {
+    reader->bmp = cpBmp;
+
+    // The buffer must contain a scanline starting anywhere in its first sector. The size is a multiple of the
+    // sector size, so the following ram allocations stay aligned
+    static_assert(BMP_READ_BUFFER_SIZE % BMP_SECTOR_SIZE == 0);
+    size_t minSize = (size_t)cpBmp->rowByteSize + BMP_SECTOR_SIZE - 1;
+    reader->bufferSize = MAX(BMP_READ_BUFFER_SIZE, (minSize + BMP_SECTOR_SIZE - 1) & ~((size_t)BMP_SECTOR_SIZE - 1));
+    reader->bufferOffset = 0;
+    reader->bufferedBytes = 0;
+
+    // The buffer is in the ram allocator memory, which is reachable by the SD DMA
+    reader->buffer = (BYTE*)ralloc(reader->bufferSize);
+    if (reader->buffer == NULL) {
         return BmpResultFailure;
     }
+    return BmpResultOk;
+}
 
-    Pen pen = { 0 };
-    pen.color.components.A = 0xFF;
+BmpResult BmpRowReaderGetRow(BmpRowReader* reader, UInt32 fileRow, PCBYTE* row) {
+    const Bmp* cpBmp = reader->bmp;
+    DebugAssert(fileRow < cpBmp->height);
+
+    FSIZE_t rowOffset = cpBmp->dataOffset + ((FSIZE_t)fileRow * cpBmp->rowByteSize);
+    FSIZE_t bufferEnd = reader->bufferOffset + reader->bufferedBytes;
+    DebugAssert(rowOffset >= reader->bufferOffset);
+
+    if (rowOffset + cpBmp->rowByteSize > bufferEnd) {
+        FSIZE_t readOffset;
+        UInt32 keptBytes;
+        if (rowOffset < bufferEnd) {
+            // The row starts at the end of the buffer: its first part is moved at the beginning and the following
+            // sectors are read after it. Only a partial row is copied
+            keptBytes = (UInt32)(bufferEnd - rowOffset);
+            memmove(reader->buffer, &reader->buffer[rowOffset - reader->bufferOffset], keptBytes);
+            readOffset = bufferEnd;
+            reader->bufferOffset = rowOffset;
+        }
+        else {
+            // Skipped rows are not read: we restart from the sector containing the row
+            keptBytes = 0;
+            readOffset = rowOffset & ~((FSIZE_t)BMP_SECTOR_SIZE - 1);
+            reader->bufferOffset = readOffset;
+        }
 
-    PointS point = { 0 };
-    // From our beloved MSDN https://docs.microsoft.com/en-us/windows/win32/gdi/about-bitmaps
-    // The bitmap scanline are stored in reverse order in our case
-    UInt32 currentRowPos = f_tell(cpBmp->fileHandle);
-    for (int row = cpScreenBuffer->screenSize.height - 1; row >= 0; row--) {
-        point.y = (Int16)row;
-
-        // We seek to the current row pointer
-        result = f_lseek(cpBmp->fileHandle, currentRowPos);
-        if (result != FR_OK) {
+        // Seeking forward does not read any data sector
+        FIL* file = cpBmp->fileHandle;
+        if (f_tell(file) != readOffset && f_lseek(file, readOffset) != FR_OK) {
             return BmpResultFailure;
         }
 
-        // Loop for each pixel
-        for (int col = 0; col < cpScreenBuffer->screenSize.width; col++) {
-            UINT read;
+        // Whole sectors, except for the last one of the file
+        DebugAssert(readOffset % BMP_SECTOR_SIZE == 0 || readOffset == f_size(file));
+        UINT bytesToRead = (UINT)((reader->bufferSize - keptBytes) & ~((size_t)BMP_SECTOR_SIZE - 1));
+        if (readOffset + bytesToRead > f_size(file)) {
+            bytesToRead = (UINT)(f_size(file) - readOffset);
+        }
+        UINT read;
+        if (f_read(file, &reader->buffer[keptBytes], bytesToRead, &read) != FR_OK || read != bytesToRead) {
+            return BmpResultFailure;
+        }
+        reader->bufferedBytes = keptBytes + bytesToRead;
+
+        if (rowOffset + cpBmp->rowByteSize > reader->bufferOffset + reader->bufferedBytes) {
+            // Truncated file
+            return BmpResultFailure;
+        }
+    }
+
+    *row = &reader->buffer[rowOffset - reader->bufferOffset];
+    return BmpResultOk;
+}
+
+void BmpRowReaderClose(BmpRowReader* reader) {
+    rfree(reader->buffer, reader->bufferSize);
+    reader->buffer = NULL;
+}
+
+BmpResult FastDisplayBitmap(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer, ScreenDither dither) {
+    BmpRowReader reader;
+    BmpResult result = BmpRowReaderOpen(&reader, cpBmp);
+    if (result != BmpResultOk) {
+        return result;
+    }
+
+    DebugWriteChar('f');
+    // From our beloved MSDN https://docs.microsoft.com/en-us/windows/win32/gdi/about-bitmaps
+    // The bitmap scanline are stored in reverse order in our case. The scanline pixels are already in the
+    // B, G, R order so they can be blitted directly from the read buffer
+    Int16 screenWidth = cpScreenBuffer->screenSize.width;
+    for (UInt32 fileRow = 0; fileRow < cpBmp->height; fileRow++) {
+        PCBYTE row;
+        if ((result = BmpRowReaderGetRow(&reader, fileRow, &row)) != BmpResultOk) {
+            break;
+        }
+
+        ScreenBlitSpan(cpScreenBuffer, (Int16)(cpBmp->height - 1 - fileRow), 0, row, screenWidth, dither);
+    }
+    DebugWriteChar('F');
+
+    BmpRowReaderClose(&reader);
+    return result;
+}
 
-            // We directly read the 3 components (that are stored in "little-endian")
-            // directly into the pen color
-            // Alpha component should remain untouched since we are reading only 3 bytes
-            result = f_read(cpBmp->fileHandle, &pen.color.argb, 3, &read);
-            if (result != FR_OK) {
-                return BmpResultFailure;
+BmpResult SlowDisplayBitmap(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer, BYTE* rowBuffer, ScreenDither dither) {
+    // Nearest neighbour scaling with 32.32 fixed point steps: the source coordinate of a destination pixel is
+    // floor(destination * sourceSize / destinationSize). The division is performed only once per axis.
+    // The steps are rounded up: with sizes in the Int16 range the accumulated error stays below the distance
+    // between two destination pixels, so the coordinates are exact (a truncated step falls short of the exact
+    // integer coordinates, e.g. pixel 3 of a 10 to 6 reduction)
+    Int16 screenWidth = cpScreenBuffer->screenSize.width;
+    Int16 screenHeight = cpScreenBuffer->screenSize.height;
+    UInt64 stepX = (((UInt64)cpBmp->width << 32) + (UInt32)screenWidth - 1) / (UInt32)screenWidth;
+    UInt64 stepY = (((UInt64)cpBmp->height << 32) + (UInt32)screenHeight - 1) / (UInt32)screenHeight;
+
+    BmpRowReader reader;
+    BmpResult result = BmpRowReaderOpen(&reader, cpBmp);
+    if (result != BmpResultOk) {
+        return result;
+    }
+
+    DebugWriteChar('n');
+    // Scanlines are stored in reverse order in our Bmp: by drawing the screen from the bottom line we
+    // walk the file rows in increasing order, so the whole file is read with a single forward pass
+    UInt32 lastFileRow = UINT32_MAX;
+    UInt64 sourceY = stepY * (UInt32)(screenHeight - 1);
+    for (Int16 y = (Int16)(screenHeight - 1); y >= 0; y--, sourceY -= stepY) {
+        UInt32 nearestY = MIN((UInt32)(sourceY >> 32), cpBmp->height - 1);
+        UInt32 fileRow = cpBmp->height - 1 - nearestY;
+
+        // When upscaling, consecutive screen lines share the same source row: the scaled line is still
+        // in the row buffer
+        if (fileRow != lastFileRow) {
+            PCBYTE row;
+            if ((result = BmpRowReaderGetRow(&reader, fileRow, &row)) != BmpResultOk) {
+                break;
             }
-            point.x = (Int16)col;
-            ScreenDrawPixel(cpScreenBuffer, point, &pen);
+
+            UInt64 sourceX = 0;
+            BYTE* dest = rowBuffer;
+            for (Int16 x = 0; x < screenWidth; x++, sourceX += stepX) {
+                // Pixels are copied in the same B, G, R order of the file. The integer part is the high word
+                PCBYTE source = row + (MIN((UInt32)(sourceX >> 32), cpBmp->width - 1) * 3);
+                *dest++ = source[0];
+                *dest++ = source[1];
+                *dest++ = source[2];
+            }
+            lastFileRow = fileRow;
         }
 
-        currentRowPos += cpBmp->rowByteSize;
+        ScreenBlitSpan(cpScreenBuffer, y, 0, rowBuffer, screenWidth, dither);
     }
-    return BmpResultOk;
+    DebugWriteChar('N');
+
+    BmpRowReaderClose(&reader);
+    return result;
 }
 
-BmpResult GetPixelNN(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer, PointS pixelPt, float invScaleX, float invScaleY, UInt32* color) {
-    // Algorithm from https://towardsdatascience.com/image-processing-image-scaling-algorithms-ae29aaa6b36c
-    // We only use the inverse scaling factor calculation to deal with multiplications here
-
-    int nearestX = (int)((float)pixelPt.x * invScaleX);
-    int nearestY = (int)((float)pixelPt.y * invScaleY);
-
-    // Let's clip some possible border pixel if the image has a strange resolution
-    // Negative value should not be possible but let's add the check in any case
-    if (nearestX < 0) nearestX = 0;
-    if (nearestX >= cpBmp->width) nearestX = (int)(cpBmp->width - 1);
-    if (nearestY < 0) nearestY = 0;
-    if (nearestY >= cpBmp->height) nearestY = (int)(cpBmp->height - 1);
-
-    // We need to get the scanline index and seek to the pixel in the line
-    int scanLineIndex = (int)cpBmp->height - nearestY;
-    // Assuming a bitcount multiple of a byte
-    int bytesPerPixel = cpBmp->bitCount >> 3; // let's shift instead of divide the number
-    size_t pixelOffset = (size_t)((scanLineIndex * (int)cpBmp->rowByteSize) + (nearestX * bytesPerPixel));
-    // We seek to the data section of the BMP
-    FRESULT result = f_lseek(cpBmp->fileHandle, cpBmp->dataOffset + pixelOffset);
-    if (result != FR_OK) {
+BmpResult BoxDisplayBitmap(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer, BYTE* rowBuffer, ScreenDither dither) {
+    Int16 screenWidth = cpScreenBuffer->screenSize.width;
+    Int16 screenHeight = cpScreenBuffer->screenSize.height;
+    if ((cpBmp->height / (UInt32)screenHeight) >= BMP_BOX_MAX_ROWS) {
         return BmpResultFailure;
     }
 
-    UINT read = 0;
-    result = f_read(cpBmp->fileHandle, color, (UINT)bytesPerPixel, &read);
-    if (result != FR_OK) {
+    // Each screen column has an accumulator per color component, where the horizontal averages of the
+    // source rows are summed
+    size_t accumulatorsSize = (((size_t)screenWidth * 3 * sizeof(UInt16)) + 3) & ~((size_t)0x3);
+    UInt16* accumulators = (UInt16*)ralloc(accumulatorsSize);
+    if (accumulators == NULL) {
         return BmpResultFailure;
     }
 
-    return BmpResultOk;
+    BmpRowReader reader;
+    BmpResult result = BmpRowReaderOpen(&reader, cpBmp);
+    if (result != BmpResultOk) {
+        goto cleanup;
+    }
+
+    DebugWriteChar('b');
+    // The screen line y covers the source rows [y * height / screenHeight; (y + 1) * height / screenHeight).
+    // Like the nearest neighbour scaler, we start from the bottom line to read the file in a single forward pass
+    UInt32 lastFirstRow = UINT32_MAX;
+    for (Int16 y = (Int16)(screenHeight - 1); y >= 0; y--) {
+        UInt32 firstRow = ((UInt32)y * cpBmp->height) / (UInt32)screenHeight;
+        UInt32 endRow = (((UInt32)y + 1) * cpBmp->height) / (UInt32)screenHeight;
+        // When upscaling a screen line can cover less than a row: we use the row it starts in
+        UInt32 rows = MAX(endRow - firstRow, 1);
+
+        // When upscaling, consecutive screen lines can share the same source row: the line is still in the row buffer
+        if (firstRow != lastFirstRow) {
+            memset(accumulators, 0, (size_t)screenWidth * 3 * sizeof(UInt16));
+            for (UInt32 fileRow = cpBmp->height - firstRow - rows; fileRow < cpBmp->height - firstRow; fileRow++) {
+                PCBYTE row;
+                if ((result = BmpRowReaderGetRow(&reader, fileRow, &row)) != BmpResultOk) {
+                    goto closeReader;
+                }
+                AccumulateBoxRow(cpBmp, row, accumulators, screenWidth);
+            }
+
+            UInt32 reciprocal = BMP_RECIPROCAL(rows);
+            for (int i = 0; i < screenWidth * 3; i++) {
+                rowBuffer[i] = (BYTE)BMP_ROUNDED_DIVIDE(accumulators[i], rows, reciprocal);
+            }
+            lastFirstRow = firstRow;
+        }
+
+        ScreenBlitSpan(cpScreenBuffer, y, 0, rowBuffer, screenWidth, dither);
+    }
+    DebugWriteChar('B');
+
+closeReader:
+    BmpRowReaderClose(&reader);
+cleanup:
+    rfree(accumulators, accumulatorsSize);
+    return result;
 }
 
-BmpResult SlowDisplayBitmap(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer) {
-    float invScaleX = (float)cpBmp->width / (float)cpScreenBuffer->screenSize.width;
-    float invScaleY = (float)cpBmp->height / (float)cpScreenBuffer->screenSize.height;
+void AccumulateBoxRow(const Bmp* cpBmp, PCBYTE row, UInt16* accumulators, Int16 screenWidth) {
+    // The column boundaries are computed with an exact integer DDA: each column covers widthQuotient or
+    // widthQuotient + 1 pixels, so only two reciprocals are needed to average the sums
+    UInt32 widthQuotient = cpBmp->width / (UInt32)screenWidth;
+    UInt32 widthRemainder = cpBmp->width % (UInt32)screenWidth;
+    UInt32 minPixels = MAX(widthQuotient, 1);
+    UInt32 reciprocals[2] = { BMP_RECIPROCAL(minPixels), BMP_RECIPROCAL(minPixels + 1) };
+
+    UInt32 error = 0;
+    PCBYTE source = row;
+    for (Int16 x = 0; x < screenWidth; x++) {
+        UInt32 pixels = widthQuotient;
+        error += widthRemainder;
+        if (error >= (UInt32)screenWidth) {
+            error -= (UInt32)screenWidth;
+            pixels++;
+        }
 
-    PointS pixelPt = { 0 };
-    Pen pen = { 0 };
-    pen.color.components.A = 0xFF;
+        // When upscaling a column can cover less than a pixel: we use the pixel it starts in
+        UInt32 averagedPixels = MAX(pixels, 1);
+        UInt32 blue = 0, green = 0, red = 0;
+        for (UInt32 i = 0; i < averagedPixels * 3; i += 3) {
+            blue += source[i];
+            green += source[i + 1];
+            red += source[i + 2];
+        }
+        source += pixels * 3;
 
-    DebugWriteChar('n');
-    // Scanlines are stored in reverse order in our Bmp
-    for (int y = cpScreenBuffer->screenSize.height - 1; y >= 0; y--)
-    {
-        pixelPt.y = (Int16)y;
-        for (int x = 0; x < cpScreenBuffer->screenSize.width; x++)
-        {
-            pixelPt.x = (Int16)x;
-            BmpResult result = GetPixelNN(cpBmp, cpScreenBuffer, pixelPt, invScaleX, invScaleY, &pen.color.argb);
-            if (result != BmpResultOk) {
-                // Error: let's interrupt the drawing loop
-                return result;
+        UInt32 reciprocal = reciprocals[averagedPixels - minPixels];
+        *accumulators++ += (UInt16)BMP_ROUNDED_DIVIDE(blue, averagedPixels, reciprocal);
+        *accumulators++ += (UInt16)BMP_ROUNDED_DIVIDE(green, averagedPixels, reciprocal);
+        *accumulators++ += (UInt16)BMP_ROUNDED_DIVIDE(red, averagedPixels, reciprocal);
+    }
+}
+
+BmpResult BilinearDisplayBitmap(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer, BYTE* rowBuffer, ScreenDither dither) {
+    Int16 screenWidth = cpScreenBuffer->screenSize.width;
+    Int16 screenHeight = cpScreenBuffer->screenSize.height;
+
+    // The two source rows around a screen line are kept already interpolated to the screen width
+    size_t lineSize = (((size_t)screenWidth * 3) + 3) & ~((size_t)0x3);
+    BYTE* lines = (BYTE*)ralloc(lineSize * 2);
+    if (lines == NULL) {
+        return BmpResultFailure;
+    }
+    UInt32 lineFileRows[2] = { UINT32_MAX, UINT32_MAX };
+
+    BmpRowReader reader;
+    BmpResult result = BmpRowReaderOpen(&reader, cpBmp);
+    if (result != BmpResultOk) {
+        goto cleanup;
+    }
+
+    DebugWriteChar('l');
+    // Source coordinate of the center of a screen pixel: (y + 0.5) * height / screenHeight - 0.5
+    BmpBilinearDda ddaY;
+    BilinearDdaInitialize(&ddaY, cpBmp->height, screenHeight, (Int16)(screenHeight - 1));
+    for (Int16 y = (Int16)(screenHeight - 1); y >= 0; y--, BilinearDdaPrevious(&ddaY)) {
+        UInt32 clampedY = (UInt32)MAX(ddaY.position, 0);
+        UInt32 topRow = MIN(clampedY >> 8, cpBmp->height - 1);
+        UInt32 bottomRow = MIN(topRow + 1, cpBmp->height - 1);
+        UInt32 weight = clampedY & 0xFF;
+
+        // The bottom row comes first in the file: the two rows are loaded in file order. A row that is
+        // not cached replaces the one that is not needed anymore
+        UInt32 fileRows[2] = { cpBmp->height - 1 - bottomRow, cpBmp->height - 1 - topRow };
+        BYTE* rowLines[2];
+        for (int i = 0; i < 2; i++) {
+            int slot;
+            if (lineFileRows[0] == fileRows[i]) {
+                slot = 0;
+            }
+            else if (lineFileRows[1] == fileRows[i]) {
+                slot = 1;
+            }
+            else {
+                slot = (lineFileRows[0] == fileRows[1 - i]) ? 1 : 0;
+                if ((result = LoadBilinearLine(&reader, fileRows[i], lines + (lineSize * slot), screenWidth)) != BmpResultOk) {
+                    goto closeReader;
+                }
+                lineFileRows[slot] = fileRows[i];
             }
+            rowLines[i] = lines + (lineSize * slot);
+        }
 
-            ScreenDrawPixel(cpScreenBuffer, pixelPt, &pen);
+        // Vertical interpolation between the top and the bottom row
+        PCBYTE bottomLine = rowLines[0];
+        PCBYTE topLine = rowLines[1];
+        for (int i = 0; i < screenWidth * 3; i++) {
+            rowBuffer[i] = (BYTE)(((topLine[i] * (0x100 - weight)) + (bottomLine[i] * weight)) >> 8);
         }
+
+        ScreenBlitSpan(cpScreenBuffer, y, 0, rowBuffer, screenWidth, dither);
     }
-    DebugWriteChar('N');
+    DebugWriteChar('L');
+
+closeReader:
+    BmpRowReaderClose(&reader);
+cleanup:
+    rfree(lines, lineSize * 2);
+    return result;
+}
 
+BmpResult LoadBilinearLine(BmpRowReader* reader, UInt32 fileRow, BYTE* line, Int16 screenWidth) {
+    const Bmp* cpBmp = reader->bmp;
+    PCBYTE row;
+    BmpResult result = BmpRowReaderGetRow(reader, fileRow, &row);
+    if (result != BmpResultOk) {
+        return result;
+    }
+
+    BmpBilinearDda ddaX;
+    BilinearDdaInitialize(&ddaX, cpBmp->width, screenWidth, 0);
+    for (Int16 x = 0; x < screenWidth; x++, BilinearDdaNext(&ddaX)) {
+        UInt32 clampedX = (UInt32)MAX(ddaX.position, 0);
+        UInt32 leftPixel = MIN(clampedX >> 8, cpBmp->width - 1);
+        UInt32 rightPixel = MIN(leftPixel + 1, cpBmp->width - 1);
+        UInt32 weight = clampedX & 0xFF;
+
+        PCBYTE left = row + (leftPixel * 3);
+        PCBYTE right = row + (rightPixel * 3);
+        *line++ = (BYTE)(((left[0] * (0x100 - weight)) + (right[0] * weight)) >> 8);
+        *line++ = (BYTE)(((left[1] * (0x100 - weight)) + (right[1] * weight)) >> 8);
+        *line++ = (BYTE)(((left[2] * (0x100 - weight)) + (right[2] * weight)) >> 8);
+    }
     return BmpResultOk;
 }
 
+void BilinearDdaInitialize(BmpBilinearDda* dda, UInt32 size, Int16 screenSize, Int16 screenCoordinate) {
+    // Position in 1/256 of pixel: ((2 * i + 1) * size - screenSize) * 128 / screenSize, divided rounding down
+    // also when negative (the first centers can be before the center of the first bitmap pixel)
+    Int64 numerator = ((((2 * (Int64)screenCoordinate) + 1) * size) - screenSize) * 128;
+    Int64 quotient = numerator / screenSize;
+    Int64 remainder = numerator % screenSize;
+    if (remainder < 0) {
+        quotient--;
+        remainder += screenSize;
+    }
+
+    dda->position = (Int32)quotient;
+    dda->remainder = (Int32)remainder;
+    dda->stepQuotient = (Int32)((size * 256) / (UInt32)screenSize);
+    dda->stepRemainder = (Int32)((size * 256) % (UInt32)screenSize);
+    dda->screenSize = screenSize;
+}
+
+void BilinearDdaNext(BmpBilinearDda* dda) {
+    dda->position += dda->stepQuotient;
+    dda->remainder += dda->stepRemainder;
+    if (dda->remainder >= dda->screenSize) {
+        dda->remainder -= dda->screenSize;
+        dda->position++;
+    }
+}
+
+void BilinearDdaPrevious(BmpBilinearDda* dda) {
+    dda->position -= dda->stepQuotient;
+    dda->remainder -= dda->stepRemainder;
+    if (dda->remainder < 0) {
+        dda->remainder += dda->screenSize;
+        dda->position--;
+    }
+}
+
 BmpResult ReadBufferOffset(Bmp* pBmp) {
     // First we seek to the correct file point
     FRESULT result = f_lseek(pBmp->fileHandle, offsetof(BITMAPFILEHEADER, bfOffBits));
@@ -274,6 +646,8 @@ BmpResult BmpReadFromFile(FIL* file, Bmp* pBmp) {
     // Here header is valid. Let's Immediately register the file handle in the destination struct
     // Maybe it's not the best for security, etc but now the focus is not on this
     pBmp->fileHandle = file;
+    // The header fields and the scanlines are read with several seeks
+    EnableFastSeek(file);
 
     // After the identifier, we have to read the image data offset, which is still a field of the header
     // (the main header is shared by all the strange BMP implementation)
@@ -301,7 +675,7 @@ BmpResult BmpReadFromFile(FIL* file, Bmp* pBmp) {
     return BmpResultOk;
 }
 
-BmpResult BmpDisplay(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer) {
+BmpResult BmpDisplay(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer, BmpScaleMode scaleMode, ScreenDither dither) {
     static_assert(sizeof(BmpIdentifier) == sizeof(WORD));
 
     if (cpBmp == NULL)
@@ -310,15 +684,42 @@ BmpResult BmpDisplay(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer) {
         return BmpResultFailure;
     if (cpBmp->width == 0 || cpBmp->height == 0)
         return BmpResultFailure;
+    // Like the screen coordinates, bitmap sizes are limited to the Int16 range so that the fixed point
+    // scaling computations cannot overflow
+    if (cpBmp->width > INT16_MAX || cpBmp->height > INT16_MAX)
+        return BmpResultFailure;
+
+    // The bitmap is drawn line by line over the entire screen
+    ScreenInvalidateRectangle(cpScreenBuffer, (PointS) { 0 }, cpScreenBuffer->screenSize);
 
     // If the bitmap we want to display is of the same size as the screen , we don't have to apply any scaling and
-    // we can directly copy pixel by pixel
+    // we can directly copy the scanlines
     if (cpScreenBuffer->screenSize.width == cpBmp->width && cpScreenBuffer->screenSize.height == cpBmp->height) {
-        FastDisplayBitmap(cpBmp, cpScreenBuffer);
+        return FastDisplayBitmap(cpBmp, cpScreenBuffer, dither);
     }
-    else {
-        SlowDisplayBitmap(cpBmp, cpScreenBuffer);
+
+    // Screen lines are prepared in a 24bit buffer and then blitted on the screen. The size is kept
+    // word-aligned to not misalign the following ram allocations
+    size_t rowBufferSize = (((size_t)cpScreenBuffer->screenSize.width * 3) + 3) & ~((size_t)0x3);
+    BYTE* rowBuffer = (BYTE*)ralloc(rowBufferSize);
+    if (rowBuffer == NULL) {
+        return BmpResultFailure;
     }
 
-    return BmpResultOk;
+    BmpResult result;
+    switch (scaleMode) {
+    case BmpScaleBox:
+        result = BoxDisplayBitmap(cpBmp, cpScreenBuffer, rowBuffer, dither);
+        break;
+    case BmpScaleBilinear:
+        result = BilinearDisplayBitmap(cpBmp, cpScreenBuffer, rowBuffer, dither);
+        break;
+    case BmpScaleNearest:
+    default:
+        result = SlowDisplayBitmap(cpBmp, cpScreenBuffer, rowBuffer, dither);
+        break;
+    }
+
+    rfree(rowBuffer, rowBufferSize);
+    return result;
 }
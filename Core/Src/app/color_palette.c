@@ -1,6 +1,14 @@
 #include <app/color_palette.h>
+#include <vga/vgascreenbuffer.h>
+#include <intmath.h>
 #include <stddef.h>
 
+/// Swatches in a row of the palettized screen, one for each green level
+#define SWATCH_COLUMNS 5
+/// Green and blue steps between two swatches
+#define SWATCH_GREEN_STEP 63
+#define SWATCH_BLUE_STEP 127
+
 /// Active screen buffer pointer
 static ScreenBuffer* _pActiveBuffer = NULL;
 
@@ -14,6 +22,51 @@ static int _redLevel = 0;
 /// for each level
 static int _redIncrement = 0;
 
+/// Colors of the palettized modes (16 or 4). The first one is the black background, the others are the swatches
+static BYTE _paletteSize = 0;
+
+static void BuildPalette(int redLevel, ARGB8Color* palette) {
+    palette[0].argb = SCREEN_RGB(0, 0, 0);
+    for (int i = 1; i < _paletteSize; i++) {
+        palette[i].argb = SCREEN_RGB(redLevel * _redIncrement, ((i - 1) % SWATCH_COLUMNS) * SWATCH_GREEN_STEP,
+            ((i - 1) / SWATCH_COLUMNS) * SWATCH_BLUE_STEP);
+    }
+}
+
+static void SetPalette() {
+    ARGB8Color palette[16];
+    BuildPalette(_redLevel, palette);
+    VgaSetPalette(palette, _paletteSize);
+}
+
+static void DrawSwatches() {
+    ScreenBuffer* screenBuffer = _pActiveBuffer;
+    Pen pen = { 0 };
+    pen.color.argb = SCREEN_RGB(0, 0, 0);
+    ScreenClear(screenBuffer, &pen);
+
+    // Drawing colors are mapped to the nearest palette entry. With the brightest red every swatch color differs
+    // from the black background, so each swatch gets its own entry
+    ARGB8Color palette[16];
+    BuildPalette(_redLevels - 1, palette);
+    VgaSetPalette(palette, _paletteSize);
+
+    // Green changes by column and blue by row, like the blue lines and the green columns of the 8bpp palette
+    int swatchCount = _paletteSize - 1;
+    int columns = MIN(swatchCount, SWATCH_COLUMNS);
+    int rows = (swatchCount + SWATCH_COLUMNS - 1) / SWATCH_COLUMNS;
+    SizeS size = { (Int16)(screenBuffer->screenSize.width / columns), (Int16)(screenBuffer->screenSize.height / rows) };
+    for (int i = 0; i < swatchCount; i++) {
+        PointS point = { (Int16)((i % SWATCH_COLUMNS) * size.width), (Int16)((i / SWATCH_COLUMNS) * size.height) };
+        pen.color = palette[i + 1];
+        ScreenFillRectangle(screenBuffer, point, size, &pen);
+    }
+
+    // The whole frame has been redrawn, so the buffers can be exchanged without copying the modified areas
+    SetPalette();
+    VgaSwapBuffers();
+}
+
 static void DrawPalette() {
     Pen currentPen = { 0 };
     ScreenBuffer* screenBuffer = _pActiveBuffer;
@@ -27,6 +80,8 @@ static void DrawPalette() {
     float greenDivisions = screenBuffer->screenSize.width / 256.0f;
 
     PointS pixelPoint = { 0 };
+    // The palette covers the whole screen, pixel by pixel
+    ScreenInvalidateRectangle(screenBuffer, pixelPoint, screenBuffer->screenSize);
     for (int line = 0; line < screenBuffer->screenSize.height; line++) {
         // Blue and Y are fixed for the whole line
         // Blue level [0; 255] in the col is simply defined by the line
@@ -40,6 +95,19 @@ static void DrawPalette() {
             ScreenDrawPixel(screenBuffer, pixelPoint, &currentPen);
         }
     }
+
+    ScreenPresent(screenBuffer);
+}
+
+static void ChangeRedLevel(int redLevel) {
+    _redLevel = redLevel;
+    if (_paletteSize != 0) {
+        // Only the palette changes: the swatches are recolored without drawing
+        SetPalette();
+    }
+    else {
+        DrawPalette();
+    }
 }
 
 // ##### Public Function definitions #####
@@ -48,10 +116,15 @@ void AppPaletteInitialize(ScreenBuffer* screenBuffer) {
     // We register the frame buffer
     _pActiveBuffer = screenBuffer;
 
-    // Let's calculate the red level and increment
+    // Let's calculate the red level and increment. The palettized modes map their colors to the 8bpp ones
+    _paletteSize = 0;
     if (screenBuffer->bitsPerPixel == Bpp8) {
         _redLevels = 4;
     }
+    else if (screenBuffer->bitsPerPixel == Bpp4 || screenBuffer->bitsPerPixel == Bpp2) {
+        _redLevels = 4;
+        _paletteSize = screenBuffer->bitsPerPixel == Bpp4 ? 16 : 4;
+    }
     else {
         _redLevels = 256;
     }
@@ -59,7 +132,12 @@ void AppPaletteInitialize(ScreenBuffer* screenBuffer) {
     _redLevel = 0;
 
     // Eventually we draw the initial palette
-    DrawPalette();
+    if (_paletteSize != 0) {
+        DrawSwatches();
+    }
+    else {
+        DrawPalette();
+    }
 }
 
 void AppPaletteProcessInput(char command) {
@@ -67,12 +145,10 @@ void AppPaletteProcessInput(char command) {
     // '+' char increments the red level and redraw the palette
     // '-' char decrements the red level and redraw the palette
     if (command == '+' && _redLevel < (_redLevels - 1)) {
-        ++_redLevel;
-        DrawPalette();
+        ChangeRedLevel(_redLevel + 1);
     }
     else if (command == '-' && _redLevel > 0) {
-        --_redLevel;
-        DrawPalette();
+        ChangeRedLevel(_redLevel - 1);
     }
 }
 
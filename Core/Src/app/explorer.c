@@ -15,8 +15,14 @@
 #include <binary.h>
 #include <app/bmp.h>
 #include <vga/vgascreenbuffer.h>
+#include <ram.h>
+#include <disk/sectorcache.h>
+#include <disk/readahead.h>
+#include <sd/sd.h>
 
 #define FORMAT_BUFFER_SIZE 120
+/// Padding (in pixels) around the file list rows
+#define FILE_LIST_ROW_PADDING 3
 
  /// FatFs relative data for the mounted filesystem
 static FATFS _fsMountData;
@@ -48,8 +54,18 @@ static FILINFO _fileListSelectedFile;
 static BOOL _displayingError;
 /// Cached size of the application title box
 static int _titleBoxHeight;
+/// Flag that indicates that the file list is currently displayed on the screen
+static BOOL _fileListVisible;
 /// Flag that indicates that the output must be suspended when drawing an image
 BOOL _suspendOutput = 0;
+/// Resize algorithm used for the bitmaps that do not match the screen size
+static BmpScaleMode _scaleMode = BmpScaleNearest;
+/// Printable names of the resize algorithms, indexed by BmpScaleMode
+static const char* const _scaleModeNames[] = { "nearest neighbour", "box filter", "bilinear" };
+/// Dithering applied to the displayed images
+static ScreenDither _dither = ScreenDitherNone;
+/// Printable names of the dithering modes, indexed by ScreenDither
+static const char* const _ditherNames[] = { "none", "ordered", "error diffusion" };
 /// Static buffer for error string formatting
 char _errorFormatBuffer[FORMAT_BUFFER_SIZE];
 
@@ -75,6 +91,24 @@ static void DrawSelectedFile();
 static void DrawSelectedBmpFile();
 /// Draws the file list in the root directory on the screen
 static void DrawFileList();
+/// Draws a single row of the file list
+/// @param fileInfo File displayed in the row
+/// @param pageRow Index of the row in the displayed page
+/// @param selected True if the row must be highlighted
+/// @param clearBackground True if the row area must be cleared before drawing
+static void DrawFileListRow(const FILINFO* fileInfo, int pageRow, BOOL selected, BOOL clearBackground);
+/// Finds the valid file at the specified index in the root directory
+/// @param fileIndex Index of the file, counting only the valid ones
+/// @param fileInfo [Out] Information of the file found
+/// @return FR_NO_FILE if the index is beyond the last valid file
+static FRESULT FindFileAtIndex(int fileIndex, FILINFO* fileInfo);
+/// Returns the height of a file list row
+static int GetFileListRowSize();
+/// Returns the number of file list rows that fit in a page
+static int GetFileListRowsInPage();
+/// Moves the file list selection. Only the two changed rows are redrawn if the page does not change
+/// @param newSelectedRow Index of the new selected file
+static void MoveFileListSelection(int newSelectedRow);
 /// Draws on the screen the selected RAW file
 static void DrawSelectedRawFile();
 /// Draws the tile of the application on the screen
@@ -82,6 +116,8 @@ static void DrawApplicationTitle();
 /// Filter to check that a file in our list is valid
 /// @return False if the file need to be ignored, true otherwhise
 static bool FilterValidFile(const FILINFO* pInfo);
+/// Prints the activity of the storage layers and restarts the SD driver measure
+static void DumpStorageStatistics();
 
 /* Private section */
 
@@ -198,6 +234,7 @@ void FormatError(FRESULT result) {
 void DisplayFResultError(const ScreenBuffer* screenBuffer, FRESULT result, const char* description) {
     // We flag that we are in error condition. This will prevent any other user command to be processed
     _displayingError = true;
+    _fileListVisible = false;
 
     // Let's setup the pen
     Pen pen = { 0 };
@@ -248,6 +285,7 @@ void DisplayFResultError(const ScreenBuffer* screenBuffer, FRESULT result, const
     point.x = (Int16)errXPos;
     point.y = (Int16)(point.y + descrStrSize.height);
     ScreenDrawString(screenBuffer, _errorFormatBuffer, point, &pen);
+    ScreenPresent(screenBuffer);
 }
 
 void DisplayGenericError(const ScreenBuffer* screenBuffer, const char* description) {
@@ -259,6 +297,7 @@ void DisplayGenericError(const ScreenBuffer* screenBuffer, const char* descripti
 
 void DisplayMessage(const ScreenBuffer* screenBuffer, const char* message, UInt32 background) {
     const int padding = 2;
+    _fileListVisible = false;
     Pen pen = { 0 };
     PointS point = { 0 };
 
@@ -289,6 +328,7 @@ void DisplayMessage(const ScreenBuffer* screenBuffer, const char* message, UInt3
     pen.color.argb = SCREEN_RGB(0xFF, 0xFF, 0xFF);
     point.y = (Int16)(point.y + padding);
     ScreenDrawString(screenBuffer, message, point, &pen);
+    ScreenPresent(screenBuffer);
 }
 
 void DrawApplicationTitle() {
@@ -320,6 +360,8 @@ void DrawApplicationTitle() {
 }
 
 void DrawSelectedFile() {
+    // The image will cover the list
+    _fileListVisible = false;
     if (EndsWith(_fileListSelectedFile.fname, ".raw"))
     {
         DrawSelectedRawFile();
@@ -328,6 +370,9 @@ void DrawSelectedFile() {
     {
         DrawSelectedBmpFile();
     }
+
+    // The image (or the error message) is displayed only when completely drawn
+    ScreenPresent(_screenBuffer);
 }
 
 void DrawSelectedBmpFile() {
@@ -346,7 +391,7 @@ void DrawSelectedBmpFile() {
         goto cleanup;
     }
 
-    result = BmpDisplay(&_bmpHandle, _screenBuffer);
+    result = BmpDisplay(&_bmpHandle, _screenBuffer, _scaleMode, _dither);
     if (result != BmpResultOk) {
         DisplayGenericError(_screenBuffer, "Unable display bitmap");
     }
@@ -363,37 +408,45 @@ void DrawSelectedRawFile() {
         return;
     }
 
+    // Each line is read in a 24bit buffer and then blitted on the screen
+    Int16 screenWidth = _screenBuffer->screenSize.width;
+    size_t rowBufferSize = (((size_t)screenWidth * 3) + 3) & ~((size_t)0x3);
+    BYTE* rowBuffer = (BYTE*)ralloc(rowBufferSize);
+    if (rowBuffer == NULL) {
+        DisplayGenericError(_screenBuffer, "Not enough memory to read raw file");
+        f_close(&_fileHandle);
+        return;
+    }
+
     UINT read;
-    Pen pen = { 0 };
-    pen.color.components.A = 0xFF;
-    PointS point;
+    PointS point = { 0 };
+    // We are drawing the lines directly so we need to invalidate the whole screen
+    ScreenInvalidateRectangle(_screenBuffer, point, _screenBuffer->screenSize);
     // Raw files are similar to bitmap but with no headers, word alignment, no reverse scanline
     for (int line = 0; line < _screenBuffer->screenSize.height; line++) {
-        point.y = (Int16)line;
-
-        for (int x = 0; x < _screenBuffer->screenSize.width; x++) {
-            UInt32 color = 0;
+        for (int x = 0; x < screenWidth; x++) {
+            BYTE* pixel = &rowBuffer[x * 3];
 
-            // We read the big endian RGB code into our local color variable
-            FRESULT readResult = f_read(&_fileHandle, &color, 3, &read);
+            // We read the big endian RGB code into the row buffer
+            FRESULT readResult = f_read(&_fileHandle, pixel, 3, &read);
             if (readResult != FR_OK) {
                 DisplayGenericError(_screenBuffer, "Unable to read raw file");
                 goto cleanup;
             }
             DebugAssert(read == 3);
 
-            // Raw components are not in little endian
-            pen.color.components.R = MASKI2BYTE(color);
-            pen.color.components.G = MASKI2BYTE(color >> 8);
-            pen.color.components.B = MASKI2BYTE(color >> 16);
-            
-            point.x = (Int16)x;
-            ScreenDrawPixel(_screenBuffer, point, &pen);
+            // Raw components are not in the B, G, R order expected by the screen
+            BYTE red = pixel[0];
+            pixel[0] = pixel[2];
+            pixel[2] = red;
         }
+
+        ScreenBlitSpan(_screenBuffer, (Int16)line, 0, rowBuffer, screenWidth, _dither);
     }
 
     // If we cannot load the RAW, we still have to close the file
 cleanup:
+    rfree(rowBuffer, rowBufferSize);
     f_close(&_fileHandle);
 }
 
@@ -414,17 +467,8 @@ void DrawFileList() {
         DisplayFResultError(_screenBuffer, openResult, "Unable to open root dir");
         return;
     }
-    // Let's calculate a row using the max character height with the current font
-    const int rowPadding = 3;
-    int rowSize = ScreenGetCharMaxHeight() + (rowPadding * 2);
-    // Let's fix the row text color
-    pen.color.argb = SCREEN_RGB(0xb2, 0xdf, 0xdb);
-
-    PointS rowPoint = { 0 };
-    rowPoint.x = (Int16)(rowPoint.x + rowPadding); // let's start with a little offset to not draw directly on the border
-    rowPoint.y = (Int16)(_titleBoxHeight + rowPadding);
 
-    int rowsInPage = (_screenBuffer->screenSize.height - _titleBoxHeight) / rowSize;
+    int rowsInPage = GetFileListRowsInPage();
     int pageOffset = _fileListSelectedRow / rowsInPage;
     int rowsToSkip = pageOffset * rowsInPage;
 
@@ -432,7 +476,8 @@ void DrawFileList() {
     // If we use strlen(), the string is read entirely each time. We can simply check if the first char is not zero
     FRESULT dirReadResult = FR_OK;
     int fileIndex = 0;
-    while ((rowPoint.y + rowSize < _screenBuffer->screenSize.height) && // Row in screen bound
+    int pageRow = 0;
+    while ((pageRow < rowsInPage) && // Row in screen bound
         ((dirReadResult = f_readdir(&_dirHandle, &_fileInfoHandle)) == FR_OK) && // No Error
         _fileInfoHandle.fname[0] != '\0') // Enumeration not ended
     {
@@ -447,32 +492,16 @@ void DrawFileList() {
             continue;
         }
 
-        // Let's draw the name a little bit shifted
-        PointS nameDrawPoint = rowPoint;
-        nameDrawPoint.x = (Int16)(nameDrawPoint.x + rowPadding);
-
-        if (fileIndex == _fileListSelectedRow) {
+        BOOL selected = fileIndex == _fileListSelectedRow;
+        if (selected) {
             // We copy the selected file info to a static object so it can be used in the 
             // application command subroutines
             memcpy(&_fileListSelectedFile, &_fileInfoHandle, sizeof(FILINFO));
-            UInt32 originalPenColor = pen.color.argb;
-            SizeS stringRectSize;
-            ScreenMeasureString(_fileInfoHandle.fname, &stringRectSize);
-
-            // We draw the rectangle a little bit larger to correct the string offset
-            stringRectSize.width = (Int16)(stringRectSize.width + rowPadding * 2);
-            ScreenFillRectangle(_screenBuffer, rowPoint, stringRectSize, &pen);
-
-            // We draw the string and we reset the original color
-            pen.color.argb = SCREEN_RGB(0xFF, 0xFF, 0xFF);
-            ScreenDrawString(_screenBuffer, _fileInfoHandle.fname, nameDrawPoint, &pen);
-            pen.color.argb = originalPenColor;
-        }
-        else {
-            // Super simple string draw if the file is not selected
-            ScreenDrawString(_screenBuffer, _fileInfoHandle.fname, nameDrawPoint, &pen);
         }
-        rowPoint.y = (Int16)(rowPoint.y + rowSize);
+
+        // Screen has already been cleared
+        DrawFileListRow(&_fileInfoHandle, pageRow, selected, false);
+        ++pageRow;
         ++fileIndex;
     }
 
@@ -480,19 +509,140 @@ void DrawFileList() {
     if (dirReadResult != FR_OK) {
         DisplayFResultError(_screenBuffer, dirReadResult, "Enumeration failed");
     }
+    else {
+        _fileListVisible = true;
+    }
 
     // Eventually we close the directory handle
     f_closedir(&_dirHandle);
+    ScreenPresent(_screenBuffer);
+}
+
+void DrawFileListRow(const FILINFO* fileInfo, int pageRow, BOOL selected, BOOL clearBackground) {
+    int rowSize = GetFileListRowSize();
+    Pen pen;
+
+    PointS rowPoint;
+    rowPoint.x = FILE_LIST_ROW_PADDING; // let's start with a little offset to not draw directly on the border
+    rowPoint.y = (Int16)(_titleBoxHeight + FILE_LIST_ROW_PADDING + (pageRow * rowSize));
+
+    if (clearBackground) {
+        // The row may contain a selection box. We clear the entire row area
+        PointS clearPoint = { 0, rowPoint.y };
+        SizeS clearSize = { _screenBuffer->screenSize.width, (Int16)rowSize };
+        pen.color.argb = SCREEN_RGB(0, 0, 0);
+        ScreenFillRectangle(_screenBuffer, clearPoint, clearSize, &pen);
+    }
+
+    // Let's draw the name a little bit shifted
+    PointS nameDrawPoint = rowPoint;
+    nameDrawPoint.x = (Int16)(nameDrawPoint.x + FILE_LIST_ROW_PADDING);
+
+    // Let's fix the row text color
+    pen.color.argb = SCREEN_RGB(0xb2, 0xdf, 0xdb);
+    if (selected) {
+        SizeS stringRectSize;
+        ScreenMeasureString(fileInfo->fname, &stringRectSize);
+
+        // We draw the rectangle a little bit larger to correct the string offset
+        stringRectSize.width = (Int16)(stringRectSize.width + FILE_LIST_ROW_PADDING * 2);
+        ScreenFillRectangle(_screenBuffer, rowPoint, stringRectSize, &pen);
+
+        // The string is drawn in white over the selection box
+        pen.color.argb = SCREEN_RGB(0xFF, 0xFF, 0xFF);
+    }
+    ScreenDrawString(_screenBuffer, fileInfo->fname, nameDrawPoint, &pen);
+}
+
+FRESULT FindFileAtIndex(int fileIndex, FILINFO* fileInfo) {
+    FRESULT result = f_opendir(&_dirHandle, FsRootDirectory);
+    if (result != FR_OK) {
+        return result;
+    }
+
+    // Same enumeration of DrawFileList() but without any drawing
+    int validIndex = 0;
+    while (((result = f_readdir(&_dirHandle, fileInfo)) == FR_OK) && fileInfo->fname[0] != '\0') {
+        if (!FilterValidFile(fileInfo)) {
+            continue;
+        }
+
+        if (validIndex++ == fileIndex) {
+            break;
+        }
+    }
+
+    if (result == FR_OK && fileInfo->fname[0] == '\0') {
+        // Enumeration ended before reaching the index
+        result = FR_NO_FILE;
+    }
+
+    f_closedir(&_dirHandle);
+    return result;
+}
+
+int GetFileListRowSize() {
+    // Let's calculate a row using the max character height with the current font
+    return ScreenGetCharMaxHeight() + (FILE_LIST_ROW_PADDING * 2);
+}
+
+int GetFileListRowsInPage() {
+    // A row is displayed only if its bottom edge is inside the screen
+    int rowsInPage = (_screenBuffer->screenSize.height - _titleBoxHeight - FILE_LIST_ROW_PADDING - 1) / GetFileListRowSize();
+    DebugAssert(rowsInPage > 0);
+    return rowsInPage;
+}
+
+void MoveFileListSelection(int newSelectedRow) {
+    int rowsInPage = GetFileListRowsInPage();
+    int previousSelectedRow = _fileListSelectedRow;
+    _fileListSelectedRow = newSelectedRow;
+
+    if (!_fileListVisible || (previousSelectedRow / rowsInPage) != (newSelectedRow / rowsInPage)) {
+        // The list is not on the screen or the page has changed. We need to redraw everything
+        DrawFileList();
+        return;
+    }
+
+    // Same page: we remove the highlight from the previous row and we draw the new selected row
+    DrawFileListRow(&_fileListSelectedFile, previousSelectedRow % rowsInPage, false, true);
+
+    FRESULT findResult = FindFileAtIndex(newSelectedRow, &_fileInfoHandle);
+    if (findResult != FR_OK) {
+        DisplayFResultError(_screenBuffer, findResult, "Enumeration failed");
+        return;
+    }
+    memcpy(&_fileListSelectedFile, &_fileInfoHandle, sizeof(FILINFO));
+    DrawFileListRow(&_fileListSelectedFile, newSelectedRow % rowsInPage, true, true);
+
+    // Only the two rows are copied to the screen
+    ScreenPresent(_screenBuffer);
+}
+
+static void DumpStorageStatistics() {
+    SdDumpStatistics();
+    SdResetStatistics();
+
+    ReadAheadStatistics readAhead;
+    ReadAheadGetStatistics(&readAhead);
+    printf("Read-ahead: %" PRIu32 " hit, %" PRIu32 " miss, %" PRIu32 " prefetched, %" PRIu32 " discarded, %" PRIu32 " direct sectors, %" PRIu32 " ready prefetches\r\n",
+        readAhead.hitSectors, readAhead.missSectors, readAhead.prefetchedSectors, readAhead.discardedSectors,
+        readAhead.directSectors, readAhead.readyPrefetches);
+
+    SectorCacheStatistics cache;
+    SectorCacheGetStatistics(&cache);
+    printf("Sector cache: metadata %" PRIu32 "/%" PRIu32 ", data %" PRIu32 "/%" PRIu32 " (hits/misses)\r\n",
+        cache.metadataHits, cache.metadataMisses, cache.dataHits, cache.dataMisses);
 }
 
 static bool FilterValidFile(const FILINFO* pInfo) {
-    if ((_fileInfoHandle.fattrib & AM_DIR) || (_fileInfoHandle.fattrib & AM_SYS) || (_fileInfoHandle.fattrib & AM_HID)) {
+    if ((pInfo->fattrib & AM_DIR) || (pInfo->fattrib & AM_SYS) || (pInfo->fattrib & AM_HID)) {
         // Not for us
         return false;
     }
     // We want do display only .bmp and .raw files
     // let's ignore case sensitivity for the moment
-    return EndsWith(_fileInfoHandle.fname, ".bmp") || EndsWith(_fileInfoHandle.fname, ".raw");
+    return EndsWith(pInfo->fname, ".bmp") || EndsWith(pInfo->fname, ".raw");
 }
 
 /* Public section */
@@ -501,12 +651,15 @@ void ExplorerOpen(ScreenBuffer* screenBuffer) {
     // We reset our state
     _screenBuffer = screenBuffer;
     _displayingError = false;
+    _fileListVisible = false;
 
     // We display the SD message and we clear the selected FILINFO structure
     DisplayMessage(screenBuffer, "Mounting SD card ...", SCREEN_RGB(0x28, 0xB5, 0xF4));
     memset(&_fileListSelectedFile, 0, sizeof(FILINFO));
 
     // Eventually we mount the SD and we draw the list
+    // Sectors read into the volume window are FAT and directory sectors, that the cache keeps preferentially
+    SectorCacheSetMetadataWindow(_fsMountData.win);
     FRESULT mountResult = f_mount(&_fsMountData, FsRootDirectory, 1);
     if (mountResult != FR_OK) {
         DisplayFResultError(screenBuffer, mountResult, "Unable to mount SD CARD");
@@ -522,12 +675,10 @@ void ExplorerProcessInput(char command) {
         return;
 
     if (command == '+' && (_fileListSelectedRow + 1) < _fileListCountCache) {
-        ++_fileListSelectedRow;
-        DrawFileList();
+        MoveFileListSelection(_fileListSelectedRow + 1);
     }
     else if (command == '-' && _fileListSelectedRow > 0) {
-        _fileListSelectedRow = _fileListSelectedRow - 1;
-        DrawFileList();
+        MoveFileListSelection(_fileListSelectedRow - 1);
     }
     else if (command == 'e') {
         // We redraw the file list. this is necessary to avoid exiting and re-opening the applciation
@@ -538,6 +689,20 @@ void ExplorerProcessInput(char command) {
         _suspendOutput = !_suspendOutput;
         printf("Output suspend: %s\r\n", _suspendOutput ? "enabled" : "disabled");
     }
+    else if (command == 'm') {
+        // Cycles the resize algorithm used for the next images
+        _scaleMode = (BmpScaleMode)((_scaleMode + 1) % (sizeof(_scaleModeNames) / sizeof(_scaleModeNames[0])));
+        printf("Scale mode: %s\r\n", _scaleModeNames[_scaleMode]);
+    }
+    else if (command == 'd') {
+        // Cycles the dithering used for the next images
+        _dither = (ScreenDither)((_dither + 1) % (sizeof(_ditherNames) / sizeof(_ditherNames[0])));
+        printf("Dithering: %s\r\n", _ditherNames[_dither]);
+    }
+    else if (command == 's') {
+        // Prints the storage activity. SD counters restart at each request, so they can measure a single image load
+        DumpStorageStatistics();
+    }
     else if (command == '\r' || command == '\n' || command == ' ') {
         // Let's handle the Enter or Space key to draw a file
         if (_suspendOutput)
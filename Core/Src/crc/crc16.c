@@ -2,7 +2,12 @@
 #include <assertion.h>
 #include <binary.h>
 
-static uint16_t CRCTable[256];
+/// Number of bytes processed at a time by the bulk update (slice-by-4)
+#define CRC16_SLICES 4
+
+/// CRC tables. CRCTables[0] is the classic byte table, CRCTables[k][i] is the CRC of byte i followed by k zero bytes
+/// \remarks Tables are only read by the CPU so they stay in the core coupled memory
+static uint16_t CRCTables[CRC16_SLICES][256];
 
 #if _DEBUG
 /// Super simple debug initialization flag. If we forgot to call the Initialize function, the assertion in the Add method will fail
@@ -31,7 +36,15 @@ void Crc16Initialize() {
             }
         }
 
-        CRCTable[i] = crc;
+        CRCTables[0][i] = crc;
+    }
+
+    // Each slice table pushes the CRC of the previous one through an additional zero byte
+    for (int k = 1; k < CRC16_SLICES; ++k) {
+        for (int i = 0; i < 256; ++i) {
+            uint16_t previous = CRCTables[k - 1][i];
+            CRCTables[k][i] = (uint16_t)(MASKI2SHORT(previous << 8) ^ CRCTables[0][previous >> 8]);
+        }
     }
 
 #if _DEBUG
@@ -50,6 +63,42 @@ uint16_t Crc16Add(uint16_t crc, uint8_t data) {
     // This comes from the fact that the CRC calculation is done only on 1 byte at a time, so when two bytes are queued, only the LSB of the 
     // first byte CRC is XORer with the input dividend.
     // http://www.sunshine2k.de/articles/coding/crc/understanding_crc.html#ch5 explains the operation using the column division
-    return (uint16_t)((crc << 8) ^ ((uint16_t)CRCTable[pos]));
+    return (uint16_t)((crc << 8) ^ ((uint16_t)CRCTables[0][pos]));
+}
+
+uint16_t Crc16Update(uint16_t crc, const uint8_t* pData, size_t count) {
+#if _DEBUG
+    DebugAssert(_initialized != 0);
+#endif
+
+    // Until pointer is not aligned, we have to access byte per byte
+    while (count > 0 && (((uintptr_t)pData) & 0x3)) {
+        crc = (uint16_t)((crc << 8) ^ CRCTables[0][(uint8_t)((crc >> 8) ^ *pData)]);
+        ++pData;
+        --count;
+    }
+
+    // Slice-by-4: the CRC of a whole word is the XOR of the contribution of each byte. The first two bytes
+    // absorb the current CRC, the others only the data
+    while (count >= CRC16_SLICES) {
+        // NB: data are read in little endian order so the first byte of the stream is the word LSB
+        uint32_t data = *((const uint32_t*)pData);
+        crc = (uint16_t)(CRCTables[3][(uint8_t)(data ^ (crc >> 8))] ^
+            CRCTables[2][(uint8_t)((data >> 8) ^ crc)] ^
+            CRCTables[1][(uint8_t)(data >> 16)] ^
+            CRCTables[0][(uint8_t)(data >> 24)]);
+
+        pData += CRC16_SLICES;
+        count -= CRC16_SLICES;
+    }
+
+    // Let's also handle trailing bytes
+    while (count > 0) {
+        crc = (uint16_t)((crc << 8) ^ CRCTables[0][(uint8_t)((crc >> 8) ^ *pData)]);
+        ++pData;
+        --count;
+    }
+
+    return crc;
 }
 
@@ -53,10 +53,17 @@ uint8_t Crc7Calculate(const uint8_t* pData, size_t count) {
     if (count == 0 || pData == NULL)
         return CRC7_ZERO;
 
-    uint8_t crc = CRC7_ZERO;
+    return Crc7Update(CRC7_ZERO, pData, count);
+}
+
+uint8_t Crc7Update(uint8_t crc, const uint8_t* pData, size_t count) {
+#if _DEBUG
+    DebugAssert(_initialized != 0);
+#endif
+
     // Until pointer is not aligned, we have to access byte per byte
-    while ((((uintptr_t)pData) & 0x3)) {
-        crc = Crc7Add(crc, *pData);
+    while (count > 0 && (((uintptr_t)pData) & 0x3)) {
+        crc = CRCTable[(uint8_t)((crc << 1) ^ *pData)];
 
         // We update pointer and number of item to read
         ++pData;
@@ -69,10 +76,10 @@ uint8_t Crc7Calculate(const uint8_t* pData, size_t count) {
 
         // NB: data are read in little endian order in our U32 so
         // we must crc them in "reverse" order
-        crc = Crc7Add(crc, (uint8_t)MASKI2BYTE(data));
-        crc = Crc7Add(crc, (uint8_t)MASKI2BYTE(data >> 8));
-        crc = Crc7Add(crc, (uint8_t)MASKI2BYTE(data >> 16));
-        crc = Crc7Add(crc, (uint8_t)MASKI2BYTE(data >> 24));
+        crc = CRCTable[(uint8_t)((crc << 1) ^ MASKI2BYTE(data))];
+        crc = CRCTable[(uint8_t)((crc << 1) ^ MASKI2BYTE(data >> 8))];
+        crc = CRCTable[(uint8_t)((crc << 1) ^ MASKI2BYTE(data >> 16))];
+        crc = CRCTable[(uint8_t)((crc << 1) ^ MASKI2BYTE(data >> 24))];
 
         pData += 4;
         count -= 4;
@@ -80,7 +87,7 @@ uint8_t Crc7Calculate(const uint8_t* pData, size_t count) {
 
     // Let's also handle trailing bytes
     while (count > 0) {
-        crc = Crc7Add(crc, *pData);
+        crc = CRCTable[(uint8_t)((crc << 1) ^ *pData)];
 
         ++pData;
         --count;
@@ -0,0 +1,201 @@
+/*
+ * readahead.c
+ *
+ *  Created on: Oct 16, 2026
+ */
+
+#include <disk/readahead.h>
+#include <disk/storage.h>
+#include <cmsis_extensions.h>
+#include <assertion.h>
+#include <intmath.h>
+#include <ram.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern void Error_Handler();
+
+/// Number of sectors prefetched at a time
+#define READAHEAD_SECTORS 4
+/// Size of a sector
+#define READAHEAD_SECTOR_SIZE 512
+/// Number of consecutive reads that make a sequential stream
+#define READAHEAD_STREAM_READS 2
+
+/// Prefetched sectors
+typedef struct _ReadAheadWindow {
+    /// Sector buffers (READAHEAD_SECTORS)
+    BYTE* buffer;
+    /// First sector in the window
+    UInt32 start;
+    /// Number of valid sectors (zero if the window is empty)
+    UInt32 count;
+    /// Bitmask of the sectors that have been served at least once
+    UInt32 servedMask;
+    /// True while the prefetch request is running
+    BOOL pending;
+    /// Prefetch request
+    StorageRequest request;
+} ReadAheadWindow;
+
+// ##### Private forward declarations #####
+
+/// Waits for the completion of the running prefetch
+static void WaitPrefetch();
+/// Drops the window content, updating the counters
+static void DiscardWindow();
+/// Starts the prefetch of the sectors following the stream
+static void StartPrefetch(UInt32 sector);
+
+// ##### Private fields #####
+
+static ReadAheadWindow _window;
+static ReadAheadStatistics _statistics;
+/// Sector following the last read
+static UInt32 _nextSector;
+/// Number of consecutive reads of the current stream
+static UInt32 _streamReads;
+
+// ##### Private Function definitions #####
+
+void WaitPrefetch() {
+    if (!_window.pending) {
+        return;
+    }
+
+    // A prefetch that completed while the client was working is a full overlap with the SD transfer
+    if ((osThreadFlagsGet() & STORAGE_FLAG_REQUEST_COMPLETED) != 0) {
+        _statistics.readyPrefetches++;
+    }
+    UInt32 flags = osThreadFlagsWait(STORAGE_FLAG_REQUEST_COMPLETED, osFlagsWaitAny, osWaitForever);
+    if (osExResultIsFlagsErrorCode(flags)) {
+        Error_Handler();
+    }
+
+    _window.pending = false;
+    if (_window.request.status != SdStatusOk) {
+        // A failed prefetch (ex. past the end of the card) is not an error for the client
+        _window.count = 0;
+    }
+}
+
+void DiscardWindow() {
+    for (UInt32 i = 0; i < _window.count; i++) {
+        if ((_window.servedMask & (1U << i)) == 0) {
+            _statistics.discardedSectors++;
+        }
+    }
+    _window.count = 0;
+    _window.servedMask = 0;
+}
+
+void StartPrefetch(UInt32 sector) {
+    static_assert(READAHEAD_SECTORS < 32);
+    DebugAssert(!_window.pending);
+
+    DiscardWindow();
+
+    // Sectors past the end of the card would fail the whole request
+    UInt32 count = READAHEAD_SECTORS;
+    UInt32 cardSectors = SdGetCardDescription()->SectorCount;
+    if (cardSectors > 0) {
+        if (sector >= cardSectors) {
+            return;
+        }
+        count = MIN(count, cardSectors - sector);
+    }
+
+    StorageRequest* request = &_window.request;
+    request->sector = sector;
+    request->count = count;
+    request->buffer = _window.buffer;
+    request->notifyThread = osThreadGetId();
+    request->callback = NULL;
+    request->context = NULL;
+    request->status = SdStatusOk;
+
+    // The same thread flag is used by StorageRead: since we always wait for the prefetch before any other read,
+    // the two requests never overlap
+    osThreadFlagsClear(STORAGE_FLAG_REQUEST_COMPLETED);
+    if (!StorageReadAsync(request)) {
+        return;
+    }
+
+    _window.start = sector;
+    _window.count = count;
+    _window.pending = true;
+    _statistics.prefetchedSectors += count;
+
+    // The scheduler is cooperative and queuing a request does not yield, so without this the prefetch would only
+    // start when the client waits for it. The storage task starts the first block and blocks on its DMA: we get
+    // back the processor, and the DMA interrupts wake the task for the following blocks
+    osThreadYield();
+}
+
+// ##### Public Function definitions #####
+
+void ReadAheadInitialize() {
+    // The window stays in the core coupled memory: the SD driver receives its blocks through the DMA bounce buffers,
+    // so the window does not take DMA-reachable RAM from the frame buffer and the image rows
+    _window.buffer = (BYTE*)malloc(READAHEAD_SECTORS * READAHEAD_SECTOR_SIZE);
+    if (_window.buffer == NULL) {
+        printf("Cannot allocate the read-ahead window. Prefetch disabled\r\n");
+    }
+}
+
+SdStatus ReadAheadRead(BYTE* buffer, UInt32 sector, UInt32 count) {
+    if (_window.buffer == NULL) {
+        return StorageRead(buffer, sector, count);
+    }
+
+    WaitPrefetch();
+
+    if (count > 1 && rcontains(buffer)) {
+        // Multiple sector reads into a DMA-reachable buffer (the image rows) are read straight from the card:
+        // serving them from the window would copy every byte again. They never start a prefetch, since their
+        // following sectors would be requested in the same way
+        _streamReads = 0;
+        _nextSector = sector + count;
+        _statistics.directSectors += count;
+        return StorageRead(buffer, sector, count);
+    }
+
+    _streamReads = (sector == _nextSector) ? _streamReads + 1 : 1;
+    _nextSector = sector + count;
+
+    // The first part of the request can be in the window
+    UInt32 served = 0;
+    if (_window.count > 0 && sector >= _window.start && sector < _window.start + _window.count) {
+        UInt32 offset = sector - _window.start;
+        served = MIN(count, _window.count - offset);
+        memcpy(buffer, &_window.buffer[offset * READAHEAD_SECTOR_SIZE], served * READAHEAD_SECTOR_SIZE);
+
+        _window.servedMask |= ((1U << served) - 1) << offset;
+        _statistics.hitSectors += served;
+    }
+
+    SdStatus status = SdStatusOk;
+    if (served < count) {
+        status = StorageRead(&buffer[served * READAHEAD_SECTOR_SIZE], sector + served, count - served);
+        _statistics.missSectors += count - served;
+    }
+
+    // The prefetch needs the storage task, and it is useless if the window still contains the next sectors
+    BOOL nextInWindow = _window.count > 0 && _nextSector >= _window.start && _nextSector < _window.start + _window.count;
+    if (status == SdStatusOk && _streamReads >= READAHEAD_STREAM_READS && !nextInWindow &&
+        osKernelGetState() == osKernelRunning) {
+        StartPrefetch(_nextSector);
+    }
+    return status;
+}
+
+void ReadAheadInvalidate() {
+    WaitPrefetch();
+    DiscardWindow();
+    _streamReads = 0;
+}
+
+void ReadAheadGetStatistics(ReadAheadStatistics* statistics) {
+    *statistics = _statistics;
+}
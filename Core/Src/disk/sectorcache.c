@@ -0,0 +1,156 @@
+/*
+ * sectorcache.c
+ *
+ *  Created on: Oct 16, 2026
+ */
+
+#include <disk/sectorcache.h>
+#include <disk/readahead.h>
+#include <assertion.h>
+#include <string.h>
+
+/// Size of a cached sector
+#define SECTOR_CACHE_SECTOR_SIZE 512
+/// Slot index returned when no slot is found
+#define SECTOR_CACHE_NO_SLOT -1
+
+/// Cache slot descriptor
+typedef struct _SectorCacheSlot {
+    /// Cached sector
+    UInt32 sector;
+    /// Value of the use counter when the slot was last accessed
+    UInt32 lastUse;
+    /// True if the slot contains a sector
+    BOOL valid;
+    /// True if the sector contains file system metadata
+    BOOL metadata;
+} SectorCacheSlot;
+
+// ##### Private forward declarations #####
+
+/// Returns the slot containing the sector or SECTOR_CACHE_NO_SLOT
+static int FindSlot(UInt32 sector);
+/// Returns the slot where a new sector can be stored or SECTOR_CACHE_NO_SLOT if the sector must not be cached
+/// @param metadata True if the new sector contains metadata
+static int FindVictimSlot(BOOL metadata);
+
+// ##### Private fields #####
+
+static SectorCacheSlot _slots[SECTOR_CACHE_SLOTS];
+/// Dedicated pool for the cached sectors. Sectors are only copied by the CPU so the pool can stay in the core coupled memory
+static BYTE _slotData[SECTOR_CACHE_SLOTS][SECTOR_CACHE_SECTOR_SIZE] __attribute__((aligned(4)));
+/// Counter incremented at each access, used to find the least recently used slot
+static UInt32 _useCounter;
+static const BYTE* _metadataWindow = NULL;
+static SectorCacheStatistics _statistics;
+
+// ##### Private Function definitions #####
+
+int FindSlot(UInt32 sector) {
+    for (int i = 0; i < SECTOR_CACHE_SLOTS; i++) {
+        if (_slots[i].valid && _slots[i].sector == sector) {
+            return i;
+        }
+    }
+    return SECTOR_CACHE_NO_SLOT;
+}
+
+int FindVictimSlot(BOOL metadata) {
+    int dataSlot = SECTOR_CACHE_NO_SLOT;
+    int metadataSlot = SECTOR_CACHE_NO_SLOT;
+
+    for (int i = 0; i < SECTOR_CACHE_SLOTS; i++) {
+        const SectorCacheSlot* slot = &_slots[i];
+        if (!slot->valid) {
+            return i;
+        }
+
+        if (slot->metadata) {
+            if (metadataSlot == SECTOR_CACHE_NO_SLOT || slot->lastUse < _slots[metadataSlot].lastUse) {
+                metadataSlot = i;
+            }
+        }
+        else if (dataSlot == SECTOR_CACHE_NO_SLOT || slot->lastUse < _slots[dataSlot].lastUse) {
+            dataSlot = i;
+        }
+    }
+
+    // Data sectors are always evicted first, and they can never evict a metadata sector
+    if (dataSlot != SECTOR_CACHE_NO_SLOT) {
+        return dataSlot;
+    }
+    return metadata ? metadataSlot : SECTOR_CACHE_NO_SLOT;
+}
+
+// ##### Public Function definitions #####
+
+void SectorCacheSetMetadataWindow(const BYTE* window) {
+    _metadataWindow = window;
+}
+
+SdStatus SectorCacheRead(BYTE* buffer, UInt32 sector, UInt32 count) {
+    if (count != 1) {
+        return ReadAheadRead(buffer, sector, count);
+    }
+
+    BOOL metadata = buffer == _metadataWindow;
+    int slotIndex = FindSlot(sector);
+    if (slotIndex != SECTOR_CACHE_NO_SLOT) {
+        SectorCacheSlot* slot = &_slots[slotIndex];
+        memcpy(buffer, _slotData[slotIndex], SECTOR_CACHE_SECTOR_SIZE);
+        slot->lastUse = ++_useCounter;
+        // A data sector read again through the window is promoted
+        slot->metadata |= metadata;
+
+        if (metadata) {
+            _statistics.metadataHits++;
+        }
+        else {
+            _statistics.dataHits++;
+        }
+        return SdStatusOk;
+    }
+
+    if (metadata) {
+        _statistics.metadataMisses++;
+    }
+    else {
+        _statistics.dataMisses++;
+    }
+
+    SdStatus status = ReadAheadRead(buffer, sector, 1);
+    if (status != SdStatusOk) {
+        return status;
+    }
+
+    slotIndex = FindVictimSlot(metadata);
+    if (slotIndex != SECTOR_CACHE_NO_SLOT) {
+        SectorCacheSlot* slot = &_slots[slotIndex];
+        memcpy(_slotData[slotIndex], buffer, SECTOR_CACHE_SECTOR_SIZE);
+        slot->sector = sector;
+        slot->lastUse = ++_useCounter;
+        slot->valid = true;
+        slot->metadata = metadata;
+    }
+    return SdStatusOk;
+}
+
+void SectorCacheWrite(const BYTE* buffer, UInt32 sector, UInt32 count) {
+    for (UInt32 i = 0; i < count; i++) {
+        int slotIndex = FindSlot(sector + i);
+        if (slotIndex != SECTOR_CACHE_NO_SLOT) {
+            memcpy(_slotData[slotIndex], &buffer[i * SECTOR_CACHE_SECTOR_SIZE], SECTOR_CACHE_SECTOR_SIZE);
+            _slots[slotIndex].lastUse = ++_useCounter;
+        }
+    }
+}
+
+void SectorCacheInvalidate() {
+    for (int i = 0; i < SECTOR_CACHE_SLOTS; i++) {
+        _slots[i].valid = false;
+    }
+}
+
+void SectorCacheGetStatistics(SectorCacheStatistics* statistics) {
+    *statistics = _statistics;
+}
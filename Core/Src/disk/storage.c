@@ -0,0 +1,157 @@
+/*
+ * storage.c
+ *
+ *  Created on: Oct 16, 2026
+ */
+
+#include <disk/storage.h>
+#include <cmsis_extensions.h>
+#include <assertion.h>
+
+extern void Error_Handler();
+
+/// Max number of requests waiting in the queue
+#define STORAGE_QUEUE_LENGTH 8
+/// Max number of requests merged in a single multiple block read
+#define STORAGE_MAX_BATCH STORAGE_QUEUE_LENGTH
+
+// ##### Private forward declarations #####
+
+/// Main loop of the storage task: requests are dequeued, merged and executed
+static void StorageTask(void* argument);
+/// Reads the sectors of a batch of adjacent requests
+static void ExecuteBatch(StorageRequest** batch, BYTE batchSize);
+/// Notifies the client that the request has been completed
+static void CompleteRequest(StorageRequest* request);
+
+// ##### Private fields #####
+
+static osThreadId_t _storageTaskHandle = NULL;
+static const osThreadAttr_t _storageTaskAttributes = {
+    .name = "_storageTask",
+    // The whole read path (SD driver, CRC verification and clock governor) runs on this stack. It must not be
+    // smaller than the one of the main task, that used to run it
+    .stack_size = 384 * 4,
+    .priority = (osPriority_t)osPriorityAboveNormal,
+};
+
+/// Queue of pointers to the submitted requests
+static osMessageQueueId_t _requestQueue = NULL;
+static const osMessageQueueAttr_t _requestQueueAttributes = {
+    .name = "_storageQueue"
+};
+
+// ##### Private Function definitions #####
+
+void StorageTask(void* argument) {
+    StorageRequest* batch[STORAGE_MAX_BATCH];
+    // Request dequeued while building the previous batch but not adjacent to it
+    StorageRequest* deferred = NULL;
+
+    for (;;) {
+        BYTE batchSize = 0;
+        if (deferred != NULL) {
+            batch[batchSize++] = deferred;
+            deferred = NULL;
+        }
+        else {
+            CHECK_OS_STATUS(osMessageQueueGet(_requestQueue, &batch[batchSize++], NULL, osWaitForever));
+        }
+
+        // Requests already waiting in the queue are merged while they continue the batch (FIFO order is preserved)
+        // The scheduler is cooperative, so the queue holds more than one request only if a client submits several
+        // asynchronous requests before yielding
+        StorageRequest* next;
+        while (batchSize < STORAGE_MAX_BATCH && osMessageQueueGet(_requestQueue, &next, NULL, 0) == osOK) {
+            const StorageRequest* last = batch[batchSize - 1];
+            if (next->sector != last->sector + last->count) {
+                deferred = next;
+                break;
+            }
+            batch[batchSize++] = next;
+        }
+
+        ExecuteBatch(batch, batchSize);
+    }
+}
+
+void ExecuteBatch(StorageRequest** batch, BYTE batchSize) {
+    DebugAssert(batchSize > 0);
+
+    if (batchSize == 1 && batch[0]->count == 1) {
+        // Single block read has a lower command overhead
+        batch[0]->status = SdReadSector(batch[0]->buffer, batch[0]->sector);
+    }
+    else {
+        // A single multiple block read covers the whole batch, each request receives its blocks in its own buffer
+        SdReadSectorsBegin(batch[0]->sector);
+        for (BYTE i = 0; i < batchSize; i++) {
+            batch[i]->status = SdReadSectorsNext(batch[i]->buffer, batch[i]->count);
+        }
+        SdReadSectorsEnd();
+    }
+
+    for (BYTE i = 0; i < batchSize; i++) {
+        CompleteRequest(batch[i]);
+    }
+}
+
+void CompleteRequest(StorageRequest* request) {
+    // The client may reuse the request as soon as it is notified, so we read everything before
+    osThreadId_t notifyThread = request->notifyThread;
+
+    if (request->callback != NULL) {
+        request->callback(request);
+    }
+
+    if (notifyThread != NULL) {
+        UInt32 result = osThreadFlagsSet(notifyThread, STORAGE_FLAG_REQUEST_COMPLETED);
+        if (osExResultIsFlagsErrorCode(result)) {
+            // Something wrong happened, better stop everything
+            Error_Handler();
+        }
+    }
+}
+
+// ##### Public Function definitions #####
+
+void StorageInitialize() {
+    _requestQueue = osMessageQueueNew(STORAGE_QUEUE_LENGTH, sizeof(StorageRequest*), &_requestQueueAttributes);
+    _storageTaskHandle = osThreadNew(StorageTask, NULL, &_storageTaskAttributes);
+    if (_requestQueue == NULL || _storageTaskHandle == NULL) {
+        Error_Handler();
+    }
+}
+
+BOOL StorageReadAsync(StorageRequest* request) {
+    DebugAssert(request != NULL && request->buffer != NULL);
+    return osMessageQueuePut(_requestQueue, &request, 0, 0) == osOK;
+}
+
+SdStatus StorageRead(BYTE* buffer, UInt32 sector, UInt32 count) {
+    // Without the scheduler (or from the storage task itself) nobody would serve the request
+    if (osKernelGetState() != osKernelRunning || _storageTaskHandle == NULL || osThreadGetId() == _storageTaskHandle) {
+        return count == 1 ? SdReadSector(buffer, sector) : SdReadSectors(buffer, sector, count);
+    }
+
+    StorageRequest request;
+    request.sector = sector;
+    request.count = count;
+    request.buffer = buffer;
+    request.notifyThread = osThreadGetId();
+    request.callback = NULL;
+    request.context = NULL;
+    request.status = SdStatusOk;
+
+    // A stale flag must not complete the request before it is served
+    osThreadFlagsClear(STORAGE_FLAG_REQUEST_COMPLETED);
+
+    StorageRequest* requestPtr = &request;
+    CHECK_OS_STATUS(osMessageQueuePut(_requestQueue, &requestPtr, 0, osWaitForever));
+
+    UInt32 flags = osThreadFlagsWait(STORAGE_FLAG_REQUEST_COMPLETED, osFlagsWaitAny, osWaitForever);
+    if (osExResultIsFlagsErrorCode(flags)) {
+        Error_Handler();
+    }
+    return request.status;
+}
@@ -0,0 +1,157 @@
+/*
+ * glyphcache.c
+ *
+ *  Created on: Oct 16, 2026
+ */
+
+#include <fonts/glyphcache.h>
+#include <assertion.h>
+#include <intmath.h>
+
+/// Number of glyphs that can be cached at the same time
+#define GLYPH_CACHE_SLOTS 48
+/// Max size of an encoded glyph. Most of the font glyphs take less than 100 bytes, the largest ones are not cached
+#define GLYPH_CACHE_SLOT_SIZE 128
+/// Number of characters supported by the font
+#define GLYPH_CACHE_CHARACTERS 128
+/// Slot index of a character that is not cached
+#define GLYPH_SLOT_NONE 0xFF
+/// Slot index of a character that cannot be cached
+#define GLYPH_SLOT_TOO_LARGE 0xFE
+
+/// Cached glyph
+typedef struct _GlyphCacheSlot {
+    /// Character stored in the slot (-1 if empty)
+    SBYTE character;
+    /// Value of the use counter when the slot was last accessed
+    UInt32 lastUse;
+    /// Encoded glyph rows
+    BYTE runs[GLYPH_CACHE_SLOT_SIZE];
+} GlyphCacheSlot;
+
+// ##### Private forward declarations #####
+
+/// Encodes the glyph bitmap into the destination buffer
+/// @return False if the encoded glyph does not fit in the buffer
+static BOOL EncodeGlyph(const GlyphMetrics* metrics, PCBYTE data, BYTE* runs, size_t runsSize);
+/// Returns the run type of a coverage level
+static BYTE GetRunType(BYTE coverage);
+
+// ##### Private fields #####
+
+/// Cache slots. Glyphs are only read by the CPU, so the cache can stay in the core coupled memory
+static GlyphCacheSlot _slots[GLYPH_CACHE_SLOTS];
+/// Slot of each character (or GLYPH_SLOT_NONE/GLYPH_SLOT_TOO_LARGE)
+static BYTE _characterSlots[GLYPH_CACHE_CHARACTERS];
+/// Counter incremented at each access, used to find the least recently used slot
+static UInt32 _useCounter;
+/// Flag that indicates that the cache structures have been initialized
+static BOOL _initialized;
+
+// ##### Private Function definitions #####
+
+BYTE GetRunType(BYTE coverage) {
+    if (coverage == 0) {
+        return GLYPH_RUN_SKIP;
+    }
+    return coverage >= SCREEN_COVERAGE_MAX ? GLYPH_RUN_SOLID : GLYPH_RUN_BLEND;
+}
+
+BOOL EncodeGlyph(const GlyphMetrics* metrics, PCBYTE data, BYTE* runs, size_t runsSize) {
+    // Glyph rows are word-aligned in the font buffer
+    int rowWidth = (metrics->blackBoxX + 3) & (~0x3);
+    BYTE* runsEnd = runs + runsSize;
+
+    for (int row = 0; row < metrics->blackBoxY; row++) {
+        PCBYTE levels = &data[row * rowWidth];
+
+        // Trailing transparent pixels are not encoded
+        int rowEnd = metrics->blackBoxX;
+        while (rowEnd > 0 && levels[rowEnd - 1] == 0) {
+            rowEnd--;
+        }
+
+        int x = 0;
+        while (x < rowEnd) {
+            // We extend the run while the pixels have the same type
+            BYTE runType = GetRunType(levels[x]);
+            int runLength = 1;
+            while (x + runLength < rowEnd && runLength < GLYPH_RUN_LENGTH_MASK &&
+                GetRunType(levels[x + runLength]) == runType) {
+                runLength++;
+            }
+
+            size_t encodedSize = 1 + (runType == GLYPH_RUN_BLEND ? (size_t)runLength : 0);
+            if ((size_t)(runsEnd - runs) < encodedSize) {
+                return false;
+            }
+            *runs++ = (BYTE)(runType | runLength);
+            if (runType == GLYPH_RUN_BLEND) {
+                for (int i = 0; i < runLength; i++) {
+                    *runs++ = levels[x + i];
+                }
+            }
+            x += runLength;
+        }
+
+        if (runs >= runsEnd) {
+            return false;
+        }
+        *runs++ = GLYPH_RUN_END_OF_ROW;
+    }
+    return true;
+}
+
+// ##### Public Function definitions #####
+
+PCBYTE GlyphCacheGetRuns(char character, const GlyphMetrics* metrics, PCBYTE data) {
+    if (character < 0 || character >= GLYPH_CACHE_CHARACTERS) {
+        return NULL;
+    }
+
+    if (!_initialized) {
+        for (int i = 0; i < GLYPH_CACHE_CHARACTERS; i++) {
+            _characterSlots[i] = GLYPH_SLOT_NONE;
+        }
+        for (int i = 0; i < GLYPH_CACHE_SLOTS; i++) {
+            _slots[i].character = -1;
+        }
+        _initialized = true;
+    }
+
+    BYTE slotIndex = _characterSlots[(int)character];
+    if (slotIndex == GLYPH_SLOT_TOO_LARGE) {
+        return NULL;
+    }
+    if (slotIndex != GLYPH_SLOT_NONE) {
+        // Cache hit
+        _slots[slotIndex].lastUse = ++_useCounter;
+        return _slots[slotIndex].runs;
+    }
+
+    // Cache miss: we replace the least recently used slot (empty slots are never used so they come first)
+    slotIndex = 0;
+    for (BYTE i = 1; i < GLYPH_CACHE_SLOTS; i++) {
+        if (_slots[i].lastUse < _slots[slotIndex].lastUse) {
+            slotIndex = i;
+        }
+    }
+
+    GlyphCacheSlot* slot = &_slots[slotIndex];
+    if (slot->character >= 0) {
+        _characterSlots[(int)slot->character] = GLYPH_SLOT_NONE;
+    }
+    slot->character = -1;
+    slot->lastUse = 0;
+
+    if (!EncodeGlyph(metrics, data, slot->runs, sizeof(slot->runs))) {
+        // We remember the failure to not encode the glyph again. The slot remains free
+        _characterSlots[(int)character] = GLYPH_SLOT_TOO_LARGE;
+        return NULL;
+    }
+
+    slot->character = (SBYTE)character;
+    slot->lastUse = ++_useCounter;
+    _characterSlots[(int)character] = slotIndex;
+    return slot->runs;
+}
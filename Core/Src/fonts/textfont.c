@@ -0,0 +1,82 @@
+/*
+ * textfont.c
+ *
+ *  Created on: Oct 16, 2026
+ */
+
+#include <fonts/textfont.h>
+#include <fonts/glyph.h>
+#include <intmath.h>
+#include <string.h>
+
+/// Cell row of the glyph origin. The font ascenders start slightly above the pen position
+#define TEXT_FONT_TOP_OFFSET 2
+/// Horizontal resolution of the box filter, in fractions of pixel
+#define TEXT_FONT_SUBPIXELS 8
+
+// ##### Private forward declarations #####
+
+/// Converts a single glyph into its character cell
+static void BuildCell(char character, BYTE* cell);
+
+// ##### Private Function definitions #####
+
+void BuildCell(char character, BYTE* cell) {
+    GlyphMetrics metrics;
+    PCBYTE data;
+    GetGlyphOutline(character, &metrics, &data);
+
+    memset(cell, 0, TEXT_FONT_CELL_HEIGHT);
+    if (metrics.bufferSize == 0) {
+        // Blank character
+        return;
+    }
+
+    // The advance is squeezed into the cell width, narrower glyphs are centered instead of being stretched
+    int advance = MAX(metrics.cellIncX, TEXT_FONT_CELL_WIDTH);
+    int offsetX = (advance - metrics.cellIncX) / 2 + metrics.glyphOrigin.x;
+    // Glyph rows are word-aligned in the font buffer
+    int rowWidth = (metrics.blackBoxX + 3) & (~0x3);
+
+    for (int y = 0; y < metrics.blackBoxY; y++) {
+        int cellRow = metrics.glyphOrigin.y + y + TEXT_FONT_TOP_OFFSET;
+        if (cellRow < 0 || cellRow >= TEXT_FONT_CELL_HEIGHT) {
+            continue;
+        }
+
+        // Both glyph pixels and cell columns are measured in subpixels: a glyph pixel spans TEXT_FONT_SUBPIXELS
+        // units, a cell column spans advance units (the whole advance is TEXT_FONT_CELL_WIDTH columns wide)
+        UInt32 coverage[TEXT_FONT_CELL_WIDTH] = { 0 };
+        PCBYTE levels = &data[y * rowWidth];
+        for (int x = 0; x < metrics.blackBoxX; x++) {
+            if (levels[x] == 0) {
+                continue;
+            }
+            int pixelStart = (offsetX + x) * TEXT_FONT_SUBPIXELS;
+            int pixelEnd = pixelStart + TEXT_FONT_SUBPIXELS;
+            for (int column = 0; column < TEXT_FONT_CELL_WIDTH; column++) {
+                int overlap = MIN(pixelEnd, (column + 1) * advance) - MAX(pixelStart, column * advance);
+                if (overlap > 0) {
+                    coverage[column] += (UInt32)(levels[x] * overlap);
+                }
+            }
+        }
+
+        BYTE bits = 0;
+        for (int column = 0; column < TEXT_FONT_CELL_WIDTH; column++) {
+            // A column is lit when at least half of it is covered
+            if (coverage[column] * 2 >= (UInt32)(SCREEN_COVERAGE_MAX * advance)) {
+                bits |= (BYTE)(1 << column);
+            }
+        }
+        cell[cellRow] = bits;
+    }
+}
+
+// ##### Public Function definitions #####
+
+void TextFontBuildCells(BYTE* cells) {
+    for (int i = 0; i < TEXT_FONT_CHARACTERS; i++) {
+        BuildCell((char)i, &cells[i * TEXT_FONT_CELL_HEIGHT]);
+    }
+}
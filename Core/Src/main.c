@@ -38,6 +38,8 @@
 #include <vga/vgascreenbuffer.h>
 #include <screen/screen.h>
 #include <sd/sd.h>
+#include <disk/storage.h>
+#include <disk/readahead.h>
 #include <ram.h>
 
 #include <app/ascii_table.h>
@@ -116,6 +118,8 @@ const osEventFlagsAttr_t _vgaEDIDRcvEvnt_attributes = {
 static Edid _vgaEDID = { 0 };
 /// Current active FrameBuffer
 static ScreenBuffer* _screenBuffer = NULL;
+/// Character grid displayed instead of the frame buffer by the text applications. NULL in the bitmap modes
+static VgaTextBuffer* _textBuffer = NULL;
 /// VGA informations that will be used to create the framebuffer
 static VgaVisualizationInfo _visualizationInfos = { 0 };
 /// Command byte received via UART interrupt
@@ -162,6 +166,16 @@ static bool IsVGAStillConnected();
 static void DrawMainScreen();
 static void DrawMainScreenBorder();
 static void DrawMainScreenTitle();
+/// Selects the largest mode of the connected monitor for the format and creates the screen buffer
+static void CreateScreenBuffer(Bpp bitsPerPixel, BOOL doubleBuffered);
+/// Replaces the displayed screen buffer (or character grid) with one in a different format
+static void SwitchScreenBuffer(Bpp bitsPerPixel, BOOL doubleBuffered);
+/// Replaces the displayed screen buffer with a character grid in the same video mode
+static void SwitchTextBuffer();
+/// Stops the output and releases the displayed screen buffer or character grid
+static void ReleaseDisplayedBuffer();
+/// Closes the running application, if any
+static void CloseRunningApp();
 /* USER CODE END PFP */
 
 /* Private user code ---------------------------------------------------------*/
@@ -295,9 +309,25 @@ void HAL_UART_RxCpltCallback(UART_HandleTypeDef* huart) {
     }
 }
 
+void VgaClockTreeChangedCallback() {
+    // The kernel programmed the SysTick reload from the core clock when it started
+    SysTick->LOAD = (SystemCoreClock / configTICK_RATE_HZ) - 1UL;
+    SysTick->VAL = 0;
+
+    // UART4 and I2C2 are on APB1. The baud rate is rewritten without a new HAL_UART_Init, which would
+    // drop the pending command read. The EDID transfer is over, so the I2C can be initialized again
+    huart4.Instance->BRR = UART_BRR_SAMPLING16(HAL_RCC_GetPCLK1Freq(), huart4.Init.BaudRate);
+    if (HAL_I2C_Init(&hi2c2) != HAL_OK) {
+        Error_Handler();
+    }
+    // The SD card SPI clock is chosen from PCLK1 when the card connects, and the planned APB1 clock is never faster
+    // than the default one
+}
+
 void DrawMainScreen() {
     DrawMainScreenBorder();
     DrawMainScreenTitle();
+    ScreenPresent(_screenBuffer);
 }
 
 void DrawMainScreenBorder() {
@@ -343,12 +373,13 @@ void DrawMainScreenTitle() {
     const int messages = 4;
 
     // Let's measure the enclosing rectangle for all the lines
+    // The sizes are kept to center the lines without measuring them again
+    SizeS strSizes[4] = { 0 };
     for (int i = 0; i < messages; i++)
     {
-        SizeS strSize = { 0 };
-        ScreenMeasureString(_homeMessages[i], &strSize);
+        ScreenMeasureString(_homeMessages[i], &strSizes[i]);
 
-        titleHeight += strSize.height + padding;
+        titleHeight += strSizes[i].height + padding;
     }
     titleHeight -= padding;
 
@@ -363,15 +394,12 @@ void DrawMainScreenTitle() {
     drawingPoint.y = (Int16)startingY;
     for (int i = 0; i < messages; i++)
     {
-        SizeS strSize = { 0 };
-
-        // We measure the string to horizontally center it
-        ScreenMeasureString(_homeMessages[i], &strSize);
-        int startingX = (_screenBuffer->screenSize.width / 2) - (strSize.width / 2);
+        // We use the string size to horizontally center it
+        int startingX = (_screenBuffer->screenSize.width / 2) - (strSizes[i].width / 2);
         drawingPoint.x = (Int16)startingX;
 
         ScreenDrawString(_screenBuffer, _homeMessages[i], drawingPoint, &pen);
-        drawingPoint.y = (Int16)(drawingPoint.y + padding + strSize.height);
+        drawingPoint.y = (Int16)(drawingPoint.y + padding + strSizes[i].height);
     }
 }
 
@@ -389,6 +417,7 @@ int main(void)
     setvbuf(stdout, NULL, _IONBF, 0);
     Crc7Initialize();
     Crc16Initialize();
+    ScreenInitializeFont();
 
     // We set to stop our main screen timer during debug
     // In this way we avoid strange conditions and we can correclty debug DMA e timer counters
@@ -473,6 +502,10 @@ int main(void)
 
     /* USER CODE BEGIN RTOS_THREADS */
     CHECK_OS_STATUS(osThreadSuspend(_mainTaskHandle));
+    // The storage task serves all the SD card reads
+    StorageInitialize();
+    // Read-ahead window is allocated once, at startup
+    ReadAheadInitialize();
     /* add threads, ... */
   /* USER CODE END RTOS_THREADS */
 
@@ -998,16 +1031,11 @@ void HandleUserInput() {
     IssueUserInputReadWithIT();
     if (receivedCommand == '\033') {
         // Escape command, we close the application
-        if (_currentRunningApp == AppAsciiTable) {
-            AsciiTableClose();
+        BOOL mainScreenBuffer = _textBuffer == NULL && _screenBuffer->bitsPerPixel == Bpp8;
+        CloseRunningApp();
+        if (!mainScreenBuffer) {
+            SwitchScreenBuffer(Bpp8, false);
         }
-        else if (_currentRunningApp == AppPalette) {
-            AppPaletteClose();
-        }
-        else if (_currentRunningApp == AppExplorer) {
-            ExplorerClose();
-        }
-        _currentRunningApp = AppIdle;
         DrawMainScreen();
     }
     else if (_currentRunningApp != AppIdle) {
@@ -1030,12 +1058,16 @@ void HandleUserInput() {
         // We open the specific application
         switch (receivedCommand) {
         case 'a':
+            // The table is only text: the character grid needs no frame buffer
             _currentRunningApp = AppAsciiTable;
-            AsciiTableInitialize(_screenBuffer);
+            SwitchTextBuffer();
+            AsciiTableInitialize(_textBuffer);
             break;
             break;
         case 'p':
+            // Two 4bpp buffers fit at 400x300, and the palette changes the red level without redrawing
             _currentRunningApp = AppPalette;
+            SwitchScreenBuffer(Bpp4, true);
             AppPaletteInitialize(_screenBuffer);
             break;
         case 'e':
@@ -1047,6 +1079,76 @@ void HandleUserInput() {
 
 }
 
+void CloseRunningApp() {
+    if (_currentRunningApp == AppAsciiTable) {
+        AsciiTableClose();
+    }
+    else if (_currentRunningApp == AppPalette) {
+        AppPaletteClose();
+    }
+    else if (_currentRunningApp == AppExplorer) {
+        ExplorerClose();
+    }
+    _currentRunningApp = AppIdle;
+}
+
+void CreateScreenBuffer(Bpp bitsPerPixel, BOOL doubleBuffered) {
+    _visualizationInfos.BitsPerPixel = bitsPerPixel;
+    _visualizationInfos.DoubleBuffered = doubleBuffered;
+    if (VgaSelectMode(&_vgaEDID, &_visualizationInfos) != VgaErrorNone) {
+        // The monitor does not report any mode we can generate. The 800x600 frame has always worked
+        // with our monitors, so we try it anyway
+        printf("\033[1;33mNo supported VGA mode reported by the monitor. Using 800x600 @ 60Hz\033[0m\r\n");
+        _visualizationInfos.FrameSignals = VideoFrame800x600at60Hz;
+        _visualizationInfos.Scaling = 2;
+        _visualizationInfos.Height = 0;
+        _visualizationInfos.DoubleBuffered = false;
+    }
+
+    _visualizationInfos.mainTimer = &htim4;
+    _visualizationInfos.hSyncTimer = &htim1;
+    _visualizationInfos.vSyncTimer = &htim3;
+    _visualizationInfos.lineDMA = &hdma_tim1_trig;
+
+    // We create the screen buffer
+    VgaError vgaResult = VgaCreateScreenBuffer(&_visualizationInfos, &_screenBuffer);
+    if (vgaResult != VgaErrorNone) {
+        Error_Handler();
+    }
+}
+
+void SwitchScreenBuffer(Bpp bitsPerPixel, BOOL doubleBuffered) {
+    // The monitor loses the sync signals only for the time of the switch: the frames are released and created
+    // again in the DMA-reachable RAM
+    ReleaseDisplayedBuffer();
+    CreateScreenBuffer(bitsPerPixel, doubleBuffered);
+    if (VgaStartOutput() != VgaErrorNone) {
+        Error_Handler();
+    }
+}
+
+void SwitchTextBuffer() {
+    // The grid keeps the mode selected for the main screen: the line width is already limited by the line DMA,
+    // and the cells take only a few KB of RAM
+    ReleaseDisplayedBuffer();
+    if (VgaCreateTextBuffer(&_visualizationInfos, &_textBuffer) != VgaErrorNone
+        || VgaStartOutput() != VgaErrorNone) {
+        Error_Handler();
+    }
+}
+
+void ReleaseDisplayedBuffer() {
+    VgaError result = VgaStopOutput();
+    if (result == VgaErrorNone) {
+        result = _textBuffer != NULL ? VgaReleaseTextBuffer(_textBuffer) : VgaReleaseScreenBuffer(_screenBuffer);
+    }
+    if (result != VgaErrorNone) {
+        Error_Handler();
+    }
+    _screenBuffer = NULL;
+    _textBuffer = NULL;
+}
+
 void IssueUserInputReadWithIT() {
     HAL_StatusTypeDef status = HAL_UART_Receive_IT(&huart4, &_userCommand, UART_USERCOMMAND_LENGTH);
     if (status != HAL_OK) {
@@ -1153,28 +1255,16 @@ void ConnecToVGATask(void* argument)
         printf("\033[1;92mVGA connected\033[0m\r\n");
         EdidDumpStructure(&_vgaEDID);
 
-        _visualizationInfos.FrameSignals = VideoFrame800x600at60Hz;
-        _visualizationInfos.BitsPerPixel = Bpp8;
-        _visualizationInfos.Scaling = 2;
-
-        _visualizationInfos.mainTimer = &htim4;
-        _visualizationInfos.hSyncTimer = &htim1;
-        _visualizationInfos.vSyncTimer = &htim3;
-        _visualizationInfos.lineDMA = &hdma_tim1_trig;
-
-        // We create the screen buffer
-        VgaError vgaResult = VgaCreateScreenBuffer(&_visualizationInfos, &_screenBuffer);
-        if (vgaResult != VgaErrorNone) {
-            Error_Handler();
-        }
-
+        // The main screen is drawn incrementally and never swapped, and two 8bpp buffers would lower the
+        // 400x300 mode to 266x200
+        CreateScreenBuffer(Bpp8, false);
         VgaDumpTimersFrequencies();
         // We are connected. We resume the low priority check connection task and we suspend ourself
         CHECK_OS_STATUS(osThreadResume(_mainTaskHandle));
 
         // Before suspending, we start the drawing and we start reading user commands
         DrawMainScreen();
-        vgaResult = VgaStartOutput();
+        VgaError vgaResult = VgaStartOutput();
         if (vgaResult != VgaErrorNone) {
             Error_Handler();
         }
@@ -1215,9 +1305,10 @@ void MainTask(void* argument)
             // We start the disconnection procedure
             // We abort the uart command reception (we are not interested in the outcome of this operation)
             HAL_UART_AbortReceive_IT(&huart4);
+            // The application loses its screen: at the next connection the main screen is displayed
+            CloseRunningApp();
             // We completly stop the VGA output
-            VgaStopOutput();
-            VgaReleaseScreenBuffer(_screenBuffer);
+            ReleaseDisplayedBuffer();
 
             // Eventually we resume the connection task and suspend ourself
             CHECK_OS_STATUS(osThreadResume(vgaConnectionTaHandle));
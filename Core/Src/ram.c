@@ -34,3 +34,13 @@ void rfree(void* ptr, size_t size) {
     s_current -= size;
     s_remaining += size;
 }
+
+BOOL rcontains(const void* ptr) {
+    // The section is a single block, so the check is just a range comparison
+    return (const uint8_t*)ptr >= &s_ramdata[0] && (const uint8_t*)ptr < &s_ramdata[RAM_SIZE];
+}
+
+size_t ravailable() {
+    // Blocks are always allocated at the end of the used space, so all the free memory is contiguous
+    return s_remaining;
+}
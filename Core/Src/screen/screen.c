@@ -1,34 +1,141 @@
-#include <screen\screen.h>
-#include <fonts\glyph.h>
+#include <screen/screen.h>
+#include <fonts/glyph.h>
+#include <fonts/glyphcache.h>
 #include <assertion.h>
 #include <string.h>
 #include <math.h>
 #include <intmath.h>
 #include "stm32f4xx_hal.h"
 
-/// Fix the font color using the glyph level provided
-/// \param glyphLevel Glyph level ranging from 0 to 64 (included)
-/// \param fontColor Color of the font
-/// \return Modified font color
-/// \remarks The function only changes the alpha of the color to have a "better" result on our super scaled screen
-static ARGB8Color FixPixelColorWithGlyphLevel(BYTE glyphLevel, ARGB8Color fontColor) {
-    // To better display the glyph, I assumed that is better to directly work only on the alpha value
-    // In our case, the font bitmaps are exported from Window$. Some of the pixels at the border of the glyph
-    // may have a level that is near zero (but not zero). If we modify the RGB components leaving the alpha unaltered
-    // for these pixels, we get on the display some black pixels. So i think that is better to only remap the alpha level using
-    // the glyph level
-
-    // Simple level calculation using int math. Our glyph bitmap levels range from 0 .. 64
-    // Compiler will optimize division with the shift right
-    int newAlpha = (fontColor.components.A * glyphLevel) / 64;
-    DebugAssert(newAlpha >= 0 && newAlpha <= 255);
-
-    fontColor.components.A = (BYTE)(newAlpha);
-    return fontColor;
+/// Number of characters supported by the font
+#define SCREEN_FONT_CHARACTERS 128
+
+/// Font metrics that are used to measure the strings
+typedef struct _ScreenFontMetrics {
+    /// Max height of a glyph black box
+    UInt16 maxHeight;
+    /// Horizontal distance from the origin of a character cell to the next one, for each character
+    Int16 advances[SCREEN_FONT_CHARACTERS];
+    /// Distance of the glyph bottom edge from the top of the character cell, for each character
+    Int16 heights[SCREEN_FONT_CHARACTERS];
+} ScreenFontMetrics;
+
+/// Font metrics calculated by ScreenInitializeFont()
+static ScreenFontMetrics _fontMetrics;
+/// Flag that indicates that the font metrics have been calculated
+static BOOL _fontInitialized;
+
+/// Checks if two rectangles overlap or share an edge
+static BOOL RectanglesTouch(const RectS* first, const RectS* second) {
+    return first->left <= second->right && second->left <= first->right &&
+        first->top <= second->bottom && second->top <= first->bottom;
+}
+
+/// Calculates the smallest rectangle enclosing two rectangles
+static RectS RectanglesUnion(const RectS* first, const RectS* second) {
+    RectS result;
+    result.left = MIN(first->left, second->left);
+    result.top = MIN(first->top, second->top);
+    result.right = MAX(first->right, second->right);
+    result.bottom = MAX(first->bottom, second->bottom);
+    return result;
+}
+
+/// Calculates the area of a rectangle
+static Int32 RectangleArea(const RectS* rect) {
+    return (Int32)(rect->right - rect->left) * (Int32)(rect->bottom - rect->top);
+}
+
+/// Adds a (clipped and not empty) rectangle to the dirty region, merging it with the rectangles it touches
+static void AddDirtyRectangle(ScreenDirtyRegion* region, RectS rect) {
+    while (true) {
+        // We merge the new rectangle with all the ones it touches. The merged rectangle is larger and may now touch
+        // a rectangle we have already checked, so we restart the scan after each merge
+        BYTE i = 0;
+        while (i < region->count) {
+            if (RectanglesTouch(&region->rectangles[i], &rect)) {
+                rect = RectanglesUnion(&region->rectangles[i], &rect);
+                // Order is not important, we simply move the last rectangle in the free slot
+                region->rectangles[i] = region->rectangles[--region->count];
+                i = 0;
+            }
+            else {
+                ++i;
+            }
+        }
+
+        if (region->count < SCREEN_DIRTY_RECTANGLES) {
+            break;
+        }
+
+        // No more space in the region. We merge the rectangle with the one that grows the least
+        BYTE bestIndex = 0;
+        Int32 bestGrowth = INT32_MAX;
+        for (i = 0; i < region->count; i++) {
+            RectS merged = RectanglesUnion(&region->rectangles[i], &rect);
+            Int32 growth = RectangleArea(&merged) - RectangleArea(&region->rectangles[i]);
+            if (growth < bestGrowth) {
+                bestGrowth = growth;
+                bestIndex = i;
+            }
+        }
+        rect = RectanglesUnion(&region->rectangles[bestIndex], &rect);
+        region->rectangles[bestIndex] = region->rectangles[--region->count];
+        // The enlarged rectangle may touch other ones. Let's repeat the merge
+    }
+
+    region->rectangles[region->count++] = rect;
+}
+
+/// Marks an area as dirty, clipping it to the screen bounds
+static void InvalidateArea(const ScreenBuffer* buffer, int left, int top, int right, int bottom) {
+    ScreenDirtyRegion* region = buffer->dirtyRegion;
+    if (region == NULL) {
+        // Driver is not interested
+        return;
+    }
+
+    RectS rect;
+    rect.left = (Int16)MAX(left, 0);
+    rect.top = (Int16)MAX(top, 0);
+    rect.right = (Int16)MIN(right, buffer->screenSize.width);
+    rect.bottom = (Int16)MIN(bottom, buffer->screenSize.height);
+    if (rect.left >= rect.right || rect.top >= rect.bottom) {
+        // Nothing visible
+        return;
+    }
+
+    AddDirtyRectangle(region, rect);
+}
+
+/// Draws the run-length encoded rows of a glyph that is completely inside the screen
+static void ScreenDrawGlyphRuns(const ScreenBuffer* buffer, PCBYTE runs, int originX, int originY, int rows, const Pen* pen) {
+    for (int line = originY; line < originY + rows; line++) {
+        Int16 x = (Int16)originX;
+        BYTE header;
+        while ((header = *runs++) != GLYPH_RUN_END_OF_ROW) {
+            Int16 length = (Int16)(header & GLYPH_RUN_LENGTH_MASK);
+            switch (header & GLYPH_RUN_TYPE_MASK) {
+            case GLYPH_RUN_SOLID:
+                // The driver fills the span with word stores
+                ScreenDrawSpan(buffer, (Int16)line, x, (Int16)(x + length), pen);
+                break;
+            case GLYPH_RUN_BLEND:
+                ScreenBlendSpan(buffer, (Int16)line, x, runs, length, pen);
+                runs += length;
+                break;
+            default:
+                // Transparent pixels
+                break;
+            }
+            x = (Int16)(x + length);
+        }
+    }
 }
 
 /// Draws a character glyph onto the screen at the specified coordinates
-static void ScreenDrawCharacter(const ScreenBuffer* buffer, char character, PointS point, GlyphMetrics* charMetrics, const Pen* pen) {
+/// \param drawnArea [In/Out] Rectangle that is enlarged to include the pixels written by the function
+static void ScreenDrawCharacter(const ScreenBuffer* buffer, char character, PointS point, GlyphMetrics* charMetrics, const Pen* pen, RectS* drawnArea) {
     // We are currently supporting only simple ASCII characters
     if (character < 0 || character >= 128) {
         // Let's just clear the metrics since they are used from the caller to increment the drawing point
@@ -89,9 +196,25 @@ static void ScreenDrawCharacter(const ScreenBuffer* buffer, char character, Poin
     int vStart = glyphOriginY; // Already clipped to be >= 0
     int hEnd = MIN(glyphOriginX + charMetrics->blackBoxX, buffer->screenSize.width);
     int vEnd = MIN(glyphOriginY + charMetrics->blackBoxY, buffer->screenSize.height);
+    if (hStart >= hEnd || vStart >= vEnd) {
+        // Glyph starts exactly at the screen border
+        return;
+    }
 
-    // We need to copy the pen since each pixel color will be potentially different
-    Pen glyphPixelPen = *pen;
+    drawnArea->left = (Int16)MIN(drawnArea->left, hStart);
+    drawnArea->top = (Int16)MIN(drawnArea->top, vStart);
+    drawnArea->right = (Int16)MAX(drawnArea->right, hEnd);
+    drawnArea->bottom = (Int16)MAX(drawnArea->bottom, vEnd);
+
+    // Glyphs that are completely visible are drawn from their cached runs
+    if (glyphXOffset == 0 && glyphBufferLineOffset == 0 &&
+        hEnd - hStart == charMetrics->blackBoxX && vEnd - vStart == charMetrics->blackBoxY) {
+        PCBYTE runs = GlyphCacheGetRuns(character, charMetrics, glyphBufferPtr);
+        if (runs != NULL) {
+            ScreenDrawGlyphRuns(buffer, runs, hStart, vStart, vEnd - vStart, pen);
+            return;
+        }
+    }
 
     // The row length of the buffer is a multiple of a Word (32bit), so it must be multiple of 4
     // We simply add 3 to our box width and we clear the 2 LSBs. In this case all the numbers where the
@@ -100,51 +223,16 @@ static void ScreenDrawCharacter(const ScreenBuffer* buffer, char character, Poin
     // Make sure we are doing fine with our math
     DebugAssert(glyphBufferRowWidth * charMetrics->blackBoxY == charMetrics->bufferSize);
 
-    // Classic line loop
-    PointS pixelPt = { 0 };
+    // Glyph levels are already coverage values [0; 64] so each visible glyph row is blended with a single span call
+    // To better display the glyph, the driver only works on the pen alpha value. In our case, the font bitmaps are exported
+    // from Window$ and some of the pixels at the border of the glyph may have a level that is near zero (but not zero).
+    // If we modify the RGB components leaving the alpha unaltered for these pixels, we get on the display some black pixels
+    static_assert(SCREEN_COVERAGE_MAX == 64, "Glyph levels must match the screen coverage range");
+    Int16 spanLength = (Int16)(hEnd - hStart);
     for (int line = vStart; line < vEnd; ++line, ++glyphBufferLineOffset) {
-        pixelPt.y = (Int16)line; // Cast should be safe since line is between [0; screenHeight)
-        pixelPt.x = (Int16)hStart; // Cast should be safe since hStart is between [0; screenWidth)
-
-        // We recalculate the current starting pixel of the glyph
-        int glyphX = glyphXOffset;
-        // Since glyph rows are aligned at word boundaries, we can read 4 levels at the time
-        // to save little time
-        // We just need to make sure we are not starting from an unaligned glyph address
-        for (; (glyphX & 0x3) != 0 && pixelPt.x < hEnd; pixelPt.x++, glyphX++) {
-            // We read the glyph level from the glyph
-            BYTE glyphLevel = glyphBufferPtr[glyphBufferLineOffset * glyphBufferRowWidth + glyphX];
-
-            // If level is zero it is useless to draw the pixel
-            if (glyphLevel != 0) {
-                glyphPixelPen.color = FixPixelColorWithGlyphLevel(glyphLevel, pen->color);
-                ScreenDrawPixel(buffer, pixelPt, &glyphPixelPen);
-            }
-        }
-
-        // From here all accesses to glyphBuffer should be aligned
-        for (; pixelPt.x < hEnd; glyphX += 4) {
-            // We read the 4 glyph levels from the glyph
-            const BYTE* pLevel = &glyphBufferPtr[glyphBufferLineOffset * glyphBufferRowWidth + glyphX];
-            UInt32 glyphLevels = *((const UInt32*)pLevel);
-
-            // NB: Our system is little endian so the 1st level is now on the LSB of the 32bit int
-            // So we start with no right shift and we the increment the shift of 8 bits at each iteration
-            // First iteration we read 000000XX (1st glyph level in little endian), then 0000XX00, 00XX0000, XX000000 (4th glyph level)
-            int i = 0;
-            while (i < 32 && pixelPt.x < hEnd) {
-                BYTE glyphLevel = (glyphLevels >> i) & 0xFF;
-
-                // If level is zero it' s useless to draw the pixel
-                if (glyphLevel != 0) {
-                    glyphPixelPen.color = FixPixelColorWithGlyphLevel(glyphLevel, pen->color);
-                    ScreenDrawPixel(buffer, pixelPt, &glyphPixelPen);
-                }
-                // Better than using i = 0 .. 3 and multiplying by 8
-                i += 8;
-                pixelPt.x++;
-            }
-        }
+        PCBYTE glyphRow = &glyphBufferPtr[glyphBufferLineOffset * glyphBufferRowWidth + glyphXOffset];
+        // Casts should be safe since line and hStart are inside the screen
+        ScreenBlendSpan(buffer, (Int16)line, (Int16)hStart, glyphRow, spanLength, pen);
     }
 }
 
@@ -161,80 +249,42 @@ void ScreenFillRectangle(const ScreenBuffer* buffer, PointS point, SizeS size, c
     Int16 vStart = MAX(point.y, 0);
     Int16 vEnd = (Int16)(MIN(point.y + size.height, buffer->screenSize.height));
 
-    BYTE packSizePower = buffer->packSizePower;
-    DebugAssert(packSizePower <= 2); // We work with 32 bits max
-    BYTE packSize = (BYTE)(1 << packSizePower);
+    InvalidateArea(buffer, hStart, vStart, hEnd, vEnd);
 
-    // We do the check here to limit the number of branch instruction in the code
     DebugWriteChar('d');
 
-    if (packSize == 1) {
-        // No packed draw available. We draw pixel by pixel
-        PointS point;
-        for (Int16 line = vStart; line < vEnd; line++) {
-            point.y = line;
-            for (Int16 pixel = hStart; pixel < hEnd; ++pixel) {
-                point.x = pixel;
-                ScreenDrawPixel(buffer, point, pen);
-            }
-        }
-    }
-    else {
-        PointS pixelPoint;
-        // We need to calculate the PIXEL alignment mask here to have the correct pack alignment
-        // NB: We are assuming that the framebuffer start address is already aligned
-        BYTE alignmentMask = 0;
-
-        for (BYTE i = 0; i < packSizePower; i++)
-        {
-            // Left-shit the alignment mask
-            alignmentMask = (BYTE)(alignmentMask << 1);
-            // Or with a 1
-            alignmentMask |= 1;
-        }
-
-        // We are only using 32bit alignment so let's make sure this is correct
-        DebugAssert(packSizePower == 2 && packSize == 4 && alignmentMask == 0x3);
-
+    if (hStart < hEnd) {
+        // Pack handling and address calculation are left to the driver, once per line
         for (Int16 line = vStart; line < vEnd; line++) {
-            pixelPoint.y = line;
-
-            // First we draw the unaligned pixels at the beginning
-            pixelPoint.x = hStart;
-            for (int unPixel = hStart & alignmentMask; unPixel != 0; unPixel = (unPixel + 1) & alignmentMask, pixelPoint.x++) {
-                ScreenDrawPixel(buffer, pixelPoint, pen);
-            }
-
-            // Once we are aligned to the pack, we can start issuing packed draw calls
-            for (; pixelPoint.x < (hEnd & (~alignmentMask)); pixelPoint.x = (Int16)(pixelPoint.x + packSize)) {
-                ScreenDrawPixelPack(buffer, pixelPoint, pen);
-            }
-
-            // We do the same for the trailing pixels that are not aligned
-            for (; pixelPoint.x < hEnd; pixelPoint.x++) {
-                ScreenDrawPixel(buffer, pixelPoint, pen);
-            }
+            ScreenDrawSpan(buffer, line, hStart, hEnd, pen);
         }
     }
     DebugWriteChar('D');
 }
 
-UInt16 ScreenGetCharMaxHeight() {
-    UInt16 size = 0;
-
+void ScreenInitializeFont() {
     // Super simple loop here
-    // For each character in our string we get the metric 
+    // For each character we get the metric and we store the values needed for the measurement
     GlyphMetrics charMetrics;
     PCBYTE glyphBufferPtr;
-    for (char i = 0; i < 0x80; i++) {
-        GetGlyphOutline(i, &charMetrics, &glyphBufferPtr);
+    _fontMetrics.maxHeight = 0;
+    for (int i = 0; i < SCREEN_FONT_CHARACTERS; i++) {
+        GetGlyphOutline((char)i, &charMetrics, &glyphBufferPtr);
 
-        size = MAX(size, charMetrics.blackBoxY);
+        _fontMetrics.maxHeight = MAX(_fontMetrics.maxHeight, charMetrics.blackBoxY);
+        _fontMetrics.advances[i] = charMetrics.cellIncX;
+        _fontMetrics.heights[i] = (Int16)(charMetrics.blackBoxY + charMetrics.glyphOrigin.y);
     }
-    return size;
+    _fontInitialized = true;
+}
+
+UInt16 ScreenGetCharMaxHeight() {
+    DebugAssert(_fontInitialized);
+    return _fontMetrics.maxHeight;
 }
 
 void ScreenMeasureString(const char* str, SizeS* size) {
+    DebugAssert(_fontInitialized);
     if (size == NULL)
         return;
 
@@ -242,44 +292,54 @@ void ScreenMeasureString(const char* str, SizeS* size) {
     size->width = 0;
     // This is not safe but our project is just display some stuff on the screen, there is not
     // sensible data in it. It may still be hacked though
-    size_t stringLength = strlen(str);
-    if (stringLength <= 0) {
-        // Nothing to draw
-        return;
-    }
-
-    // Super simple loop here
-    // For each character in our string we get the metric 
-    GlyphMetrics charMetrics;
-    PCBYTE glyphBufferPtr;
-    for (int i = 0; i < stringLength; i++) {
-        GetGlyphOutline(str[i], &charMetrics, &glyphBufferPtr);
+    for (; *str != '\0'; str++) {
+        int character = (BYTE)*str;
+        if (character >= SCREEN_FONT_CHARACTERS) {
+            // Not supported by the font: it is not drawn
+            continue;
+        }
 
-        size->height = (Int16)MAX(size->height, charMetrics.blackBoxY + charMetrics.glyphOrigin.y);
-        size->width = (Int16)(size->width + charMetrics.cellIncX);
+        size->height = (Int16)MAX(size->height, _fontMetrics.heights[character]);
+        size->width = (Int16)(size->width + _fontMetrics.advances[character]);
     }
 }
 
 void ScreenDrawString(const ScreenBuffer* buffer, const char* str, PointS point, const Pen* pen) {
-    // This is not safe but our project is just display some stuff on the screen, there is not
-    // sensible data in it. It may still be hacked though
-    size_t stringLength = strlen(str);
+    ScreenDrawStringMeasured(buffer, str, point, pen, NULL);
+}
 
-    if (stringLength == 0) {
-        // Nothing to draw
-        return;
-    }
+void ScreenDrawStringMeasured(const ScreenBuffer* buffer, const char* str, PointS point, const Pen* pen, SizeS* size) {
+    DebugAssert(_fontInitialized);
 
     // Super simple loop here
     // For each character in our string we draw it's glyph on the screen and we move the point forward
+    // We also collect the area of the written pixels to invalidate it only once at the end
+    // This is not safe but our project is just display some stuff on the screen, there is not
+    // sensible data in it. It may still be hacked though
     GlyphMetrics charMetrics;
-    for (int i = 0; i < stringLength; i++) {
-        char character = str[i];
-        ScreenDrawCharacter(buffer, character, point, &charMetrics, pen);
+    RectS drawnArea = { INT16_MAX, INT16_MAX, INT16_MIN, INT16_MIN };
+    SizeS stringSize = { 0 };
+    for (; *str != '\0'; str++) {
+        int character = (BYTE)*str;
+        if (character >= SCREEN_FONT_CHARACTERS) {
+            // Not supported by the font: it is not drawn
+            continue;
+        }
+        ScreenDrawCharacter(buffer, (char)character, point, &charMetrics, pen, &drawnArea);
 
         // We move our "drawing cursor" forward using the font specifications
         // The font also has a Y increment but we are not interested
-        point.x = (Int16)(point.x + charMetrics.cellIncX);
+        Int16 advance = _fontMetrics.advances[character];
+        point.x = (Int16)(point.x + advance);
+        stringSize.width = (Int16)(stringSize.width + advance);
+        stringSize.height = (Int16)MAX(stringSize.height, _fontMetrics.heights[character]);
+    }
+
+    if (drawnArea.left < drawnArea.right) {
+        InvalidateArea(buffer, drawnArea.left, drawnArea.top, drawnArea.right, drawnArea.bottom);
+    }
+    if (size != NULL) {
+        *size = stringSize;
     }
 }
 
@@ -290,3 +350,29 @@ void ScreenDrawPixelPack(const ScreenBuffer* buffer, PointS point, const Pen* pe
     buffer->DrawPackCallback(point, pen);
 }
 
+void ScreenDrawSpan(const ScreenBuffer* buffer, Int16 y, Int16 xStart, Int16 xEnd, const Pen* pen) {
+    buffer->DrawSpanCallback(y, xStart, xEnd, pen);
+}
+
+void ScreenBlitSpan(const ScreenBuffer* buffer, Int16 y, Int16 x, PCBYTE source, Int16 count, ScreenDither dither) {
+    buffer->BlitSpanCallback(y, x, source, count, dither);
+}
+
+void ScreenBlendSpan(const ScreenBuffer* buffer, Int16 y, Int16 x, PCBYTE coverage, Int16 count, const Pen* pen) {
+    buffer->BlendSpanCallback(y, x, coverage, count, pen);
+}
+
+void ScreenInvalidateRectangle(const ScreenBuffer* buffer, PointS point, SizeS size) {
+    InvalidateArea(buffer, point.x, point.y, point.x + size.width, point.y + size.height);
+}
+
+void ScreenPresent(const ScreenBuffer* buffer) {
+    if (buffer->PresentCallback != NULL) {
+        buffer->PresentCallback(buffer->dirtyRegion);
+    }
+
+    // Everything is now visible
+    if (buffer->dirtyRegion != NULL) {
+        buffer->dirtyRegion->count = 0;
+    }
+}
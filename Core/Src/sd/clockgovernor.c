@@ -0,0 +1,85 @@
+#include <sd/clockgovernor.h>
+#include <intmath.h>
+
+/// Number of reads of an observation window
+#define SD_GOVERNOR_WINDOW 64
+/// Failed reads in a window that trigger a fallback to a slower rate
+#define SD_GOVERNOR_MAX_ERRORS 2
+/// Clean reads needed before probing a faster rate after the first fallback
+#define SD_GOVERNOR_PROBE_INTERVAL 1024
+/// Max number of clean reads between two probes
+#define SD_GOVERNOR_MAX_PROBE_INTERVAL (SD_GOVERNOR_PROBE_INTERVAL * 32)
+
+// ##### Private forward declarations #####
+
+/// Starts a new observation window
+static void ResetWindow(SdClockGovernor* governor);
+
+// ##### Private Function definitions #####
+
+void ResetWindow(SdClockGovernor* governor) {
+    governor->windowReads = 0;
+    governor->windowErrors = 0;
+}
+
+// ##### Public Function definitions #####
+
+void SdClockGovernorInitialize(SdClockGovernor* governor, UInt32 busFrequency, UInt32 maxTransferSpeed) {
+    // We look for the smallest divider that does not exceed the card max transfer speed
+    BYTE prescaler = 0;
+    while (prescaler < SD_GOVERNOR_SLOWEST_PRESCALER && (busFrequency >> (prescaler + 1)) > maxTransferSpeed) {
+        prescaler++;
+    }
+
+    governor->fastestPrescaler = prescaler;
+    governor->prescaler = prescaler;
+    governor->probing = false;
+    governor->cleanReads = 0;
+    governor->probeInterval = SD_GOVERNOR_PROBE_INTERVAL;
+    ResetWindow(governor);
+}
+
+BOOL SdClockGovernorReportRead(SdClockGovernor* governor, BOOL failed) {
+    governor->windowReads++;
+    if (failed) {
+        governor->windowErrors++;
+        governor->cleanReads = 0;
+    }
+    else {
+        governor->cleanReads++;
+    }
+
+    if (failed && governor->probing) {
+        // The probed rate is not reliable: we go back to the previous one and we wait longer before the next probe
+        governor->prescaler++;
+        governor->probing = false;
+        governor->probeInterval = MIN(governor->probeInterval * 2, SD_GOVERNOR_MAX_PROBE_INTERVAL);
+        ResetWindow(governor);
+        return true;
+    }
+
+    if (governor->windowErrors >= SD_GOVERNOR_MAX_ERRORS) {
+        ResetWindow(governor);
+        if (governor->prescaler < SD_GOVERNOR_SLOWEST_PRESCALER) {
+            governor->prescaler++;
+            return true;
+        }
+        // Nothing slower than this, errors are not caused by the bus speed
+        return false;
+    }
+
+    if (governor->windowReads >= SD_GOVERNOR_WINDOW) {
+        // A whole window without too many errors: a probed rate is now confirmed
+        governor->probing = false;
+        ResetWindow(governor);
+    }
+
+    if (governor->prescaler > governor->fastestPrescaler && governor->cleanReads >= governor->probeInterval) {
+        governor->prescaler--;
+        governor->probing = true;
+        governor->cleanReads = 0;
+        ResetWindow(governor);
+        return true;
+    }
+    return false;
+}
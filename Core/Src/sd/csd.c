@@ -23,6 +23,19 @@
 /// Mask for the read block length exponent in the field byte
 #define READBLLEN_MASK 0x0F;
 
+/// Offset for the C_SIZE field of the version 1.0 [bits 73:62]
+#define CSIZEV1_U8OFFSET 6
+/// Offset for the C_SIZE field of the version 2.0 [bits 69:48]
+#define CSIZEV2_U8OFFSET 7
+/// Offset for the C_SIZE_MULT field of the version 1.0 [bits 49:47]
+#define CSIZEMULT_U8OFFSET 9
+/// Offset for the SECTOR_SIZE field [bits 45:39]
+#define SECTORSIZE_U8OFFSET 10
+/// Offset for the WRITE_BL_LEN field [bits 25:22]
+#define WRITEBLLEN_U8OFFSET 12
+/// Sector size used by the file system layer
+#define CSD_SECTOR_SIZE_LOG2 9
+
 /// Internal CSD Definition as block of bytes
 /// Bit fields are no good since layout is compiler dependent
 struct _CSDRegister {
@@ -132,6 +145,40 @@ UInt16 SdCsdGetMaxReadDataBlockLength(PCCsdRegister pCSD) {
     return (UInt16)(1 << exponent); // Block size = 2 ^ (READ_BL_LEN)
 }
 
+UInt32 SdCsdGetSectorCount(PCCsdRegister pCSD) {
+    // Function is assuming a valid CSD
+    PCBYTE pRaw = pCSD->Raw;
+
+    if (SdCsdGetVersion(pCSD) == SDCSDV2p0) {
+        // Capacity = (C_SIZE + 1) * 512KB [Section 5.3.3]
+        UInt32 cSize = ((UInt32)(pRaw[CSIZEV2_U8OFFSET] & 0x3F) << 16) | ((UInt32)pRaw[CSIZEV2_U8OFFSET + 1] << 8) |
+            pRaw[CSIZEV2_U8OFFSET + 2];
+        return (cSize + 1) << 10;
+    }
+
+    // Capacity = (C_SIZE + 1) * 2^(C_SIZE_MULT + 2) * 2^(READ_BL_LEN) [Section 5.3.2]
+    UInt32 cSize = ((UInt32)(pRaw[CSIZEV1_U8OFFSET] & 0x03) << 10) | ((UInt32)pRaw[CSIZEV1_U8OFFSET + 1] << 2) |
+        (pRaw[CSIZEV1_U8OFFSET + 2] >> 6);
+    BYTE cSizeMult = (BYTE)(((pRaw[CSIZEMULT_U8OFFSET] & 0x03) << 1) | (pRaw[CSIZEMULT_U8OFFSET + 1] >> 7));
+    BYTE readBlLen = GetReadBlLen(pRaw);
+    return (cSize + 1) << (cSizeMult + 2 + readBlLen - CSD_SECTOR_SIZE_LOG2);
+}
+
+UInt32 SdCsdGetEraseSectorSize(PCCsdRegister pCSD) {
+    // Function is assuming a valid CSD
+    PCBYTE pRaw = pCSD->Raw;
+
+    // Erasable sector is SECTOR_SIZE + 1 write blocks (2 ^ WRITE_BL_LEN bytes) in both versions.
+    // Version 2.0 cards have fixed values (64KB)
+    UInt32 sectorSize = (UInt32)(((pRaw[SECTORSIZE_U8OFFSET] & 0x3F) << 1) | (pRaw[SECTORSIZE_U8OFFSET + 1] >> 7));
+    BYTE writeBlLen = (BYTE)(((pRaw[WRITEBLLEN_U8OFFSET] & 0x03) << 2) | (pRaw[WRITEBLLEN_U8OFFSET + 1] >> 6));
+    if (writeBlLen < CSD_SECTOR_SIZE_LOG2) {
+        // Reserved value, the size is unknown
+        return 1;
+    }
+    return (sectorSize + 1) << (writeBlLen - CSD_SECTOR_SIZE_LOG2);
+}
+
 void SdCsdDumpValidationResult(SdCsdValidation result)
 {
     switch (result)
@@ -1,6 +1,7 @@
 #include <sd/sd.h>
 #include <sd/csd.h>
 #include <sd/ocr.h>
+#include <sd/clockgovernor.h>
 #include <crc/crc7.h>
 #include <crc/crc16.h>
 #include <stdio.h>
@@ -8,6 +9,8 @@
 #include <assertion.h>
 #include <binary.h>
 #include <console.h>
+#include <ram.h>
+#include <cmsis_extensions.h>
 
 extern void Error_Handler();
 
@@ -27,6 +30,28 @@ extern void Error_Handler();
 #define SD_DATA_BLOCK_SIZE 512
 #define SD_DATA_CRC_SIZE 2
 
+/// Data blocks are clocked by the DMA instead of polling the SPI byte by byte
+#define SD_USE_DMA
+/// Blocks smaller than this size (registers) are always polled: the DMA setup would take longer than the transfer
+#define SD_DMA_MIN_BLOCK_SIZE 64
+/// Number of bounce buffers. Multi-block reads use two of them: the DMA fills one while the CPU verifies the other
+#define SD_DMA_BOUNCE_SLOTS 2
+/// Max time (in ms) that a DMA block transfer can take
+#define SD_DMA_TIMEOUT 100
+/// Thread flag set by the DMA interrupt when the block has been received
+#define SD_DMA_FLAG_COMPLETE 0x1
+/// Thread flag set by the DMA interrupt when the transfer failed
+#define SD_DMA_FLAG_ERROR 0x2
+/// SPI2 RX request is mapped on DMA1 Stream 3, channel 0 [RM0090 - Table 42]
+#define SD_DMA_RX_STREAM DMA1_Stream3
+/// SPI2 TX request is mapped on DMA1 Stream 4, channel 0 [RM0090 - Table 42]
+#define SD_DMA_TX_STREAM DMA1_Stream4
+#define SD_DMA_RX_CLEAR_FLAGS (DMA_LIFCR_CTCIF3 | DMA_LIFCR_CHTIF3 | DMA_LIFCR_CTEIF3 | DMA_LIFCR_CDMEIF3 | DMA_LIFCR_CFEIF3)
+#define SD_DMA_TX_CLEAR_FLAGS (DMA_HIFCR_CTCIF4 | DMA_HIFCR_CHTIF4 | DMA_HIFCR_CTEIF4 | DMA_HIFCR_CDMEIF4 | DMA_HIFCR_CFEIF4)
+/// Core coupled memory range. The CCM is connected only to the CPU so the DMA cannot write there
+#define SD_CCMRAM_START 0x10000000U
+#define SD_CCMRAM_END 0x10010000U
+
 /// Voltage Supplied (VHS) parameter for CMD8
 #define SD_CMD8_VHS_2p7To3p6 (0x1U << 8)
 
@@ -43,6 +68,8 @@ extern void Error_Handler();
 /// As specified in the Physical Layer Simplified Specification Version 8.00 [Section 4.2.3, Card Initialization and Identification Process]
 /// we should use a 1sec timeout when waiting the device to become ready
 #define SD_ACMD41_LOOP_TIMEOUT 1000
+/// Max time (in ms) that the card can keep the line busy after the stop of a multiple block read
+#define SD_STOP_BUSY_TIMEOUT 250
 
 typedef enum _SDCommand {
     /// Resets the SD memory card
@@ -77,8 +104,29 @@ typedef enum _SDAppCommand {
     SdACmd41SendOpCond = 41
 } SDAppCommand;
 
+/// Data block received by the DMA whose CRC has not been verified yet
+typedef struct _PendingBlock {
+    /// Buffer written by the DMA: the final destination or a bounce buffer
+    BYTE* data;
+    /// Final destination of the block
+    BYTE* destination;
+    /// CRC received after the block
+    BYTE crc[SD_DATA_CRC_SIZE];
+} PendingBlock;
+
 /// Prints the SPI frequency
 static void PrintSpiFrequency();
+/// Changes the SPI prescaler
+/// @param prescaler Value of the BR field: the SPI clock is PCLK1 / 2^(prescaler + 1)
+static void SetSpiPrescaler(BYTE prescaler);
+/// Returns the core clock cycle counter
+static UInt32 GetCycleCount();
+/// Updates the statistics at the end of a read transaction
+/// @param startCycle Cycle counter when the transaction started
+/// @param sectors Sectors read by the transaction (ignored if the read failed)
+static void AccountRead(SdStatus readStatus, UInt32 startCycle, UInt32 sectors);
+/// Reports the outcome of a read to the clock governor and applies its decision
+static void UpdateClockGovernor(SdStatus readStatus);
 /// Completely disables the SPI interface
 static void ShutdownSPIInterface();
 /// Select the SPI by asserting LOW the NSS pin
@@ -142,11 +190,40 @@ static SdStatus VerifyCardCapacityStatus();
 static BOOL IsErrorToken(BYTE data);
 /// Converts an error token to a SdStatus value 
 static SdStatus ConvertErrorToken(BYTE token);
+/// Waits for the start block token that precedes a data block
+/// @return Status of the operation. Error tokens are converted to the related status
+static SdStatus WaitStartBlockToken();
 /// Reads a data block in the specified section and checks it checksum
 /// @param destination Destination buffer
 /// @param blockSize Size of data to read
 /// @return Status of the operation
 static SdStatus ReadDataBlock(BYTE* destination, UInt16 blockSize);
+/// Reads consecutive data blocks of a multiple block read with the DMA. The CRC of each block is verified
+/// while the next block is being transferred
+/// @param destination Destination buffer
+/// @param blockSize Size of each block
+/// @param count Number of blocks to read
+/// @return Status of the operation
+static SdStatus ReadDataBlocksPipelined(BYTE* destination, UInt16 blockSize, UInt32 count);
+/// Configures the DMA streams connected to the SPI RX and TX requests
+static void InitializeDMA();
+/// Checks if a data block can be transferred with the DMA into the destination buffer
+static BOOL CanUseDMA(const BYTE* destination, UInt16 blockSize);
+/// Disables both DMA streams and waits for them to be stopped
+static void StopDMA();
+/// Returns the buffer where the DMA must write a block directed to the destination
+/// @param slot Bounce buffer to use if the destination cannot be reached by the DMA
+static BYTE* GetDMATarget(BYTE* destination, BYTE slot);
+/// Starts clocking a data block on the SPI using the DMA. The transfer must be completed with WaitBlockDMA
+static void StartBlockDMA(BYTE* target, UInt16 blockSize);
+/// Blocks the calling task until the running DMA transfer is completed
+/// @return Status of the operation
+static SdStatus WaitBlockDMA();
+/// Reads the CRC that follows a block received by the DMA
+static void ReadBlockCRC(PendingBlock* block);
+/// Verifies the CRC of a block received by the DMA and moves it to its destination
+/// @return Status of the operation
+static SdStatus CompleteBlock(const PendingBlock* block, UInt16 blockSize);
 static SdStatus ReadRegister(SdCommand readCommand, UInt16 length);
 /// Changes the block length of memory access in the SD card
 /// @return Status of the operation
@@ -173,6 +250,31 @@ static BYTE _responseBuffer[SD_MAX_RESPONSE_SIZE];
 /// Static allocated buffer where a data block will be read togheter with the related crc
 static BYTE _registersBuffer[SD_MAX_REGISTER_SIZE];
 static SDDescription _attachedSdCard;
+/// Governor of the SPI clock used for the data transfers
+static SdClockGovernor _clockGovernor;
+
+/// State of the multiple block read opened by SdReadSectorsBegin
+static struct _ReadStream {
+    /// True between SdReadSectorsBegin and SdReadSectorsEnd
+    BOOL open;
+    /// First error occurred in the stream
+    SdStatus status;
+    /// True if the card accepted CMD18: it keeps sending blocks until CMD12, even after an error
+    BOOL transmitting;
+    /// Cycle counter when the stream was opened
+    UInt32 startCycle;
+    /// Sectors successfully read in the stream
+    UInt32 sectors;
+} _readStream;
+/// Counters of the driver activity
+static SdStatistics _statistics;
+
+/// Byte sent by the TX DMA stream for each received byte. Being constant it stays in flash, which is reachable by the DMA
+static const BYTE _dmaDummyByte = SD_DUMMY_BYTE;
+/// Block buffers in the main RAM used when the destination is in the core coupled memory (ex. FatFs window)
+static BYTE* _dmaBounceBuffers = NULL;
+/// Thread waiting for the completion of the DMA transfer (NULL if no transfer is running)
+static volatile osThreadId_t _dmaWaitingThread = NULL;
 
 typedef struct _ResponseR1 {
     BYTE Idle : 1; // BIT 0
@@ -209,6 +311,37 @@ static void PrintSpiFrequency(){
     printf("\r\n");
 }
 
+static void SetSpiPrescaler(BYTE prescaler) {
+    // As stated in the RM0090, the SPI baud rate control can be changed with the peripheral enabled but not when a transfer is ongoing
+    MODIFY_REG(_spiInstance->CR1, SPI_CR1_BR, ((UInt32)prescaler << SPI_CR1_BR_Pos) & SPI_CR1_BR);
+}
+
+static UInt32 GetCycleCount() {
+    return DWT->CYCCNT;
+}
+
+static void AccountRead(SdStatus readStatus, UInt32 startCycle, UInt32 sectors) {
+    // Cycle counter wraps in about 25 seconds, far more than a read transaction
+    _statistics.readCycles += GetCycleCount() - startCycle;
+    if (readStatus == SdStatusOk) {
+        _statistics.sectors += sectors;
+    }
+    else if (readStatus == SdStatusReadCorrupted) {
+        _statistics.corruptedReads++;
+    }
+}
+
+static void UpdateClockGovernor(SdStatus readStatus) {
+    // Only corrupted data and timeouts can be caused by a bus that is too fast
+    BOOL failed = readStatus == SdStatusReadCorrupted || readStatus == SdStatusCommunicationTimeout;
+    if (SdClockGovernorReportRead(&_clockGovernor, failed)) {
+        // The change is only counted: the read path runs on the small stack of the storage task, and printing
+        // would delay the transfer. The current speed is reported by SdDumpStatistics
+        SetSpiPrescaler(_clockGovernor.prescaler);
+        _statistics.clockChanges++;
+    }
+}
+
 static void ShutdownSPIInterface() {
     // We need to completely disable our SPI interface
     // Let's follow the procedure indicate in the SPI chapter of RM0090 [Section 28.3.8]
@@ -278,15 +411,21 @@ static void WriteByte(BYTE val, BYTE* crc) {
 }
 
 static SBYTE PerformCommandTransaction(BYTE command, UInt32 argument, BYTE responseLength) {
-    BYTE crc = CRC7_ZERO;
-    WriteByte(0x40 | command, &crc);
-    WriteByte((BYTE)(argument >> 24), &crc);
-    WriteByte((BYTE)(argument >> 16), &crc);
-    WriteByte((BYTE)(argument >> 8), &crc);
-    WriteByte((BYTE)(argument), &crc);
-
-    BYTE dataF = (BYTE)((crc << 1) | 0x1); // End bit
-    WriteByte(dataF, &crc); // We ignore this last crc
+    // The whole command frame is known in advance, so the CRC is computed in one pass
+    BYTE frame[6];
+    frame[0] = (BYTE)(0x40 | command);
+    frame[1] = (BYTE)(argument >> 24);
+    frame[2] = (BYTE)(argument >> 16);
+    frame[3] = (BYTE)(argument >> 8);
+    frame[4] = (BYTE)(argument);
+
+    BYTE crc = Crc7Update(CRC7_ZERO, frame, 5);
+    frame[5] = (BYTE)((crc << 1) | 0x1); // End bit
+
+    for (int i = 0; i < sizeof(frame); i++) {
+        PerformByteTransaction(frame[i]);
+    }
+    _statistics.commands++;
 
     static_assert(sizeof(ResponseR1) == sizeof(BYTE));
     DebugAssert(responseLength > 0 && responseLength <= SD_MAX_RESPONSE_SIZE);
@@ -529,7 +668,7 @@ static SdStatus ConvertErrorToken(BYTE token) {
     }
 }
 
-static SdStatus ReadDataBlock(BYTE* destination, UInt16 blockSize) {
+static SdStatus WaitStartBlockToken() {
     const BYTE startBlock = 0xFE;
 
     // First wait for data block
@@ -547,11 +686,36 @@ static SdStatus ReadDataBlock(BYTE* destination, UInt16 blockSize) {
     else if (readValue != startBlock) {
         return SdStatusCommunicationTimeout;
     }
+    return SdStatusOk;
+}
+
+static SdStatus ReadDataBlock(BYTE* destination, UInt16 blockSize) {
+    SdStatus status = WaitStartBlockToken();
+    if (status != SdStatusOk) {
+        return status;
+    }
 
 #ifdef SD_PROFILE
     DebugWriteChar('b');
 #endif
 
+    if (CanUseDMA(destination, blockSize)) {
+        PendingBlock block;
+        block.destination = destination;
+        block.data = GetDMATarget(destination, 0);
+
+        StartBlockDMA(block.data, blockSize);
+        if ((status = WaitBlockDMA()) != SdStatusOk) {
+            return status;
+        }
+        ReadBlockCRC(&block);
+
+#ifdef SD_PROFILE
+        DebugWriteChar('B');
+#endif
+        return CompleteBlock(&block, blockSize);
+    }
+
     UInt16 crc = CRC16_ZERO;
     /* We read our data block into the destination buffer*/
     for (int i = 0; i < blockSize; i++) {
@@ -581,6 +745,214 @@ static SdStatus ReadDataBlock(BYTE* destination, UInt16 blockSize) {
     return SdStatusOk;
 }
 
+static SdStatus ReadDataBlocksPipelined(BYTE* destination, UInt16 blockSize, UInt32 count) {
+    DebugAssert(count > 0);
+
+    // Blocks alternate between two slots: while the DMA fills the slot of block N + 1, the CPU verifies
+    // (and eventually moves from the bounce buffer) block N
+    PendingBlock blocks[SD_DMA_BOUNCE_SLOTS];
+    PendingBlock* pending = NULL;
+
+    for (UInt32 i = 0; i < count; i++) {
+        SdStatus status = WaitStartBlockToken();
+        if (status != SdStatusOk) {
+            return status;
+        }
+
+#ifdef SD_PROFILE
+        DebugWriteChar('b');
+#endif
+
+        BYTE slot = (BYTE)(i % SD_DMA_BOUNCE_SLOTS);
+        PendingBlock* current = &blocks[slot];
+        current->destination = destination;
+        current->data = GetDMATarget(destination, slot);
+        StartBlockDMA(current->data, blockSize);
+
+        // Previous block is verified while the current one is being clocked
+        SdStatus pendingStatus = pending != NULL ? CompleteBlock(pending, blockSize) : SdStatusOk;
+
+        // Even if the previous block is corrupted, we must wait for the DMA before leaving
+        status = WaitBlockDMA();
+        if (status != SdStatusOk) {
+            return status;
+        }
+        if (pendingStatus != SdStatusOk) {
+            return pendingStatus;
+        }
+        ReadBlockCRC(current);
+
+#ifdef SD_PROFILE
+        DebugWriteChar('B');
+#endif
+
+        pending = current;
+        destination += blockSize;
+    }
+
+    // Last block has no following transfer to overlap with
+    return CompleteBlock(pending, blockSize);
+}
+
+static void InitializeDMA() {
+    // Requests are hardwired to the SPI2 peripheral
+    DebugAssert(_spiInstance == SPI2);
+
+    __HAL_RCC_DMA1_CLK_ENABLE();
+    StopDMA();
+
+    // Streams are configured once: each transfer only sets the buffer address and the length.
+    // Both streams work in direct mode (no FIFO) with byte transfers. RX has a higher priority than TX
+    // so that a received byte is always read before the next one is clocked (no SPI overrun)
+    SD_DMA_RX_STREAM->CR = DMA_SxCR_PL_1 | DMA_SxCR_MINC | DMA_SxCR_TCIE | DMA_SxCR_TEIE;
+    SD_DMA_RX_STREAM->PAR = (UInt32)&_spiInstance->DR;
+    SD_DMA_RX_STREAM->FCR = 0;
+
+    // TX stream always sends the same dummy byte, so the memory address is not incremented
+    SD_DMA_TX_STREAM->CR = DMA_SxCR_PL_0 | DMA_SxCR_DIR_0;
+    SD_DMA_TX_STREAM->PAR = (UInt32)&_spiInstance->DR;
+    SD_DMA_TX_STREAM->M0AR = (UInt32)&_dmaDummyByte;
+    SD_DMA_TX_STREAM->FCR = 0;
+
+    // Transfer completion is signaled only by the RX stream (the last byte is received after the last one is sent)
+    // The IRQ uses the OS API so its priority cannot be higher than configLIBRARY_MAX_SYSCALL_INTERRUPT_PRIORITY
+    HAL_NVIC_SetPriority(DMA1_Stream3_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Stream3_IRQn);
+
+    // Bounce buffers are allocated once, before the frame buffer, and never released
+    _dmaBounceBuffers = (BYTE*)ralloc(SD_DMA_BOUNCE_SLOTS * SD_DATA_BLOCK_SIZE);
+    if (_dmaBounceBuffers == NULL) {
+        printf("Cannot allocate the SD DMA buffer. Blocks in CCM will be polled\r\n");
+    }
+}
+
+static BOOL CanUseDMA(const BYTE* destination, UInt16 blockSize) {
+#ifdef SD_USE_DMA
+    if (blockSize < SD_DMA_MIN_BLOCK_SIZE) {
+        return false;
+    }
+
+    // The task must be able to wait for the completion: no DMA before the scheduler starts or inside an IRQ
+    if (osKernelGetState() != osKernelRunning || __get_IPSR() != 0) {
+        return false;
+    }
+
+    UInt32 address = (UInt32)destination;
+    if (address >= SD_CCMRAM_START && address < SD_CCMRAM_END) {
+        return _dmaBounceBuffers != NULL && blockSize <= SD_DATA_BLOCK_SIZE;
+    }
+    return true;
+#else
+    return false;
+#endif
+}
+
+static void StopDMA() {
+    CLEAR_BIT(SD_DMA_RX_STREAM->CR, DMA_SxCR_EN);
+    CLEAR_BIT(SD_DMA_TX_STREAM->CR, DMA_SxCR_EN);
+    // Streams are effectively stopped only when the EN bit reads back as zero [RM0090 - Section 10.3.17]
+    while (READ_BIT(SD_DMA_RX_STREAM->CR, DMA_SxCR_EN) || READ_BIT(SD_DMA_TX_STREAM->CR, DMA_SxCR_EN)) {
+
+    }
+    SET_BIT(DMA1->LIFCR, SD_DMA_RX_CLEAR_FLAGS);
+    SET_BIT(DMA1->HIFCR, SD_DMA_TX_CLEAR_FLAGS);
+}
+
+static BYTE* GetDMATarget(BYTE* destination, BYTE slot) {
+    DebugAssert(slot < SD_DMA_BOUNCE_SLOTS);
+
+    UInt32 address = (UInt32)destination;
+    if (address >= SD_CCMRAM_START && address < SD_CCMRAM_END) {
+        return &_dmaBounceBuffers[slot * SD_DATA_BLOCK_SIZE];
+    }
+    return destination;
+}
+
+static void StartBlockDMA(BYTE* target, UInt16 blockSize) {
+    // Flags of a previous timed out transfer must not wake us up
+    osThreadFlagsClear(SD_DMA_FLAG_COMPLETE | SD_DMA_FLAG_ERROR);
+    _dmaWaitingThread = osThreadGetId();
+
+    SET_BIT(DMA1->LIFCR, SD_DMA_RX_CLEAR_FLAGS);
+    SET_BIT(DMA1->HIFCR, SD_DMA_TX_CLEAR_FLAGS);
+    SD_DMA_RX_STREAM->M0AR = (UInt32)target;
+    SD_DMA_RX_STREAM->NDTR = blockSize;
+    SD_DMA_TX_STREAM->NDTR = blockSize;
+
+    // Enable sequence of RM0090 [Section 28.3.9]: RX requests are enabled before the TX ones
+    // so that the first received byte is not lost
+    SET_BIT(_spiInstance->CR2, SPI_CR2_RXDMAEN);
+    SET_BIT(SD_DMA_RX_STREAM->CR, DMA_SxCR_EN);
+    SET_BIT(SD_DMA_TX_STREAM->CR, DMA_SxCR_EN);
+    SET_BIT(_spiInstance->CR2, SPI_CR2_TXDMAEN);
+}
+
+static SdStatus WaitBlockDMA() {
+    // The task is blocked here, other tasks can run while the block is clocked
+    UInt32 flags = osThreadFlagsWait(SD_DMA_FLAG_COMPLETE | SD_DMA_FLAG_ERROR, osFlagsWaitAny, SD_DMA_TIMEOUT);
+
+    CLEAR_BIT(_spiInstance->CR2, SPI_CR2_TXDMAEN | SPI_CR2_RXDMAEN);
+
+    if (osExResultIsFlagsErrorCode(flags) || (flags & SD_DMA_FLAG_ERROR) != 0) {
+        _dmaWaitingThread = NULL;
+        StopDMA();
+
+        // We discard a byte that may be left in the data register
+        (void)_spiInstance->DR;
+        return flags == (UInt32)osFlagsErrorTimeout ? SdStatusCommunicationTimeout : SdStatusDMAError;
+    }
+    return SdStatusOk;
+}
+
+static void ReadBlockCRC(PendingBlock* block) {
+    for (int i = 0; i < SD_DATA_CRC_SIZE; i++) {
+        block->crc[i] = ReadByte();
+    }
+}
+
+static SdStatus CompleteBlock(const PendingBlock* block, UInt16 blockSize) {
+#ifndef SD_PROFILE
+    UInt16 crc = Crc16Update(CRC16_ZERO, block->data, blockSize);
+    crc = Crc16Update(crc, block->crc, SD_DATA_CRC_SIZE);
+
+    // If CRC is not zero, we have a communication problem
+    if (crc != 0) {
+        return SdStatusReadCorrupted;
+    }
+#endif
+
+    if (block->data != block->destination) {
+        memcpy(block->destination, block->data, blockSize);
+    }
+    return SdStatusOk;
+}
+
+void DMA1_Stream3_IRQHandler(void) {
+    UInt32 dmaStatus = DMA1->LISR;
+    SET_BIT(DMA1->LIFCR, SD_DMA_RX_CLEAR_FLAGS);
+
+    UInt32 flags = 0;
+    if ((dmaStatus & DMA_LISR_TEIF3) != 0) {
+        flags = SD_DMA_FLAG_ERROR;
+    }
+    else if ((dmaStatus & DMA_LISR_TCIF3) != 0) {
+        flags = SD_DMA_FLAG_COMPLETE;
+    }
+
+    osThreadId_t waitingThread = _dmaWaitingThread;
+    if (flags == 0 || waitingThread == NULL) {
+        // Transfer was aborted by the waiting task
+        return;
+    }
+
+    _dmaWaitingThread = NULL;
+    UInt32 result = osThreadFlagsSet(waitingThread, flags);
+    if (osExResultIsFlagsErrorCode(result)) {
+        // Something wrong happened, better stop everything
+        Error_Handler();
+    }
+}
+
 static SdStatus ReadRegister(SdCommand readCommand, UInt16 length) {
     DebugAssert(length <= SD_MAX_REGISTER_SIZE);
 
@@ -638,20 +1010,19 @@ SdStatus FixWithCSDRegister() {
     PCCsdRegister csd = (PCCsdRegister)_registersBuffer;
     _attachedSdCard.MaxTransferSpeed = SdCsdGetMaxTransferRate(csd);
     _attachedSdCard.BlockLen = SdCsdGetMaxReadDataBlockLength(csd);
+    _attachedSdCard.SectorCount = SdCsdGetSectorCount(csd);
+    _attachedSdCard.EraseSectorSize = SdCsdGetEraseSectorSize(csd);
 
     printf("Max transfer speed is ");
     FormatFrequency((float)_attachedSdCard.MaxTransferSpeed);
     printf("\r\n");
 
     printf("Read block length is %" PRIu16 " bytes\r\n", _attachedSdCard.BlockLen);
+    printf("Card capacity is %" PRIu32 " sectors\r\n", _attachedSdCard.SectorCount);
 
-    // SPI2 is on PCLK1
-    UInt32 spi2Freq = HAL_RCC_GetPCLK1Freq();
-    // As stated in the RM0090, the SPI baud rate control can be changed with the peripheral enabled but not when a transfer is ongoing
-    DebugAssert(((UInt32)((float)spi2Freq / 2.0f)) < _attachedSdCard.MaxTransferSpeed);
-
-    // Max baud rate
-    CLEAR_BIT(_spiHandle->Instance->CR1, SPI_CR1_BR);
+    // SPI2 is on PCLK1. The governor starts from the fastest rate within the card TRAN_SPEED
+    SdClockGovernorInitialize(&_clockGovernor, HAL_RCC_GetPCLK1Freq(), _attachedSdCard.MaxTransferSpeed);
+    SetSpiPrescaler(_clockGovernor.prescaler);
     PrintSpiFrequency();
 
     return SdStatusOk;
@@ -692,6 +1063,13 @@ SdStatus SdInitialize(GPIO_TypeDef* powerGPIO, UInt16 powerPin, SPI_HandleTypeDe
     DebugAssert((_spiHandle->Instance->CR1 & SPI_CR1_BIDIMODE) == 0);
     DebugAssert((_spiHandle->Instance->CR1 & SPI_CR1_RXONLY) == 0);
 
+    InitializeDMA();
+
+    // The cycle counter measures the time spent in the read transactions
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+    SdResetStatistics();
+
     return SdStatusOk;
 }
 
@@ -815,6 +1193,9 @@ SdStatus SdReadSector(BYTE* destination, UInt32 sector) {
         address *= _attachedSdCard.BlockLen;
     }
 
+    UInt32 startCycle = GetCycleCount();
+    _statistics.singleBlockReads++;
+
     // Let's select the SPI by asserting LOW the NSS pin
     SelectCard();
 
@@ -833,53 +1214,103 @@ SdStatus SdReadSector(BYTE* destination, UInt32 sector) {
     result = SdStatusOk;
 cleanup: 
     DeselectCard();
+    UpdateClockGovernor(result);
+    AccountRead(result, startCycle, 1);
     return result;
 }
 
 SdStatus SdReadSectors(BYTE* destination, UInt32 sector, UInt32 count) {
-    UInt32 address = sector;
+    SdStatus result = SdReadSectorsBegin(sector);
+    if (result == SdStatusOk) {
+        SdReadSectorsNext(destination, count);
+    }
+    // The stream status includes the errors of the single steps
+    return SdReadSectorsEnd();
+}
 
-    UInt16 blockSize = _attachedSdCard.BlockLen;
+SdStatus SdReadSectorsBegin(UInt32 sector) {
+    DebugAssert(!_readStream.open);
+
+    UInt32 address = sector;
     if (_attachedSdCard.AddressingMode == SDAddressingModeByte) {
-        address *= blockSize;
+        address *= _attachedSdCard.BlockLen;
     }
 
+    _readStream.startCycle = GetCycleCount();
+    _readStream.sectors = 0;
+    _statistics.multipleBlockReads++;
+
     SelectCard();
+    _readStream.open = true;
+    _readStream.status = SdStatusOk;
 
-    SdStatus result;
     SBYTE commandResult = PerformCommandTransaction(SdCmd18ReadMultipleBlock, address, sizeof(ResponseR1));
     if (commandResult < 0) {
-        result = (SdStatus)commandResult;
-        goto cleanup;
+        _readStream.status = (SdStatus)commandResult;
     }
+    _readStream.transmitting = commandResult >= 0;
+    return _readStream.status;
+}
 
-    do {
-        result = ReadDataBlock(destination, blockSize);
-        if (result != SdStatusOk) {
-            // Do we need to send a stop command here?
-            goto cleanup;
-        }
+SdStatus SdReadSectorsNext(BYTE* destination, UInt32 count) {
+    DebugAssert(_readStream.open);
 
-        // Move destination ptr forward
-        destination += blockSize;
-    } while (--count);
+    // After an error the card is no more sending the blocks we expect
+    if (_readStream.status != SdStatusOk || count == 0) {
+        return _readStream.status;
+    }
 
-    commandResult = PerformCommandTransaction(SdCmd12StopTransmission, 0, sizeof(ResponseR1));
-    if (commandResult < 0) {
-        result = (SdStatus)commandResult;
-        // In our test SD the CMD 12 returns a R1 with all the bits set to 1
-        // but everything works fines, so let's forget about the error
-        // goto cleanup;
+    UInt16 blockSize = _attachedSdCard.BlockLen;
+    SdStatus result;
+    if (CanUseDMA(destination, blockSize)) {
+        result = ReadDataBlocksPipelined(destination, blockSize, count);
     }
+    else {
+        UInt32 remaining = count;
+        do {
+            result = ReadDataBlock(destination, blockSize);
 
-    BYTE lineBusy;
-    do {
-        lineBusy = ReadByte();
-    } while (lineBusy == 0);
+            // Move destination ptr forward
+            destination += blockSize;
+        } while (result == SdStatusOk && --remaining);
+    }
+
+    if (result == SdStatusOk) {
+        _readStream.sectors += count;
+    }
+    _readStream.status = result;
+    return result;
+}
+
+SdStatus SdReadSectorsEnd() {
+    DebugAssert(_readStream.open);
+
+    SdStatus result = _readStream.status;
+    // Once CMD18 has been accepted, the card stays in the multiple block transfer until the stop command, also when
+    // a block was corrupted or the DMA timed out. Without the stop, the next read command would fail
+    if (_readStream.transmitting) {
+        SBYTE commandResult = PerformCommandTransaction(SdCmd12StopTransmission, 0, sizeof(ResponseR1));
+        if (commandResult < 0) {
+            // In our test SD the CMD 12 returns a R1 with all the bits set to 1
+            // but everything works fines, so let's forget about the error
+        }
+
+        BYTE lineBusy;
+        UInt32 startTick = HAL_GetTick();
+        do {
+            lineBusy = ReadByte();
+        } while (lineBusy == 0 && ((HAL_GetTick() - startTick) < SD_STOP_BUSY_TIMEOUT));
+
+        if (lineBusy == 0 && result == SdStatusOk) {
+            result = SdStatusCommunicationTimeout;
+        }
+        _readStream.transmitting = false;
+    }
 
-    result = SdStatusOk;
-cleanup:
     DeselectCard();
+    _readStream.open = false;
+    UpdateClockGovernor(result);
+    AccountRead(result, _readStream.startCycle, _readStream.sectors);
     return result;
 }
 
@@ -930,12 +1361,52 @@ void SdDumpStatusCode(SdStatus status) {
     case SdStatusECCFailed:
         printf("ECC failed");
         break;
+    case SdStatusDMAError:
+        printf("DMA transfer error");
+        break;
     default:
         printf("%" PRId32 ", unknown status", (Int32)status);
         break;
     }
 }
 
+PCSDDescription SdGetCardDescription() {
+    return &_attachedSdCard;
+}
+
+void SdGetStatistics(SdStatistics* statistics) {
+    *statistics = _statistics;
+}
+
+void SdResetStatistics() {
+    memset(&_statistics, 0, sizeof(SdStatistics));
+    _statistics.startTick = HAL_GetTick();
+}
+
+void SdDumpStatistics() {
+    // Ticks are milliseconds
+    UInt32 elapsed = HAL_GetTick() - _statistics.startTick;
+    UInt32 transactions = _statistics.singleBlockReads + _statistics.multipleBlockReads;
+    float readSeconds = (float)_statistics.readCycles / (float)SystemCoreClock;
+
+    printf("SD activity in %" PRIu32 " ms: %" PRIu32 " commands", elapsed, _statistics.commands);
+    if (elapsed > 0) {
+        printf(" (%.0f/s)", ((float)_statistics.commands * 1000.0f) / (float)elapsed);
+    }
+    printf("\r\n");
+    printf("Clock governor: %" PRIu32 " bus speed changes. ", _statistics.clockChanges);
+    PrintSpiFrequency();
+    printf("Reads: %" PRIu32 " single block, %" PRIu32 " multiple block, %" PRIu32 " corrupted\r\n",
+        _statistics.singleBlockReads, _statistics.multipleBlockReads, _statistics.corruptedReads);
+    printf("Sectors: %" PRIu32 " in %.1f ms", _statistics.sectors, readSeconds * 1000.0f);
+    if (transactions > 0 && _statistics.sectors > 0) {
+        printf(" (%.2f MB/s, %" PRIu32 " cycles per sector)",
+            ((float)_statistics.sectors * (float)SD_DATA_BLOCK_SIZE) / (readSeconds * 1000000.0f),
+            (UInt32)(_statistics.readCycles / _statistics.sectors));
+    }
+    printf("\r\n");
+}
+
 SdStatus SdShutdown() {
     printf("Performing SD power off cycle ...\r\n");
     // Preamble: we shutdown the SPI interface to later re-enabled it
@@ -126,10 +126,16 @@ void EdidDumpStructure(const Edid *edid) {
 		printf("\t\t800x600 @ 60Hz \033[1;31mNOT supported\033[0m\r\n");
 	}
 
-	if (EdidIsTimingSupported(edid, EdidTiming1024x728At60Hz)) {
-		printf("\t\t1024x728 @ 60Hz \033[1;32msupported\033[0m\r\n");
+	if (EdidIsTimingSupported(edid, EdidTiming800x600At72Hz)) {
+		printf("\t\t800x600 @ 72Hz \033[1;32msupported\033[0m\r\n");
 	} else {
-		printf("\t\t1024x728 @ 60Hz \033[1;31mNOT supported\033[0m\r\n");
+		printf("\t\t800x600 @ 72Hz \033[1;31mNOT supported\033[0m\r\n");
+	}
+
+	if (EdidIsTimingSupported(edid, EdidTiming1024x768At60Hz)) {
+		printf("\t\t1024x768 @ 60Hz \033[1;32msupported\033[0m\r\n");
+	} else {
+		printf("\t\t1024x768 @ 60Hz \033[1;31mNOT supported\033[0m\r\n");
 	}
 
 	printf("\tDescriptor 2\r\n");
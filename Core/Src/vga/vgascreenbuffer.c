@@ -1,10 +1,14 @@
 #include <vga/vgascreenbuffer.h>
+#include <fonts/textfont.h>
 #include <assertion.h>
 #include <ram.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <console.h>
 #include <binary.h>
+#include <intmath.h>
+#include <string.h>
+#include <cmsis_os.h>
 
 #ifdef _DEBUG
 #define DRAWPIXELASSERT
@@ -12,17 +16,78 @@
 // #define DEBUGWRITE
 #endif // _DEBUG
 
+/// Max time (in ms) we wait for the vertical blanking when swapping the buffers
+#define SWAP_BUFFERS_TIMEOUT 100
+/// Max pixel frequency (in Hz) that the line DMA can sustain when writing the pixels to the GPIO port
+#define VGA_MAX_PIXEL_FREQUENCY 20000000U
+/// Max distance between the generated pixel clock and the requested one, in parts per million.
+/// Monitors lock on the sync signals, so a small error only shifts the refresh rate
+#define VGA_PIXEL_CLOCK_TOLERANCE_PPM 5000U
+/// Max scaling considered when selecting a video mode
+#define VGA_MAX_SCALING 4
+/// Line buffer entry of a line buffer that does not contain any frame buffer line
+#define PALETTIZED_LINE_NONE 0xFFFF
+/// The 8bpp and the palettized modes output the pixels with the 8bpp line DMA
+#define HAS_LINE_DMA(bpp) ((bpp) == Bpp8 || (bpp) == Bpp4 || (bpp) == Bpp2)
+/// Palettized modes store a palette index for each pixel
+#define IS_PALETTIZED(bpp) ((bpp) == Bpp4 || (bpp) == Bpp2)
+/// Time (in ns) between the DMA start interrupt and the first visible pixel. The line DMA needs it to react to the
+/// interrupt and to fill its FIFO. The value has been measured on the 800x600 frame (18 pixels at 20MHz)
+#define VGA_DMA_START_LEAD_NS 900U
+/// Limits of the main PLL: input after the M divider, VCO output, N multiplier and 48MHz output
+#define VGA_PLL_MIN_INPUT 1000000U
+#define VGA_PLL_MAX_INPUT 2000000U
+#define VGA_PLL_MIN_VCO 100000000U
+#define VGA_PLL_MAX_VCO 432000000U
+#define VGA_PLL_MIN_N 50U
+#define VGA_PLL_MAX_N 432U
+#define VGA_PLL_MAX_Q 15U
+#define VGA_PLL_MAX_Q_OUTPUT 48000000U
+/// Max system clock with the regulator in scale 1
+#define VGA_MAX_SYSTEM_CLOCK 168000000U
+/// Max APB1 clock of a planned clock tree. The SD card SPI prescaler is chosen from PCLK1 when the card connects:
+/// a bus faster than the 30MHz of the board default would push a connected card over its transfer speed
+#define VGA_MAX_APB1_FREQUENCY 30000000U
+/// Min HCLK cycles for each pixel. The line DMA and the sync interrupts have been tuned at 120MHz with the 20MHz
+/// pixel clock: a slower core would not keep up with the line rate
+#define VGA_MIN_CYCLES_PER_PIXEL 6U
+/// HCLK range of each flash wait state at 3.3V
+#define VGA_FLASH_WAIT_STATE_FREQUENCY 30000000U
+/// Clock tree programmed by SystemClock_Config: PLL 8MHz / 4 * 120 / 2 = 120MHz, APB buses divided by 4
+#define VGA_DEFAULT_PLL_M 4U
+#define VGA_DEFAULT_PLL_N 120U
+#define VGA_DEFAULT_PLL_P 2U
+#define VGA_DEFAULT_APB_SHIFT 2U
+
 extern void Error_Handler();
 
 // ##### Private forward declarations #####
 
 typedef struct _VgaScreenBuffer VgaScreenBuffer;
+typedef struct _VgaMode VgaMode;
+typedef struct _VgaClockTree VgaClockTree;
+/// Renders a frame buffer line into a native line buffer read by the line DMA
+/// \param line Frame buffer line (entry of the line table)
+/// \param dest Line buffer of linePixels native pixels
+typedef void (*LineRenderCallback)(const VgaScreenBuffer* screenBuffer, UInt16 line, BYTE* dest);
+
+/// Creates and registers a new VGA buffer. Shared by the bitmap and the text modes
+/// \param textMode True to allocate a character grid instead of a frame buffer
+/// \param vgaBuffer [Out] Created buffer
+static VgaError CreateVgaBuffer(const VgaVisualizationInfo* info, BOOL textMode, VgaScreenBuffer** vgaBuffer);
+/// Releases all the resources of a VGA buffer created by CreateVgaBuffer
+static VgaError ReleaseVgaBuffer(VgaScreenBuffer* vgaBuffer);
 
 /// \brief  Creates a new frame buffer using the specified informations
 /// \param info Information about screen resolution, timings, ecc
 /// \param buffer [Out] Buffer informations
 /// \return VgaErrorNone if everything is ok
 static VgaError AllocateFrameBuffer(const VgaVisualizationInfo* info, VgaScreenBuffer* buffer);
+/// Creates the character grid, the font cells and the line buffers of the text mode
+/// \param info Information about screen resolution, timings, ecc
+/// \param buffer [Out] Buffer informations
+/// \return VgaErrorNone if everything is ok
+static VgaError AllocateTextBuffer(const VgaVisualizationInfo* info, VgaScreenBuffer* buffer);
 /// Checks and calculates the new video timings using the timings provided in the initialization info 
 /// @param info Initialization information
 /// @param newTimings Scaled pTiming
@@ -32,6 +97,16 @@ static VgaError CorrectVideoFrameTimings(const VgaVisualizationInfo* info, VgaVi
 /// \param pixelPtr Screen buffer pointer
 /// \param color Pixel color
 static void Draw8bppPixelWithAlpha(BYTE* pixelPtr, ARGB8Color color);
+/// \brief Returns the table that maps a background pixel to the pixel blended with the color
+/// \param color Blended color. The alpha is the opacity at full coverage
+/// \param level Coverage level, from 1 to BLEND_LEVELS (included). At BLEND_LEVELS the color alpha is used as is
+/// \remarks Tables are built on first use and they remain valid until a different color is requested
+static const BYTE* GetBlendTable(ARGB8Color color, BYTE level);
+/// \brief Blends a color component over the native levels of the same component
+/// \param levels Destination array with one entry for each native level
+/// \param levelShift Shift that converts a native level into the component MSBs
+/// \param resultShift Shift that converts the blended component into the native level
+static void BuildComponentBlend(BYTE* levels, int levelCount, int levelShift, int resultShift, BYTE component, int alpha);
 /// \brief Draw a single pixel in the specified point using the speficied pen
 /// \param pixel Pixel location
 /// \param pen Pixel pen
@@ -42,6 +117,60 @@ static void DrawPixel(PointS pixel, const Pen* pen);
 /// \remarks This function allows some optimizations when drawing the same color on a large part of the screen
 /// (clearing the entire screen for example)
 static void DrawPixelPack(PointS pixel, const Pen* pen);
+/// \brief Fills the pixels [xStart; xEnd) of a line using the specified pen
+/// \remarks Opaque colors are written 4 pixels at the time with word stores
+static void DrawSpan(Int16 y, Int16 xStart, Int16 xEnd, const Pen* pen);
+/// \brief Converts and copies a line of 24bit BGR pixels into the buffer
+static void BlitSpan(Int16 y, Int16 x, PCBYTE source, Int16 count, ScreenDither dither);
+/// \brief Converts and copies a line of 24bit BGR pixels into native pixels without dithering
+static void BlitSpanUndithered(BYTE* pixelPtr, PCBYTE source, Int16 count);
+/// \brief Converts and copies a line of 24bit BGR pixels into the buffer applying the Bayer ordered dithering
+static void BlitSpanOrdered(BYTE* pixelPtr, Int16 y, Int16 x, PCBYTE source, Int16 count);
+/// \brief Converts and copies a line of 24bit BGR pixels into the buffer applying the Floyd-Steinberg dithering
+static void BlitSpanErrorDiffusion(VgaScreenBuffer* buffer, BYTE* pixelPtr, Int16 y, Int16 x, PCBYTE source, Int16 count);
+/// \brief Blends the pen color over a line of pixels using the coverage of each pixel
+static void BlendSpan(Int16 y, Int16 x, PCBYTE coverage, Int16 count, const Pen* pen);
+/// \brief Returns the back buffer address of a pixel in 8bpp mode
+static BYTE* Get8bppPixelAddress(const VgaScreenBuffer* buffer, Int16 x, Int16 y);
+/// \brief Makes the content of the back buffer visible on the screen
+/// \param region Areas modified since the last present
+/// \remarks The buffers are exchanged in the vertical blanking and the modified spans are then copied into the new
+/// back buffer, so the two buffers remain aligned and the application can keep drawing on top of the presented frame
+static void PresentBackBuffer(const ScreenDirtyRegion* region);
+/// Copies the modified spans of a region between two frame buffers
+static void CopyPresentSpans(const VgaScreenBuffer* buffer, const ScreenDirtyRegion* region, const BYTE* source, BYTE* dest);
+/// Exchanges the front and back buffer pointers
+static void SwapBufferPointers(VgaScreenBuffer* screenBuffer);
+/// Exchanges the front and back buffers at the next vertical blanking and waits for the exchange
+/// @return VGAErrorInvalidState if the exchange did not happen within SWAP_BUFFERS_TIMEOUT
+static VgaError WaitBufferSwap(VgaScreenBuffer* screenBuffer);
+/// Returns the native color of a pixel of the back buffer in the palettized modes
+static BYTE ReadPalettizedPixel(const VgaScreenBuffer* buffer, Int16 x, Int16 y);
+/// Writes the palette index of a pixel of the back buffer in the palettized modes
+static void WritePalettizedPixel(const VgaScreenBuffer* buffer, Int16 x, Int16 y, BYTE index);
+/// Converts a span of the back buffer into native colors
+/// @return Pointer to the native color of the first pixel, in the conversion line of the buffer
+static BYTE* UnpackSpan(const VgaScreenBuffer* buffer, Int16 y, Int16 x, Int16 count);
+/// Writes a span of native colors into the back buffer, mapping them to the nearest palette entry
+/// \param source Native colors, as returned by UnpackSpan
+static void PackSpan(const VgaScreenBuffer* buffer, Int16 y, Int16 x, PCBYTE source, Int16 count);
+/// Fills the pixels [xStart; xEnd) of a line in the palettized modes
+/// \remarks Opaque colors are written a word at the time
+static void DrawPalettizedSpan(const VgaScreenBuffer* buffer, Int16 y, Int16 xStart, Int16 xEnd, ARGB8Color color);
+/// Returns a frame buffer word with all the pixels set to the palette entry
+static UInt32 GetPalettizedWord(const VgaScreenBuffer* buffer, BYTE index);
+/// Returns the squared distance between two native colors, with the components on the 0-255 scale
+static Int32 GetNativeColorDistance(BYTE first, BYTE second);
+/// Builds the tables used to convert between native colors and palette indexes
+static void BuildPaletteTables(VgaScreenBuffer* buffer);
+/// Expands a frame buffer line of the front buffer through the palette
+/// \param dest Line buffer that will be read by the line DMA
+static void UnpackLine(const VgaScreenBuffer* screenBuffer, UInt16 line, BYTE* dest);
+/// Renders a line of the character grid: the glyph row of each cell is drawn with the cell colors
+/// \param dest Line buffer that will be read by the line DMA
+static void RenderTextLine(const VgaScreenBuffer* screenBuffer, UInt16 line, BYTE* dest);
+/// Renders the line of the next scanline in the line buffer that is not being displayed
+static void PrepareNextRenderedLine(VgaScreenBuffer* screenBuffer);
 /// Disables the DMA stream 
 static void DisableLineDMA(DMA_Stream_TypeDef* dmaStream);
 ///\brief Get the sum of all the pixels count in a VgaTiming instance
@@ -53,14 +182,58 @@ static void HandleDMALineEndFor8Bpp(VgaScreenBuffer* screenBuffer);
 /// \param timing Valid pointer to a VgaTiming structure
 /// \return Status of the validation
 static VgaError ValidateTiming(const VgaTiming* timing);
+/// Builds the table of the frame buffer line displayed in each scanline
+/// @param visibleLines Number of visible lines of the frame
+/// @param height Number of lines of the frame buffer
+/// @return Status of the operation
+static VgaError BuildLineTable(VgaScreenBuffer* screenBuffer, UInt16 visibleLines, UInt16 height);
 /// Scales the timing contained in a VgaTiming structure by a certain factor
 /// @param timing 
 /// @param scale Factor of the scaling
 /// @param dest 
 static void ScaleTiming(const VgaTiming* timing, BYTE scale, VgaTiming* dest);
+/// Programs a clock tree that generates the pixel clock, if the current one cannot
+/// @param pixelMHzFreq Scaled pixel frequency
+/// @return VgaErrorNotSupported if no clock tree generates the pixel clock
+/// \remarks The VGA output must be stopped. VgaClockTreeChangedCallback is called after a change
 static VgaError SetupMainClockTree(float pixelMHzFreq);
+/// Finds the clock tree that generates the pixel clock: the board default if it can, otherwise the one with the
+/// fastest system clock and then the smallest pixel clock error
+/// @param pixelMHzFreq Scaled pixel frequency
+/// @param tree [Out] Selected clock tree
+/// @return False if no clock tree generates the pixel clock
+static BOOL PlanMainClockTree(float pixelMHzFreq, VgaClockTree* tree);
+/// Checks the limits of a clock tree derived from the HSE and calculates its frequencies
+/// @param pixelMHzFreq Scaled pixel frequency
+/// @param apbShift Log2 of the divider of both the APB buses
+/// @param tree [Out] Clock tree
+/// @return False if the clock tree exceeds a limit or cannot generate the pixel clock
+static BOOL BuildClockTree(float pixelMHzFreq, UInt32 pllM, UInt32 pllN, UInt32 pllP, UInt32 apbShift, VgaClockTree* tree);
+/// Checks if the pixel clock can be generated, with the current clock tree or with a planned one
+static BOOL IsPixelClockSupported(float pixelMHzFreq);
+/// Returns the clock of the timers on APB1 (the main timer) with the current clock tree
+static UInt32 GetTimersClock();
+/// Calculates the main timer period that generates the pixel clock from the timers clock
+/// @param pixelMHzFreq Scaled pixel frequency
+/// @param timersFreq Clock of the main timer (Hz)
+/// @return Period in timers clock cycles or 0 if the frequency cannot be generated
+static UInt32 GetPixelClockPeriod(float pixelMHzFreq, UInt32 timersFreq);
+/// Converts the DMA start lead time in pixels
+/// @param pixelMHzFreq Scaled pixel frequency
+static UInt32 GetDMAStartLeadPixels(float pixelMHzFreq);
+/// Calculates the frame buffer size of a scaled video mode, using the default height
+/// @param bufferCount Number of frame buffers (2 for a double buffered screen)
+/// @return Size in bytes of all the buffers, including the line buffers of the palettized modes
+static size_t GetFrameBufferSize(const VgaVideoFrameInfo* frame, BYTE scaling, Bpp bpp, BYTE bufferCount);
+/// Finds the mode of the mode table with the largest frame buffer that fits in the free RAM
+/// @param edid EDID of the connected monitor. NULL if all the modes must be considered supported
+/// @param bufferCount Number of frame buffers that must fit in the free RAM
+/// @param scaling [Out] Scaling of the selected mode
+/// @param size [Out] Size of the buffers of the selected mode
+/// @return Selected mode or NULL if no mode can be displayed
+static const VgaMode* FindLargestMode(const Edid* edid, Bpp bpp, BYTE bufferCount, BYTE* scaling, size_t* size);
 /// Setup the hsync and vsync STM timers 
-static VgaError SetupTimers(BYTE resScaling, VgaScreenBuffer* screenBuffer);
+static VgaError SetupTimers(VgaScreenBuffer* screenBuffer);
 /// Completly switches off the DMA for our screen buffer
 static void ShutdownDMAFor8BppBuffer(VgaScreenBuffer* screenBuffer);
 
@@ -69,6 +242,23 @@ static void ShutdownDMAFor8BppBuffer(VgaScreenBuffer* screenBuffer);
 /// Compacts the 24 color bits into a single byte
 /// \remarks Red is only 2 bits (the r byte MSB), Green and Blue are 3 bits
 #define RGB_TO_8BPP(r,g,b) ((((r) >> 6) | (((g) >> 5) << 2) | (((b) >> 5) << 5)) & 0xFF)
+/// Compacts a 24 bit pixel stored in B, G, R order (bitmap order) into a single byte
+#define BGR_PTR_TO_8BPP(ptr) RGB_TO_8BPP((ptr)[2], (ptr)[1], (ptr)[0])
+/// Number of coverage levels that have their own blend table. Coverage of the blended spans is rounded to these levels
+#define BLEND_LEVELS 16
+/// Number of coverage levels of a span that share the same blend table
+#define BLEND_COVERAGE_STEP (SCREEN_COVERAGE_MAX / BLEND_LEVELS)
+/// Number of dithering steps between two adjacent native color levels
+#define DITHER_STEPS 16
+/// Scales a color component to the 3 bits native levels, in DITHER_STEPS units (0 -> 0, 255 -> 7 * DITHER_STEPS)
+#define DITHER_SCALE_3BIT(c) (((c) * ((7 * DITHER_STEPS) + 1)) >> 8)
+/// Scales a color component to the 2 bits native levels, in DITHER_STEPS units (0 -> 0, 255 -> 3 * DITHER_STEPS)
+#define DITHER_SCALE_2BIT(c) (((c) * ((3 * DITHER_STEPS) + 1)) >> 8)
+/// Compacts a 24 bit pixel stored in B, G, R order into a single byte, adding the dithering threshold to each component
+#define BGR_PTR_TO_8BPP_DITHERED(ptr, threshold) \
+    ((((DITHER_SCALE_2BIT((ptr)[2]) + (threshold)) >> 4)) | \
+    (((DITHER_SCALE_3BIT((ptr)[1]) + (threshold)) >> 4) << 2) | \
+    (((DITHER_SCALE_3BIT((ptr)[0]) + (threshold)) >> 4) << 5))
 
 /// Definition for the output state of our VGA driver
 typedef enum _VgaOutputState {
@@ -94,29 +284,92 @@ typedef struct _Bpp8State {
     DMA_Stream_TypeDef* screenLineDMAStream;
 } Bpp8State;
 
+/// State associated to the palettized display modalities
+typedef struct _PalettizedState {
+    /// Native colors of the palette entries
+    BYTE palette[16];
+    /// Number of palette entries
+    BYTE paletteSize;
+    /// Nearest palette entry of each native color
+    BYTE nativeToIndex[256];
+    /// Native colors of the pixels stored in a frame buffer byte. Entry i contains the pixels of the byte i,
+    /// starting from the first one in the LSB (two pixels at 4bpp, four pixels at 2bpp)
+    UInt32 unpackTable[256];
+    /// Native colors of the screen pixels being converted by the drawing functions
+    /// \remarks Only accessed by the CPU, so it can stay in the core coupled memory
+    BYTE* conversionLine;
+    /// Native lines read by the line DMA. One is displayed while the other one is being prepared
+    BYTE* lineBuffers[2];
+    /// Frame buffer line contained in each line buffer (or PALETTIZED_LINE_NONE)
+    UInt16 lineBufferLines[2];
+    /// Line buffer read by the line DMA
+    BYTE activeLineBuffer;
+} PalettizedState;
+
+/// State associated to the text mode
+typedef struct _TextState {
+    /// Character grid exposed to the application
+    /// \remarks Only read by the CPU, so the cells can stay in the core coupled memory
+    VgaTextBuffer grid;
+    /// 1bpp rows of the font characters (see TextFontBuildCells)
+    BYTE* glyphCells;
+} TextState;
+
 /// Internal screen buffer extension
 struct _VgaScreenBuffer {
     /// Base screen buffer definition
     ScreenBuffer base;
     /// Pointer to the allocated native video frame buffer
     BYTE* BufferPtr;
+    /// Pointer to the buffer where all the draw calls are performed
+    /// \remarks If the screen is not double buffered, this is the same as BufferPtr
+    BYTE* BackBufferPtr;
     /// Size of the buffer allocated (in bytes)
+    /// \remarks The size refers to a single frame buffer
     UInt32 bufferSize;
+    /// Number of frame buffers allocated (1 or 2)
+    BYTE bufferCount;
+    /// Flag that indicates that the front and back buffers must be swapped at the next vertical blanking
+    volatile BYTE swapPending;
+    /// Areas of the back buffer modified since the last present
+    ScreenDirtyRegion dirtyRegion;
+    /// Floyd-Steinberg quantization errors (B, G, R) that must be diffused on the next line. The row has a
+    /// guard pixel at both ends, so the error of the screen pixel x is stored at (x + 1) * 3
+    /// \remarks NULL if there was no memory for the row: error diffusion falls back to ordered dithering
+    SBYTE* ditherErrors;
+    /// Last line blitted with the error diffusion. The errors are valid only for the adjacent lines
+    Int16 ditherLine;
+
+    /// Number of bytes of a frame buffer line
+    UInt16 lineBytes;
+    /// Number of pixels stored in a frame buffer byte, as a power of two (0 in the 8bpp mode)
+    BYTE pixelsPerByteLog2;
 
     /// State of the display output depending on the selected color mode
+    /// \remarks Palettized modes output native pixels, so they use the Bpp8 state for the line DMA
     union {
         Bpp8State Bpp8;
     } displayState;
+    /// Palette and line buffers of the palettized modes
+    /// \remarks The text mode outputs 16 colors, so it uses the 4bpp palette and the same line buffers
+    PalettizedState palettized;
+    /// Character grid of the text mode
+    TextState text;
+    /// Function that renders a line into the line buffers. NULL if the line DMA reads the frame buffer directly
+    LineRenderCallback renderLine;
     /// Timing associated to the current frame buffer
     VgaVideoFrameInfo VideoFrameTiming;
     /// Current state of the output
     VgaOutputState outputState;
 
-    /// Lines prescaling constant
-    /// If the resolution is "software" scaled, we may have to display the same line for a given number of real "lines"
-    BYTE linePrescaler;
-    /// Lines prescaler counter. When the counter reaches the prescaling constant, a new line will displayed
-    SBYTE linePrescalerCnt;
+    /// Frame buffer line displayed in each scanline of the frame
+    /// The frame buffer can have less lines than the frame, so the same line may be displayed in more scanlines.
+    /// The first entry is the line prepared in the vertical blanking, before the first visible scanline
+    UInt16* lineTable;
+    /// Number of entries in the line table
+    UInt16 scanlineCount;
+    /// Entry of the line table that is displayed by the current (or next) scanline
+    UInt16 scanline;
 
     /// VGA is in the vertical porch/sync state
     /// \remarks In this stage, the VGA monitor is using the RBG channels as black level calibration so our
@@ -134,10 +387,91 @@ struct _VgaScreenBuffer {
     UInt32 dmaClearFlags;
 };
 
+VgaVideoFrameInfo VideoFrame640x480at60Hz = { 25.175f, { 640, 16, 96, 48 }, { 480, 10, 2, 33 } };
+VgaVideoFrameInfo VideoFrame800x600at56Hz = { 36, { 800, 24, 72, 128 }, { 600, 1, 2, 22 } };
 VgaVideoFrameInfo VideoFrame800x600at60Hz = { 40, { 800, 40, 128, 88 }, { 600, 1, 4, 23 } };
+VgaVideoFrameInfo VideoFrame800x600at72Hz = { 50, { 800, 56, 120, 64 }, { 600, 37, 6, 23 } };
+VgaVideoFrameInfo VideoFrame1024x768at60Hz = { 65, { 1024, 24, 136, 160 }, { 768, 3, 6, 29 } };
+
+/// Video mode known by the driver
+struct _VgaMode {
+    /// Name printed when the mode is selected
+    const char* name;
+    /// Standard VESA timings of the mode
+    const VgaVideoFrameInfo* frame;
+    /// Established timing bit that reports the mode support in the EDID
+    EdidTiming edidTiming;
+};
+
+/// Clock tree that generates a pixel clock: HSE -> PLL -> SYSCLK = HCLK -> APB1 and APB2
+struct _VgaClockTree {
+    UInt32 pllM;
+    UInt32 pllN;
+    /// Division factor of the system clock output (2, 4, 6 or 8)
+    UInt32 pllP;
+    /// Division factor of the 48MHz output, the lowest that keeps it within the limit
+    UInt32 pllQ;
+    /// Log2 of the divider of both the APB buses (at least 2), so that the timers of the two buses share the clock
+    UInt32 apbShift;
+    /// Flash wait states of the system clock
+    UInt32 flashLatency;
+    UInt32 systemClock;
+    /// Clock of the timers, twice the APB clock
+    UInt32 timersClock;
+    /// Main timer period that generates the pixel clock
+    UInt32 pixelClockPeriod;
+    /// Distance between the generated pixel clock and the requested one (Hz)
+    UInt32 pixelClockError;
+};
+
+/// Modes considered by VgaSelectMode. When two modes have the same frame buffer size, the first one that can be
+/// displayed without changing the clock tree is preferred
+static const VgaMode _modes[] = {
+    { "1024x768 @ 60Hz", &VideoFrame1024x768at60Hz, EdidTiming1024x768At60Hz },
+    { "800x600 @ 60Hz", &VideoFrame800x600at60Hz, EdidTiming800x600At60Hz },
+    { "800x600 @ 72Hz", &VideoFrame800x600at72Hz, EdidTiming800x600At72Hz },
+    { "800x600 @ 56Hz", &VideoFrame800x600at56Hz, EdidTiming800x600At56Hz },
+    { "640x480 @ 60Hz", &VideoFrame640x480at60Hz, EdidTiming640x480At60Hz },
+};
 
 static VgaScreenBuffer* volatile _activeScreenBuffer = NULL;
 
+/// Blend tables of the last blended color, one for each coverage level. Entry i of a table is the native pixel i
+/// blended with the color
+/// \remarks Tables are only accessed by the CPU so they can stay in the core coupled memory
+static BYTE _blendTables[BLEND_LEVELS][256];
+/// Color the blend tables refer to
+static UInt32 _blendTablesColor;
+/// Bitmask of the blend tables that have been built for _blendTablesColor
+static UInt32 _blendTablesValid;
+
+/// Default 4bpp palette: the classic 16 colors of the text mode terminals
+static const UInt32 _defaultPalette4bpp[16] = {
+    SCREEN_RGB(0, 0, 0), SCREEN_RGB(0, 0, 170), SCREEN_RGB(0, 170, 0), SCREEN_RGB(0, 170, 170),
+    SCREEN_RGB(170, 0, 0), SCREEN_RGB(170, 0, 170), SCREEN_RGB(170, 85, 0), SCREEN_RGB(170, 170, 170),
+    SCREEN_RGB(85, 85, 85), SCREEN_RGB(85, 85, 255), SCREEN_RGB(85, 255, 85), SCREEN_RGB(85, 255, 255),
+    SCREEN_RGB(255, 85, 85), SCREEN_RGB(255, 85, 255), SCREEN_RGB(255, 255, 85), SCREEN_RGB(255, 255, 255)
+};
+/// Default 2bpp palette: gray levels, so that the antialiased text keeps its smooth edges
+static const UInt32 _defaultPalette2bpp[4] = {
+    SCREEN_RGB(0, 0, 0), SCREEN_RGB(85, 85, 85), SCREEN_RGB(170, 170, 170), SCREEN_RGB(255, 255, 255)
+};
+
+/// Native pixel masks of the 4 pixels of a glyph row nibble. Bit 0 of the nibble is the first pixel, that is
+/// stored in the lowest byte of the word
+static const UInt32 _textPixelMasks[16] = {
+    0x00000000, 0x000000FF, 0x0000FF00, 0x0000FFFF, 0x00FF0000, 0x00FF00FF, 0x00FFFF00, 0x00FFFFFF,
+    0xFF000000, 0xFF0000FF, 0xFF00FF00, 0xFF00FFFF, 0xFFFF0000, 0xFFFF00FF, 0xFFFFFF00, 0xFFFFFFFF
+};
+
+/// Bayer 4x4 threshold matrix, in DITHER_STEPS units
+static const BYTE _bayerMatrix[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 }
+};
+
 // ##### Private Function definitions #####
 
 void TIM1_CC_IRQHandler(void) {
@@ -162,7 +496,7 @@ void TIM1_CC_IRQHandler(void) {
         return;
     }
 
-    if (screenBuffer->base.bitsPerPixel == Bpp8) {
+    if (HAS_LINE_DMA(screenBuffer->base.bitsPerPixel)) {
         HandleHSyncInterruptFor8bpp(screenBuffer, isLineStartIRQ);
     }
 }
@@ -194,6 +528,13 @@ void TIM3_IRQHandler() {
     // The vSyncing flag is indipended from the output buffer color mode
     BYTE isVSyncing = isVisibleFrameEndIRQ != 0;
     screenBuffer->vSyncing = isVSyncing;
+
+    // The visible area has just ended, so the DMA is no more reading the front buffer. We can swap the buffers here,
+    // the HSync handler will then reload the DMA address with the new front buffer during the vertical blanking
+    if (isVSyncing && screenBuffer->swapPending) {
+        SwapBufferPointers(screenBuffer);
+        screenBuffer->swapPending = false;
+    }
     //DebugWriteChar('v' + isVSyncing);
 }
 
@@ -203,7 +544,12 @@ void HandleHSyncInterruptFor8bpp(VgaScreenBuffer* screenBuffer, UInt32 isLineSta
         //DebugWriteChar('V');
 
         DMA_Stream_TypeDef* dmaStream = bpp3State->screenLineDMAStream;
-        if (dmaStream->M0AR != (UInt32)screenBuffer->BufferPtr) {
+        // Rendered modes (palettized and text) display the line buffers, and the first one must be prepared again
+        // at each frame
+        LineRenderCallback renderLine = screenBuffer->renderLine;
+        BYTE* firstLine = renderLine != NULL ? screenBuffer->palettized.lineBuffers[0] : screenBuffer->BufferPtr;
+        if (screenBuffer->scanline != 0 || dmaStream->M0AR != (UInt32)firstLine
+            || (renderLine != NULL && screenBuffer->palettized.lineBufferLines[0] == PALETTIZED_LINE_NONE)) {
             //DebugWriteChar('v');
             // DMA should not be running in our ideal world. But as we already mentioned, the BusMatrix contentions can
             // introduce some latency
@@ -215,13 +561,23 @@ void HandleHSyncInterruptFor8bpp(VgaScreenBuffer* screenBuffer, UInt32 isLineSta
             CLEAR_BIT(screenBuffer->hSyncClockTimer->Instance->DIER, TIM_DMA_TRIGGER);
             DisableLineDMA(dmaStream);
 
-            // VSYNC is raised at the start event one line before the actual start of the frame so we have to make sure that the
-            // end line interrupt will set a prescaler counter at zero to correctly start drawing at the next line
-            screenBuffer->linePrescalerCnt = -1;
+            // VSYNC is raised at the start event one line before the actual start of the frame: the first entry of the
+            // line table covers that line
+            screenBuffer->scanline = 0;
             bpp3State->currentLineOffset = 0;
 
+            if (renderLine != NULL) {
+                // The lines may have been modified (or the buffers swapped) since the previous frame, so none of
+                // the rendered lines can be reused
+                PalettizedState* palettizedState = &screenBuffer->palettized;
+                renderLine(screenBuffer, screenBuffer->lineTable[0], palettizedState->lineBuffers[0]);
+                palettizedState->lineBufferLines[0] = screenBuffer->lineTable[0];
+                palettizedState->lineBufferLines[1] = PALETTIZED_LINE_NONE;
+                palettizedState->activeLineBuffer = 0;
+            }
+
             // We set back the dma to read data from the beginning of the buffer
-            dmaStream->M0AR = ((UInt32)screenBuffer->BufferPtr);
+            dmaStream->M0AR = ((UInt32)firstLine);
             dmaStream->NDTR = (UInt32)bpp3State->linePixels;
             // We enable ONLY the DMA to start the fifo preloading of the data
             SET_BIT(dmaStream->CR, DMA_SxCR_EN);
@@ -236,6 +592,12 @@ void HandleHSyncInterruptFor8bpp(VgaScreenBuffer* screenBuffer, UInt32 isLineSta
 
         // After the DMA start, we can send a little char to the ITM to let the programmer know what is happening
         //DebugWriteChar('S');
+
+        if (screenBuffer->renderLine != NULL) {
+            // The porch is too short to render a whole line, so the next line is rendered while the DMA
+            // is displaying the current one from the other line buffer
+            PrepareNextRenderedLine(screenBuffer);
+        }
     }
     else {
         HandleDMALineEndFor8Bpp(screenBuffer);
@@ -243,6 +605,14 @@ void HandleHSyncInterruptFor8bpp(VgaScreenBuffer* screenBuffer, UInt32 isLineSta
 }
 
 void HandleDMALineEndFor8Bpp(VgaScreenBuffer* screenBuffer) {
+    // Why the stream is re-armed at every line instead of running free in double buffer mode (DBM, with M0AR/M1AR
+    // alternating between the lines):
+    // the DMA requests come from the TIM1 trigger at every pixel clock, and only the TDE bit stops them in the
+    // porch. In normal mode the stream disables itself after exactly one line, so the latency of this interrupt
+    // only delays the blanking. A circular (DBM) stream would keep serving requests until the TDE bit is cleared,
+    // sending the first pixels of the next line during the porch and shifting every following line by the
+    // interrupt latency. The line end interrupt is also needed to force the output to black for the monitor
+    // calibration, so a free running stream would not save any interrupt
     // We are in the porch section, we have a little more time to do all of our stuff
     /* First thing that we have to do: check that the DMA has completed the transfer */
     // The ideal should check if the DMA is completed, otherwhise we have done something wrong with the timing and "raise" and error
@@ -296,23 +666,39 @@ void HandleDMALineEndFor8Bpp(VgaScreenBuffer* screenBuffer) {
      }*/
 
      /* Preparation of a new DMA request */
-     // We clear all the Complete|Half Trasfer completed flags
-    SET_BIT(bpp8State->screenLineDMAController->LIFCR, screenBuffer->dmaClearFlags);
-
-    // Line pixels freq scaling
-    if ((++screenBuffer->linePrescalerCnt) == screenBuffer->linePrescaler) {
-        bpp8State->currentLineOffset += bpp8State->linePixels;
-        screenBuffer->linePrescalerCnt = 0;
-    }
+     // We clear all the Complete|Half Trasfer completed flags. The clear register is write-only, so there
+     // is no need to read it back
+    WRITE_REG(bpp8State->screenLineDMAController->LIFCR, screenBuffer->dmaClearFlags);
 
     // Data items to transfer are always the lines pixels
     // In Mem2Per mode the "items" width are relative to the width of the "peripheral" bus (RM0090 - Section 10.3.10)
     dmaStream->NDTR = bpp8State->linePixels;
-    // Source memory address is simply buffer start + current line offset
-    dmaStream->M0AR = ((UInt32)screenBuffer->BufferPtr) + ((UInt32)bpp8State->currentLineOffset);
 
-    if (bpp8State->currentLineOffset < screenBuffer->bufferSize &&
-        screenBuffer->outputState == VgaOutputActive) {
+    // The line of the next scanline comes from the line table
+    // The transfers do not modify M0AR, so when a line is repeated the address is already the right one
+    // (the buffers are swapped only in the vertical blanking, where the address is reloaded)
+    UInt16 scanline = ++screenBuffer->scanline;
+    if (scanline < screenBuffer->scanlineCount && screenBuffer->renderLine != NULL) {
+        // The line has been rendered during the previous scanline. If the line is repeated, the active line
+        // buffer already contains it
+        PalettizedState* palettizedState = &screenBuffer->palettized;
+        BYTE nextLineBuffer = (BYTE)(palettizedState->activeLineBuffer ^ 1);
+        if (palettizedState->lineBufferLines[nextLineBuffer] == screenBuffer->lineTable[scanline]) {
+            palettizedState->activeLineBuffer = nextLineBuffer;
+            dmaStream->M0AR = (UInt32)palettizedState->lineBuffers[nextLineBuffer];
+        }
+    }
+    else if (scanline < screenBuffer->scanlineCount) {
+        UInt32 lineOffset = (UInt32)screenBuffer->lineTable[scanline] * bpp8State->linePixels;
+        if (lineOffset != bpp8State->currentLineOffset) {
+            bpp8State->currentLineOffset = lineOffset;
+
+            // Source memory address is simply buffer start + current line offset
+            dmaStream->M0AR = ((UInt32)screenBuffer->BufferPtr) + lineOffset;
+        }
+    }
+
+    if (scanline < screenBuffer->scanlineCount && screenBuffer->outputState == VgaOutputActive) {
         // If the buffer is within the limits, we enable the dma stream
         // This will only preload the data in the FIFO (at least in Mem2Per mode) [AN4031- Section 2.2.2]
         SET_BIT(dmaStream->CR, DMA_SxCR_EN);
@@ -330,6 +716,87 @@ void HandleDMALineEndFor8Bpp(VgaScreenBuffer* screenBuffer) {
     }
 }
 
+void PrepareNextRenderedLine(VgaScreenBuffer* screenBuffer) {
+    UInt16 nextScanline = (UInt16)(screenBuffer->scanline + 1);
+    if (nextScanline >= screenBuffer->scanlineCount) {
+        // Last visible line
+        return;
+    }
+
+    PalettizedState* palettizedState = &screenBuffer->palettized;
+    UInt16 line = screenBuffer->lineTable[nextScanline];
+    BYTE freeLineBuffer = (BYTE)(palettizedState->activeLineBuffer ^ 1);
+    if (palettizedState->lineBufferLines[palettizedState->activeLineBuffer] == line
+        || palettizedState->lineBufferLines[freeLineBuffer] == line) {
+        // Repeated line: it is already rendered
+        return;
+    }
+
+    screenBuffer->renderLine(screenBuffer, line, palettizedState->lineBuffers[freeLineBuffer]);
+    palettizedState->lineBufferLines[freeLineBuffer] = line;
+
+    // The line must be ready before the end of the displayed one, otherwise the line end interrupt has been delayed
+    if (READ_BIT(TIM1->SR, TIM_FLAG_CC4) != 0) {
+        Error_Handler();
+    }
+}
+
+void UnpackLine(const VgaScreenBuffer* screenBuffer, UInt16 line, BYTE* dest) {
+    // Lines are word-aligned, so we read the packed pixels one word at the time and we write a word for
+    // each 4 native pixels. The expansion is a table lookup for each byte
+    const UInt32* unpackTable = screenBuffer->palettized.unpackTable;
+    const UInt32* source = (const UInt32*)(screenBuffer->BufferPtr + ((UInt32)line * screenBuffer->lineBytes));
+    const UInt32* sourceEnd = source + (screenBuffer->lineBytes >> 2);
+    UInt32* destWord = (UInt32*)dest;
+
+    if (screenBuffer->base.bitsPerPixel == Bpp4) {
+        for (; source < sourceEnd; source++, destWord += 2) {
+            UInt32 pixels = *source;
+            destWord[0] = unpackTable[pixels & 0xFF] | (unpackTable[(pixels >> 8) & 0xFF] << 16);
+            destWord[1] = unpackTable[(pixels >> 16) & 0xFF] | (unpackTable[pixels >> 24] << 16);
+        }
+    }
+    else {
+        for (; source < sourceEnd; source++, destWord += 4) {
+            UInt32 pixels = *source;
+            destWord[0] = unpackTable[pixels & 0xFF];
+            destWord[1] = unpackTable[(pixels >> 8) & 0xFF];
+            destWord[2] = unpackTable[(pixels >> 16) & 0xFF];
+            destWord[3] = unpackTable[pixels >> 24];
+        }
+    }
+}
+
+void RenderTextLine(const VgaScreenBuffer* screenBuffer, UInt16 line, BYTE* dest) {
+    const TextState* textState = &screenBuffer->text;
+    UInt16 cellRow = (UInt16)(line / TEXT_FONT_CELL_HEIGHT);
+    UInt32* destWord = (UInt32*)dest;
+    UInt32* destEnd = destWord + ((textState->grid.Columns * TEXT_FONT_CELL_WIDTH) >> 2);
+
+    if (cellRow >= textState->grid.Rows) {
+        // Lines below the last row are black. The border pixels are never written, so they stay black too
+        for (; destWord < destEnd; destWord++) {
+            *destWord = 0;
+        }
+        return;
+    }
+
+    // Each cell is 8 pixels (two words) wide. The glyph row selects between the foreground and the background
+    // word of each pixel, so a cell costs two table lookups
+    const VgaTextCell* cell = &textState->grid.Cells[cellRow * textState->grid.Columns];
+    const BYTE* glyphRows = textState->glyphCells + (line - cellRow * TEXT_FONT_CELL_HEIGHT);
+    const BYTE* palette = screenBuffer->palettized.palette;
+    for (; destWord < destEnd; cell++, destWord += 2) {
+        // Characters outside the font are displayed as their 7 bit counterpart
+        BYTE bits = glyphRows[((BYTE)cell->Character & (TEXT_FONT_CHARACTERS - 1)) * TEXT_FONT_CELL_HEIGHT];
+        UInt32 foreground = palette[cell->Attribute & 0x0F] * 0x01010101U;
+        UInt32 background = palette[cell->Attribute >> 4] * 0x01010101U;
+        UInt32 difference = foreground ^ background;
+        destWord[0] = background ^ (difference & _textPixelMasks[bits & 0x0F]);
+        destWord[1] = background ^ (difference & _textPixelMasks[bits >> 4]);
+    }
+}
+
 VgaError AllocateFrameBuffer(const VgaVisualizationInfo* info, VgaScreenBuffer* vgaScreenBuffer) {
     const VgaVideoFrameInfo* finalTimings = &vgaScreenBuffer->VideoFrameTiming;
     // Let's cache our info data in local variables
@@ -340,28 +807,37 @@ VgaError AllocateFrameBuffer(const VgaVisualizationInfo* info, VgaScreenBuffer*
     screenBufferInfos.bitsPerPixel = localBpp;
     // We write as the screen width out visible line pixels
     screenBufferInfos.screenSize.width = (Int16)finalTimings->ScanlineTiming.VisibleArea;
-    // We write as the screen height out visible frame lines
-    screenBufferInfos.screenSize.height = (Int16)finalTimings->FrameTiming.VisibleArea;
+    // We write as the screen height the requested lines. By default there is a buffer line for each scaled frame line
+    UInt16 visibleLines = finalTimings->FrameTiming.VisibleArea;
+    UInt16 height = info->Height != 0 ? info->Height : (UInt16)(visibleLines / info->Scaling);
+    if (height > visibleLines || height > INT16_MAX) {
+        return VgaErrorInvalidParameter;
+    }
+    screenBufferInfos.screenSize.height = (Int16)height;
 
     // Let' s check that here we are ok with our math
     DebugAssert(screenBufferInfos.screenSize.width > 0);
     DebugAssert(screenBufferInfos.screenSize.height > 0);
 
     size_t framebufferSize = 0;
-    if (localBpp == Bpp8) {
+    if (HAS_LINE_DMA(localBpp)) {
         Bpp8State* bpp8State = &vgaScreenBuffer->displayState.Bpp8;
         // Let's reset the line offset
         bpp8State->currentLineOffset = 0;
 
-        // We calculate the border pixels to have an word-aligned buffer width
-        BYTE borderPixels = (BYTE)((4 - (screenBufferInfos.screenSize.width & 0x3)) & 0x3);
+        // Palettized modes store more pixels in a byte
+        BYTE pixelsPerByteLog2 = localBpp == Bpp4 ? 1 : (localBpp == Bpp2 ? 2 : 0);
+        UInt16 wordPixels = (UInt16)(4U << pixelsPerByteLog2);
 
-        bpp8State->linePixels = (UInt16)(screenBufferInfos.screenSize.width + borderPixels);
-        framebufferSize = bpp8State->linePixels;
-        DebugAssert((bpp8State->linePixels & 0x3) == 0); // make sure we have done everything right
+        // We add the border pixels to have an word-aligned buffer width
+        bpp8State->linePixels = (UInt16)((screenBufferInfos.screenSize.width + wordPixels - 1) & ~(wordPixels - 1));
+        vgaScreenBuffer->pixelsPerByteLog2 = pixelsPerByteLog2;
+        vgaScreenBuffer->lineBytes = (UInt16)(bpp8State->linePixels >> pixelsPerByteLog2);
+        framebufferSize = vgaScreenBuffer->lineBytes;
+        DebugAssert((vgaScreenBuffer->lineBytes & 0x3) == 0); // make sure we have done everything right
 
-        // 8bpp supports optimized 32bit pixel writes
-        screenBufferInfos.packSizePower = 2;
+        // 32bit pixel writes are supported by all the modes. A word holds 4, 8 or 16 pixels
+        screenBufferInfos.packSizePower = (BYTE)(2 + pixelsPerByteLog2);
     }
     else {
         // localBpp == Bpp24
@@ -371,33 +847,111 @@ VgaError AllocateFrameBuffer(const VgaVisualizationInfo* info, VgaScreenBuffer*
     }
     screenBufferInfos.DrawCallback = &DrawPixel;
     screenBufferInfos.DrawPackCallback = &DrawPixelPack;
+    screenBufferInfos.DrawSpanCallback = &DrawSpan;
+    screenBufferInfos.BlitSpanCallback = &BlitSpan;
+    screenBufferInfos.BlendSpanCallback = &BlendSpan;
+    screenBufferInfos.PresentCallback = &PresentBackBuffer;
 
     // framebufferSize here contains the number of bytes required for a single line depending of the mode
-    // We simply now multiply the lines and double everything if double buffered
+    // We simply now multiply the lines. The size of the back buffer (if any) is not included
     framebufferSize = ((size_t)screenBufferInfos.screenSize.height) * framebufferSize;
 
     // We store the new buffer size
     vgaScreenBuffer->bufferSize = framebufferSize;
     // We setup the lines scaling
-    vgaScreenBuffer->linePrescaler = info->Scaling;
-    vgaScreenBuffer->linePrescalerCnt = 0;
+    VgaError result = BuildLineTable(vgaScreenBuffer, visibleLines, height);
+    if (result != VgaErrorNone) {
+        return result;
+    }
     // VGA will be by default in the vSyncing section
     vgaScreenBuffer->vSyncing = true;
 
+    PalettizedState* palettizedState = &vgaScreenBuffer->palettized;
+    *palettizedState = (const PalettizedState){ 0 };
+    vgaScreenBuffer->text = (const TextState){ 0 };
+    vgaScreenBuffer->renderLine = IS_PALETTIZED(localBpp) ? &UnpackLine : NULL;
+    size_t lineBuffersSize = 0;
+    if (IS_PALETTIZED(localBpp)) {
+        // The line buffers are read by the DMA, so they are allocated in the RAM before the frame buffer.
+        // The conversion line is used only by the CPU
+        lineBuffersSize = (size_t)vgaScreenBuffer->displayState.Bpp8.linePixels * 2;
+        palettizedState->lineBuffers[0] = (BYTE*)ralloc(lineBuffersSize);
+        palettizedState->conversionLine = (BYTE*)malloc((size_t)screenBufferInfos.screenSize.width);
+        if (palettizedState->lineBuffers[0] == NULL || palettizedState->conversionLine == NULL) {
+            if (palettizedState->lineBuffers[0] != NULL) {
+                rfree(palettizedState->lineBuffers[0], lineBuffersSize);
+            }
+            free(palettizedState->conversionLine);
+            free(vgaScreenBuffer->lineTable);
+            *vgaScreenBuffer = (const VgaScreenBuffer){ 0 };
+            return VGAErrorOutOfMemory;
+        }
+        palettizedState->lineBuffers[1] = palettizedState->lineBuffers[0] + vgaScreenBuffer->displayState.Bpp8.linePixels;
+        palettizedState->lineBufferLines[0] = PALETTIZED_LINE_NONE;
+        palettizedState->lineBufferLines[1] = PALETTIZED_LINE_NONE;
+    }
+
     // We we try to allocate the frame buffer
     BYTE* buffer = (BYTE*)ralloc(framebufferSize);
     if (buffer == NULL) {
         // We clear the out parameter to emphasize that something has gone wrong
+        if (palettizedState->lineBuffers[0] != NULL) {
+            rfree(palettizedState->lineBuffers[0], lineBuffersSize);
+        }
+        free(palettizedState->conversionLine);
+        free(vgaScreenBuffer->lineTable);
         *vgaScreenBuffer = (const VgaScreenBuffer){ 0 };
         return VGAErrorOutOfMemory;
     }
 
+    // The back buffer is optional: if there is no space for it, we simply draw on the front buffer
+    // NB: ralloc is a stack allocator so the two buffers will be contiguous and they can be released toghether
+    BYTE* backBuffer = buffer;
+    vgaScreenBuffer->bufferCount = 1;
+    if (info->DoubleBuffered) {
+        backBuffer = (BYTE*)ralloc(framebufferSize);
+        if (backBuffer == NULL) {
+            printf("Not enough memory for the back buffer. Using a single buffer\r\n");
+            backBuffer = buffer;
+        }
+        else {
+            vgaScreenBuffer->bufferCount = 2;
+        }
+    }
+
     // Allocation is ok. Let' s write the few remaining things
     vgaScreenBuffer->BufferPtr = buffer;
+    vgaScreenBuffer->BackBufferPtr = backBuffer;
+    vgaScreenBuffer->swapPending = false;
+    // Modified areas are useful only when there is a back buffer to copy from
+    vgaScreenBuffer->dirtyRegion.count = 0;
+    screenBufferInfos.dirtyRegion = vgaScreenBuffer->bufferCount > 1 ? &vgaScreenBuffer->dirtyRegion : NULL;
     vgaScreenBuffer->base = screenBufferInfos;
 
+    // The error diffusion row is only accessed by the CPU, so it does not need to be in the DMA-reachable RAM
+    vgaScreenBuffer->ditherLine = INT16_MIN;
+    vgaScreenBuffer->ditherErrors = (SBYTE*)malloc(((size_t)screenBufferInfos.screenSize.width + 2) * 3);
+    if (vgaScreenBuffer->ditherErrors == NULL) {
+        printf("Not enough memory for the error diffusion. Using ordered dithering\r\n");
+    }
+
+    if (IS_PALETTIZED(localBpp)) {
+        // Every pixel (border included) starts with the first palette entry
+        memset(buffer, 0, framebufferSize * vgaScreenBuffer->bufferCount);
+
+        const UInt32* defaultPalette = localBpp == Bpp4 ? _defaultPalette4bpp : _defaultPalette2bpp;
+        palettizedState->paletteSize = localBpp == Bpp4 ? 16 : 4;
+        for (BYTE i = 0; i < palettizedState->paletteSize; i++) {
+            ARGB8Color color = { .argb = defaultPalette[i] };
+            palettizedState->palette[i] = (BYTE)RGB_TO_8BPP(color.components.R, color.components.G, color.components.B);
+        }
+        BuildPaletteTables(vgaScreenBuffer);
+        return VgaErrorNone;
+    }
+
     // Let's initialize the border pixels -> these will remain untouched for the rest of the application lifetime
-    for (int line = 0; line < screenBufferInfos.screenSize.height; line++) {
+    // The border must be cleared in both the buffers since they will be exchanged
+    for (int line = 0; line < screenBufferInfos.screenSize.height * vgaScreenBuffer->bufferCount; line++) {
         if (localBpp == Bpp8) {
             UInt16 totalLinePixels = vgaScreenBuffer->displayState.Bpp8.linePixels;
             for (int pixel = screenBufferInfos.screenSize.width; pixel < totalLinePixels; pixel++) {
@@ -409,6 +963,118 @@ VgaError AllocateFrameBuffer(const VgaVisualizationInfo* info, VgaScreenBuffer*
     return VgaErrorNone;
 }
 
+VgaError AllocateTextBuffer(const VgaVisualizationInfo* info, VgaScreenBuffer* vgaScreenBuffer) {
+    const VgaVideoFrameInfo* finalTimings = &vgaScreenBuffer->VideoFrameTiming;
+    UInt16 width = finalTimings->ScanlineTiming.VisibleArea;
+    UInt16 visibleLines = finalTimings->FrameTiming.VisibleArea;
+    UInt16 height = info->Height != 0 ? info->Height : (UInt16)(visibleLines / info->Scaling);
+    if (height > visibleLines || height > INT16_MAX) {
+        return VgaErrorInvalidParameter;
+    }
+
+    UInt16 columns = (UInt16)(width / TEXT_FONT_CELL_WIDTH);
+    UInt16 rows = (UInt16)(height / TEXT_FONT_CELL_HEIGHT);
+    if (columns == 0 || rows == 0) {
+        return VgaErrorInvalidParameter;
+    }
+
+    // The text mode has no frame buffer and no drawing callbacks: the lines are rendered from the grid
+    ScreenBuffer screenBufferInfos = { 0 };
+    screenBufferInfos.bitsPerPixel = Bpp4;
+    screenBufferInfos.screenSize.width = (Int16)width;
+    screenBufferInfos.screenSize.height = (Int16)height;
+    vgaScreenBuffer->base = screenBufferInfos;
+    vgaScreenBuffer->BufferPtr = NULL;
+    vgaScreenBuffer->BackBufferPtr = NULL;
+    vgaScreenBuffer->bufferSize = 0;
+    vgaScreenBuffer->bufferCount = 1;
+    vgaScreenBuffer->swapPending = false;
+    vgaScreenBuffer->dirtyRegion.count = 0;
+    vgaScreenBuffer->ditherErrors = NULL;
+    vgaScreenBuffer->ditherLine = INT16_MIN;
+    vgaScreenBuffer->pixelsPerByteLog2 = 0;
+    vgaScreenBuffer->lineBytes = 0;
+
+    Bpp8State* bpp8State = &vgaScreenBuffer->displayState.Bpp8;
+    bpp8State->currentLineOffset = 0;
+    // Word-aligned lines, as in the 8bpp mode. The cells always end on a word boundary
+    bpp8State->linePixels = (UInt16)((width + 3) & ~3);
+
+    VgaError result = BuildLineTable(vgaScreenBuffer, visibleLines, height);
+    if (result != VgaErrorNone) {
+        return result;
+    }
+    // VGA will be by default in the vSyncing section
+    vgaScreenBuffer->vSyncing = true;
+
+    // The grid and the font are only read by the CPU, so they stay in the core coupled memory. The line buffers
+    // are read by the DMA
+    PalettizedState* palettizedState = &vgaScreenBuffer->palettized;
+    *palettizedState = (const PalettizedState){ 0 };
+    TextState* textState = &vgaScreenBuffer->text;
+    *textState = (const TextState){ 0 };
+    size_t lineBuffersSize = (size_t)bpp8State->linePixels * 2;
+    textState->grid.Cells = (VgaTextCell*)malloc((size_t)columns * rows * sizeof(VgaTextCell));
+    textState->glyphCells = (BYTE*)malloc(TEXT_FONT_CELLS_SIZE);
+    palettizedState->lineBuffers[0] = (BYTE*)ralloc(lineBuffersSize);
+    if (textState->grid.Cells == NULL || textState->glyphCells == NULL || palettizedState->lineBuffers[0] == NULL) {
+        if (palettizedState->lineBuffers[0] != NULL) {
+            rfree(palettizedState->lineBuffers[0], lineBuffersSize);
+        }
+        free(textState->glyphCells);
+        free(textState->grid.Cells);
+        free(vgaScreenBuffer->lineTable);
+        *vgaScreenBuffer = (const VgaScreenBuffer){ 0 };
+        return VGAErrorOutOfMemory;
+    }
+
+    // Border pixels are never rendered, so they must start black
+    memset(palettizedState->lineBuffers[0], 0, lineBuffersSize);
+    palettizedState->lineBuffers[1] = palettizedState->lineBuffers[0] + bpp8State->linePixels;
+    palettizedState->lineBufferLines[0] = PALETTIZED_LINE_NONE;
+    palettizedState->lineBufferLines[1] = PALETTIZED_LINE_NONE;
+
+    textState->grid.Columns = columns;
+    textState->grid.Rows = rows;
+    for (size_t i = 0; i < (size_t)columns * rows; i++) {
+        textState->grid.Cells[i].Character = ' ';
+        textState->grid.Cells[i].Attribute = VGA_TEXT_ATTRIBUTE(7, 0);
+    }
+    TextFontBuildCells(textState->glyphCells);
+
+    // The 16 attribute colors are the entries of the 4bpp palette, so they can be changed with VgaSetPalette
+    palettizedState->paletteSize = 16;
+    for (BYTE i = 0; i < palettizedState->paletteSize; i++) {
+        ARGB8Color color = { .argb = _defaultPalette4bpp[i] };
+        palettizedState->palette[i] = (BYTE)RGB_TO_8BPP(color.components.R, color.components.G, color.components.B);
+    }
+    BuildPaletteTables(vgaScreenBuffer);
+
+    vgaScreenBuffer->renderLine = &RenderTextLine;
+    return VgaErrorNone;
+}
+
+VgaError BuildLineTable(VgaScreenBuffer* screenBuffer, UInt16 visibleLines, UInt16 height) {
+    // The table is only read by the CPU, so it can stay in the core coupled memory
+    UInt16 scanlineCount = (UInt16)(visibleLines + 1);
+    UInt16* lineTable = (UInt16*)malloc(scanlineCount * sizeof(UInt16));
+    if (lineTable == NULL) {
+        return VGAErrorOutOfMemory;
+    }
+
+    // The entry 0 is the line prepared before the first visible scanline. Visible scanlines are then spread
+    // evenly over the buffer lines, so the scale factor does not need to be an integer
+    lineTable[0] = 0;
+    for (UInt32 scanline = 0; scanline < visibleLines; scanline++) {
+        lineTable[scanline + 1] = (UInt16)((scanline * height) / visibleLines);
+    }
+
+    screenBuffer->lineTable = lineTable;
+    screenBuffer->scanlineCount = scanlineCount;
+    screenBuffer->scanline = 0;
+    return VgaErrorNone;
+}
+
 VgaError CorrectVideoFrameTimings(const VgaVisualizationInfo* info, VgaVideoFrameInfo* newTimings) {
     // All basic parameters (except for timings) should have been checked here
     DebugAssert(info && newTimings);
@@ -434,44 +1100,58 @@ VgaError CorrectVideoFrameTimings(const VgaVisualizationInfo* info, VgaVideoFram
     newTimings->PixelFrequencyMHz = info->FrameSignals.PixelFrequencyMHz / info->Scaling;
 
     // Same for the pixel values (which have already been checked, so everything should be ok even after the scaling)
-    ScaleTiming(&info->FrameSignals.FrameTiming, info->Scaling, &newTimings->FrameTiming);
     ScaleTiming(&info->FrameSignals.ScanlineTiming, info->Scaling, &newTimings->ScanlineTiming);
+    // The frame lines are not scaled: the vsync timer counts the real lines and the line table repeats the buffer lines.
+    // Scaling the frame would lose whole lines of the sync pulse when the scaling is not a divider of the timings
+    newTimings->FrameTiming = info->FrameSignals.FrameTiming;
 
     return VgaErrorNone;
 }
 
 void Draw8bppPixelWithAlpha(BYTE* pixelPtr, ARGB8Color color) {
-    // Super simple implementations: we read our color components, correct them
-    // with the alpha and then we map back into the 8bit color
-
-    BYTE r = color.components.R;
-    BYTE g = color.components.G;
-    BYTE b = color.components.B;
-
-    // We can avoid floating point operations by doing everything with integers
-    int currentPixelColor = ((int)(*pixelPtr)) & 0xFF;
+    // The blend of the full color is a single table lookup
+    *pixelPtr = GetBlendTable(color, BLEND_LEVELS)[*pixelPtr];
+}
 
-    int alpha = color.components.A;
-    int bgAlpha = 255 - color.components.A;
+const BYTE* GetBlendTable(ARGB8Color color, BYTE level) {
+    DebugAssert(level > 0 && level <= BLEND_LEVELS);
 
-    int newRed = r * alpha;
-    int oldRed = MASKI2BYTE(currentPixelColor << 6) * bgAlpha;
+    if (color.argb != _blendTablesColor) {
+        // New color: all the tables must be recalculated
+        _blendTablesColor = color.argb;
+        _blendTablesValid = 0;
+    }
 
-    int newGreen = g * alpha;
-    int oldGreen = MASKI2BYTE((currentPixelColor & 0x1c) << 3) * bgAlpha;
+    BYTE* table = _blendTables[level - 1];
+    UInt32 tableMask = 1UL << (level - 1);
+    if ((_blendTablesValid & tableMask) != 0) {
+        return table;
+    }
 
-    int newBlue = b * alpha;
-    int oldBlue = MASKI2BYTE(currentPixelColor & 0xE0) * bgAlpha;
+    // The components are blended separately: each one has only 4 or 8 native levels so we blend
+    // only 20 values and then we combine them in the 256 table entries
+    int alpha = (color.components.A * level) / BLEND_LEVELS;
+    BYTE redLevels[4], greenLevels[8], blueLevels[8];
+    BuildComponentBlend(redLevels, 4, 6, 6, color.components.R, alpha);
+    BuildComponentBlend(greenLevels, 8, 5, 5, color.components.G, alpha);
+    BuildComponentBlend(blueLevels, 8, 5, 5, color.components.B, alpha);
 
-    // Let's make sure we are doing nothing strange with out math
-    DebugAssert((newRed + oldRed) / 255 <= 255);
-    DebugAssert((newGreen + oldGreen) / 255 <= 255);
-    DebugAssert(((newBlue + oldBlue) / 255) <= 255);
+    for (int pixel = 0; pixel < 256; pixel++) {
+        table[pixel] = (BYTE)(redLevels[pixel & 0x3] | (greenLevels[(pixel >> 2) & 0x7] << 2) | (blueLevels[pixel >> 5] << 5));
+    }
+    _blendTablesValid |= tableMask;
+    return table;
+}
 
-    r = (BYTE)((newRed + oldRed) / 255);
-    g = (BYTE)((newGreen + oldGreen) / 255);
-    b = (BYTE)((newBlue + oldBlue) / 255);
-    *pixelPtr = (BYTE)RGB_TO_8BPP(r, g, b);
+void BuildComponentBlend(BYTE* levels, int levelCount, int levelShift, int resultShift, BYTE component, int alpha) {
+    // We can avoid floating point operations by doing everything with integers
+    int bgAlpha = 255 - alpha;
+    for (int level = 0; level < levelCount; level++) {
+        int blended = ((component * alpha) + ((level << levelShift) * bgAlpha)) / 255;
+        // Let's make sure we are doing nothing strange with out math
+        DebugAssert(blended <= 255);
+        levels[level] = (BYTE)(blended >> resultShift);
+    }
 }
 
 void DrawPixel(PointS pixel, const Pen* pen) {
@@ -486,7 +1166,7 @@ void DrawPixel(PointS pixel, const Pen* pen) {
 
     if (buffer->base.bitsPerPixel == Bpp8) {
         int bufferOffset = pixel.y * buffer->displayState.Bpp8.linePixels + pixel.x;
-        BYTE* vgaBufferPtr = buffer->BufferPtr + bufferOffset;
+        BYTE* vgaBufferPtr = buffer->BackBufferPtr + bufferOffset;
 
         // NB: The compiler will create a branch that jumps ahead if this condition.
         /*
@@ -511,6 +1191,19 @@ void DrawPixel(PointS pixel, const Pen* pen) {
             Draw8bppPixelWithAlpha(vgaBufferPtr, color);
         }
     }
+    else if (IS_PALETTIZED(buffer->base.bitsPerPixel)) {
+        // The pixel is drawn as a native color and then mapped to the nearest palette entry
+        ARGB8Color color = pen->color;
+        BYTE nativeColor;
+        if (color.components.A == 0xFF) {
+            nativeColor = (BYTE)RGB_TO_8BPP(color.components.R, color.components.G, color.components.B);
+        }
+        else {
+            nativeColor = ReadPalettizedPixel(buffer, pixel.x, pixel.y);
+            Draw8bppPixelWithAlpha(&nativeColor, color);
+        }
+        WritePalettizedPixel(buffer, pixel.x, pixel.y, buffer->palettized.nativeToIndex[nativeColor]);
+    }
 }
 
 void DrawPixelPack(PointS pixel, const Pen* pen) {
@@ -522,9 +1215,17 @@ void DrawPixelPack(PointS pixel, const Pen* pen) {
     DebugAssert(pixel.y >= 0 && pixel.y < buffer->base.screenSize.height);
 #endif // DRAWPIXELASSERT
 
+    if (IS_PALETTIZED(buffer->base.bitsPerPixel)) {
+        // The pack is a whole frame buffer word
+        Int16 packPixels = (Int16)(1 << buffer->base.packSizePower);
+        DebugAssert((pixel.x & (packPixels - 1)) == 0);
+        DrawPalettizedSpan(buffer, pixel.y, pixel.x, (Int16)(pixel.x + packPixels), pen->color);
+        return;
+    }
+
     // We need to calculate the pack address. In our case, the pack address must be 32 bit aligned since we are using a 32bit
     // memory access. The processor will throw an exception if the access is not aligned.
-    BYTE* pixelPtr = &buffer->BufferPtr[pixel.y * buffer->displayState.Bpp8.linePixels + pixel.x];
+    BYTE* pixelPtr = &buffer->BackBufferPtr[pixel.y * buffer->displayState.Bpp8.linePixels + pixel.x];
     DebugAssert(((UInt32)pixelPtr & 0x03) == 0x0);
 
     ARGB8Color color = pen->color;
@@ -550,15 +1251,420 @@ void DrawPixelPack(PointS pixel, const Pen* pen) {
     }
 }
 
-void DisableLineDMA(DMA_Stream_TypeDef* dmaStream) {
-    // If DMA is still enabled, we disable it to interrupt the transfer
-    // This is the only thing that has to be done [RM0090 - Section 10.3.14]
-    CLEAR_BIT(dmaStream->CR, DMA_SxCR_EN);
+BYTE* Get8bppPixelAddress(const VgaScreenBuffer* buffer, Int16 x, Int16 y) {
+    return &buffer->BackBufferPtr[y * buffer->displayState.Bpp8.linePixels + x];
+}
+
+BYTE ReadPalettizedPixel(const VgaScreenBuffer* buffer, Int16 x, Int16 y) {
+    // The first pixel of a byte is stored in its LSBs
+    BYTE pixelsPerByteLog2 = buffer->pixelsPerByteLog2;
+    BYTE pixelByte = buffer->BackBufferPtr[y * buffer->lineBytes + (x >> pixelsPerByteLog2)];
+    BYTE shift = (BYTE)((x & ((1 << pixelsPerByteLog2) - 1)) << (3 - pixelsPerByteLog2));
+    return buffer->palettized.palette[(pixelByte >> shift) & (buffer->palettized.paletteSize - 1)];
+}
+
+void WritePalettizedPixel(const VgaScreenBuffer* buffer, Int16 x, Int16 y, BYTE index) {
+    BYTE pixelsPerByteLog2 = buffer->pixelsPerByteLog2;
+    BYTE* pixelByte = &buffer->BackBufferPtr[y * buffer->lineBytes + (x >> pixelsPerByteLog2)];
+    BYTE shift = (BYTE)((x & ((1 << pixelsPerByteLog2) - 1)) << (3 - pixelsPerByteLog2));
+    BYTE mask = (BYTE)((buffer->palettized.paletteSize - 1) << shift);
+    *pixelByte = (BYTE)((*pixelByte & ~mask) | (index << shift));
+}
+
+BYTE* UnpackSpan(const VgaScreenBuffer* buffer, Int16 y, Int16 x, Int16 count) {
+    BYTE* nativePixels = buffer->palettized.conversionLine + x;
+    for (Int16 i = 0; i < count; i++) {
+        nativePixels[i] = ReadPalettizedPixel(buffer, (Int16)(x + i), y);
+    }
+    return nativePixels;
+}
+
+void PackSpan(const VgaScreenBuffer* buffer, Int16 y, Int16 x, PCBYTE source, Int16 count) {
+    const BYTE* nativeToIndex = buffer->palettized.nativeToIndex;
+    for (Int16 i = 0; i < count; i++) {
+        WritePalettizedPixel(buffer, (Int16)(x + i), y, nativeToIndex[source[i]]);
+    }
+}
+
+UInt32 GetPalettizedWord(const VgaScreenBuffer* buffer, BYTE index) {
+    // 0xFFFFFFFF / 15 = 0x11111111 and 0xFFFFFFFF / 3 = 0x55555555 repeat the index in every pixel
+    return (UInt32)index * (0xFFFFFFFFU / (UInt32)(buffer->palettized.paletteSize - 1));
+}
+
+void DrawPalettizedSpan(const VgaScreenBuffer* buffer, Int16 y, Int16 xStart, Int16 xEnd, ARGB8Color color) {
+    const BYTE* nativeToIndex = buffer->palettized.nativeToIndex;
+    if (color.components.A != 0xFF) {
+        // With alpha, each background pixel can be different but they are all blended with the same table
+        const BYTE* blendTable = GetBlendTable(color, BLEND_LEVELS);
+        for (Int16 x = xStart; x < xEnd; x++) {
+            WritePalettizedPixel(buffer, x, y, nativeToIndex[blendTable[ReadPalettizedPixel(buffer, x, y)]]);
+        }
+        return;
+    }
+
+    BYTE index = nativeToIndex[RGB_TO_8BPP(color.components.R, color.components.G, color.components.B)];
+    Int16 wordPixels = (Int16)(1 << buffer->base.packSizePower);
+    Int16 x = xStart;
+
+    // First we draw the pixels before the word boundary
+    for (; x < xEnd && (x & (wordPixels - 1)) != 0; x++) {
+        WritePalettizedPixel(buffer, x, y, index);
+    }
+
+    // Then we write a whole word of pixels at the time
+    UInt32 wordIndex = GetPalettizedWord(buffer, index);
+    UInt32* wordPtr = (UInt32*)&buffer->BackBufferPtr[y * buffer->lineBytes + (x >> buffer->pixelsPerByteLog2)];
+    for (; (Int16)(x + wordPixels) <= xEnd; x = (Int16)(x + wordPixels)) {
+        *wordPtr++ = wordIndex;
+    }
+
+    // Trailing pixels
+    for (; x < xEnd; x++) {
+        WritePalettizedPixel(buffer, x, y, index);
+    }
+}
+
+void DrawSpan(Int16 y, Int16 xStart, Int16 xEnd, const Pen* pen) {
+    VgaScreenBuffer* buffer = _activeScreenBuffer;
+
+#ifdef DRAWPIXELASSERT
+    DebugAssert(buffer != NULL);
+    DebugAssert(y >= 0 && y < buffer->base.screenSize.height);
+    DebugAssert(xStart >= 0 && xStart <= xEnd && xEnd <= buffer->base.screenSize.width);
+    DebugAssert(pen != NULL);
+#endif // DRAWPIXELASSERT
+
+    if (IS_PALETTIZED(buffer->base.bitsPerPixel)) {
+        DrawPalettizedSpan(buffer, y, xStart, xEnd, pen->color);
+        return;
+    }
+
+    // Address is calculated only once for the entire span
+    BYTE* pixelPtr = Get8bppPixelAddress(buffer, xStart, y);
+    BYTE* spanEnd = pixelPtr + (xEnd - xStart);
+
+    ARGB8Color color = pen->color;
+    if (color.components.A != 0xFF) {
+        // With alpha, each background pixel can be different but they are all blended with the same table
+        const BYTE* blendTable = GetBlendTable(color, BLEND_LEVELS);
+        for (; pixelPtr < spanEnd; pixelPtr++) {
+            *pixelPtr = blendTable[*pixelPtr];
+        }
+        return;
+    }
+
+    BYTE pixelColor = (BYTE)RGB_TO_8BPP(color.components.R, color.components.G, color.components.B);
+
+    // First we draw the unaligned pixels at the beginning
+    for (; pixelPtr < spanEnd && ((UInt32)pixelPtr & 0x3) != 0; pixelPtr++) {
+        *pixelPtr = pixelColor;
+    }
+
+    // Once we are aligned to the word, we can store 4 pixels at the time
+    UInt32 wordPixelColor = pixelColor | pixelColor << 8 | pixelColor << 16 | pixelColor << 24;
+    UInt32* wordPtr = (UInt32*)pixelPtr;
+    UInt32* wordEnd = (UInt32*)((UInt32)spanEnd & ~0x3U);
+    for (; wordPtr < wordEnd; wordPtr++) {
+        *wordPtr = wordPixelColor;
+    }
+
+    // We do the same for the trailing pixels that are not aligned
+    for (pixelPtr = (BYTE*)wordPtr; pixelPtr < spanEnd; pixelPtr++) {
+        *pixelPtr = pixelColor;
+    }
+}
+
+void BlitSpan(Int16 y, Int16 x, PCBYTE source, Int16 count, ScreenDither dither) {
+    VgaScreenBuffer* buffer = _activeScreenBuffer;
+
+#ifdef DRAWPIXELASSERT
+    DebugAssert(buffer != NULL);
+    DebugAssert(y >= 0 && y < buffer->base.screenSize.height);
+    DebugAssert(x >= 0 && count >= 0 && x + count <= buffer->base.screenSize.width);
+    DebugAssert(source != NULL);
+#endif // DRAWPIXELASSERT
+
+    // Palettized modes convert the pixels in the conversion line and then they map them to the palette
+    BOOL palettized = IS_PALETTIZED(buffer->base.bitsPerPixel);
+    BYTE* pixelPtr = palettized ? buffer->palettized.conversionLine + x : Get8bppPixelAddress(buffer, x, y);
+    if (dither == ScreenDitherErrorDiffusion && buffer->ditherErrors != NULL) {
+        BlitSpanErrorDiffusion(buffer, pixelPtr, y, x, source, count);
+    }
+    else if (dither != ScreenDitherNone) {
+        BlitSpanOrdered(pixelPtr, y, x, source, count);
+    }
+    else {
+        BlitSpanUndithered(pixelPtr, source, count);
+    }
+
+    if (palettized) {
+        PackSpan(buffer, y, x, pixelPtr, count);
+    }
+}
+
+void BlitSpanUndithered(BYTE* pixelPtr, PCBYTE source, Int16 count) {
+    BYTE* spanEnd = pixelPtr + count;
+
+    // Unaligned pixels at the beginning
+    for (; pixelPtr < spanEnd && ((UInt32)pixelPtr & 0x3) != 0; pixelPtr++, source += 3) {
+        *pixelPtr = (BYTE)BGR_PTR_TO_8BPP(source);
+    }
+
+    // We pack 4 converted pixels in a word and we store them in one shot
+    // NB: source pixels are 3 bytes long so we can only read them byte by byte
+    UInt32* wordPtr = (UInt32*)pixelPtr;
+    UInt32* wordEnd = (UInt32*)((UInt32)spanEnd & ~0x3U);
+    for (; wordPtr < wordEnd; wordPtr++, source += 12) {
+        *wordPtr = (UInt32)BGR_PTR_TO_8BPP(source) |
+            ((UInt32)BGR_PTR_TO_8BPP(source + 3) << 8) |
+            ((UInt32)BGR_PTR_TO_8BPP(source + 6) << 16) |
+            ((UInt32)BGR_PTR_TO_8BPP(source + 9) << 24);
+    }
+
+    // Trailing pixels
+    for (pixelPtr = (BYTE*)wordPtr; pixelPtr < spanEnd; pixelPtr++, source += 3) {
+        *pixelPtr = (BYTE)BGR_PTR_TO_8BPP(source);
+    }
+}
+
+void BlitSpanOrdered(BYTE* pixelPtr, Int16 y, Int16 x, PCBYTE source, Int16 count) {
+    // Each component is scaled to the native levels with DITHER_STEPS sub-levels. The threshold of the pixel position
+    // is added before dropping the sub-levels, so a component between two native levels is rounded up on a
+    // number of pixels proportional to its distance from the lower level
+    const BYTE* thresholds = _bayerMatrix[y & 0x3];
+    BYTE* spanEnd = pixelPtr + count;
+
+    // Unaligned pixels at the beginning
+    for (; pixelPtr < spanEnd && ((UInt32)pixelPtr & 0x3) != 0; pixelPtr++, source += 3, x++) {
+        *pixelPtr = (BYTE)BGR_PTR_TO_8BPP_DITHERED(source, thresholds[x & 0x3]);
+    }
+
+    // Same 4 pixels word packing of the undithered blit
+    UInt32* wordPtr = (UInt32*)pixelPtr;
+    UInt32* wordEnd = (UInt32*)((UInt32)spanEnd & ~0x3U);
+    for (; wordPtr < wordEnd; wordPtr++, source += 12, x += 4) {
+        *wordPtr = (UInt32)BGR_PTR_TO_8BPP_DITHERED(source, thresholds[x & 0x3]) |
+            ((UInt32)BGR_PTR_TO_8BPP_DITHERED(source + 3, thresholds[(x + 1) & 0x3]) << 8) |
+            ((UInt32)BGR_PTR_TO_8BPP_DITHERED(source + 6, thresholds[(x + 2) & 0x3]) << 16) |
+            ((UInt32)BGR_PTR_TO_8BPP_DITHERED(source + 9, thresholds[(x + 3) & 0x3]) << 24);
+    }
+
+    // Trailing pixels
+    for (pixelPtr = (BYTE*)wordPtr; pixelPtr < spanEnd; pixelPtr++, source += 3, x++) {
+        *pixelPtr = (BYTE)BGR_PTR_TO_8BPP_DITHERED(source, thresholds[x & 0x3]);
+    }
+}
+
+void BlitSpanErrorDiffusion(VgaScreenBuffer* buffer, BYTE* pixelPtr, Int16 y, Int16 x, PCBYTE source, Int16 count) {
+    // Errors of the previous line can be diffused only on an adjacent line (lines can be drawn in both directions)
+    SBYTE* errors = buffer->ditherErrors;
+    if (y != buffer->ditherLine + 1 && y != buffer->ditherLine - 1) {
+        memset(errors, 0, ((size_t)buffer->base.screenSize.width + 2) * 3);
+    }
+    buffer->ditherLine = y;
+
+    // Max value of the B, G, R components in DITHER_STEPS units
+    static const Int32 maxLevels[3] = { 7 * DITHER_STEPS, 7 * DITHER_STEPS, 3 * DITHER_STEPS };
+    // Error diffused to the right pixel (7/16)
+    Int32 rightErrors[3] = { 0 };
+    // Errors diffused on the next line to the left pixel (3/16), the pixel below (5/16) and the right pixel (1/16)
+    // are collected in the two pending accumulators and written when the current line value has been consumed
+    Int32 belowLeftErrors[3] = { 0 };
+    Int32 belowErrors[3] = { 0 };
+
+    // The error row is used in place: the slot of the pixel x - 1 is free as soon as the pixel x has been read
+    SBYTE* errorPtr = errors + ((x + 1) * 3);
+    for (Int16 i = 0; i < count; i++, source += 3, errorPtr += 3) {
+        Int32 levels[3];
+        for (int c = 0; c < 3; c++) {
+            Int32 scaled = (c == 2) ? DITHER_SCALE_2BIT(source[c]) : DITHER_SCALE_3BIT(source[c]);
+            // Value is clamped to the representable range to avoid the accumulation of the errors on saturated areas
+            Int32 value = MIN(MAX(scaled + errorPtr[c] + rightErrors[c], 0), maxLevels[c]);
+            Int32 level = (value + (DITHER_STEPS / 2)) >> 4;
+            Int32 error = value - (level * DITHER_STEPS);
+            levels[c] = level;
+
+            rightErrors[c] = (error * 7) / 16;
+            errorPtr[c - 3] = (SBYTE)(belowLeftErrors[c] + ((error * 3) / 16));
+            belowLeftErrors[c] = belowErrors[c] + ((error * 5) / 16);
+            belowErrors[c] = error / 16;
+        }
+        *pixelPtr++ = (BYTE)(levels[2] | (levels[1] << 2) | (levels[0] << 5));
+    }
+
+    // The last pending error belongs to the last pixel of the span (the right one falls in the guard pixel)
+    for (int c = 0; c < 3; c++) {
+        errorPtr[c - 3] = (SBYTE)belowLeftErrors[c];
+        errorPtr[c] = (SBYTE)belowErrors[c];
+    }
+}
+
+void BlendSpan(Int16 y, Int16 x, PCBYTE coverage, Int16 count, const Pen* pen) {
+    VgaScreenBuffer* buffer = _activeScreenBuffer;
+
+#ifdef DRAWPIXELASSERT
+    DebugAssert(buffer != NULL);
+    DebugAssert(y >= 0 && y < buffer->base.screenSize.height);
+    DebugAssert(x >= 0 && count >= 0 && x + count <= buffer->base.screenSize.width);
+    DebugAssert(coverage != NULL && pen != NULL);
+#endif // DRAWPIXELASSERT
+
+    // Palettized modes blend the native colors in the conversion line and then they map them to the palette
+    BOOL palettized = IS_PALETTIZED(buffer->base.bitsPerPixel);
+    BYTE* spanStart = palettized ? UnpackSpan(buffer, y, x, count) : Get8bppPixelAddress(buffer, x, y);
+    BYTE* pixelPtr = spanStart;
+    ARGB8Color color = pen->color;
+    BYTE opaqueColor = (BYTE)RGB_TO_8BPP(color.components.R, color.components.G, color.components.B);
+    BOOL opaquePen = color.components.A == 0xFF;
+
+    for (Int16 i = 0; i < count; i++, pixelPtr++) {
+        // Coverage is rounded to the nearest blend level
+        BYTE level = (BYTE)((coverage[i] + (BLEND_COVERAGE_STEP / 2)) / BLEND_COVERAGE_STEP);
+        if (level == 0) {
+            // Nothing to blend
+            continue;
+        }
 
-    // We have to wait that DMA_SxCR_EN is effectively set to 0
-    // so we can setup our next transfer
-    while (READ_BIT(dmaStream->CR, DMA_SxCR_EN) != 0)
-        ;
+        if (level >= BLEND_LEVELS && opaquePen) {
+            // Fully covered pixel: no blending is needed
+            *pixelPtr = opaqueColor;
+        }
+        else {
+            *pixelPtr = GetBlendTable(color, MIN(level, BLEND_LEVELS))[*pixelPtr];
+        }
+    }
+
+    if (palettized) {
+        PackSpan(buffer, y, x, spanStart, count);
+    }
+}
+
+void PresentBackBuffer(const ScreenDirtyRegion* region) {
+    VgaScreenBuffer* buffer = _activeScreenBuffer;
+    DebugAssert(buffer != NULL);
+
+    if (buffer->bufferCount < 2 || region == NULL || region->count == 0) {
+        // We are already drawing on the displayed buffer
+        return;
+    }
+
+    // The line DMA is reading the front buffer, so it cannot be modified outside the vertical blanking. The buffers
+    // are exchanged by the VSync interrupt instead (a constant time operation), and the modified spans are then copied
+    // from the new front buffer to the new back buffer, that is no longer displayed. Only the modified areas are
+    // copied, so for small updates (a selected row for example) this is only a few hundreds of bytes
+    if (WaitBufferSwap(buffer) != VgaErrorNone) {
+        // Timers are not running as expected and the buffers have not been exchanged. We copy the spans directly
+        // to the front buffer: the frame may tear but it is correct
+        CopyPresentSpans(buffer, region, buffer->BackBufferPtr, buffer->BufferPtr);
+        return;
+    }
+    CopyPresentSpans(buffer, region, buffer->BufferPtr, buffer->BackBufferPtr);
+}
+
+void CopyPresentSpans(const VgaScreenBuffer* buffer, const ScreenDirtyRegion* region, const BYTE* source, BYTE* dest) {
+    // In the palettized modes the bytes at the span edges can contain pixels outside the rectangle. They are
+    // copied too, but the two buffers are aligned outside the modified areas
+    UInt16 lineBytes = buffer->lineBytes;
+    BYTE pixelsPerByteLog2 = buffer->pixelsPerByteLog2;
+    for (BYTE i = 0; i < region->count; i++) {
+        const RectS* rect = &region->rectangles[i];
+        UInt32 firstByte = (UInt32)rect->left >> pixelsPerByteLog2;
+        size_t spanSize = (size_t)((((UInt32)rect->right + (1U << pixelsPerByteLog2) - 1) >> pixelsPerByteLog2) - firstByte);
+
+        UInt32 offset = (UInt32)rect->top * lineBytes + firstByte;
+        for (Int16 line = rect->top; line < rect->bottom; line++, offset += lineBytes) {
+            memcpy(dest + offset, source + offset, spanSize);
+        }
+    }
+}
+
+Int32 GetNativeColorDistance(BYTE first, BYTE second) {
+    // Red has 4 levels (0, 85, 170, 255), green and blue have 8 levels
+    Int32 red = ((Int32)(first & 0x3) - (Int32)(second & 0x3)) * 85;
+    Int32 green = (((Int32)((first >> 2) & 0x7) - (Int32)((second >> 2) & 0x7)) * 255) / 7;
+    Int32 blue = (((Int32)(first >> 5) - (Int32)(second >> 5)) * 255) / 7;
+    return (red * red) + (green * green) + (blue * blue);
+}
+
+void BuildPaletteTables(VgaScreenBuffer* buffer) {
+    PalettizedState* palettizedState = &buffer->palettized;
+
+    // Drawing functions work with the native colors, so we map each native color to the nearest entry
+    for (int nativeColor = 0; nativeColor < 256; nativeColor++) {
+        BYTE nearestIndex = 0;
+        Int32 nearestDistance = INT32_MAX;
+        for (BYTE index = 0; index < palettizedState->paletteSize; index++) {
+            Int32 distance = GetNativeColorDistance((BYTE)nativeColor, palettizedState->palette[index]);
+            if (distance < nearestDistance) {
+                nearestIndex = index;
+                nearestDistance = distance;
+            }
+        }
+        palettizedState->nativeToIndex[nativeColor] = nearestIndex;
+    }
+
+    // The scanout expands a whole frame buffer byte with a single lookup
+    BYTE pixelBits = (BYTE)(8U >> buffer->pixelsPerByteLog2);
+    BYTE pixelsPerByte = (BYTE)(1U << buffer->pixelsPerByteLog2);
+    for (int packedPixels = 0; packedPixels < 256; packedPixels++) {
+        UInt32 nativePixels = 0;
+        for (BYTE pixel = 0; pixel < pixelsPerByte; pixel++) {
+            BYTE index = (BYTE)((packedPixels >> (pixel * pixelBits)) & (palettizedState->paletteSize - 1));
+            nativePixels |= (UInt32)palettizedState->palette[index] << (pixel * 8);
+        }
+        palettizedState->unpackTable[packedPixels] = nativePixels;
+    }
+}
+
+void SwapBufferPointers(VgaScreenBuffer* screenBuffer) {
+    BYTE* frontBuffer = screenBuffer->BufferPtr;
+    screenBuffer->BufferPtr = screenBuffer->BackBufferPtr;
+    screenBuffer->BackBufferPtr = frontBuffer;
+}
+
+VgaError WaitBufferSwap(VgaScreenBuffer* screenBuffer) {
+    if (screenBuffer->outputState == VgaOutputStopped) {
+        // No one is reading the front buffer. We can swap immediately
+        SwapBufferPointers(screenBuffer);
+        return VgaErrorNone;
+    }
+
+    // The swap is performed by the VSync interrupt at the end of the visible area. Here we simply wait
+    // for the flag to be cleared, yielding the processor to the other tasks
+    // NB: VSync interrupt has a priority higher than the syscall one, so we cannot use an OS event here
+    screenBuffer->swapPending = true;
+    UInt32 startTick = HAL_GetTick();
+    while (screenBuffer->swapPending) {
+        if ((HAL_GetTick() - startTick) > SWAP_BUFFERS_TIMEOUT) {
+            // Timers are not running as expected. The VSync interrupt may still swap the buffers between the
+            // test and the reset of the flag, so the flag is checked and cleared with the interrupts masked
+            UInt32 primask = __get_PRIMASK();
+            __disable_irq();
+            BOOL swapped = !screenBuffer->swapPending;
+            screenBuffer->swapPending = false;
+            if (primask == 0) {
+                __enable_irq();
+            }
+            return swapped ? VgaErrorNone : VGAErrorInvalidState;
+        }
+        osDelay(1);
+    }
+    return VgaErrorNone;
+}
+
+void DisableLineDMA(DMA_Stream_TypeDef* dmaStream) {
+    // In the common case the stream has already transferred the whole line and the hardware cleared
+    // the EN bit by itself
+    if (READ_BIT(dmaStream->CR, DMA_SxCR_EN) != 0) {
+        // If DMA is still enabled, we disable it to interrupt the transfer
+        // This is the only thing that has to be done [RM0090 - Section 10.3.14]
+        CLEAR_BIT(dmaStream->CR, DMA_SxCR_EN);
+
+        // We have to wait that DMA_SxCR_EN is effectively set to 0
+        // so we can setup our next transfer
+        while (READ_BIT(dmaStream->CR, DMA_SxCR_EN) != 0)
+            ;
+    }
 
     // We clear the output on the DMA peripheral since we are in the blanking portion and we don't know
     // the exact output value where the transfer was interrupted
@@ -608,40 +1714,198 @@ void ScaleTiming(const VgaTiming* timing, BYTE scale, VgaTiming* dest) {
     }
 }
 
-static VgaError SetupMainClockTree(float pixelMHzFreq) {
-    RCC_OscInitTypeDef oscInit = { 0 };
-    HAL_RCC_GetOscConfig(&oscInit);
-
-    // We need to configure only the hse oscillator
-    DebugAssert(oscInit.OscillatorType == RCC_OSCILLATORTYPE_HSE);
-    DebugAssert(oscInit.HSEState == RCC_HSE_BYPASS);
-    // Our PLL is On and it takes the clock from our super stable HSE
-    DebugAssert(oscInit.PLL.PLLState == RCC_PLL_ON);
-    DebugAssert(oscInit.PLL.PLLSource == RCC_PLLSOURCE_HSE);
-
-    // We set the output freq of the PLL to 120MHz = 6 * 20Mhz needed
-    // To do this we set the PLLP to 2 (minimum) and PLLM to 4. In this way, our 8 Mhz HSE source clock
-    // is bring to 120MHz
-    oscInit.PLL.PLLM = 4;
-    oscInit.PLL.PLLP = RCC_PLLP_DIV2;
-    oscInit.PLL.PLLN = 120;
-
-    /*if (HAL_RCC_OscConfig(&oscInit) != HAL_OK)
-     {
-     Error_Handler();
-     }*/
+VgaError SetupMainClockTree(float pixelMHzFreq) {
+    if (GetPixelClockPeriod(pixelMHzFreq, GetTimersClock()) != 0) {
+        // Nothing to change
+        return VgaErrorNone;
+    }
+
+    VgaClockTree tree;
+    if (!PlanMainClockTree(pixelMHzFreq, &tree)) {
+        return VgaErrorNotSupported;
+    }
 
     RCC_ClkInitTypeDef clkInit = { 0 };
     uint32_t latency;
     HAL_RCC_GetClockConfig(&clkInit, &latency);
-
-    DebugAssert(clkInit.ClockType == (RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2));
     DebugAssert(clkInit.SYSCLKSource == RCC_SYSCLKSOURCE_PLLCLK);
     DebugAssert(clkInit.AHBCLKDivider == RCC_SYSCLK_DIV1);
-    clkInit.APB1CLKDivider = RCC_HCLK_DIV4;
-    clkInit.APB2CLKDivider = RCC_HCLK_DIV4;
 
-    return VgaErrorNone;
+    // The PLL cannot be reconfigured while it clocks the system: we run from the HSE in the meantime.
+    // The flash latency of the current clock is also enough for the HSE
+    clkInit.ClockType = RCC_CLOCKTYPE_SYSCLK;
+    clkInit.SYSCLKSource = RCC_SYSCLKSOURCE_HSE;
+    if (HAL_RCC_ClockConfig(&clkInit, latency) != HAL_OK) {
+        return VgaErrorNotSupported;
+    }
+
+    // Only the PLL changes: the HSE stays in bypass, as configured by SystemClock_Config
+    RCC_OscInitTypeDef oscInit = { 0 };
+    oscInit.OscillatorType = RCC_OSCILLATORTYPE_NONE;
+    oscInit.PLL.PLLState = RCC_PLL_ON;
+    oscInit.PLL.PLLSource = RCC_PLLSOURCE_HSE;
+    oscInit.PLL.PLLM = tree.pllM;
+    oscInit.PLL.PLLN = tree.pllN;
+    oscInit.PLL.PLLP = tree.pllP;
+    oscInit.PLL.PLLQ = tree.pllQ;
+    VgaError result = VgaErrorNone;
+    if (HAL_RCC_OscConfig(&oscInit) == HAL_OK) {
+        static const UInt32 apbDividers[] = { RCC_HCLK_DIV1, RCC_HCLK_DIV2, RCC_HCLK_DIV4, RCC_HCLK_DIV8, RCC_HCLK_DIV16 };
+        clkInit.ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2;
+        clkInit.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+        clkInit.APB1CLKDivider = apbDividers[tree.apbShift];
+        clkInit.APB2CLKDivider = apbDividers[tree.apbShift];
+        // FLASH_LATENCY_n is n wait states
+        if (HAL_RCC_ClockConfig(&clkInit, tree.flashLatency) != HAL_OK) {
+            result = VgaErrorNotSupported;
+        }
+    }
+    else {
+        // The PLL did not lock: the system keeps running from the HSE
+        result = VgaErrorNotSupported;
+    }
+
+    // The bus clocks have changed in any case
+    VgaClockTreeChangedCallback();
+    return result;
+}
+
+BOOL PlanMainClockTree(float pixelMHzFreq, VgaClockTree* tree) {
+    UInt32 pixelFreq = (UInt32)(pixelMHzFreq * 1000000.0f);
+    if (pixelFreq == 0 || pixelFreq > VGA_MAX_PIXEL_FREQUENCY) {
+        return false;
+    }
+
+    // The board default clock tree keeps the peripherals at the rates they have been tuned for
+    if (BuildClockTree(pixelMHzFreq, VGA_DEFAULT_PLL_M, VGA_DEFAULT_PLL_N, VGA_DEFAULT_PLL_P, VGA_DEFAULT_APB_SHIFT, tree)) {
+        return true;
+    }
+
+    // Each period of the main timer fixes the timers clock, and so the system clock for each APB divider.
+    // The PLL factors that give the nearest system clock are then checked. The generated clocks can exceed the
+    // targets by the pixel clock tolerance
+    UInt64 maxSystemClock = ((UInt64)VGA_MAX_SYSTEM_CLOCK * (1000000U + VGA_PIXEL_CLOCK_TOLERANCE_PPM)) / 1000000U;
+    UInt64 maxApbClock = ((UInt64)VGA_MAX_APB1_FREQUENCY * (1000000U + VGA_PIXEL_CLOCK_TOLERANCE_PPM)) / 1000000U;
+    BOOL found = false;
+    for (UInt32 apbShift = 1; apbShift <= 4; apbShift++) {
+        for (UInt32 period = 2; period <= UINT8_MAX; period++) {
+            UInt64 targetApbClock = ((UInt64)pixelFreq * period) / 2U;
+            UInt64 targetSystemClock = targetApbClock << apbShift;
+            if (targetSystemClock > maxSystemClock || targetApbClock > maxApbClock) {
+                break;
+            }
+
+            for (UInt32 pllP = 2; pllP <= 8; pllP += 2) {
+                UInt64 targetVco = targetSystemClock * pllP;
+                for (UInt32 pllM = HSE_VALUE / VGA_PLL_MAX_INPUT; pllM <= HSE_VALUE / VGA_PLL_MIN_INPUT; pllM++) {
+                    UInt32 pllN = (UInt32)(((targetVco * pllM) + (HSE_VALUE / 2U)) / HSE_VALUE);
+                    VgaClockTree candidate;
+                    if (!BuildClockTree(pixelMHzFreq, pllM, pllN, pllP, apbShift, &candidate)) {
+                        continue;
+                    }
+
+                    if (!found || candidate.systemClock > tree->systemClock
+                        || (candidate.systemClock == tree->systemClock && candidate.pixelClockError < tree->pixelClockError)) {
+                        *tree = candidate;
+                        found = true;
+                    }
+                }
+            }
+        }
+    }
+    return found;
+}
+
+BOOL BuildClockTree(float pixelMHzFreq, UInt32 pllM, UInt32 pllN, UInt32 pllP, UInt32 apbShift, VgaClockTree* tree) {
+    UInt32 pixelFreq = (UInt32)(pixelMHzFreq * 1000000.0f);
+    UInt32 pllInput = HSE_VALUE / pllM;
+    if (pllInput < VGA_PLL_MIN_INPUT || pllInput > VGA_PLL_MAX_INPUT || pllN < VGA_PLL_MIN_N || pllN > VGA_PLL_MAX_N) {
+        return false;
+    }
+
+    // Same integer arithmetic of HAL_RCC_GetSysClockFreq
+    UInt32 vco = (UInt32)(((UInt64)HSE_VALUE * pllN) / pllM);
+    if (vco < VGA_PLL_MIN_VCO || vco > VGA_PLL_MAX_VCO) {
+        return false;
+    }
+    UInt32 systemClock = vco / pllP;
+    UInt32 apbClock = systemClock >> apbShift;
+    if (systemClock > VGA_MAX_SYSTEM_CLOCK || systemClock < pixelFreq * VGA_MIN_CYCLES_PER_PIXEL
+        || apbClock > VGA_MAX_APB1_FREQUENCY) {
+        return false;
+    }
+
+    UInt32 pllQ = (vco + VGA_PLL_MAX_Q_OUTPUT - 1U) / VGA_PLL_MAX_Q_OUTPUT;
+    if (pllQ > VGA_PLL_MAX_Q) {
+        return false;
+    }
+
+    UInt32 timersClock = apbClock * 2U;
+    UInt32 period = GetPixelClockPeriod(pixelMHzFreq, timersClock);
+    if (period == 0) {
+        return false;
+    }
+    UInt32 generatedFreq = timersClock / period;
+
+    tree->pllM = pllM;
+    tree->pllN = pllN;
+    tree->pllP = pllP;
+    tree->pllQ = MAX(pllQ, 2U);
+    tree->apbShift = apbShift;
+    tree->flashLatency = (systemClock - 1U) / VGA_FLASH_WAIT_STATE_FREQUENCY;
+    tree->systemClock = systemClock;
+    tree->timersClock = timersClock;
+    tree->pixelClockPeriod = period;
+    tree->pixelClockError = generatedFreq > pixelFreq ? generatedFreq - pixelFreq : pixelFreq - generatedFreq;
+    return true;
+}
+
+BOOL IsPixelClockSupported(float pixelMHzFreq) {
+    VgaClockTree tree;
+    return GetPixelClockPeriod(pixelMHzFreq, GetTimersClock()) != 0 || PlanMainClockTree(pixelMHzFreq, &tree);
+}
+
+UInt32 GetTimersClock() {
+    // The APB1 divider is never 1, so the timers run at twice the bus clock
+    return HAL_RCC_GetPCLK1Freq() * 2U;
+}
+
+UInt32 GetPixelClockPeriod(float pixelMHzFreq, UInt32 timersFreq) {
+    UInt32 pixelFreq = (UInt32)(pixelMHzFreq * 1000000.0f);
+    if (pixelFreq == 0 || pixelFreq > VGA_MAX_PIXEL_FREQUENCY) {
+        return 0;
+    }
+
+    // The main timer can only divide its clock, so we look for the nearest divider.
+    // The timer needs at least two counts to generate its update event
+    UInt32 period = (timersFreq + (pixelFreq / 2U)) / pixelFreq;
+    if (period < 2 || period > UINT8_MAX) {
+        return 0;
+    }
+
+    UInt32 generatedFreq = timersFreq / period;
+    UInt32 error = generatedFreq > pixelFreq ? generatedFreq - pixelFreq : pixelFreq - generatedFreq;
+    if ((UInt64)error * 1000000U > (UInt64)pixelFreq * VGA_PIXEL_CLOCK_TOLERANCE_PPM) {
+        return 0;
+    }
+    return period;
+}
+
+UInt32 GetDMAStartLeadPixels(float pixelMHzFreq) {
+    return (UInt32)(((pixelMHzFreq * (float)VGA_DMA_START_LEAD_NS) / 1000.0f) + 0.5f);
+}
+
+size_t GetFrameBufferSize(const VgaVideoFrameInfo* frame, BYTE scaling, Bpp bpp, BYTE bufferCount) {
+    // Same layout used by AllocateFrameBuffer: word-aligned lines with 1, 2 or 4 pixels in a byte
+    size_t pixelsPerByteLog2 = bpp == Bpp4 ? 1 : (bpp == Bpp2 ? 2 : 0);
+    size_t wordPixels = 4U << pixelsPerByteLog2;
+    size_t linePixels = ((size_t)(frame->ScanlineTiming.VisibleArea / scaling) + wordPixels - 1) & ~(wordPixels - 1);
+    size_t bufferSize = (linePixels >> pixelsPerByteLog2) * (size_t)(frame->FrameTiming.VisibleArea / scaling) * bufferCount;
+    if (IS_PALETTIZED(bpp)) {
+        // Two native line buffers, shared by the frame buffers
+        bufferSize += linePixels * 2;
+    }
+    return bufferSize;
 }
 
 VgaError ValidateTiming(const VgaTiming* pTiming) {
@@ -660,13 +1924,10 @@ VgaError ValidateTiming(const VgaTiming* pTiming) {
     return VgaErrorNone;
 }
 
-VgaError SetupTimers(BYTE resScaling, VgaScreenBuffer* screenBuffer) {
-    UInt32 timersOnAPB1Freq = HAL_RCC_GetPCLK1Freq() * 2;
-    UInt32 pixelFreq = (UInt32)(screenBuffer->VideoFrameTiming.PixelFrequencyMHz * 1000000.0f);
-    UInt32 prescaler = timersOnAPB1Freq / pixelFreq;
-
-    if (prescaler == 0 || prescaler > UINT8_MAX) {
-        return VgaErrorInvalidParameter;
+VgaError SetupTimers(VgaScreenBuffer* screenBuffer) {
+    UInt32 prescaler = GetPixelClockPeriod(screenBuffer->VideoFrameTiming.PixelFrequencyMHz, GetTimersClock());
+    if (prescaler == 0) {
+        return VgaErrorNotSupported;
     }
 
     // We prepare the main timer with the prescaling. The main timer will clock the HSync
@@ -677,6 +1938,10 @@ VgaError SetupTimers(BYTE resScaling, VgaScreenBuffer* screenBuffer) {
 
     const VgaTiming* hTiming = &screenBuffer->VideoFrameTiming.ScanlineTiming;
     const VgaTiming* vTiming = &screenBuffer->VideoFrameTiming.FrameTiming;
+    UInt32 dmaLeadPixels = GetDMAStartLeadPixels(screenBuffer->VideoFrameTiming.PixelFrequencyMHz);
+    if (dmaLeadPixels >= hTiming->BackPorch) {
+        return VgaErrorNotSupported;
+    }
 
     // Due to the PWM mode of our timers, the line/frame starts with a back porch
     // The timers will be high for BPorch + Visible + FPorch time and go low for the Sync time
@@ -693,7 +1958,7 @@ VgaError SetupTimers(BYTE resScaling, VgaScreenBuffer* screenBuffer) {
     hSyncTimer->CCR1 = wholeLine - hTiming->SyncPulse; // Main HSYNC signal
     hSyncTimer->CCR2 = hTiming->BackPorch; // Black porch VSYNC trigger
     // The correction delay is calculated empirically using the monitor in the default setting
-    hSyncTimer->CCR3 = hTiming->BackPorch - 18U; // DMA start (video line render start)
+    hSyncTimer->CCR3 = hTiming->BackPorch - dmaLeadPixels; // DMA start (video line render start)
     // We MUST be very strict in the line ending timing, otherwise the "auto correct picture" monitor
     // feature will go mad
     // We may correct the interrupt delay also here but this should not be a problem
@@ -706,12 +1971,12 @@ VgaError SetupTimers(BYTE resScaling, VgaScreenBuffer* screenBuffer) {
     DebugAssert(hSyncTimer->CCR4 >= 0 && hSyncTimer->CCR4 >= hSyncTimer->CCR3 && hSyncTimer->CCR4 < hSyncTimer->CCR1);
 
     /* *** Vertical sync setup *** */
-    // HSync will trigger the VSync at each line using the correct VGA timing, so we have to prescale the
-    // timer at the input
+    // HSync will trigger the VSync at each line using the correct VGA timing. The frame timings are not scaled,
+    // so the timer counts every line
     TIM_TypeDef* vSyncTimer = screenBuffer->vSyncClockTimer->Instance;
     vSyncTimer->ARR = wholeFrame - 1;
     vSyncTimer->CNT = 0;
-    vSyncTimer->PSC = (UInt32)resScaling - 1U;
+    vSyncTimer->PSC = 0;
 
     vSyncTimer->CCR1 = wholeFrame - vTiming->SyncPulse;
     vSyncTimer->CCR2 = vTiming->BackPorch;				// VideoStart signal
@@ -734,41 +1999,37 @@ void ShutdownDMAFor8BppBuffer(VgaScreenBuffer* screenBuffer) {
     __HAL_TIM_DISABLE_DMA(screenBuffer->hSyncClockTimer, TIM_DMA_TRIGGER);
 }
 
-// ##### Public Function definitions #####
-
-VgaError VgaCreateScreenBuffer(const VgaVisualizationInfo* visualizationInfo, ScreenBuffer** screenBuffer) {
-    // In and out pointers must me valid
-    if (!visualizationInfo || !screenBuffer) {
-        return VgaErrorInvalidParameter;
-    }
+VgaError CreateVgaBuffer(const VgaVisualizationInfo* visualizationInfo, BOOL textMode, VgaScreenBuffer** vgaBuffer) {
+    // The callers return the buffer pointer also on failure
+    *vgaBuffer = NULL;
     if (!visualizationInfo->mainTimer || !visualizationInfo->hSyncTimer || !visualizationInfo->vSyncTimer) {
         return VgaErrorInvalidParameter;
     }
 
     // Let's allocate in our generic memory the VgaScreenBuffer struct
     VgaScreenBuffer* vgaScreenBuffer = (VgaScreenBuffer*)malloc(sizeof(VgaScreenBuffer));
-    *screenBuffer = (ScreenBuffer*)vgaScreenBuffer;
-    if (*screenBuffer == NULL) {
+    if (vgaScreenBuffer == NULL) {
         // Cannot allocate memory for ScreenBuffer
         return VGAErrorOutOfMemory;
     }
+    // A zeroed buffer owns no resources, so every failure below can be cleaned up by ReleaseVgaBuffer
+    *vgaScreenBuffer = (const VgaScreenBuffer){ 0 };
 
+    VgaError result;
     if (visualizationInfo->FrameSignals.PixelFrequencyMHz <= 0.0f
         || visualizationInfo->Scaling <= 0) {
-        return VgaErrorInvalidParameter;
+        result = VgaErrorInvalidParameter;
+        goto cleanup;
     }
-    // For now we support the exact 40MHz frequency
-    if (visualizationInfo->FrameSignals.PixelFrequencyMHz != 40.0f) {
-        return VgaErrorNotSupported;
-    }
-    if (visualizationInfo->Scaling != 2) {
-        return VgaErrorNotSupported;
+    // The scaled pixel clock must be generated from the current clock tree or from a planned one
+    if (!IsPixelClockSupported(visualizationInfo->FrameSignals.PixelFrequencyMHz / visualizationInfo->Scaling)) {
+        result = VgaErrorNotSupported;
+        goto cleanup;
     }
 
-    VgaError result;
     VgaVideoFrameInfo scaledVideoTimings;
     if ((result = CorrectVideoFrameTimings(visualizationInfo, &scaledVideoTimings)) != VgaErrorNone) {
-        return result;
+        goto cleanup;
     }
 
     // Let's reset the screen buffer output state (stopped since we are displaying nothig)
@@ -780,8 +2041,10 @@ VgaError VgaCreateScreenBuffer(const VgaVisualizationInfo* visualizationInfo, Sc
     vgaScreenBuffer->VideoFrameTiming = scaledVideoTimings;
 
     // Before configuring clock, we try to allocate our buffer to see if there is enough memory
-    if ((result = AllocateFrameBuffer(visualizationInfo, vgaScreenBuffer)) != VgaErrorNone) {
-        return result;
+    result = textMode ? AllocateTextBuffer(visualizationInfo, vgaScreenBuffer) :
+        AllocateFrameBuffer(visualizationInfo, vgaScreenBuffer);
+    if (result != VgaErrorNone) {
+        goto cleanup;
     }
 
     // Let's eventually also register the timer references
@@ -789,53 +2052,74 @@ VgaError VgaCreateScreenBuffer(const VgaVisualizationInfo* visualizationInfo, Sc
     vgaScreenBuffer->hSyncClockTimer = visualizationInfo->hSyncTimer;
     vgaScreenBuffer->vSyncClockTimer = visualizationInfo->vSyncTimer;
 
-    if (visualizationInfo->BitsPerPixel == Bpp8) {
+    // The text mode reports the 4bpp palettized mode, so the buffer bpp is the one to check
+    if (HAS_LINE_DMA(vgaScreenBuffer->base.bitsPerPixel)) {
         // Let's hardcode that we are using DMA2 stream 0
         vgaScreenBuffer->displayState.Bpp8.screenLineDMAController = DMA2;
         vgaScreenBuffer->displayState.Bpp8.screenLineDMAStream = visualizationInfo->lineDMA->Instance;
         vgaScreenBuffer->dmaClearFlags = DMA_LIFCR_CTCIF0 | DMA_LIFCR_CHTIF0 | DMA_LIFCR_CFEIF0;
     }
 
-    /*if ((result = SetupMainClockTree(scaledVideoTimings.PixelFrequencyMHz)) != VgaErrorNone) {
-     return result;
-     }*/
+    // The buffers fit, so we can change the clocks if the pixel clock needs it
+    if ((result = SetupMainClockTree(scaledVideoTimings.PixelFrequencyMHz)) != VgaErrorNone) {
+        goto cleanup;
+    }
 
-    if ((result = SetupTimers(visualizationInfo->Scaling, vgaScreenBuffer)) != VgaErrorNone) {
-        return result;
+    if ((result = SetupTimers(vgaScreenBuffer)) != VgaErrorNone) {
+        goto cleanup;
     }
 
-    if (visualizationInfo->BitsPerPixel == Bpp8) {
+    if (HAS_LINE_DMA(vgaScreenBuffer->base.bitsPerPixel)) {
         // When using the 8bpp visualization, we use the low 8 GPIOE pins to output our colors:
         // 3 bits for blue, 3 bits for green, 2 bits for red, in "little-endian" order (Red -> [0, 1], Green -> [2, 4], Blu -> [5-7])
+        // Palettized and text modes output the same native pixels from their line buffers
 
         DMA_Stream_TypeDef* dmaStream = vgaScreenBuffer->displayState.Bpp8.screenLineDMAStream;
         dmaStream->PAR = (uint32_t)&GPIOE->ODR;
-        dmaStream->M0AR = (uint32_t)vgaScreenBuffer->BufferPtr;
+        dmaStream->M0AR = vgaScreenBuffer->renderLine != NULL ?
+            (uint32_t)vgaScreenBuffer->palettized.lineBuffers[0] : (uint32_t)vgaScreenBuffer->BufferPtr;
         dmaStream->NDTR = (uint32_t)vgaScreenBuffer->displayState.Bpp8.linePixels;
 
     }
 
     // We eventually register the screen buffer instance
     _activeScreenBuffer = vgaScreenBuffer;
+    *vgaBuffer = vgaScreenBuffer;
     return VgaErrorNone;
-}
 
-VgaError VgaReleaseScreenBuffer(ScreenBuffer* screenBuffer) {
-    if (!screenBuffer) {
-        return VgaErrorInvalidParameter;
-    }
+cleanup:
+    // ralloc is a stack allocator: the memory of a failed attempt must be given back or the pool would shrink
+    // at each connection
+    ReleaseVgaBuffer(vgaScreenBuffer);
+    return result;
+}
 
-    VgaScreenBuffer* vgaBuffer = (VgaScreenBuffer*)screenBuffer;
+VgaError ReleaseVgaBuffer(VgaScreenBuffer* vgaBuffer) {
     if (vgaBuffer->outputState != VgaOutputStopped) {
         // VGA output must be stopped when releasing the buffer
         return VgaErrorInvalidParameter;
     }
     // First we delete our internal reference (no interrupt should be active since the output
     // must be stopped but let's make sure no one is using this reference)
-    _activeScreenBuffer = NULL;
+    // A buffer whose creation failed has never been registered
+    if (_activeScreenBuffer == vgaBuffer) {
+        _activeScreenBuffer = NULL;
+    }
 
-    // We free our RAM-allocated buffer pointer
-    rfree(vgaBuffer->BufferPtr, vgaBuffer->bufferSize);
+    // We free our RAM-allocated buffer pointers. Front and back buffer may have been swapped, so the
+    // allocation start is the lowest of the two addresses
+    if (vgaBuffer->BufferPtr != NULL) {
+        rfree(MIN(vgaBuffer->BufferPtr, vgaBuffer->BackBufferPtr), vgaBuffer->bufferSize * vgaBuffer->bufferCount);
+    }
+    if (vgaBuffer->renderLine != NULL) {
+        // Line buffers have been allocated before the frame buffers
+        rfree(vgaBuffer->palettized.lineBuffers[0], (size_t)vgaBuffer->displayState.Bpp8.linePixels * 2);
+    }
+    free(vgaBuffer->palettized.conversionLine);
+    free(vgaBuffer->text.grid.Cells);
+    free(vgaBuffer->text.glyphCells);
+    free(vgaBuffer->ditherErrors);
+    free(vgaBuffer->lineTable);
 
     // Zeroing everything to make sure the buffer will be not reused
     *vgaBuffer = (VgaScreenBuffer){ 0 };
@@ -845,6 +2129,127 @@ VgaError VgaReleaseScreenBuffer(ScreenBuffer* screenBuffer) {
     return VgaErrorNone;
 }
 
+const VgaMode* FindLargestMode(const Edid* edid, Bpp bpp, BYTE bufferCount, BYTE* scaling, size_t* size) {
+    size_t freeRam = ravailable();
+    UInt32 timersClock = GetTimersClock();
+    const VgaMode* selectedMode = NULL;
+    BOOL selectedKeepsClocks = false;
+    *scaling = 0;
+    *size = 0;
+
+    for (size_t i = 0; i < sizeof(_modes) / sizeof(_modes[0]); i++) {
+        const VgaMode* mode = &_modes[i];
+        if (edid != NULL && !EdidIsTimingSupported(edid, mode->edidTiming)) {
+            continue;
+        }
+
+        // The smallest scaling we can generate gives the largest frame buffer of the mode
+        for (BYTE modeScaling = 1; modeScaling <= VGA_MAX_SCALING; modeScaling++) {
+            float pixelMHzFreq = mode->frame->PixelFrequencyMHz / modeScaling;
+            if (!IsPixelClockSupported(pixelMHzFreq)
+                || GetDMAStartLeadPixels(pixelMHzFreq) >= mode->frame->ScanlineTiming.BackPorch / modeScaling) {
+                continue;
+            }
+
+            size_t bufferSize = GetFrameBufferSize(mode->frame, modeScaling, bpp, bufferCount);
+            if (bufferSize > freeRam) {
+                continue;
+            }
+
+            // A clock tree change slows down the peripherals tuned for the board default, so it is avoided when
+            // another mode gives the same buffer
+            BOOL keepsClocks = GetPixelClockPeriod(pixelMHzFreq, timersClock) != 0;
+            if (bufferSize > *size || (bufferSize == *size && keepsClocks && !selectedKeepsClocks)) {
+                selectedMode = mode;
+                selectedKeepsClocks = keepsClocks;
+                *scaling = modeScaling;
+                *size = bufferSize;
+            }
+            break;
+        }
+    }
+    return selectedMode;
+}
+
+// ##### Public Function definitions #####
+
+VgaError VgaSelectMode(const Edid* edid, VgaVisualizationInfo* visualizationInfo) {
+    if (!visualizationInfo) {
+        return VgaErrorInvalidParameter;
+    }
+    // Only the frame buffers displayed with the line DMA are implemented
+    if (!HAS_LINE_DMA(visualizationInfo->BitsPerPixel)) {
+        return VgaErrorNotSupported;
+    }
+
+    // A double buffered screen needs a mode where both the buffers fit. If there is none, we explicitly fall back
+    // to a single buffer instead of letting the back buffer allocation fail later
+    BYTE selectedScaling = 0;
+    size_t selectedSize = 0;
+    BYTE bufferCount = visualizationInfo->DoubleBuffered ? 2 : 1;
+    const VgaMode* selectedMode = FindLargestMode(edid, visualizationInfo->BitsPerPixel, bufferCount, &selectedScaling, &selectedSize);
+    if (selectedMode == NULL && bufferCount == 2) {
+        selectedMode = FindLargestMode(edid, visualizationInfo->BitsPerPixel, 1, &selectedScaling, &selectedSize);
+        if (selectedMode != NULL) {
+            printf("No VGA mode fits two frame buffers. Using a single buffer\r\n");
+            visualizationInfo->DoubleBuffered = false;
+        }
+    }
+
+    if (selectedMode == NULL) {
+        return VgaErrorNotSupported;
+    }
+
+    printf("VGA mode %s, scaling %d (%d bytes)\r\n", selectedMode->name, selectedScaling, (int)selectedSize);
+    visualizationInfo->FrameSignals = *selectedMode->frame;
+    visualizationInfo->Scaling = selectedScaling;
+    visualizationInfo->Height = 0;
+    return VgaErrorNone;
+}
+
+VgaError VgaCreateScreenBuffer(const VgaVisualizationInfo* visualizationInfo, ScreenBuffer** screenBuffer) {
+    // In and out pointers must me valid
+    if (!visualizationInfo || !screenBuffer) {
+        return VgaErrorInvalidParameter;
+    }
+
+    VgaScreenBuffer* vgaScreenBuffer;
+    VgaError result = CreateVgaBuffer(visualizationInfo, false, &vgaScreenBuffer);
+    *screenBuffer = (ScreenBuffer*)vgaScreenBuffer;
+    return result;
+}
+
+VgaError VgaReleaseScreenBuffer(ScreenBuffer* screenBuffer) {
+    if (!screenBuffer) {
+        return VgaErrorInvalidParameter;
+    }
+    return ReleaseVgaBuffer((VgaScreenBuffer*)screenBuffer);
+}
+
+VgaError VgaCreateTextBuffer(const VgaVisualizationInfo* visualizationInfo, VgaTextBuffer** textBuffer) {
+    // In and out pointers must me valid
+    if (!visualizationInfo || !textBuffer) {
+        return VgaErrorInvalidParameter;
+    }
+    *textBuffer = NULL;
+
+    VgaScreenBuffer* vgaScreenBuffer;
+    VgaError result = CreateVgaBuffer(visualizationInfo, true, &vgaScreenBuffer);
+    if (result == VgaErrorNone) {
+        *textBuffer = &vgaScreenBuffer->text.grid;
+    }
+    return result;
+}
+
+VgaError VgaReleaseTextBuffer(VgaTextBuffer* textBuffer) {
+    VgaScreenBuffer* vgaBuffer = _activeScreenBuffer;
+    // The grid is embedded in the registered buffer
+    if (!textBuffer || vgaBuffer == NULL || textBuffer != &vgaBuffer->text.grid) {
+        return VgaErrorInvalidParameter;
+    }
+    return ReleaseVgaBuffer(vgaBuffer);
+}
+
 VgaError VgaDumpTimersFrequencies() {
     VgaScreenBuffer* screenBuf = _activeScreenBuffer;
     if (screenBuf == NULL) {
@@ -937,7 +2342,7 @@ VgaError VgaStartOutput() {
     HAL_TIM_PWM_Start_IT(screenBuf->vSyncClockTimer, TIM_CHANNEL_2);
     HAL_TIM_PWM_Start_IT(screenBuf->vSyncClockTimer, TIM_CHANNEL_3);
 
-    if (screenBuf->base.bitsPerPixel == Bpp8) {
+    if (HAS_LINE_DMA(screenBuf->base.bitsPerPixel)) {
         Bpp8State* bpp8State = &screenBuf->displayState.Bpp8;
         // Before starting we clear all the flags in case a previous transfer was completed/cancelled
 
@@ -1006,7 +2411,7 @@ VgaError VgaStopOutput() {
     // we first have to disable the DMA, wait for its EN bit to become 0 and then disable the peripheral
     screenBuf->outputState = VgaOutputStopped;
 
-    if (screenBuf->base.bitsPerPixel == Bpp8) {
+    if (HAS_LINE_DMA(screenBuf->base.bitsPerPixel)) {
         ShutdownDMAFor8BppBuffer(screenBuf);
     }
 
@@ -1027,3 +2432,48 @@ VgaError VgaStopOutput() {
     screenBuf->hSyncClockTimer->Instance->CNT = 0;
     return VgaErrorNone;
 }
+
+VgaError VgaSwapBuffers() {
+    VgaScreenBuffer* screenBuf = _activeScreenBuffer;
+    if (screenBuf == NULL) {
+        // VGA screen buffer not allocated and registered
+        return VGAErrorInvalidState;
+    }
+
+    if (screenBuf->bufferCount < 2) {
+        // Nothing to swap
+        return VgaErrorNone;
+    }
+
+    // The swap presents the whole back buffer, so the modified areas recorded until now must not be copied
+    // again by a later ScreenPresent (they would come from the stale buffer)
+    screenBuf->dirtyRegion.count = 0;
+
+    return WaitBufferSwap(screenBuf);
+}
+
+VgaError VgaSetPalette(const ARGB8Color* colors, BYTE count) {
+    VgaScreenBuffer* screenBuf = _activeScreenBuffer;
+    if (screenBuf == NULL) {
+        // VGA screen buffer not allocated and registered
+        return VGAErrorInvalidState;
+    }
+
+    if (!IS_PALETTIZED(screenBuf->base.bitsPerPixel)) {
+        return VgaErrorNotSupported;
+    }
+    if (colors == NULL || count != screenBuf->palettized.paletteSize) {
+        return VgaErrorInvalidParameter;
+    }
+
+    for (BYTE i = 0; i < count; i++) {
+        screenBuf->palettized.palette[i] = (BYTE)RGB_TO_8BPP(colors[i].components.R, colors[i].components.G, colors[i].components.B);
+    }
+    // The tables are read by the scanout without any lock: the displayed frame can mix the two palettes for a few lines
+    BuildPaletteTables(screenBuf);
+    return VgaErrorNone;
+}
+
+__weak void VgaClockTreeChangedCallback() {
+    // The application has no peripheral that depends on the bus clocks
+}
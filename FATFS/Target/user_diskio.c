@@ -39,6 +39,8 @@
 #include "ff_gen_drv.h"
 
 #include <sd/sd.h>
+#include <disk/readahead.h>
+#include <disk/sectorcache.h>
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
@@ -111,6 +113,10 @@ DSTATUS USER_initialize(
         return STA_NOINIT;
 
     printf("Initializing SD card ...\r\n");
+    // Prefetched and cached sectors may belong to another card
+    ReadAheadInvalidate();
+    SectorCacheInvalidate();
+
     // We perform a power cycle in the SD card (a card already attached may be not correctly initialized if a reset
     // occurred
     SdStatus powerCycleStatus = SdPerformPowerCycle();
@@ -169,28 +175,16 @@ DRESULT USER_read(
 )
 {
     /* USER CODE BEGIN READ */
-    if (count == 1) {
-        SdStatus readSectorStatus = SdReadSector(buff, sector);
-        if (readSectorStatus != SdStatusOk) {
-            printf("Read of sector %" PRIu32 " returned error ", sector);
-            SdDumpStatusCode(readSectorStatus);
-            printf("\r\n");
-
-            return HandleDiskReadError(pdrv, readSectorStatus);
-        }
-        return RES_OK;
-    }
-    else {
-        SdStatus readSectorsStatus = SdReadSectors(buff, sector, count);
-        if (readSectorsStatus != SdStatusOk) {
-            printf("Read of %" PRIu32 " sectors from sector %" PRIu32 " returned error ", count, sector);
-            SdDumpStatusCode(readSectorsStatus);
-            printf("\r\n");
-
-            return HandleDiskReadError(pdrv, readSectorsStatus);
-        }
-        return RES_OK;
+    // Single sectors can be served by the sector cache, the others by the read-ahead window or by the storage task
+    SdStatus readStatus = SectorCacheRead(buff, sector, count);
+    if (readStatus != SdStatusOk) {
+        printf("Read of %" PRIu32 " sectors from sector %" PRIu32 " returned error ", (UInt32)count, sector);
+        SdDumpStatusCode(readStatus);
+        printf("\r\n");
+
+        return HandleDiskReadError(pdrv, readStatus);
     }
+    return RES_OK;
     /* USER CODE END READ */
 }
 
@@ -236,9 +230,29 @@ DRESULT USER_ioctl(
 )
 {
     /* USER CODE BEGIN IOCTL */
-    Error_Handler();
-    DRESULT res = RES_ERROR;
-    return res;
+    if (pdrv > 0)
+        return RES_PARERR;
+    if (_diskStatus & STA_NOINIT)
+        return RES_NOTRDY;
+
+    // Geometry comes from the CSD register read during the connection
+    PCSDDescription card = SdGetCardDescription();
+    switch (cmd) {
+    case CTRL_SYNC:
+        // Read-only driver: nothing is ever pending
+        return RES_OK;
+    case GET_SECTOR_COUNT:
+        *(DWORD*)buff = card->SectorCount;
+        return RES_OK;
+    case GET_SECTOR_SIZE:
+        *(WORD*)buff = _MAX_SS;
+        return RES_OK;
+    case GET_BLOCK_SIZE:
+        *(DWORD*)buff = card->EraseSectorSize;
+        return RES_OK;
+    default:
+        return RES_PARERR;
+    }
     /* USER CODE END IOCTL */
 }
 #endif /* _USE_IOCTL == 1 */
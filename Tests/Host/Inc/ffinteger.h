@@ -0,0 +1,28 @@
+/*
+ * Host replacement of the FatFs integer types, included before any other header
+ *
+ * The FatFs integer.h defines the 32 bit types as long, which is 64 bit on the host: the file format structures
+ * (FAT entries, BMP headers) would have the wrong layout. The guard of integer.h is defined here, so the
+ * original file is skipped
+ */
+
+#ifndef _FF_INTEGER
+#define _FF_INTEGER
+
+#include <stdint.h>
+
+typedef int INT;
+typedef unsigned int UINT;
+
+typedef uint8_t BYTE;
+
+typedef int16_t SHORT;
+typedef uint16_t WORD;
+typedef uint16_t WCHAR;
+
+typedef int32_t LONG;
+typedef uint32_t DWORD;
+
+typedef uint64_t QWORD;
+
+#endif
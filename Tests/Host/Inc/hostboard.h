@@ -0,0 +1,118 @@
+/*
+ * Emulated board for the host tests of the firmware modules that access the peripherals
+ *
+ * The firmware runs unmodified: the peripheral registers are mapped at their real addresses, the HAL and
+ * CMSIS-RTOS functions it calls are replaced by host implementations and the SPI2 and DMA1 registers are
+ * trapped, so that every access is served by the SPI model and the device connected to the bus.
+ *
+ * The emulated time only advances with the bus activity and the delays: the CPU is infinitely fast. The bus
+ * time of a byte follows the SPI prescaler, a DMA transfer keeps the bus busy while the CPU is free, and its
+ * completion interrupt is raised at the end of the last byte. Interrupts are taken at the RTOS calls: the
+ * scheduler is cooperative like the one of the board, and a thread woken by an interrupt preempts the running
+ * one if its priority is higher
+ *
+ * @remarks The peripheral trap relies on the x86-64 Linux signal context. The test programs are not position
+ * independent, since the firmware stores the addresses of its buffers in 32 bit DMA registers
+ */
+
+#ifndef TESTS_HOST_INC_HOSTBOARD_H_
+#define TESTS_HOST_INC_HOSTBOARD_H_
+
+#include <typedefs.h>
+#include <stm32f4xx.h>
+#include <cmsis_os2.h>
+
+/// Emulated time units (the emulated clock counts picoseconds)
+#define HOST_TIME_NS 1000ULL
+#define HOST_TIME_US (1000ULL * HOST_TIME_NS)
+#define HOST_TIME_MS (1000ULL * HOST_TIME_US)
+#define HOST_TIME_S (1000ULL * HOST_TIME_MS)
+
+/// Default core clock of the board (HSE 8MHz, PLL 120MHz) and APB1 clock of SPI2. The RCC functions of the HAL
+/// change the clock tree like on the board
+#define HOST_SYSTEM_CLOCK 120000000U
+#define HOST_PCLK1_CLOCK 30000000U
+
+/// Start of the core coupled memory of the board: the emulated DMA cannot reach it
+#define HOST_CCMRAM_START 0x10000000U
+#define HOST_CCMRAM_SIZE 0x10000U
+
+/// Device connected to the emulated SPI2 bus
+typedef struct _HostSpiDevice {
+    /// Exchanges a byte
+    /// @param time Emulated time when the last bit is clocked
+    /// @return Byte sent by the device while receiving mosi
+    BYTE (*exchange)(void* context, BYTE mosi, UInt64 time);
+    /// Notifies a change of the chip select line (active low, GPIOB pin 12)
+    void (*select)(void* context, BOOL selected, UInt64 time);
+    /// Notifies a change of the power line
+    void (*power)(void* context, BOOL powered, UInt64 time);
+    /// Device data passed to the callbacks
+    void* context;
+} HostSpiDevice;
+
+/// Counters of the emulated SPI and DMA activity
+typedef struct _HostSpiStatistics {
+    /// Bytes exchanged by the CPU through the data register
+    UInt64 cpuBytes;
+    /// Bytes exchanged by the DMA
+    UInt64 dmaBytes;
+    /// DMA transfers started
+    UInt32 dmaTransfers;
+    /// Trapped register accesses
+    UInt64 registerAccesses;
+    /// Register sequences that the real peripherals would not accept (overruns, wrong DMA setup, ...)
+    UInt32 protocolErrors;
+} HostSpiStatistics;
+
+/// Maps the peripherals and the core coupled memory at the addresses of the board
+/// \remarks Must be called once, before any other function of the module and before the firmware runs
+void HostBoardInitialize();
+
+/// Returns the emulated time
+UInt64 HostTimeNow();
+/// Returns the emulated time spent with no thread ready to run, when the board runs its idle task. The rest of
+/// the time the CPU is busy, also while it polls a peripheral
+UInt64 HostTimeIdle();
+/// Moves the emulated time forward while the CPU is busy (polling a peripheral or waiting in a delay)
+/// @param time New emulated time. Times in the past are ignored
+void HostTimeAdvanceTo(UInt64 time);
+
+/// Keeps the CPU busy in the running thread for a time, like a computation of the firmware (ex. an image decode)
+/// \remarks The interrupts and the threads with a higher priority preempt the work: they run at their time, without
+/// delaying its end
+void HostCpuWork(UInt64 duration);
+
+/// Raises an interrupt at the given emulated time
+/// \remarks The handler runs at the first RTOS call after that time, if the interrupt is enabled
+void HostRaiseInterrupt(IRQn_Type irq, void (*handler)(void), UInt64 time);
+
+/// Runs a function as the first thread of the kernel, until it returns
+/// \remarks The threads created before or during the run stay blocked afterwards: they continue in the next run.
+/// Outside a run the kernel is not running, like before osKernelStart on the board
+void HostKernelRun(osThreadFunc_t function, void* argument);
+
+/// Connects the device to the SPI2 bus
+/// @param powerPort Port of the power line of the device
+/// @param powerPin Pin of the power line
+void HostSpiAttach(const HostSpiDevice* device, GPIO_TypeDef* powerPort, UInt16 powerPin);
+/// Returns the SPI and DMA counters since the start of the program
+void HostSpiGetStatistics(HostSpiStatistics* statistics);
+/// Configures the SPI2 registers as the CubeMX initialization of the board (master, 8 bit, software NSS,
+/// slowest clock) and returns its handle
+SPI_HandleTypeDef* HostSpiGetHandle();
+
+/// Notifies a change of an output pin (called by HAL_GPIO_WritePin)
+void HostSpiPinChanged(GPIO_TypeDef* port, UInt16 pin, BOOL set);
+
+/// Model of a trapped register page, called after each access of the firmware
+/// @param address Accessed register. After a write the register contains the written value
+typedef void (*HostRegisterAccess)(UInt32 address, BOOL write);
+
+/// Traps the accesses of the firmware to a page of peripheral registers
+/// @param address Start of the page
+/// @param access Model of the registers
+/// @return View of the page where the model reads and writes the registers without being trapped
+void* HostBoardTrapPage(UInt32 address, HostRegisterAccess access);
+
+#endif /* TESTS_HOST_INC_HOSTBOARD_H_ */
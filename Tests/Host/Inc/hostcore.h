@@ -0,0 +1,29 @@
+/*
+ * Host replacements of the Cortex-M4 intrinsics used by the firmware modules that run on the emulated board
+ *
+ * The header is included before any other one (-include), so that the CMSIS inline functions with ARM assembly
+ * are renamed before their definition: the renamed definitions are never called, so they are never emitted
+ */
+
+#ifndef TESTS_HOST_INC_HOSTCORE_H_
+#define TESTS_HOST_INC_HOSTCORE_H_
+
+#include <stdint.h>
+
+/// __get_IPSR(void) becomes the unused HostGetIpsrvoid(), while the calls __get_IPSR() become HostGetIpsr()
+#define __get_IPSR(...) HostGetIpsr ## __VA_ARGS__ ()
+
+/// Returns the exception number of the running interrupt handler, zero in thread mode
+uint32_t HostGetIpsr(void);
+
+#define __get_PRIMASK(...) HostGetPrimask ## __VA_ARGS__ ()
+#define __disable_irq(...) HostDisableIrq ## __VA_ARGS__ ()
+#define __enable_irq(...) HostEnableIrq ## __VA_ARGS__ ()
+
+/// Returns 1 while the interrupts are masked
+uint32_t HostGetPrimask(void);
+/// Masks the interrupts: they are serviced when they are enabled again
+void HostDisableIrq(void);
+void HostEnableIrq(void);
+
+#endif /* TESTS_HOST_INC_HOSTCORE_H_ */
@@ -0,0 +1,37 @@
+/*
+ * Builder of the FAT16 disk images read by the emulated SD card
+ *
+ * The image has no partition table (like a superfloppy formatted card): 512 byte sectors, 4 sectors per cluster,
+ * two FATs and a 512 entry root directory holding the files. The clusters of the files can be fragmented, so that
+ * the cluster chains have to be followed like on a card written many times
+ */
+
+#ifndef TESTS_HOST_INC_HOSTFAT_H_
+#define TESTS_HOST_INC_HOSTFAT_H_
+
+#include <typedefs.h>
+
+/// Sectors of the smallest FAT16 image with 4 sectors per cluster (more than 4085 clusters), rounded to 512KB
+#define HOST_FAT_MIN_SECTORS 17408U
+#define HOST_FAT_CLUSTER_SIZE 2048U
+
+/// File of the root directory
+typedef struct _HostFatFile {
+    /// 8.3 name, like "IMAGE.BMP"
+    const char* name;
+    PCBYTE data;
+    UInt32 size;
+} HostFatFile;
+
+/// Writes a disk image
+/// @param path Path of the image file
+/// @param sectorCount Size of the image. FAT16 needs at least HOST_FAT_MIN_SECTORS
+/// @param files Files of the root directory, allocated in order
+/// @param fileCount Number of files (at most 512)
+/// @param fragmentClusters Clusters of each fragment of the files: a free cluster is left after each fragment.
+///     Zero allocates the files in contiguous clusters
+/// @return False if the files do not fit in the image or the image cannot be written
+BOOL HostFatBuildImage(const char* path, UInt32 sectorCount, const HostFatFile* files, UInt32 fileCount,
+    UInt32 fragmentClusters);
+
+#endif /* TESTS_HOST_INC_HOSTFAT_H_ */
@@ -0,0 +1,54 @@
+/*
+ * Minimal support for the host tests: checks, failure counting and cycle counting
+ *
+ * Each test program calls the TEST_CHECK macros and returns TestResult() from main, so ctest reports a failure
+ * as soon as one check fails. Failed checks are printed with their location and they do not stop the program
+ */
+
+#ifndef TESTS_HOST_INC_HOSTTEST_H_
+#define TESTS_HOST_INC_HOSTTEST_H_
+
+#include <typedefs.h>
+#include <stdio.h>
+
+/// Number of failed checks since the start of the program
+extern UInt32 _testFailures;
+
+/// Checks a condition, printing the message (printf format) if it is false
+#define TEST_CHECK(condition, ...) \
+    do { \
+        if (!(condition)) { \
+            _testFailures++; \
+            printf("%s:%d: check failed: %s: ", __FILE__, __LINE__, #condition); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } while (0)
+
+/// Checks that two integer values are equal
+#define TEST_CHECK_EQUAL(expected, actual, ...) \
+    do { \
+        long long _expected = (long long)(expected); \
+        long long _actual = (long long)(actual); \
+        if (_expected != _actual) { \
+            _testFailures++; \
+            printf("%s:%d: expected %lld, got %lld: ", __FILE__, __LINE__, _expected, _actual); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } while (0)
+
+/// Prints the outcome of the test program
+/// @return Exit code of the program: 0 if all the checks passed
+int TestResult();
+
+/// Returns a free running counter of the host CPU cycles (the time stamp counter on x86)
+/// \remarks The counter is only used to compare two implementations on the same host: the absolute values
+/// do not predict the Cortex-M4 timings
+UInt64 HostCycles();
+
+/// Deterministic pseudo random generator, so that failures can be reproduced
+/// @param state Generator state, initialized with any non zero value
+UInt32 HostRandom(UInt32* state);
+
+#endif /* TESTS_HOST_INC_HOSTTEST_H_ */
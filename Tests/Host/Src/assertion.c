@@ -0,0 +1,22 @@
+#include <assertion.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Host replacement of Core/Src/assertion.c: there is no ITM and no Error_Handler to halt the board
+
+void Error_Handler(void) {
+    printf("Error_Handler called\n");
+    abort();
+}
+
+void DebugAssert(bool condition) {
+    // Not assert(): the tests are built with NDEBUG (RelWithDebInfo), but the module checks must stay enabled
+    if (!condition) {
+        printf("DebugAssert failed\n");
+        abort();
+    }
+}
+
+void DebugWriteChar(uint32_t c) {
+    SUPPRESS_WARNING(c);
+}
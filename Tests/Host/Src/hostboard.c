@@ -0,0 +1,329 @@
+#include <hostboard.h>
+#include <assertion.h>
+#include <malloc.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+#if !defined(__x86_64__) || !defined(__linux__)
+#error "The peripheral trap needs the x86-64 Linux signal context"
+#endif
+
+// Host replacement of the HAL functions used by the firmware and memory map of the emulated board.
+// The accesses to a trapped page raise a segmentation fault: the page is opened for the faulting instruction,
+// which is executed with the trap flag set, then the single step trap closes the page and runs the model
+
+#define HOST_PAGE_SIZE 0x1000U
+/// APB1, APB2 and AHB1 peripherals (timers, SPI, GPIO, RCC, DMA)
+#define HOST_PERIPHERALS_START 0x40000000U
+#define HOST_PERIPHERALS_SIZE 0x80000U
+/// Core peripherals (DWT, SysTick, NVIC, SCB, CoreDebug)
+#define HOST_CORE_PERIPHERALS_START 0xE0000000U
+#define HOST_CORE_PERIPHERALS_SIZE 0x100000U
+#define HOST_MAX_TRAPPED_PAGES 4
+/// Page fault error code bit of the write accesses
+#define HOST_PAGE_FAULT_WRITE 0x2
+/// Single step flag of RFLAGS
+#define HOST_TRAP_FLAG 0x100
+/// Limits of the clock tree (regulator in scale 1, 3.3V)
+#define HOST_MAX_SYSTEM_CLOCK 168000000U
+#define HOST_MAX_PCLK1_CLOCK 42000000U
+#define HOST_MAX_PCLK2_CLOCK 84000000U
+#define HOST_FLASH_WAIT_STATE_CLOCK 30000000U
+#define HOST_HSI_CLOCK 16000000U
+
+typedef struct _HostTrappedPage {
+    UInt32 address;
+    HostRegisterAccess access;
+} HostTrappedPage;
+
+// ##### Private forward declarations #####
+
+/// Maps anonymous memory at an address of the board
+static void MapRegion(UInt32 address, UInt32 size);
+static void OnSegmentationFault(int signal, siginfo_t* info, void* context);
+static void OnSingleStep(int signal, siginfo_t* info, void* context);
+/// Returns the log2 of an APB divider (RCC_HCLK_DIVx)
+static UInt32 GetApbShift(UInt32 divider);
+/// Returns the system clock of a clock configuration with the current PLL
+static UInt32 GetSystemClock(const RCC_ClkInitTypeDef* clocks);
+
+/// Called once by HostBoardInitialize to trap the SPI2 and DMA1 pages
+extern void HostSpiInitialize();
+
+// ##### Private fields #####
+
+uint32_t SystemCoreClock = HOST_SYSTEM_CLOCK;
+
+static HostTrappedPage _trappedPages[HOST_MAX_TRAPPED_PAGES];
+static UInt32 _trappedPageCount;
+/// Page opened for the faulting instruction
+static const HostTrappedPage* _openPage;
+static UInt32 _openAddress;
+static BOOL _openWrite;
+/// Clock tree of the board, as programmed by SystemClock_Config
+static RCC_OscInitTypeDef _oscillators = {
+    .OscillatorType = RCC_OSCILLATORTYPE_HSE,
+    .HSEState = RCC_HSE_BYPASS,
+    .PLL = { .PLLState = RCC_PLL_ON, .PLLSource = RCC_PLLSOURCE_HSE, .PLLM = 4, .PLLN = 120, .PLLP = RCC_PLLP_DIV2, .PLLQ = 7 },
+};
+static RCC_ClkInitTypeDef _clocks = {
+    .ClockType = RCC_CLOCKTYPE_HCLK | RCC_CLOCKTYPE_SYSCLK | RCC_CLOCKTYPE_PCLK1 | RCC_CLOCKTYPE_PCLK2,
+    .SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK,
+    .AHBCLKDivider = RCC_SYSCLK_DIV1,
+    .APB1CLKDivider = RCC_HCLK_DIV4,
+    .APB2CLKDivider = RCC_HCLK_DIV4,
+};
+static UInt32 _flashLatency = FLASH_LATENCY_3;
+
+// ##### Private function definitions #####
+
+void MapRegion(UInt32 address, UInt32 size) {
+    void* region = mmap((void*)(uintptr_t)address, size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+    if (region != (void*)(uintptr_t)address) {
+        printf("Cannot map the board memory at 0x%08" PRIX32 "\n", address);
+        abort();
+    }
+}
+
+void OnSegmentationFault(int signal, siginfo_t* info, void* context) {
+    ucontext_t* userContext = (ucontext_t*)context;
+    uintptr_t address = (uintptr_t)info->si_addr;
+
+    const HostTrappedPage* page = NULL;
+    for (UInt32 i = 0; i < _trappedPageCount; i++) {
+        if (address >= _trappedPages[i].address && address < _trappedPages[i].address + HOST_PAGE_SIZE) {
+            page = &_trappedPages[i];
+        }
+    }
+    if (page == NULL || _openPage != NULL) {
+        // A real crash: the instruction faults again with the default action
+        sigaction(signal, &(struct sigaction){ .sa_handler = SIG_DFL }, NULL);
+        return;
+    }
+
+    _openPage = page;
+    _openAddress = (UInt32)address;
+    _openWrite = (userContext->uc_mcontext.gregs[REG_ERR] & HOST_PAGE_FAULT_WRITE) != 0;
+    mprotect((void*)(uintptr_t)page->address, HOST_PAGE_SIZE, PROT_READ | PROT_WRITE);
+    userContext->uc_mcontext.gregs[REG_EFL] |= HOST_TRAP_FLAG;
+}
+
+void OnSingleStep(int signal, siginfo_t* info, void* context) {
+    SUPPRESS_WARNING(info);
+    ucontext_t* userContext = (ucontext_t*)context;
+    const HostTrappedPage* page = _openPage;
+    if (page == NULL) {
+        sigaction(signal, &(struct sigaction){ .sa_handler = SIG_DFL }, NULL);
+        return;
+    }
+
+    userContext->uc_mcontext.gregs[REG_EFL] &= ~HOST_TRAP_FLAG;
+    mprotect((void*)(uintptr_t)page->address, HOST_PAGE_SIZE, PROT_NONE);
+    _openPage = NULL;
+    page->access(_openAddress, _openWrite);
+}
+
+UInt32 GetApbShift(UInt32 divider) {
+    // The DIV1 value has the top bit of the field clear, the others encode the log2 minus 1
+    return (divider & RCC_CFGR_PPRE1_2) != 0 ? ((divider >> RCC_CFGR_PPRE1_Pos) & 0x3U) + 1U : 0U;
+}
+
+UInt32 GetSystemClock(const RCC_ClkInitTypeDef* clocks) {
+    switch (clocks->SYSCLKSource) {
+    case RCC_SYSCLKSOURCE_HSI:
+        return HOST_HSI_CLOCK;
+    case RCC_SYSCLKSOURCE_HSE:
+        return HSE_VALUE;
+    default:
+        // Same arithmetic of HAL_RCC_GetSysClockFreq
+        return (UInt32)(((UInt64)HSE_VALUE * _oscillators.PLL.PLLN) / _oscillators.PLL.PLLM) / _oscillators.PLL.PLLP;
+    }
+}
+
+// ##### Public function definitions #####
+
+void HostBoardInitialize() {
+    // The firmware stores the buffer addresses in 32 bit registers: large blocks must not be mapped above 4GB
+    mallopt(M_MMAP_MAX, 0);
+    MapRegion(HOST_CCMRAM_START, HOST_CCMRAM_SIZE);
+    MapRegion(HOST_PERIPHERALS_START, HOST_PERIPHERALS_SIZE);
+    MapRegion(HOST_CORE_PERIPHERALS_START, HOST_CORE_PERIPHERALS_SIZE);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_flags = SA_SIGINFO;
+    action.sa_sigaction = OnSegmentationFault;
+    sigaction(SIGSEGV, &action, NULL);
+    action.sa_sigaction = OnSingleStep;
+    sigaction(SIGTRAP, &action, NULL);
+
+    HostSpiInitialize();
+}
+
+void* HostBoardTrapPage(UInt32 address, HostRegisterAccess access) {
+    if (_trappedPageCount == HOST_MAX_TRAPPED_PAGES || (address % HOST_PAGE_SIZE) != 0) {
+        printf("Cannot trap the page 0x%08" PRIX32 "\n", address);
+        abort();
+    }
+
+    // The firmware view and the model view share the same memory
+    int file = memfd_create("HostRegisters", 0);
+    if (file < 0 || ftruncate(file, HOST_PAGE_SIZE) != 0) {
+        printf("Cannot create the registers of the page 0x%08" PRIX32 "\n", address);
+        abort();
+    }
+    void* firmwareView = mmap((void*)(uintptr_t)address, HOST_PAGE_SIZE, PROT_NONE, MAP_SHARED | MAP_FIXED, file, 0);
+    void* modelView = mmap(NULL, HOST_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+    close(file);
+    if (firmwareView != (void*)(uintptr_t)address || modelView == MAP_FAILED) {
+        printf("Cannot map the registers of the page 0x%08" PRIX32 "\n", address);
+        abort();
+    }
+
+    _trappedPages[_trappedPageCount++] = (HostTrappedPage){ .address = address, .access = access };
+    return modelView;
+}
+
+uint32_t HAL_GetTick(void) {
+    return (uint32_t)(HostTimeNow() / HOST_TIME_MS);
+}
+
+void HAL_Delay(uint32_t Delay) {
+    // The HAL delay is a busy loop, no other thread runs
+    HostTimeAdvanceTo(HostTimeNow() + ((UInt64)Delay * HOST_TIME_MS));
+}
+
+// The clock tree is emulated by its configuration: the functions accept the changes the real RCC would accept and
+// refuse the others with HAL_ERROR. SystemCoreClock and the bus clocks follow the changes
+void HAL_RCC_GetOscConfig(RCC_OscInitTypeDef* RCC_OscInitStruct) {
+    *RCC_OscInitStruct = _oscillators;
+}
+
+HAL_StatusTypeDef HAL_RCC_OscConfig(RCC_OscInitTypeDef* RCC_OscInitStruct) {
+    // Only the main PLL can change, the HSE stays the board oscillator
+    if (RCC_OscInitStruct->OscillatorType != RCC_OSCILLATORTYPE_NONE || RCC_OscInitStruct->PLL.PLLState == RCC_PLL_NONE) {
+        return RCC_OscInitStruct->OscillatorType == RCC_OSCILLATORTYPE_NONE ? HAL_OK : HAL_ERROR;
+    }
+
+    const RCC_PLLInitTypeDef* pll = &RCC_OscInitStruct->PLL;
+    if (_clocks.SYSCLKSource == RCC_SYSCLKSOURCE_PLLCLK) {
+        // The PLL clocks the system: the HAL only accepts the current configuration
+        return memcmp(pll, &_oscillators.PLL, sizeof(*pll)) == 0 ? HAL_OK : HAL_ERROR;
+    }
+
+    UInt32 input = HSE_VALUE / pll->PLLM;
+    UInt32 vco = (UInt32)(((UInt64)HSE_VALUE * pll->PLLN) / pll->PLLM);
+    if (pll->PLLState != RCC_PLL_ON || pll->PLLSource != RCC_PLLSOURCE_HSE || input < 1000000U || input > 2000000U
+        || pll->PLLN < 50U || pll->PLLN > 432U || vco < 100000000U || vco > 432000000U
+        || !IS_RCC_PLLP_VALUE(pll->PLLP) || !IS_RCC_PLLQ_VALUE(pll->PLLQ) || vco / pll->PLLQ > 48000000U) {
+        return HAL_ERROR;
+    }
+    _oscillators.PLL = *pll;
+    return HAL_OK;
+}
+
+void HAL_RCC_GetClockConfig(RCC_ClkInitTypeDef* RCC_ClkInitStruct, uint32_t* pFLatency) {
+    *RCC_ClkInitStruct = _clocks;
+    *pFLatency = _flashLatency;
+}
+
+HAL_StatusTypeDef HAL_RCC_ClockConfig(RCC_ClkInitTypeDef* RCC_ClkInitStruct, uint32_t FLatency) {
+    RCC_ClkInitTypeDef clocks = _clocks;
+    if ((RCC_ClkInitStruct->ClockType & RCC_CLOCKTYPE_SYSCLK) != 0) {
+        clocks.SYSCLKSource = RCC_ClkInitStruct->SYSCLKSource;
+    }
+    if ((RCC_ClkInitStruct->ClockType & RCC_CLOCKTYPE_HCLK) != 0) {
+        clocks.AHBCLKDivider = RCC_ClkInitStruct->AHBCLKDivider;
+    }
+    if ((RCC_ClkInitStruct->ClockType & RCC_CLOCKTYPE_PCLK1) != 0) {
+        clocks.APB1CLKDivider = RCC_ClkInitStruct->APB1CLKDivider;
+    }
+    if ((RCC_ClkInitStruct->ClockType & RCC_CLOCKTYPE_PCLK2) != 0) {
+        clocks.APB2CLKDivider = RCC_ClkInitStruct->APB2CLKDivider;
+    }
+
+    // The AHB prescaler is not emulated
+    UInt32 systemClock = GetSystemClock(&clocks);
+    if (clocks.AHBCLKDivider != RCC_SYSCLK_DIV1 || systemClock > HOST_MAX_SYSTEM_CLOCK
+        || (systemClock >> GetApbShift(clocks.APB1CLKDivider)) > HOST_MAX_PCLK1_CLOCK
+        || (systemClock >> GetApbShift(clocks.APB2CLKDivider)) > HOST_MAX_PCLK2_CLOCK
+        || FLatency < (systemClock - 1U) / HOST_FLASH_WAIT_STATE_CLOCK) {
+        return HAL_ERROR;
+    }
+
+    _clocks = clocks;
+    _flashLatency = FLatency;
+    SystemCoreClock = systemClock;
+    return HAL_OK;
+}
+
+uint32_t HAL_RCC_GetPCLK1Freq(void) {
+    return SystemCoreClock >> GetApbShift(_clocks.APB1CLKDivider);
+}
+
+void HAL_NVIC_SetPriority(IRQn_Type IRQn, uint32_t PreemptPriority, uint32_t SubPriority) {
+    SUPPRESS_WARNING(SubPriority);
+    NVIC_SetPriority(IRQn, PreemptPriority);
+}
+
+void HAL_NVIC_EnableIRQ(IRQn_Type IRQn) {
+    NVIC_EnableIRQ(IRQn);
+}
+
+void HAL_GPIO_WritePin(GPIO_TypeDef* GPIOx, uint16_t GPIO_Pin, GPIO_PinState PinState) {
+    if (PinState != GPIO_PIN_RESET) {
+        GPIOx->ODR |= GPIO_Pin;
+    }
+    else {
+        GPIOx->ODR &= ~(UInt32)GPIO_Pin;
+    }
+    HostSpiPinChanged(GPIOx, GPIO_Pin, PinState != GPIO_PIN_RESET);
+}
+
+// The timers are not emulated: their registers are plain memory, the start and stop functions only set the enable
+// bits that the HAL would set
+HAL_StatusTypeDef HAL_TIM_Base_Start(TIM_HandleTypeDef* htim) {
+    SET_BIT(htim->Instance->CR1, TIM_CR1_CEN);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_Base_Stop(TIM_HandleTypeDef* htim) {
+    CLEAR_BIT(htim->Instance->CR1, TIM_CR1_CEN);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef* htim, uint32_t Channel) {
+    SET_BIT(htim->Instance->CCER, TIM_CCER_CC1E << Channel);
+    if (IS_TIM_BREAK_INSTANCE(htim->Instance)) {
+        SET_BIT(htim->Instance->BDTR, TIM_BDTR_MOE);
+    }
+    SET_BIT(htim->Instance->CR1, TIM_CR1_CEN);
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Stop(TIM_HandleTypeDef* htim, uint32_t Channel) {
+    CLEAR_BIT(htim->Instance->CCER, TIM_CCER_CC1E << Channel);
+    if ((htim->Instance->CCER & TIM_CCER_CCxE_MASK) == 0) {
+        if (IS_TIM_BREAK_INSTANCE(htim->Instance)) {
+            CLEAR_BIT(htim->Instance->BDTR, TIM_BDTR_MOE);
+        }
+        CLEAR_BIT(htim->Instance->CR1, TIM_CR1_CEN);
+    }
+    return HAL_OK;
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Start_IT(TIM_HandleTypeDef* htim, uint32_t Channel) {
+    SET_BIT(htim->Instance->DIER, TIM_DIER_CC1IE << (Channel >> 2));
+    return HAL_TIM_PWM_Start(htim, Channel);
+}
+
+HAL_StatusTypeDef HAL_TIM_PWM_Stop_IT(TIM_HandleTypeDef* htim, uint32_t Channel) {
+    CLEAR_BIT(htim->Instance->DIER, TIM_DIER_CC1IE << (Channel >> 2));
+    return HAL_TIM_PWM_Stop(htim, Channel);
+}
@@ -0,0 +1,168 @@
+#include <hostfat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Layout of the FAT16 volume [Microsoft FAT Specification - Section 3]
+
+#define HOST_FAT_SECTOR_SIZE 512U
+#define HOST_FAT_SECTORS_PER_CLUSTER (HOST_FAT_CLUSTER_SIZE / HOST_FAT_SECTOR_SIZE)
+#define HOST_FAT_RESERVED_SECTORS 1U
+#define HOST_FAT_COUNT 2U
+#define HOST_FAT_ROOT_ENTRIES 512U
+#define HOST_FAT_ENTRY_SIZE 32U
+#define HOST_FAT_ROOT_SECTORS ((HOST_FAT_ROOT_ENTRIES * HOST_FAT_ENTRY_SIZE) / HOST_FAT_SECTOR_SIZE)
+/// First cluster of the data region
+#define HOST_FAT_FIRST_CLUSTER 2U
+#define HOST_FAT_END_OF_CHAIN 0xFFFFU
+#define HOST_FAT_MAX_CLUSTERS 65524U
+#define HOST_FAT_ATTRIBUTE_ARCHIVE 0x20
+
+// ##### Private forward declarations #####
+
+static void WriteUInt16(BYTE* destination, UInt16 value);
+static void WriteUInt32(BYTE* destination, UInt32 value);
+static void WriteBootSector(BYTE* sector, UInt32 sectorCount, UInt16 fatSectors);
+/// Writes the 8.3 name of a directory entry
+/// @return False if the name is not a valid 8.3 name
+static BOOL WriteShortName(BYTE* entry, const char* name);
+
+// ##### Private function definitions #####
+
+void WriteUInt16(BYTE* destination, UInt16 value) {
+    destination[0] = (BYTE)value;
+    destination[1] = (BYTE)(value >> 8);
+}
+
+void WriteUInt32(BYTE* destination, UInt32 value) {
+    WriteUInt16(destination, (UInt16)value);
+    WriteUInt16(destination + 2, (UInt16)(value >> 16));
+}
+
+void WriteBootSector(BYTE* sector, UInt32 sectorCount, UInt16 fatSectors) {
+    memcpy(sector, "\xEB\x3C\x90" "MSDOS5.0", 11);
+    WriteUInt16(sector + 11, HOST_FAT_SECTOR_SIZE);
+    sector[13] = HOST_FAT_SECTORS_PER_CLUSTER;
+    WriteUInt16(sector + 14, HOST_FAT_RESERVED_SECTORS);
+    sector[16] = HOST_FAT_COUNT;
+    WriteUInt16(sector + 17, HOST_FAT_ROOT_ENTRIES);
+    if (sectorCount < 0x10000) {
+        WriteUInt16(sector + 19, (UInt16)sectorCount);
+    }
+    else {
+        WriteUInt32(sector + 32, sectorCount);
+    }
+    // Fixed media
+    sector[21] = 0xF8;
+    WriteUInt16(sector + 22, fatSectors);
+    WriteUInt16(sector + 24, 63);
+    WriteUInt16(sector + 26, 255);
+    sector[36] = 0x80;
+    sector[38] = 0x29;
+    WriteUInt32(sector + 39, 0x20261016);
+    memcpy(sector + 43, "HOST TEST  FAT16   ", 19);
+    sector[510] = 0x55;
+    sector[511] = 0xAA;
+}
+
+BOOL WriteShortName(BYTE* entry, const char* name) {
+    memset(entry, ' ', 11);
+    const char* dot = strchr(name, '.');
+    size_t baseLength = dot != NULL ? (size_t)(dot - name) : strlen(name);
+    size_t extensionLength = dot != NULL ? strlen(dot + 1) : 0;
+    if (baseLength == 0 || baseLength > 8 || extensionLength > 3) {
+        return false;
+    }
+    memcpy(entry, name, baseLength);
+    if (dot != NULL) {
+        memcpy(entry + 8, dot + 1, extensionLength);
+    }
+    for (int i = 0; i < 11; i++) {
+        if (entry[i] >= 'a' && entry[i] <= 'z') {
+            entry[i] = (BYTE)(entry[i] - 'a' + 'A');
+        }
+    }
+    return true;
+}
+
+// ##### Public function definitions #####
+
+BOOL HostFatBuildImage(const char* path, UInt32 sectorCount, const HostFatFile* files, UInt32 fileCount,
+    UInt32 fragmentClusters) {
+    if (sectorCount < HOST_FAT_MIN_SECTORS || fileCount > HOST_FAT_ROOT_ENTRIES) {
+        return false;
+    }
+
+    // The FAT covers all the clusters of the volume, the size of the FAT does not change the cluster count enough
+    // to require a second iteration
+    UInt32 clusterEstimate = sectorCount / HOST_FAT_SECTORS_PER_CLUSTER;
+    UInt16 fatSectors = (UInt16)(((clusterEstimate + HOST_FAT_FIRST_CLUSTER) * 2 + HOST_FAT_SECTOR_SIZE - 1) / HOST_FAT_SECTOR_SIZE);
+    UInt32 dataStart = HOST_FAT_RESERVED_SECTORS + HOST_FAT_COUNT * fatSectors + HOST_FAT_ROOT_SECTORS;
+    UInt32 clusterCount = (sectorCount - dataStart) / HOST_FAT_SECTORS_PER_CLUSTER;
+    if (clusterCount > HOST_FAT_MAX_CLUSTERS) {
+        return false;
+    }
+
+    BYTE* image = (BYTE*)calloc(sectorCount, HOST_FAT_SECTOR_SIZE);
+    if (image == NULL) {
+        return false;
+    }
+    WriteBootSector(image, sectorCount, fatSectors);
+
+    BYTE* fat = image + HOST_FAT_RESERVED_SECTORS * HOST_FAT_SECTOR_SIZE;
+    BYTE* root = fat + HOST_FAT_COUNT * fatSectors * HOST_FAT_SECTOR_SIZE;
+    WriteUInt16(fat, 0xFFF8);
+    WriteUInt16(fat + 2, HOST_FAT_END_OF_CHAIN);
+
+    BOOL result = true;
+    UInt32 nextCluster = HOST_FAT_FIRST_CLUSTER;
+    for (UInt32 i = 0; i < fileCount && result; i++) {
+        BYTE* entry = root + i * HOST_FAT_ENTRY_SIZE;
+        if (!WriteShortName(entry, files[i].name)) {
+            result = false;
+            break;
+        }
+        entry[11] = HOST_FAT_ATTRIBUTE_ARCHIVE;
+        WriteUInt32(entry + 28, files[i].size);
+
+        UInt32 fileClusters = (files[i].size + HOST_FAT_CLUSTER_SIZE - 1) / HOST_FAT_CLUSTER_SIZE;
+        UInt32 previous = 0;
+        for (UInt32 c = 0; c < fileClusters; c++) {
+            if (fragmentClusters != 0 && c != 0 && (c % fragmentClusters) == 0) {
+                // The free cluster breaks the chain in two fragments
+                nextCluster++;
+            }
+            if (nextCluster >= HOST_FAT_FIRST_CLUSTER + clusterCount) {
+                result = false;
+                break;
+            }
+
+            UInt32 offset = c * HOST_FAT_CLUSTER_SIZE;
+            UInt32 length = files[i].size - offset < HOST_FAT_CLUSTER_SIZE ? files[i].size - offset : HOST_FAT_CLUSTER_SIZE;
+            UInt32 sector = dataStart + (nextCluster - HOST_FAT_FIRST_CLUSTER) * HOST_FAT_SECTORS_PER_CLUSTER;
+            memcpy(image + (size_t)sector * HOST_FAT_SECTOR_SIZE, files[i].data + offset, length);
+
+            if (previous == 0) {
+                WriteUInt16(entry + 26, (UInt16)nextCluster);
+            }
+            else {
+                WriteUInt16(fat + previous * 2, (UInt16)nextCluster);
+            }
+            WriteUInt16(fat + nextCluster * 2, HOST_FAT_END_OF_CHAIN);
+            previous = nextCluster++;
+        }
+    }
+
+    if (result) {
+        // Second copy of the FAT
+        memcpy(fat + fatSectors * HOST_FAT_SECTOR_SIZE, fat, fatSectors * HOST_FAT_SECTOR_SIZE);
+
+        FILE* file = fopen(path, "wb");
+        result = file != NULL && fwrite(image, HOST_FAT_SECTOR_SIZE, sectorCount, file) == sectorCount;
+        if (file != NULL) {
+            result = fclose(file) == 0 && result;
+        }
+    }
+    free(image);
+    return result;
+}
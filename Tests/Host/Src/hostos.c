@@ -0,0 +1,471 @@
+#include <hostboard.h>
+#include <hostcore.h>
+#include <assertion.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ucontext.h>
+
+// Host replacement of the CMSIS-RTOS2 functions used by the firmware, on top of the emulated time.
+// Threads are user contexts switched only when the running one blocks or yields (the board scheduler is
+// cooperative), or when an interrupt wakes a thread with a higher priority
+
+/// Host threads need more stack than the board ones (printf and the signal frames of the peripheral trap)
+#define HOST_THREAD_STACK_SIZE (512 * 1024)
+#define HOST_MAX_INTERRUPTS 8
+/// Exception number of the first external interrupt
+#define HOST_IRQ_EXCEPTION_OFFSET 16
+
+typedef enum _HostThreadState {
+    HostThreadReady,
+    HostThreadBlocked,
+    HostThreadTerminated
+} HostThreadState;
+
+typedef struct _HostThread {
+    ucontext_t context;
+    void* stack;
+    const char* name;
+    osPriority_t priority;
+    HostThreadState state;
+    /// Thread flags
+    UInt32 flags;
+    /// Object a blocked thread waits for (the thread itself for its flags, a queue, NULL for a delay)
+    const void* waitObject;
+    /// Emulated time when a blocked thread times out (UINT64_MAX if it waits forever)
+    UInt64 wakeTime;
+    /// True if the last wait ended by timeout
+    BOOL timedOut;
+    osThreadFunc_t function;
+    void* argument;
+    struct _HostThread* next;
+} HostThread;
+
+typedef struct _HostMessageQueue {
+    UInt32 capacity;
+    UInt32 messageSize;
+    UInt32 first;
+    UInt32 count;
+    BYTE* messages;
+} HostMessageQueue;
+
+typedef struct _HostInterrupt {
+    IRQn_Type irq;
+    void (*handler)(void);
+    UInt64 time;
+} HostInterrupt;
+
+// ##### Private forward declarations #####
+
+/// Entry point of all the threads
+static void ThreadStart();
+/// Switches to the ready thread with the highest priority, advancing the emulated time while none is ready
+static void Schedule();
+/// Converts a timeout in ticks to the emulated time when it expires
+static UInt64 GetDeadline(UInt32 timeout);
+/// Blocks the running thread until the object is signaled or the deadline expires
+/// @return False if the deadline expired
+static BOOL Block(const void* object, UInt64 deadline);
+/// Makes ready the threads blocked on the object
+static void WakeWaiters(const void* object);
+/// Runs the handlers of the enabled interrupts raised up to now
+static void RunDueInterrupts();
+/// Runs the due interrupts in thread mode. A thread woken with a higher priority preempts the running one
+static void ServiceInterrupts();
+/// Returns the highest priority of the ready threads, or osPriorityNone
+static osPriority_t HighestReadyPriority();
+/// Returns the time of the first enabled interrupt or thread timeout, if it comes before a limit
+static UInt64 GetNextEventTime(UInt64 limit);
+/// Makes ready the blocked threads whose deadline has expired
+static void WakeTimedOutThreads();
+
+// ##### Private fields #####
+
+static UInt64 _now;
+/// Emulated time spent with no ready thread
+static UInt64 _idleTime;
+static osKernelState_t _kernelState = osKernelInactive;
+static ucontext_t _kernelContext;
+static HostThread* _threads;
+static HostThread* _running;
+/// Thread started by HostKernelRun: the run ends when it returns
+static HostThread* _mainThread;
+static HostInterrupt _interrupts[HOST_MAX_INTERRUPTS];
+static UInt32 _interruptCount;
+/// Exception number of the running handler
+static UInt32 _ipsr;
+/// PRIMASK of the core: the interrupts wait while it is set
+static UInt32 _primask;
+
+// ##### Private function definitions #####
+
+void ThreadStart() {
+    HostThread* thread = _running;
+    thread->function(thread->argument);
+
+    thread->state = HostThreadTerminated;
+    if (thread == _mainThread) {
+        swapcontext(&thread->context, &_kernelContext);
+    }
+    Schedule();
+}
+
+osPriority_t HighestReadyPriority() {
+    osPriority_t highest = osPriorityNone;
+    for (HostThread* thread = _threads; thread != NULL; thread = thread->next) {
+        if (thread->state == HostThreadReady && thread->priority > highest) {
+            highest = thread->priority;
+        }
+    }
+    return highest;
+}
+
+UInt64 GetNextEventTime(UInt64 limit) {
+    UInt64 next = limit;
+    for (UInt32 i = 0; i < _interruptCount; i++) {
+        if (NVIC_GetEnableIRQ(_interrupts[i].irq) && _interrupts[i].time < next) {
+            next = _interrupts[i].time;
+        }
+    }
+    for (HostThread* thread = _threads; thread != NULL; thread = thread->next) {
+        if (thread->state == HostThreadBlocked && thread->wakeTime < next) {
+            next = thread->wakeTime;
+        }
+    }
+    return next;
+}
+
+void WakeTimedOutThreads() {
+    for (HostThread* thread = _threads; thread != NULL; thread = thread->next) {
+        if (thread->state == HostThreadBlocked && thread->wakeTime <= _now) {
+            thread->timedOut = true;
+            thread->state = HostThreadReady;
+        }
+    }
+}
+
+void Schedule() {
+    HostThread* current = _running;
+    for (;;) {
+        // Round robin between the threads with the same priority: the search starts after the running one
+        osPriority_t highest = HighestReadyPriority();
+        if (highest != osPriorityNone) {
+            HostThread* next = current->next != NULL ? current->next : _threads;
+            while (next->state != HostThreadReady || next->priority != highest) {
+                next = next->next != NULL ? next->next : _threads;
+            }
+            if (next != current) {
+                _running = next;
+                swapcontext(&current->context, &next->context);
+                _running = current;
+            }
+            return;
+        }
+
+        // Nobody can run: the time jumps to the next interrupt or timeout
+        UInt64 next = GetNextEventTime(UINT64_MAX);
+        if (next == UINT64_MAX) {
+            printf("Deadlock: all the threads wait forever (running %s)\n", current->name);
+            abort();
+        }
+        if (next > _now) {
+            _idleTime += next - _now;
+        }
+        HostTimeAdvanceTo(next);
+
+        WakeTimedOutThreads();
+        // No preemption here: the scheduler picks the woken threads in the next iteration
+        RunDueInterrupts();
+    }
+}
+
+UInt64 GetDeadline(UInt32 timeout) {
+    // One tick is one millisecond on the board
+    return timeout == osWaitForever ? UINT64_MAX : _now + ((UInt64)timeout * HOST_TIME_MS);
+}
+
+BOOL Block(const void* object, UInt64 deadline) {
+    HostThread* thread = _running;
+    if (deadline <= _now) {
+        return false;
+    }
+    thread->state = HostThreadBlocked;
+    thread->waitObject = object;
+    thread->wakeTime = deadline;
+    thread->timedOut = false;
+    Schedule();
+    return !thread->timedOut;
+}
+
+void WakeWaiters(const void* object) {
+    for (HostThread* thread = _threads; thread != NULL; thread = thread->next) {
+        if (thread->state == HostThreadBlocked && thread->waitObject == object) {
+            thread->state = HostThreadReady;
+        }
+    }
+}
+
+void RunDueInterrupts() {
+    for (UInt32 i = 0; i < _interruptCount;) {
+        HostInterrupt interrupt = _interrupts[i];
+        if (interrupt.time > _now || !NVIC_GetEnableIRQ(interrupt.irq)) {
+            i++;
+            continue;
+        }
+        _interrupts[i] = _interrupts[--_interruptCount];
+        _ipsr = (UInt32)interrupt.irq + HOST_IRQ_EXCEPTION_OFFSET;
+        interrupt.handler();
+        _ipsr = 0;
+    }
+}
+
+void ServiceInterrupts() {
+    if (_ipsr != 0 || _primask != 0) {
+        return;
+    }
+    RunDueInterrupts();
+
+    // Like portYIELD_FROM_ISR: the woken thread runs as soon as the handler returns
+    if (_kernelState == osKernelRunning && HighestReadyPriority() > _running->priority) {
+        Schedule();
+    }
+}
+
+// ##### Public function definitions #####
+
+UInt64 HostTimeNow() {
+    return _now;
+}
+
+UInt64 HostTimeIdle() {
+    return _idleTime;
+}
+
+void HostTimeAdvanceTo(UInt64 time) {
+    if (time <= _now) {
+        return;
+    }
+    _now = time;
+
+    // The cycle counter of the core follows the emulated time (read by the driver statistics)
+    DWT->CYCCNT = (UInt32)((_now / HOST_TIME_NS) * (SystemCoreClock / 1000000U) / 1000U);
+}
+
+void HostCpuWork(UInt64 duration) {
+    UInt64 end = _now + duration;
+    while (_now < end) {
+        // The work is split at the interrupts and timeouts that come before its end: the handlers and the woken
+        // threads with a higher priority run in between, as they would preempt the running thread
+        HostTimeAdvanceTo(GetNextEventTime(end));
+        WakeTimedOutThreads();
+        ServiceInterrupts();
+    }
+}
+
+void HostRaiseInterrupt(IRQn_Type irq, void (*handler)(void), UInt64 time) {
+    if (_interruptCount == HOST_MAX_INTERRUPTS) {
+        printf("Too many pending interrupts\n");
+        abort();
+    }
+    _interrupts[_interruptCount++] = (HostInterrupt){ .irq = irq, .handler = handler, .time = time };
+}
+
+void HostKernelRun(osThreadFunc_t function, void* argument) {
+    static const osThreadAttr_t mainAttributes = { .name = "HostMain", .priority = osPriorityNormal };
+
+    _kernelState = osKernelRunning;
+    _mainThread = (HostThread*)osThreadNew(function, argument, &mainAttributes);
+    _running = _mainThread;
+    swapcontext(&_kernelContext, &_mainThread->context);
+
+    _kernelState = osKernelInactive;
+    _running = NULL;
+    _mainThread = NULL;
+}
+
+uint32_t HostGetIpsr(void) {
+    return _ipsr;
+}
+
+uint32_t HostGetPrimask(void) {
+    return _primask;
+}
+
+void HostDisableIrq(void) {
+    _primask = 1;
+}
+
+void HostEnableIrq(void) {
+    _primask = 0;
+    // The interrupts raised while masked run now
+    ServiceInterrupts();
+}
+
+osKernelState_t osKernelGetState(void) {
+    return _kernelState;
+}
+
+osThreadId_t osThreadNew(osThreadFunc_t func, void* argument, const osThreadAttr_t* attr) {
+    HostThread* thread = (HostThread*)calloc(1, sizeof(HostThread));
+    if (thread == NULL || (thread->stack = malloc(HOST_THREAD_STACK_SIZE)) == NULL) {
+        free(thread);
+        return NULL;
+    }
+    thread->name = attr != NULL && attr->name != NULL ? attr->name : "HostThread";
+    thread->priority = attr != NULL && attr->priority != osPriorityNone ? attr->priority : osPriorityNormal;
+    thread->state = HostThreadReady;
+    thread->wakeTime = UINT64_MAX;
+    thread->function = func;
+    thread->argument = argument;
+
+    getcontext(&thread->context);
+    thread->context.uc_stack.ss_sp = thread->stack;
+    thread->context.uc_stack.ss_size = HOST_THREAD_STACK_SIZE;
+    thread->context.uc_link = NULL;
+    makecontext(&thread->context, ThreadStart, 0);
+
+    // Appended, so that the round robin follows the creation order
+    HostThread** last = &_threads;
+    while (*last != NULL) {
+        last = &(*last)->next;
+    }
+    *last = thread;
+    return (osThreadId_t)thread;
+}
+
+osThreadId_t osThreadGetId(void) {
+    return (osThreadId_t)_running;
+}
+
+osStatus_t osThreadYield(void) {
+    if (_ipsr != 0) {
+        return osErrorISR;
+    }
+    ServiceInterrupts();
+    Schedule();
+    return osOK;
+}
+
+osStatus_t osDelay(uint32_t ticks) {
+    if (_ipsr != 0) {
+        return osErrorISR;
+    }
+    Block(NULL, GetDeadline(ticks));
+    return osOK;
+}
+
+uint32_t osThreadFlagsSet(osThreadId_t thread_id, uint32_t flags) {
+    HostThread* thread = (HostThread*)thread_id;
+    if (thread == NULL || (flags & osFlagsError) != 0) {
+        return osFlagsErrorParameter;
+    }
+    thread->flags |= flags;
+    UInt32 result = thread->flags;
+    WakeWaiters(thread);
+    return result;
+}
+
+uint32_t osThreadFlagsClear(uint32_t flags) {
+    if (_ipsr != 0) {
+        return osFlagsErrorISR;
+    }
+    UInt32 previous = _running->flags;
+    _running->flags &= ~flags;
+    return previous;
+}
+
+uint32_t osThreadFlagsGet(void) {
+    return _ipsr != 0 ? 0 : _running->flags;
+}
+
+uint32_t osThreadFlagsWait(uint32_t flags, uint32_t options, uint32_t timeout) {
+    if (_ipsr != 0) {
+        return osFlagsErrorISR;
+    }
+    HostThread* thread = _running;
+    UInt64 deadline = GetDeadline(timeout);
+
+    ServiceInterrupts();
+    for (;;) {
+        UInt32 matched = thread->flags & flags;
+        BOOL satisfied = (options & osFlagsWaitAll) != 0 ? matched == flags : matched != 0;
+        if (satisfied) {
+            UInt32 result = thread->flags;
+            if ((options & osFlagsNoClear) == 0) {
+                thread->flags &= ~flags;
+            }
+            return result;
+        }
+        if (timeout == 0) {
+            return osFlagsErrorResource;
+        }
+        if (!Block(thread, deadline)) {
+            return osFlagsErrorTimeout;
+        }
+    }
+}
+
+osMessageQueueId_t osMessageQueueNew(uint32_t msg_count, uint32_t msg_size, const osMessageQueueAttr_t* attr) {
+    SUPPRESS_WARNING(attr);
+    HostMessageQueue* queue = (HostMessageQueue*)calloc(1, sizeof(HostMessageQueue));
+    if (queue == NULL || msg_count == 0 || msg_size == 0) {
+        return NULL;
+    }
+    queue->capacity = msg_count;
+    queue->messageSize = msg_size;
+    queue->messages = (BYTE*)malloc((size_t)msg_count * msg_size);
+    return queue->messages != NULL ? (osMessageQueueId_t)queue : NULL;
+}
+
+osStatus_t osMessageQueuePut(osMessageQueueId_t mq_id, const void* msg_ptr, uint8_t msg_prio, uint32_t timeout) {
+    SUPPRESS_WARNING(msg_prio);
+    HostMessageQueue* queue = (HostMessageQueue*)mq_id;
+    if (queue == NULL || msg_ptr == NULL || (_ipsr != 0 && timeout != 0)) {
+        return osErrorParameter;
+    }
+
+    UInt64 deadline = GetDeadline(timeout);
+    ServiceInterrupts();
+    while (queue->count == queue->capacity) {
+        if (timeout == 0) {
+            return osErrorResource;
+        }
+        // Getters and putters wait on the same object: each one checks its own condition again
+        if (!Block(queue, deadline)) {
+            return osErrorTimeout;
+        }
+    }
+    UInt32 slot = (queue->first + queue->count) % queue->capacity;
+    memcpy(&queue->messages[slot * queue->messageSize], msg_ptr, queue->messageSize);
+    queue->count++;
+
+    WakeWaiters(queue);
+    return osOK;
+}
+
+osStatus_t osMessageQueueGet(osMessageQueueId_t mq_id, void* msg_ptr, uint8_t* msg_prio, uint32_t timeout) {
+    HostMessageQueue* queue = (HostMessageQueue*)mq_id;
+    if (queue == NULL || msg_ptr == NULL || (_ipsr != 0 && timeout != 0)) {
+        return osErrorParameter;
+    }
+
+    UInt64 deadline = GetDeadline(timeout);
+    ServiceInterrupts();
+    while (queue->count == 0) {
+        if (timeout == 0) {
+            return osErrorResource;
+        }
+        if (!Block(queue, deadline)) {
+            return osErrorTimeout;
+        }
+    }
+    memcpy(msg_ptr, &queue->messages[queue->first * queue->messageSize], queue->messageSize);
+    queue->first = (queue->first + 1) % queue->capacity;
+    queue->count--;
+    if (msg_prio != NULL) {
+        *msg_prio = 0;
+    }
+
+    WakeWaiters(queue);
+    return osOK;
+}
@@ -0,0 +1,235 @@
+#include <hostboard.h>
+#include <assertion.h>
+#include <intmath.h>
+#include <stdio.h>
+#include <string.h>
+
+// Models of SPI2 and of the DMA1 streams connected to its requests (stream 3 RX, stream 4 TX, channel 0).
+// A byte written in the data register is exchanged with the device at once and the CPU waits for its bus time.
+// A DMA transfer exchanges all its bytes when it is enabled and its registers show the final state at once, but
+// the bus stays busy until the last byte is clocked, when the completion interrupt is raised
+
+#define HOST_SPI2_PAGE 0x40003000U
+#define HOST_DMA1_PAGE 0x40026000U
+/// Chip select of the SD card (GPIOB pin 12)
+#define HOST_SPI_SELECT_PIN GPIO_PIN_12
+
+/// Interrupt handler of the SD driver. Weak, so that the programs without the SD driver link the board too: they
+/// never enable the DMA interrupt
+extern void DMA1_Stream3_IRQHandler(void) __attribute__((weak));
+
+// ##### Private forward declarations #####
+
+/// Returns the bus time of a byte with the current prescaler
+static UInt64 GetByteTime();
+/// Exchanges a byte with the device at the given time
+static BYTE Exchange(BYTE mosi, UInt64 time);
+/// Starts the DMA transfer once both the streams and both the SPI requests are enabled
+static void TryStartTransfer();
+/// Checks the configuration of the streams: a wrong one would not transfer the SD blocks on the board
+static BOOL IsTransferValid();
+static void OnSpiAccess(UInt32 address, BOOL write);
+static void OnDmaAccess(UInt32 address, BOOL write);
+
+// ##### Private fields #####
+
+/// Model views of the registers
+static SPI_TypeDef* _spi;
+static DMA_TypeDef* _dma;
+static DMA_Stream_TypeDef* _rxStream;
+static DMA_Stream_TypeDef* _txStream;
+
+static HostSpiDevice _device;
+static BOOL _attached;
+static GPIO_TypeDef* _powerPort;
+static UInt16 _powerPin;
+/// Emulated time when the last byte on the bus is clocked
+static UInt64 _busFreeTime;
+static HostSpiStatistics _statistics;
+static SPI_HandleTypeDef _handle;
+
+// ##### Private function definitions #####
+
+UInt64 GetByteTime() {
+    UInt32 prescaler = (_spi->CR1 & SPI_CR1_BR_Msk) >> SPI_CR1_BR_Pos;
+    return (8U * HOST_TIME_S * (2U << prescaler)) / HAL_RCC_GetPCLK1Freq();
+}
+
+BYTE Exchange(BYTE mosi, UInt64 time) {
+    return _attached ? _device.exchange(_device.context, mosi, time) : 0xFF;
+}
+
+BOOL IsTransferValid() {
+    const UInt32 dataRegister = (UInt32)(uintptr_t)&SPI2->DR;
+    const UInt32 fixedBits = DMA_SxCR_CHSEL | DMA_SxCR_DIR | DMA_SxCR_PSIZE | DMA_SxCR_MSIZE | DMA_SxCR_CIRC | DMA_SxCR_DBM;
+    if (_rxStream->PAR != dataRegister || _txStream->PAR != dataRegister) {
+        return false;
+    }
+    // Channel 0, byte transfers, no circular or double buffer mode. RX to memory, TX from memory
+    if ((_rxStream->CR & fixedBits) != 0 || (_txStream->CR & fixedBits) != DMA_SxCR_DIR_0 ||
+        (_rxStream->CR & DMA_SxCR_MINC) == 0) {
+        return false;
+    }
+    if (_rxStream->NDTR == 0 || _rxStream->NDTR != _txStream->NDTR) {
+        return false;
+    }
+
+    // The DMA cannot reach the core coupled memory
+    UInt32 target = _rxStream->M0AR;
+    UInt32 end = target + _rxStream->NDTR;
+    return end <= HOST_CCMRAM_START || target >= HOST_CCMRAM_START + HOST_CCMRAM_SIZE;
+}
+
+void TryStartTransfer() {
+    const UInt32 requests = SPI_CR2_RXDMAEN | SPI_CR2_TXDMAEN;
+    if ((_spi->CR2 & requests) != requests || (_rxStream->CR & DMA_SxCR_EN) == 0 || (_txStream->CR & DMA_SxCR_EN) == 0) {
+        return;
+    }
+
+    UInt64 start = MAX(HostTimeNow(), _busFreeTime);
+    UInt32 count = _rxStream->NDTR;
+    if (!IsTransferValid()) {
+        _statistics.protocolErrors++;
+        _dma->LISR |= DMA_LISR_TEIF3;
+        _dma->HISR |= DMA_HISR_TEIF4;
+    }
+    else {
+        BYTE* target = (BYTE*)(uintptr_t)_rxStream->M0AR;
+        PCBYTE source = (PCBYTE)(uintptr_t)_txStream->M0AR;
+        BOOL incrementSource = (_txStream->CR & DMA_SxCR_MINC) != 0;
+        UInt64 byteTime = GetByteTime();
+        for (UInt32 i = 0; i < count; i++) {
+            target[i] = Exchange(source[incrementSource ? i : 0], start + (i + 1) * byteTime);
+        }
+
+        _busFreeTime = start + count * byteTime;
+        _statistics.dmaBytes += count;
+        _statistics.dmaTransfers++;
+        _dma->LISR |= DMA_LISR_TCIF3 | DMA_LISR_HTIF3;
+        _dma->HISR |= DMA_HISR_TCIF4 | DMA_HISR_HTIF4;
+    }
+
+    // The streams are disabled by the hardware at the end of the transfer
+    _rxStream->NDTR = 0;
+    _txStream->NDTR = 0;
+    _rxStream->CR &= ~DMA_SxCR_EN;
+    _txStream->CR &= ~DMA_SxCR_EN;
+    _spi->SR = (_spi->SR & ~SPI_SR_RXNE) | SPI_SR_TXE;
+
+    if ((_rxStream->CR & (DMA_SxCR_TCIE | DMA_SxCR_TEIE)) != 0) {
+        HostRaiseInterrupt(DMA1_Stream3_IRQn, DMA1_Stream3_IRQHandler, MAX(_busFreeTime, start));
+    }
+}
+
+void OnSpiAccess(UInt32 address, BOOL write) {
+    _statistics.registerAccesses++;
+    UInt32 offset = address - (UInt32)(uintptr_t)SPI2;
+
+    if (offset == offsetof(SPI_TypeDef, DR)) {
+        if (!write) {
+            _spi->SR &= ~SPI_SR_RXNE;
+            return;
+        }
+
+        if ((_spi->CR1 & SPI_CR1_SPE) == 0) {
+            // A disabled peripheral does not clock anything
+            _statistics.protocolErrors++;
+            return;
+        }
+        if ((_spi->SR & SPI_SR_RXNE) != 0) {
+            // The previous byte was never read
+            _statistics.protocolErrors++;
+            _spi->SR |= SPI_SR_OVR;
+        }
+
+        UInt64 time = MAX(HostTimeNow(), _busFreeTime) + GetByteTime();
+        _spi->DR = Exchange((BYTE)_spi->DR, time);
+        _spi->SR |= SPI_SR_RXNE | SPI_SR_TXE;
+        _busFreeTime = time;
+        _statistics.cpuBytes++;
+        // The CPU polls the status register until the byte is received
+        HostTimeAdvanceTo(time);
+    }
+    else if (write && offset == offsetof(SPI_TypeDef, CR2)) {
+        TryStartTransfer();
+    }
+}
+
+void OnDmaAccess(UInt32 address, BOOL write) {
+    _statistics.registerAccesses++;
+    if (!write) {
+        return;
+    }
+
+    UInt32 offset = address - (UInt32)(uintptr_t)DMA1;
+    if (offset == offsetof(DMA_TypeDef, LIFCR)) {
+        // Write one to clear, reads as zero
+        _dma->LISR &= ~_dma->LIFCR;
+        _dma->LIFCR = 0;
+    }
+    else if (offset == offsetof(DMA_TypeDef, HIFCR)) {
+        _dma->HISR &= ~_dma->HIFCR;
+        _dma->HIFCR = 0;
+    }
+    else if (address == (UInt32)(uintptr_t)&DMA1_Stream3->CR || address == (UInt32)(uintptr_t)&DMA1_Stream4->CR) {
+        TryStartTransfer();
+    }
+}
+
+// ##### Public function definitions #####
+
+void HostSpiInitialize() {
+    BYTE* spiPage = (BYTE*)HostBoardTrapPage(HOST_SPI2_PAGE, OnSpiAccess);
+    BYTE* dmaPage = (BYTE*)HostBoardTrapPage(HOST_DMA1_PAGE, OnDmaAccess);
+    _spi = (SPI_TypeDef*)(spiPage + ((uintptr_t)SPI2 - HOST_SPI2_PAGE));
+    _dma = (DMA_TypeDef*)(dmaPage + ((uintptr_t)DMA1 - HOST_DMA1_PAGE));
+    _rxStream = (DMA_Stream_TypeDef*)(dmaPage + ((uintptr_t)DMA1_Stream3 - HOST_DMA1_PAGE));
+    _txStream = (DMA_Stream_TypeDef*)(dmaPage + ((uintptr_t)DMA1_Stream4 - HOST_DMA1_PAGE));
+
+    // Reset values [RM0090 - Section 28.5]
+    _spi->SR = SPI_SR_TXE;
+}
+
+void HostSpiAttach(const HostSpiDevice* device, GPIO_TypeDef* powerPort, UInt16 powerPin) {
+    _device = *device;
+    _attached = true;
+    _powerPort = powerPort;
+    _powerPin = powerPin;
+}
+
+void HostSpiGetStatistics(HostSpiStatistics* statistics) {
+    *statistics = _statistics;
+}
+
+SPI_HandleTypeDef* HostSpiGetHandle() {
+    // Same configuration of MX_SPI2_Init
+    _handle.Instance = SPI2;
+    _handle.Init.Mode = SPI_MODE_MASTER;
+    _handle.Init.Direction = SPI_DIRECTION_2LINES;
+    _handle.Init.DataSize = SPI_DATASIZE_8BIT;
+    _handle.Init.CLKPolarity = SPI_POLARITY_LOW;
+    _handle.Init.CLKPhase = SPI_PHASE_1EDGE;
+    _handle.Init.NSS = SPI_NSS_SOFT;
+    _handle.Init.BaudRatePrescaler = SPI_BAUDRATEPRESCALER_256;
+    _handle.Init.FirstBit = SPI_FIRSTBIT_MSB;
+    _handle.Init.TIMode = SPI_TIMODE_DISABLE;
+    _handle.Init.CRCCalculation = SPI_CRCCALCULATION_DISABLE;
+    _handle.Init.CRCPolynomial = 10;
+    _handle.State = HAL_SPI_STATE_READY;
+
+    _spi->CR1 = SPI_CR1_MSTR | SPI_CR1_SSI | SPI_CR1_SSM | SPI_BAUDRATEPRESCALER_256;
+    _spi->CR2 = 0;
+    return &_handle;
+}
+
+void HostSpiPinChanged(GPIO_TypeDef* port, UInt16 pin, BOOL set) {
+    if (!_attached) {
+        return;
+    }
+    if (port == GPIOB && pin == HOST_SPI_SELECT_PIN) {
+        _device.select(_device.context, !set, HostTimeNow());
+    }
+    else if (port == _powerPort && pin == _powerPin) {
+        _device.power(_device.context, set, HostTimeNow());
+    }
+}
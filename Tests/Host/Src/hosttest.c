@@ -0,0 +1,37 @@
+#include <hosttest.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+UInt32 _testFailures = 0;
+
+int TestResult() {
+    if (_testFailures != 0) {
+        printf("%" PRIu32 " checks failed\n", _testFailures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
+
+UInt64 HostCycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    // Nanoseconds are the best approximation we have
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return ((UInt64)now.tv_sec * 1000000000U) + (UInt64)now.tv_nsec;
+#endif
+}
+
+UInt32 HostRandom(UInt32* state) {
+    // xorshift32
+    UInt32 value = *state;
+    value ^= value << 13;
+    value ^= value >> 17;
+    value ^= value << 5;
+    *state = value;
+    return value;
+}
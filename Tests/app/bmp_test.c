@@ -0,0 +1,333 @@
+/*
+ * Displays synthetic bitmaps with the bitmap scalers and compares every screen pixel with reference scalers
+ * that compute the source coordinates with exact integer divisions
+ *
+ * The bitmaps are real BMP files kept in memory: the FatFs functions used by the module are replaced by a fake
+ * file that also checks that the scanlines are read with a single forward pass. The screen functions are replaced
+ * by a 24bit capture of the blitted lines
+ */
+
+// The module is included to reach its header structures and fixed point macros
+#include <app/bmp.c>
+#include <hosttest.h>
+
+#define TEST_SCREEN_MAX_WIDTH 128
+#define TEST_SCREEN_MAX_HEIGHT 128
+#define TEST_FILE_MAX_SIZE (512 * 1024)
+/// Data offset of the files written by the common editors: the scanlines are not aligned to the sectors
+#define TEST_DATA_OFFSET (DIB_OFFSET + sizeof(BITMAPINFOHEADER))
+/// Value of the scanline padding bytes, which must never reach the screen
+#define TEST_PADDING_BYTE 0xEE
+
+/// Size of a test bitmap and of the screen where it is displayed
+typedef struct _ScaleCase {
+    UInt32 width;
+    UInt32 height;
+    Int16 screenWidth;
+    Int16 screenHeight;
+} ScaleCase;
+
+// ##### Private forward declarations #####
+
+/// Writes a 24bit bottom-up BMP file with random pixels in the fake file
+static void WriteTestFile(UInt32 width, UInt32 height, UInt32 seed);
+/// Returns the address of a bitmap pixel in the fake file
+/// @param y Row of the pixel, counted from the top of the image
+static PCBYTE GetFilePixel(const Bmp* cpBmp, UInt32 x, UInt32 y);
+/// Reads the bitmap of the fake file and displays it on a capture screen of the requested size
+static BmpResult DisplayTestFile(Bmp* pBmp, Int16 screenWidth, Int16 screenHeight, BmpScaleMode scaleMode);
+/// Reference nearest neighbour scaler: floor(destination * sourceSize / destinationSize) on both axes
+static void ReferenceNearest(const Bmp* cpBmp, Int16 screenWidth, Int16 screenHeight, Int16 x, Int16 y, BYTE* pixel);
+/// Reference box filter: the screen pixel is the average of the covered rows, each one averaged over the covered
+/// columns. Both averages are rounded to the nearest integer, halves up
+static void ReferenceBox(const Bmp* cpBmp, Int16 screenWidth, Int16 screenHeight, Int16 x, Int16 y, BYTE* pixel);
+/// Reference bilinear filter: the centers of the screen pixels are mapped on the bitmap with exact divisions,
+/// quantized to 1/256 of a pixel like the module weights
+static void ReferenceBilinear(const Bmp* cpBmp, Int16 screenWidth, Int16 screenHeight, Int16 x, Int16 y, BYTE* pixel);
+/// Returns the position of the center of a screen pixel on the bitmap, in 1/256 of pixel
+static UInt32 GetBilinearPosition(Int16 screenCoordinate, Int16 screenSize, UInt32 size);
+/// Compares the capture screen with a reference scaler
+/// @return Number of different components
+static UInt32 CompareScreen(const Bmp* cpBmp, Int16 screenWidth, Int16 screenHeight,
+    void (*reference)(const Bmp*, Int16, Int16, Int16, Int16, BYTE*));
+/// Displays the test cases with a scaler and compares them with its reference
+static void CheckScaler(const char* name, BmpScaleMode scaleMode, const ScaleCase* cases, size_t count,
+    void (*reference)(const Bmp*, Int16, Int16, Int16, Int16, BYTE*));
+/// Checks BMP_RECIPROCAL and BMP_ROUNDED_DIVIDE against exact divisions for every sum the box filter can compute
+static void CheckRoundedDivisions();
+/// Checks the box filter with the largest number of averaged rows, where the column accumulators are full
+static void CheckBoxRowLimit();
+
+/// Sizes checked with every scaler
+static const ScaleCase _cases[] = {
+    // Same size: the scanlines are copied without scaling
+    { 40, 30, 40, 30 },
+    // Integer ratios
+    { 80, 60, 40, 30 },
+    { 20, 15, 40, 30 },
+    // Fractional ratios, where a truncated 16.16 step misses the exact source coordinates (5/3, 7/3)
+    { 50, 30, 30, 18 },
+    { 70, 35, 30, 15 },
+    { 97, 61, 40, 30 },
+    { 13, 7, 40, 30 },
+    // Degenerate sizes
+    { 1, 1, 40, 30 },
+    { 317, 5, 64, 3 },
+    { 7, 300, 5, 60 },
+    { 400, 300, 128, 96 },
+};
+
+/// Content of the fake file
+static BYTE _fileData[TEST_FILE_MAX_SIZE];
+/// Fake file handle. Only the file pointer and the size are used
+static FIL _file;
+/// End of the last read, to detect the backward reads
+static FSIZE_t _readEnd;
+/// Total number of bytes read from the fake file
+static UInt32 _bytesRead;
+/// 24bit capture of the screen lines
+static BYTE _screen[TEST_SCREEN_MAX_HEIGHT][TEST_SCREEN_MAX_WIDTH * 3];
+/// Number of times each screen line has been blitted
+static UInt32 _lineBlits[TEST_SCREEN_MAX_HEIGHT];
+/// Size of the capture screen
+static SizeS _screenSize;
+
+// ##### Replacements of the FatFs and screen functions #####
+
+FRESULT f_read(FIL* fp, void* buff, UINT btr, UINT* br) {
+    TEST_CHECK(fp->fptr >= _readEnd, "backward read at %" PRIu32 " after %" PRIu32, (UInt32)fp->fptr, (UInt32)_readEnd);
+    UINT count = (UINT)MIN(btr, fp->obj.objsize - fp->fptr);
+    memcpy(buff, &_fileData[fp->fptr], count);
+    fp->fptr += count;
+    _readEnd = fp->fptr;
+    _bytesRead += count;
+    *br = count;
+    return FR_OK;
+}
+
+FRESULT f_lseek(FIL* fp, FSIZE_t ofs) {
+    // CREATE_LINKMAP is a seek beyond the end of the file: the fake file is never fragmented
+    fp->fptr = MIN(ofs, fp->obj.objsize);
+    return FR_OK;
+}
+
+void ScreenBlitSpan(const ScreenBuffer* buffer, Int16 y, Int16 x, PCBYTE source, Int16 count, ScreenDither dither) {
+    SUPPRESS_WARNING(dither);
+    DebugAssert(y >= 0 && y < buffer->screenSize.height);
+    DebugAssert(x >= 0 && count >= 0 && x + count <= buffer->screenSize.width);
+    memcpy(&_screen[y][x * 3], source, (size_t)count * 3);
+    _lineBlits[y]++;
+}
+
+void ScreenInvalidateRectangle(const ScreenBuffer* buffer, PointS point, SizeS size) {
+    SUPPRESS_WARNING(buffer);
+    TEST_CHECK(point.x == 0 && point.y == 0 && size.width == _screenSize.width && size.height == _screenSize.height,
+        "the whole screen is invalidated");
+}
+
+// ##### Private function definitions #####
+
+void WriteTestFile(UInt32 width, UInt32 height, UInt32 seed) {
+    UInt32 rowByteSize = ((width * 24 + 31) / 32) * 4;
+    UInt32 size = TEST_DATA_OFFSET + (rowByteSize * height);
+    DebugAssert(size <= TEST_FILE_MAX_SIZE);
+
+    BITMAPFILEHEADER fileHeader = { .bfType = BmpIdentifierBM, .bfSize = size, .bfOffBits = TEST_DATA_OFFSET };
+    BITMAPINFOHEADER infoHeader = { .biSize = sizeof(BITMAPINFOHEADER), .biWidth = (LONG)width, .biHeight = (LONG)height,
+        .biPlanes = 1, .biBitCount = 24, .biCompression = BI_RGB };
+    memcpy(_fileData, &fileHeader, sizeof(fileHeader));
+    memcpy(&_fileData[DIB_OFFSET], &infoHeader, sizeof(infoHeader));
+
+    // Random pixels make any coordinate error visible
+    for (UInt32 row = 0; row < height; row++) {
+        BYTE* scanline = &_fileData[TEST_DATA_OFFSET + (row * rowByteSize)];
+        for (UInt32 i = 0; i < width * 3; i++) {
+            scanline[i] = (BYTE)HostRandom(&seed);
+        }
+        memset(&scanline[width * 3], TEST_PADDING_BYTE, rowByteSize - (width * 3));
+    }
+
+    _file = (FIL){ 0 };
+    _file.obj.objsize = size;
+}
+
+PCBYTE GetFilePixel(const Bmp* cpBmp, UInt32 x, UInt32 y) {
+    DebugAssert(x < cpBmp->width && y < cpBmp->height);
+    return &_fileData[cpBmp->dataOffset + ((cpBmp->height - 1 - y) * cpBmp->rowByteSize) + (x * 3)];
+}
+
+BmpResult DisplayTestFile(Bmp* pBmp, Int16 screenWidth, Int16 screenHeight, BmpScaleMode scaleMode) {
+    DebugAssert(screenWidth <= TEST_SCREEN_MAX_WIDTH && screenHeight <= TEST_SCREEN_MAX_HEIGHT);
+    _screenSize = (SizeS){ screenWidth, screenHeight };
+    memset(_screen, 0, sizeof(_screen));
+    memset(_lineBlits, 0, sizeof(_lineBlits));
+
+    _file.fptr = 0;
+    _readEnd = 0;
+    if (BmpReadFromFile(&_file, pBmp) != BmpResultOk) {
+        return BmpResultFailure;
+    }
+
+    // The scanlines are read with a new pass, which starts from the sector of the first one
+    _readEnd = 0;
+    _bytesRead = 0;
+    size_t available = ravailable();
+    ScreenBuffer screenBuffer = { .screenSize = _screenSize, .bitsPerPixel = Bpp24 };
+    BmpResult result = BmpDisplay(pBmp, &screenBuffer, scaleMode, ScreenDitherNone);
+    TEST_CHECK_EQUAL(available, ravailable(), "ram allocations released");
+    return result;
+}
+
+void ReferenceNearest(const Bmp* cpBmp, Int16 screenWidth, Int16 screenHeight, Int16 x, Int16 y, BYTE* pixel) {
+    UInt32 sourceX = ((UInt32)x * cpBmp->width) / (UInt32)screenWidth;
+    UInt32 sourceY = ((UInt32)y * cpBmp->height) / (UInt32)screenHeight;
+    memcpy(pixel, GetFilePixel(cpBmp, sourceX, sourceY), 3);
+}
+
+void ReferenceBox(const Bmp* cpBmp, Int16 screenWidth, Int16 screenHeight, Int16 x, Int16 y, BYTE* pixel) {
+    // Screen pixels cover the bitmap pixels [x * width / screenWidth; (x + 1) * width / screenWidth), or the pixel
+    // they start in when upscaling
+    UInt32 firstColumn = ((UInt32)x * cpBmp->width) / (UInt32)screenWidth;
+    UInt32 columns = MAX((((UInt32)x + 1) * cpBmp->width) / (UInt32)screenWidth - firstColumn, 1);
+    UInt32 firstRow = ((UInt32)y * cpBmp->height) / (UInt32)screenHeight;
+    UInt32 rows = MAX((((UInt32)y + 1) * cpBmp->height) / (UInt32)screenHeight - firstRow, 1);
+
+    for (int i = 0; i < 3; i++) {
+        UInt32 rowsSum = 0;
+        for (UInt32 row = firstRow; row < firstRow + rows; row++) {
+            UInt32 columnsSum = 0;
+            for (UInt32 column = firstColumn; column < firstColumn + columns; column++) {
+                columnsSum += GetFilePixel(cpBmp, column, row)[i];
+            }
+            rowsSum += ((2 * columnsSum) + columns) / (2 * columns);
+        }
+        pixel[i] = (BYTE)(((2 * rowsSum) + rows) / (2 * rows));
+    }
+}
+
+UInt32 GetBilinearPosition(Int16 screenCoordinate, Int16 screenSize, UInt32 size) {
+    // (screenCoordinate + 0.5) * size / screenSize - 0.5, clamped to the first pixel
+    Int64 numerator = ((2 * (Int64)screenCoordinate + 1) * size) - screenSize;
+    return numerator <= 0 ? 0 : (UInt32)((numerator * 256) / (2 * screenSize));
+}
+
+void ReferenceBilinear(const Bmp* cpBmp, Int16 screenWidth, Int16 screenHeight, Int16 x, Int16 y, BYTE* pixel) {
+    UInt32 positionX = GetBilinearPosition(x, screenWidth, cpBmp->width);
+    UInt32 left = MIN(positionX >> 8, cpBmp->width - 1);
+    UInt32 right = MIN(left + 1, cpBmp->width - 1);
+    UInt32 weightX = positionX & 0xFF;
+    UInt32 positionY = GetBilinearPosition(y, screenHeight, cpBmp->height);
+    UInt32 top = MIN(positionY >> 8, cpBmp->height - 1);
+    UInt32 bottom = MIN(top + 1, cpBmp->height - 1);
+    UInt32 weightY = positionY & 0xFF;
+
+    // Horizontal interpolation of the two rows, then vertical one, truncating like the module
+    for (int i = 0; i < 3; i++) {
+        UInt32 topValue = ((GetFilePixel(cpBmp, left, top)[i] * (0x100 - weightX)) +
+            (GetFilePixel(cpBmp, right, top)[i] * weightX)) >> 8;
+        UInt32 bottomValue = ((GetFilePixel(cpBmp, left, bottom)[i] * (0x100 - weightX)) +
+            (GetFilePixel(cpBmp, right, bottom)[i] * weightX)) >> 8;
+        pixel[i] = (BYTE)(((topValue * (0x100 - weightY)) + (bottomValue * weightY)) >> 8);
+    }
+}
+
+UInt32 CompareScreen(const Bmp* cpBmp, Int16 screenWidth, Int16 screenHeight,
+    void (*reference)(const Bmp*, Int16, Int16, Int16, Int16, BYTE*)) {
+    UInt32 differences = 0;
+    for (Int16 y = 0; y < screenHeight; y++) {
+        TEST_CHECK_EQUAL(1, _lineBlits[y], "blits of the line %d", y);
+        for (Int16 x = 0; x < screenWidth; x++) {
+            BYTE expected[3];
+            reference(cpBmp, screenWidth, screenHeight, x, y, expected);
+            for (int i = 0; i < 3; i++) {
+                if (_screen[y][(x * 3) + i] != expected[i]) {
+                    // Only the first differences are printed
+                    if (differences < 4) {
+                        printf("  pixel (%d, %d) component %d: expected %u, got %u\n", x, y, i, expected[i],
+                            _screen[y][(x * 3) + i]);
+                    }
+                    differences++;
+                }
+            }
+        }
+    }
+    return differences;
+}
+
+void CheckRoundedDivisions() {
+    // Vertical averages: up to BMP_BOX_MAX_ROWS rows of 8 bit components
+    UInt32 failures = 0;
+    for (UInt32 n = 1; n <= BMP_BOX_MAX_ROWS; n++) {
+        UInt32 reciprocal = BMP_RECIPROCAL(n);
+        for (UInt32 x = 0; x <= 0xFF * n; x++) {
+            if (BMP_ROUNDED_DIVIDE(x, n, reciprocal) != ((2 * x) + n) / (2 * n)) {
+                if (failures++ < 4) {
+                    printf("  %" PRIu32 " / %" PRIu32 ": expected %" PRIu32 ", got %" PRIu32 "\n", x, n,
+                        ((2 * x) + n) / (2 * n), (UInt32)BMP_ROUNDED_DIVIDE(x, n, reciprocal));
+                }
+            }
+        }
+    }
+    TEST_CHECK_EQUAL(0, failures, "rounded divisions of the row sums");
+
+    // Horizontal averages: wider columns, checked at the boundaries of the results where the rounding matters
+    failures = 0;
+    for (UInt32 n = BMP_BOX_MAX_ROWS + 1; n <= 2900; n++) {
+        UInt32 reciprocal = BMP_RECIPROCAL(n);
+        for (UInt32 result = 0; result <= 0xFF; result++) {
+            UInt32 half = (result * n) + ((n - 1) / 2);
+            for (UInt32 x = half - MIN(half, 1); x <= MIN(half + 1, 0xFF * n); x++) {
+                if (BMP_ROUNDED_DIVIDE(x, n, reciprocal) != ((2 * x) + n) / (2 * n)) {
+                    failures++;
+                }
+            }
+        }
+    }
+    TEST_CHECK_EQUAL(0, failures, "rounded divisions of the column sums");
+}
+
+void CheckBoxRowLimit() {
+    // 513 rows on 2 lines: the lines average 256 and 257 rows of white pixels, so the accumulators reach 0xFFFF
+    WriteTestFile(5, 513, 1);
+    memset(&_fileData[TEST_DATA_OFFSET], 0xFF, _file.obj.objsize - TEST_DATA_OFFSET);
+    Bmp bmp;
+    TEST_CHECK_EQUAL(BmpResultOk, DisplayTestFile(&bmp, 4, 2, BmpScaleBox), "box filter of 257 rows");
+    for (Int16 y = 0; y < 2; y++) {
+        for (int i = 0; i < 4 * 3; i++) {
+            TEST_CHECK_EQUAL(0xFF, _screen[y][i], "white pixel %d of the line %d", i / 3, y);
+        }
+    }
+
+    // Lines of 257 and 258 rows: the second one would overflow the accumulators, so the filter refuses the bitmap
+    WriteTestFile(5, (2 * BMP_BOX_MAX_ROWS) + 1, 1);
+    TEST_CHECK_EQUAL(BmpResultFailure, DisplayTestFile(&bmp, 4, 2, BmpScaleBox), "box filter of 258 rows");
+}
+
+void CheckScaler(const char* name, BmpScaleMode scaleMode, const ScaleCase* cases, size_t count,
+    void (*reference)(const Bmp*, Int16, Int16, Int16, Int16, BYTE*)) {
+    for (size_t i = 0; i < count; i++) {
+        const ScaleCase* scaleCase = &cases[i];
+        WriteTestFile(scaleCase->width, scaleCase->height, 0x2468ACE0U + (UInt32)i);
+
+        Bmp bmp;
+        BmpResult result = DisplayTestFile(&bmp, scaleCase->screenWidth, scaleCase->screenHeight, scaleMode);
+        TEST_CHECK_EQUAL(BmpResultOk, result, "%s %" PRIu32 "x%" PRIu32 " to %dx%d", name, scaleCase->width,
+            scaleCase->height, scaleCase->screenWidth, scaleCase->screenHeight);
+        TEST_CHECK(_bytesRead <= _file.obj.objsize, "%s %" PRIu32 "x%" PRIu32 ": %" PRIu32 " bytes read", name,
+            scaleCase->width, scaleCase->height, _bytesRead);
+
+        UInt32 differences = CompareScreen(&bmp, scaleCase->screenWidth, scaleCase->screenHeight, reference);
+        TEST_CHECK_EQUAL(0, differences, "%s %" PRIu32 "x%" PRIu32 " to %dx%d", name, scaleCase->width,
+            scaleCase->height, scaleCase->screenWidth, scaleCase->screenHeight);
+    }
+}
+
+int main() {
+    size_t caseCount = sizeof(_cases) / sizeof(_cases[0]);
+    CheckScaler("nearest", BmpScaleNearest, _cases, caseCount, ReferenceNearest);
+    CheckRoundedDivisions();
+    CheckScaler("box", BmpScaleBox, _cases, caseCount, ReferenceBox);
+    CheckBoxRowLimit();
+    CheckScaler("bilinear", BmpScaleBilinear, _cases, caseCount, ReferenceBilinear);
+    return TestResult();
+}
@@ -0,0 +1,39 @@
+/*
+ * Declarations shared by the units of the host benchmark
+ *
+ * Each unit compares the current implementation of a firmware path with the implementation it replaced, which is
+ * rebuilt in the unit from the public APIs: the raster unit on the VGA screen buffer, the bitmap unit on a RAM disk
+ * and the card unit on the emulated SD card. Host cycles only compare two paths on the same host, the emulated times
+ * follow the bus of the board. The checks cover the results of the paths and the deterministic counters, never the
+ * host timings
+ */
+
+#ifndef TESTS_BENCH_BENCH_H_
+#define TESTS_BENCH_BENCH_H_
+
+#include <typedefs.h>
+#include <screen/screen.h>
+
+#define BENCH_SCREEN_WIDTH 400
+#define BENCH_SCREEN_HEIGHT 300
+
+/// Creates the 8bpp screen buffer of the VGA driver used by all the units, with the output stopped
+/// \remarks Must be called once, before any allocation in the DMA-reachable RAM that the firmware does after it
+const ScreenBuffer* BenchScreenCreate();
+/// Returns the frame buffer of the screen, BENCH_SCREEN_WIDTH bytes per line
+PCBYTE BenchScreenGetPixels();
+
+/// Span callbacks against per-pixel callbacks (fill, text and images), blend tables against the blend arithmetic
+/// and precomputed font metrics against the glyph lookups
+void BenchRasterRun();
+/// Bitmap streaming over a RAM disk: per-pixel reads, chunks of rows and whole sectors read in place
+void BenchBitmapRun(const ScreenBuffer* screen);
+/// Writes the files of the card image and connects the emulated card to the bus
+/// \return False if the image cannot be written
+BOOL BenchCardOpen();
+void BenchCardClose();
+/// Emulated SD card: CRC verification overlapped with the transfers, read-ahead and fast seek
+/// \remarks Runs in the kernel, after the SD driver and the storage task are initialized
+void BenchCardRun();
+
+#endif /* TESTS_BENCH_BENCH_H_ */
@@ -0,0 +1,304 @@
+/*
+ * Bitmap streaming over a RAM disk, so that only the CPU work of the readers is measured (host cycles per image)
+ *
+ * The same 400x300 24bit image is displayed 1:1 by three readers:
+ * -> 3 byte reads for each pixel, the reader before the scanlines were streamed in chunks
+ * -> Chunks of complete rows read in a 2KB buffer, the reader before the whole sector reads
+ * -> BmpDisplay, which reads whole sectors in its row buffer and uses the rows in place
+ * The RAM disk counts the sectors that FatFs reads in the file buffer (then copied to the reader piece by piece)
+ * and the ones it reads directly in the reader buffer
+ */
+
+#include <bench.h>
+#include <hostfat.h>
+#include <hosttest.h>
+#include <app/bmp.h>
+#include <fatfs.h>
+#include <intmath.h>
+#include <ram.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BITMAP_IMAGE_PATH "bench_ramdisk.img"
+#define BITMAP_IMAGE_SECTORS HOST_FAT_MIN_SECTORS
+#define BITMAP_SECTOR_SIZE 512
+#define BITMAP_FILE_NAME "IMAGE.BMP"
+/// Size of the headers (BITMAPFILEHEADER and BITMAPINFOHEADER): the scanlines are not aligned to the sectors
+#define BITMAP_DATA_OFFSET 54
+#define BITMAP_ROW_SIZE (((BENCH_SCREEN_WIDTH * 3) + 3) & ~3)
+#define BITMAP_FILE_SIZE (BITMAP_DATA_OFFSET + (BITMAP_ROW_SIZE * BENCH_SCREEN_HEIGHT))
+/// Chunk of the row reader that read complete rows
+#define BITMAP_CHUNK_SIZE 2048
+/// Times each reader displays the image
+#define BITMAP_REPEATS 5
+
+/// Bitmap reader under measure
+typedef BmpResult (*BitmapReader)(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer);
+
+/// Counters of the RAM disk
+typedef struct _RamDiskStatistics {
+    UInt32 reads;
+    /// Sectors read in the file buffer of FatFs
+    UInt32 fileBufferSectors;
+    /// Sectors read in the file system window (FAT and directory)
+    UInt32 windowSectors;
+    /// Sectors read directly in the buffer of the reader
+    UInt32 directSectors;
+} RamDiskStatistics;
+
+/// Measure of a reader
+typedef struct _BitmapMeasure {
+    const char* name;
+    BitmapReader reader;
+    UInt64 cycles;
+    RamDiskStatistics disk;
+} BitmapMeasure;
+
+// ##### Private forward declarations #####
+
+static DSTATUS RamDiskInitialize(BYTE pdrv);
+static DSTATUS RamDiskStatus(BYTE pdrv);
+static DRESULT RamDiskRead(BYTE pdrv, BYTE* buff, DWORD sector, UINT count);
+static DRESULT RamDiskIoctl(BYTE pdrv, BYTE cmd, void* buff);
+/// Writes the bitmap file with random pixels
+static BYTE* CreateBitmapFile();
+/// Loads the disk image in the RAM disk
+static BOOL LoadImage(const char* path);
+/// Reads the pixels with a f_read of 3 bytes each, then blits the row
+static BmpResult ReadPerPixel(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer);
+/// Reads as many complete rows as fit in a 2KB buffer with each f_read, then blits them from the buffer
+static BmpResult ReadRowChunks(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer);
+/// Displays the image with the bitmap module
+static BmpResult ReadWithBmpDisplay(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer);
+static void RunMeasure(BitmapMeasure* measure, const ScreenBuffer* screen);
+
+// ##### Private fields #####
+
+static const Diskio_drvTypeDef _ramDiskDriver = {
+    .disk_initialize = RamDiskInitialize,
+    .disk_status = RamDiskStatus,
+    .disk_read = RamDiskRead,
+    .disk_ioctl = RamDiskIoctl,
+};
+static char _ramDiskPath[4];
+static BYTE* _ramDisk;
+static RamDiskStatistics _ramDiskStatistics;
+static FATFS _fileSystem;
+static FIL _file;
+
+static BitmapMeasure _measures[] = {
+    { .name = "3 byte reads per pixel", .reader = ReadPerPixel },
+    { .name = "2KB chunks of complete rows", .reader = ReadRowChunks },
+    { .name = "whole sectors in place (BmpDisplay)", .reader = ReadWithBmpDisplay },
+};
+
+// ##### Private function definitions #####
+
+DSTATUS RamDiskInitialize(BYTE pdrv) {
+    return pdrv == 0 && _ramDisk != NULL ? 0 : STA_NOINIT;
+}
+
+DSTATUS RamDiskStatus(BYTE pdrv) {
+    return RamDiskInitialize(pdrv);
+}
+
+DRESULT RamDiskRead(BYTE pdrv, BYTE* buff, DWORD sector, UINT count) {
+    if (pdrv != 0 || sector + count > BITMAP_IMAGE_SECTORS) {
+        return RES_PARERR;
+    }
+    memcpy(buff, &_ramDisk[(size_t)sector * BITMAP_SECTOR_SIZE], (size_t)count * BITMAP_SECTOR_SIZE);
+
+    _ramDiskStatistics.reads++;
+    if (buff == _file.buf) {
+        _ramDiskStatistics.fileBufferSectors += count;
+    }
+    else if (buff == _fileSystem.win) {
+        _ramDiskStatistics.windowSectors += count;
+    }
+    else {
+        _ramDiskStatistics.directSectors += count;
+    }
+    return RES_OK;
+}
+
+DRESULT RamDiskIoctl(BYTE pdrv, BYTE cmd, void* buff) {
+    if (pdrv != 0) {
+        return RES_PARERR;
+    }
+    switch (cmd) {
+    case CTRL_SYNC:
+        return RES_OK;
+    case GET_SECTOR_COUNT:
+        *(DWORD*)buff = BITMAP_IMAGE_SECTORS;
+        return RES_OK;
+    case GET_SECTOR_SIZE:
+        *(WORD*)buff = BITMAP_SECTOR_SIZE;
+        return RES_OK;
+    case GET_BLOCK_SIZE:
+        *(DWORD*)buff = 1;
+        return RES_OK;
+    default:
+        return RES_PARERR;
+    }
+}
+
+BYTE* CreateBitmapFile() {
+    BYTE* file = (BYTE*)calloc(1, BITMAP_FILE_SIZE);
+    // BITMAPFILEHEADER and BITMAPINFOHEADER of a bottom-up 24bit image
+    const UInt32 fields[][3] = {
+        // Offset, size, value
+        { 0, 2, BmpIdentifierBM }, { 2, 4, BITMAP_FILE_SIZE }, { 10, 4, BITMAP_DATA_OFFSET },
+        { 14, 4, 40 }, { 18, 4, BENCH_SCREEN_WIDTH }, { 22, 4, BENCH_SCREEN_HEIGHT }, { 26, 2, 1 }, { 28, 2, 24 },
+        { 34, 4, BITMAP_ROW_SIZE * BENCH_SCREEN_HEIGHT },
+    };
+    for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        for (UInt32 b = 0; b < fields[i][1]; b++) {
+            file[fields[i][0] + b] = (BYTE)(fields[i][2] >> (b * 8));
+        }
+    }
+
+    UInt32 state = 11;
+    for (UInt32 row = 0; row < BENCH_SCREEN_HEIGHT; row++) {
+        for (UInt32 i = 0; i < BENCH_SCREEN_WIDTH * 3; i++) {
+            file[BITMAP_DATA_OFFSET + row * BITMAP_ROW_SIZE + i] = (BYTE)HostRandom(&state);
+        }
+    }
+    return file;
+}
+
+BOOL LoadImage(const char* path) {
+    FILE* image = fopen(path, "rb");
+    if (image == NULL) {
+        return false;
+    }
+    _ramDisk = (BYTE*)malloc((size_t)BITMAP_IMAGE_SECTORS * BITMAP_SECTOR_SIZE);
+    BOOL result = _ramDisk != NULL && fread(_ramDisk, BITMAP_SECTOR_SIZE, BITMAP_IMAGE_SECTORS, image) == BITMAP_IMAGE_SECTORS;
+    fclose(image);
+    return result;
+}
+
+BmpResult ReadPerPixel(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer) {
+    BYTE row[BENCH_SCREEN_WIDTH * 3];
+    FSIZE_t rowOffset = cpBmp->dataOffset;
+    for (int y = cpScreenBuffer->screenSize.height - 1; y >= 0; y--) {
+        if (f_lseek(cpBmp->fileHandle, rowOffset) != FR_OK) {
+            return BmpResultFailure;
+        }
+        for (int x = 0; x < cpScreenBuffer->screenSize.width; x++) {
+            UINT read;
+            if (f_read(cpBmp->fileHandle, &row[x * 3], 3, &read) != FR_OK || read != 3) {
+                return BmpResultFailure;
+            }
+        }
+        ScreenBlitSpan(cpScreenBuffer, (Int16)y, 0, row, cpScreenBuffer->screenSize.width, ScreenDitherNone);
+        rowOffset += cpBmp->rowByteSize;
+    }
+    return BmpResultOk;
+}
+
+BmpResult ReadRowChunks(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer) {
+    size_t bufferSize = (MAX(BITMAP_CHUNK_SIZE, (size_t)cpBmp->rowByteSize) + 3) & ~((size_t)0x3);
+    UInt32 bufferRows = (UInt32)(bufferSize / cpBmp->rowByteSize);
+    BYTE* buffer = (BYTE*)ralloc(bufferSize);
+    if (buffer == NULL || f_lseek(cpBmp->fileHandle, cpBmp->dataOffset) != FR_OK) {
+        return BmpResultFailure;
+    }
+
+    BmpResult result = BmpResultOk;
+    for (UInt32 fileRow = 0; fileRow < cpBmp->height && result == BmpResultOk; fileRow += bufferRows) {
+        UInt32 rows = MIN(bufferRows, cpBmp->height - fileRow);
+        UINT bytes = (UINT)(rows * cpBmp->rowByteSize);
+        UINT read;
+        if (f_read(cpBmp->fileHandle, buffer, bytes, &read) != FR_OK || read != bytes) {
+            result = BmpResultFailure;
+            break;
+        }
+        for (UInt32 i = 0; i < rows; i++) {
+            Int16 y = (Int16)(cpBmp->height - 1 - (fileRow + i));
+            ScreenBlitSpan(cpScreenBuffer, y, 0, &buffer[i * cpBmp->rowByteSize], cpScreenBuffer->screenSize.width, ScreenDitherNone);
+        }
+    }
+    rfree(buffer, bufferSize);
+    return result;
+}
+
+BmpResult ReadWithBmpDisplay(const Bmp* cpBmp, const ScreenBuffer* cpScreenBuffer) {
+    return BmpDisplay(cpBmp, cpScreenBuffer, BmpScaleNearest, ScreenDitherNone);
+}
+
+void RunMeasure(BitmapMeasure* measure, const ScreenBuffer* screen) {
+    TEST_CHECK_EQUAL(FR_OK, f_open(&_file, BITMAP_FILE_NAME, FA_READ), "%s: open", measure->name);
+    Bmp bmp;
+    TEST_CHECK_EQUAL(BmpResultOk, BmpReadFromFile(&_file, &bmp), "%s: headers", measure->name);
+
+    RamDiskStatistics before = _ramDiskStatistics;
+    UInt64 start = HostCycles();
+    for (int i = 0; i < BITMAP_REPEATS; i++) {
+        TEST_CHECK_EQUAL(BmpResultOk, measure->reader(&bmp, screen), "%s: display", measure->name);
+    }
+    measure->cycles = (HostCycles() - start) / BITMAP_REPEATS;
+    measure->disk.reads = (_ramDiskStatistics.reads - before.reads) / BITMAP_REPEATS;
+    measure->disk.fileBufferSectors = (_ramDiskStatistics.fileBufferSectors - before.fileBufferSectors) / BITMAP_REPEATS;
+    measure->disk.windowSectors = (_ramDiskStatistics.windowSectors - before.windowSectors) / BITMAP_REPEATS;
+    measure->disk.directSectors = (_ramDiskStatistics.directSectors - before.directSectors) / BITMAP_REPEATS;
+    f_close(&_file);
+}
+
+// ##### Public function definitions #####
+
+void BenchBitmapRun(const ScreenBuffer* screen) {
+    BYTE* bitmap = CreateBitmapFile();
+    HostFatFile file = { .name = BITMAP_FILE_NAME, .data = bitmap, .size = BITMAP_FILE_SIZE };
+    if (!HostFatBuildImage(BITMAP_IMAGE_PATH, BITMAP_IMAGE_SECTORS, &file, 1, 0) || !LoadImage(BITMAP_IMAGE_PATH)) {
+        printf("Cannot create the RAM disk\n");
+        abort();
+    }
+    free(bitmap);
+
+    // The RAM disk takes the only volume of the configuration while the card driver is unlinked
+    FATFS_UnLinkDriver(USERPath);
+    FATFS_LinkDriver(&_ramDiskDriver, _ramDiskPath);
+    TEST_CHECK_EQUAL(FR_OK, f_mount(&_fileSystem, _ramDiskPath, 1), "RAM disk mount");
+
+    size_t count = sizeof(_measures) / sizeof(_measures[0]);
+    BYTE* frames = (BYTE*)malloc(count * BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT);
+    for (size_t m = 0; m < count; m++) {
+        RunMeasure(&_measures[m], screen);
+        memcpy(&frames[m * BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT], BenchScreenGetPixels(),
+            BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT);
+    }
+
+    printf("\nBitmap streaming, %dx%d 24bit image displayed 1:1 from a RAM disk, per image\n",
+        BENCH_SCREEN_WIDTH, BENCH_SCREEN_HEIGHT);
+    printf("  %-36s %12s %8s %8s %10s %10s\n", "", "cycles", "speedup", "reads", "copied KB", "direct KB");
+    for (size_t m = 0; m < count; m++) {
+        const BitmapMeasure* measure = &_measures[m];
+        printf("  %-36s %12llu %7.2fx %8" PRIu32 " %10.1f %10.1f\n", measure->name,
+            (unsigned long long)measure->cycles, (double)_measures[0].cycles / (double)MAX(measure->cycles, 1),
+            measure->disk.reads, (double)measure->disk.fileBufferSectors * BITMAP_SECTOR_SIZE / 1024.0,
+            (double)measure->disk.directSectors * BITMAP_SECTOR_SIZE / 1024.0);
+    }
+
+    for (size_t m = 1; m < count; m++) {
+        TEST_CHECK(memcmp(frames, &frames[m * BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT],
+            BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT) == 0, "%s: frame differs from the per-pixel reads",
+            _measures[m].name);
+    }
+    // Whole sectors are read in place: only the sectors shared by two chunks of the image go through the file buffer
+    const RamDiskStatistics* direct = &_measures[count - 1].disk;
+    const RamDiskStatistics* chunks = &_measures[1].disk;
+    UInt32 imageSectors = (BITMAP_FILE_SIZE + BITMAP_SECTOR_SIZE - 1) / BITMAP_SECTOR_SIZE;
+    TEST_CHECK(direct->directSectors + direct->fileBufferSectors >= imageSectors - 1, "image not read entirely");
+    TEST_CHECK(direct->fileBufferSectors * 4 < chunks->fileBufferSectors, "in place reads copy %" PRIu32
+        " sectors through the file buffer, the chunks %" PRIu32, direct->fileBufferSectors, chunks->fileBufferSectors);
+    TEST_CHECK(direct->reads < _measures[0].disk.reads, "in place reads issue more disk reads than the pixel reads");
+    free(frames);
+
+    // The card driver gets its volume back
+    f_mount(NULL, _ramDiskPath, 0);
+    FATFS_UnLinkDriver(_ramDiskPath);
+    FATFS_LinkDriver(&USER_Driver, USERPath);
+    free(_ramDisk);
+    _ramDisk = NULL;
+}
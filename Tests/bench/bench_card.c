@@ -0,0 +1,357 @@
+/*
+ * SD card paths measured against the emulated card, in emulated time
+ *
+ * -> CRC verification: the CPU cost of the CRC16 is modeled on each block. The single block reads verify the block
+ *    after its transfer, the multiple block reads verify block N while the DMA clocks block N + 1
+ * -> Read-ahead: sequential 512 byte reads of a file on demand and with the prefetch window, with and without client
+ *    work (ex. an image decode) between the reads. The latency of each read is the time spent in f_read
+ * -> Fast seek: random seeks in a fragmented file following the cluster chain in the FAT, against the cluster link
+ *    map of FatFs. The host cycles of a seek include the emulated reads of the FAT sectors it loads
+ *
+ * The emulated CPU takes no time except the modeled work, so the latencies are the bus and card times plus the
+ * modeled CPU cost
+ */
+
+#include <bench.h>
+#include <sdcardemulator.h>
+#include <hostboard.h>
+#include <hostfat.h>
+#include <hosttest.h>
+#include <sd/sd.h>
+#include <crc/crc16.h>
+#include <disk/readahead.h>
+#include <disk/sectorcache.h>
+#include <fatfs.h>
+#include <intmath.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CARD_IMAGE_PATH "bench_card.img"
+#define CARD_IMAGE_SECTORS HOST_FAT_MIN_SECTORS
+#define CARD_SECTOR_SIZE 512
+/// Clusters of each fragment of the files: the link map of a 2MB file needs 33 entries
+#define CARD_FRAGMENT_CLUSTERS 64
+#define CARD_STREAM_FILE_NAME "STREAM.BIN"
+#define CARD_STREAM_FILE_SIZE (1024U * 1024U)
+#define CARD_SEEK_FILE_NAME "SEEK.BIN"
+#define CARD_SEEK_FILE_SIZE (2048U * 1024U)
+
+/// Modeled cost of the slice-by-4 CRC16 on the board CPU
+#define CARD_CRC_CYCLES_PER_BYTE 4
+/// Sectors read by each CRC measure
+#define CARD_CRC_SECTORS 128
+#define CARD_MAX_SECTORS_PER_READ 32
+/// 512 byte reads of each read-ahead measure (128KB)
+#define CARD_STREAM_READS 256
+/// Modeled client work after each read, longer than the prefetch of the window
+#define CARD_CLIENT_WORK (1500 * HOST_TIME_US)
+#define CARD_SEEKS 200
+/// Entries of the cluster link map, like the bitmap module
+#define CARD_LINK_MAP_SIZE 64
+
+/// Measure of the CRC verification
+typedef struct _CrcMeasure {
+    const char* name;
+    /// Sectors of each read, 1 for the single block reads
+    UInt32 sectorsPerRead;
+    /// The CRC cost is modeled
+    BOOL crcCost;
+    /// Results
+    UInt32 commands;
+    UInt64 emulatedTime;
+} CrcMeasure;
+
+/// Measure of the sequential reads
+typedef struct _StreamMeasure {
+    const char* name;
+    BOOL readAhead;
+    UInt64 clientWork;
+    /// Results
+    UInt64 emulatedTime;
+    UInt64 totalLatency;
+    UInt64 maxLatency;
+    ReadAheadStatistics statistics;
+} StreamMeasure;
+
+/// Measure of the random seeks
+typedef struct _SeekMeasure {
+    const char* name;
+    BOOL linkMap;
+    /// Results
+    UInt64 emulatedTime;
+    UInt64 seekCycles;
+    /// FAT sectors loaded in the file system window
+    UInt32 fatReads;
+} SeekMeasure;
+
+// ##### Private forward declarations #####
+
+/// Linker wrapper of the CRC of the SD driver: models the CPU cost, then computes the CRC
+uint16_t __wrap_Crc16Update(uint16_t crc, const uint8_t* pData, size_t count);
+uint16_t __real_Crc16Update(uint16_t crc, const uint8_t* pData, size_t count);
+/// Returns the modeled CPU time of the CRC of a number of bytes
+static UInt64 GetCrcCost(size_t count);
+static void RunCrcMeasure(CrcMeasure* measure);
+static void RunStreamMeasure(StreamMeasure* measure, FSIZE_t offset);
+static void RunSeekMeasure(SeekMeasure* measure);
+static void BenchCrc();
+static void BenchReadAhead();
+static void BenchFastSeek();
+
+// ##### Private fields #####
+
+static SdCardEmulator _card;
+static BYTE* _streamData;
+static BYTE* _seekData;
+static BOOL _crcCostEnabled;
+/// Destination of the raw reads in the main RAM
+static BYTE _buffer[CARD_MAX_SECTORS_PER_READ * CARD_SECTOR_SIZE];
+
+// ##### Private function definitions #####
+
+uint16_t __wrap_Crc16Update(uint16_t crc, const uint8_t* pData, size_t count) {
+    if (_crcCostEnabled) {
+        HostCpuWork(GetCrcCost(count));
+    }
+    return __real_Crc16Update(crc, pData, count);
+}
+
+UInt64 GetCrcCost(size_t count) {
+    return ((UInt64)count * CARD_CRC_CYCLES_PER_BYTE * HOST_TIME_S) / HOST_SYSTEM_CLOCK;
+}
+
+void RunCrcMeasure(CrcMeasure* measure) {
+    SdStatistics before;
+    SdGetStatistics(&before);
+    _crcCostEnabled = measure->crcCost;
+    UInt64 start = HostTimeNow();
+
+    UInt32 failedReads = 0;
+    UInt32 sector = 2000;
+    for (UInt32 read = 0; read < CARD_CRC_SECTORS / measure->sectorsPerRead; read++) {
+        SdStatus status = measure->sectorsPerRead == 1 ? SdReadSector(_buffer, sector) :
+            SdReadSectors(_buffer, sector, measure->sectorsPerRead);
+        if (status != SdStatusOk) {
+            failedReads++;
+        }
+        sector += measure->sectorsPerRead;
+    }
+
+    measure->emulatedTime = HostTimeNow() - start;
+    _crcCostEnabled = false;
+    SdStatistics after;
+    SdGetStatistics(&after);
+    measure->commands = after.commands - before.commands;
+    TEST_CHECK_EQUAL(0, failedReads, "%s: failed reads", measure->name);
+    TEST_CHECK_EQUAL(CARD_CRC_SECTORS, after.sectors - before.sectors, "%s: sectors read", measure->name);
+}
+
+void RunStreamMeasure(StreamMeasure* measure, FSIZE_t offset) {
+    FIL* file = &USERFile;
+    TEST_CHECK_EQUAL(FR_OK, f_open(file, CARD_STREAM_FILE_NAME, FA_READ), "%s: open", measure->name);
+    TEST_CHECK_EQUAL(FR_OK, f_lseek(file, offset), "%s: seek", measure->name);
+    BYTE* data = (BYTE*)malloc(CARD_SECTOR_SIZE);
+
+    ReadAheadStatistics before;
+    ReadAheadGetStatistics(&before);
+    UInt64 start = HostTimeNow();
+    for (UInt32 i = 0; i < CARD_STREAM_READS; i++) {
+        UInt64 readStart = HostTimeNow();
+        UINT read = 0;
+        FRESULT result = f_read(file, data, CARD_SECTOR_SIZE, &read);
+        UInt64 latency = HostTimeNow() - readStart;
+        measure->totalLatency += latency;
+        measure->maxLatency = MAX(measure->maxLatency, latency);
+
+        if (result != FR_OK || read != CARD_SECTOR_SIZE ||
+            memcmp(data, &_streamData[offset + (FSIZE_t)i * CARD_SECTOR_SIZE], CARD_SECTOR_SIZE) != 0) {
+            TEST_CHECK(false, "%s: read %u differs from the file", measure->name, i);
+            break;
+        }
+        if (measure->clientWork != 0) {
+            HostCpuWork(measure->clientWork);
+        }
+    }
+    measure->emulatedTime = HostTimeNow() - start;
+
+    ReadAheadStatistics after;
+    ReadAheadGetStatistics(&after);
+    measure->statistics.hitSectors = after.hitSectors - before.hitSectors;
+    measure->statistics.missSectors = after.missSectors - before.missSectors;
+    measure->statistics.prefetchedSectors = after.prefetchedSectors - before.prefetchedSectors;
+    measure->statistics.readyPrefetches = after.readyPrefetches - before.readyPrefetches;
+    free(data);
+    f_close(file);
+}
+
+void RunSeekMeasure(SeekMeasure* measure) {
+    FIL* file = &USERFile;
+    TEST_CHECK_EQUAL(FR_OK, f_open(file, CARD_SEEK_FILE_NAME, FA_READ), "%s: open", measure->name);
+    DWORD linkMap[CARD_LINK_MAP_SIZE];
+    if (measure->linkMap) {
+        linkMap[0] = CARD_LINK_MAP_SIZE;
+        file->cltbl = linkMap;
+        TEST_CHECK_EQUAL(FR_OK, f_lseek(file, CREATE_LINKMAP), "%s: link map", measure->name);
+    }
+
+    SectorCacheStatistics before;
+    SectorCacheGetStatistics(&before);
+    UInt64 start = HostTimeNow();
+    UInt32 state = 5;
+    for (UInt32 i = 0; i < CARD_SEEKS; i++) {
+        // Seeks to the start of a sector only follow the cluster chain: FatFs reads the data sector at the next read
+        FSIZE_t offset = (HostRandom(&state) % CARD_SEEK_FILE_SIZE) & ~((FSIZE_t)CARD_SECTOR_SIZE - 1);
+        UInt64 seekStart = HostCycles();
+        FRESULT result = f_lseek(file, offset);
+        measure->seekCycles += HostCycles() - seekStart;
+
+        BYTE value = 0;
+        UINT read = 0;
+        if (result != FR_OK || f_read(file, &value, 1, &read) != FR_OK || read != 1 || value != _seekData[offset]) {
+            TEST_CHECK(false, "%s: byte at %u differs from the file", measure->name, (unsigned)offset);
+            break;
+        }
+    }
+    measure->emulatedTime = HostTimeNow() - start;
+
+    SectorCacheStatistics after;
+    SectorCacheGetStatistics(&after);
+    measure->fatReads = (after.metadataHits + after.metadataMisses) - (before.metadataHits + before.metadataMisses);
+    f_close(file);
+}
+
+void BenchCrc() {
+    CrcMeasure measures[] = {
+        { .name = "single block", .sectorsPerRead = 1 },
+        { .name = "single block, CRC cost", .sectorsPerRead = 1, .crcCost = true },
+        { .name = "multiple x32", .sectorsPerRead = 32 },
+        { .name = "multiple x32, CRC cost", .sectorsPerRead = 32, .crcCost = true },
+    };
+    size_t count = sizeof(measures) / sizeof(measures[0]);
+    for (size_t m = 0; m < count; m++) {
+        RunCrcMeasure(&measures[m]);
+    }
+
+    // Data and CRC bytes of a block
+    UInt64 blockCost = GetCrcCost(CARD_SECTOR_SIZE + 2);
+    printf("\nCRC verification, %d sectors, modeled CRC cost %.1f us per block\n", CARD_CRC_SECTORS,
+        (double)blockCost / (double)HOST_TIME_US);
+    printf("  %-26s %8s %8s %14s\n", "", "us/block", "MB/s", "added us/cmd");
+    for (size_t m = 0; m < count; m++) {
+        const CrcMeasure* measure = &measures[m];
+        // Each row with the cost follows its row without the cost
+        double added = measure->crcCost ? (double)(measure->emulatedTime - measures[m - 1].emulatedTime) /
+            (double)measure->commands / (double)HOST_TIME_US : 0;
+        double seconds = (double)measure->emulatedTime / (double)HOST_TIME_S;
+        printf("  %-26s %8.1f %8.3f %14.1f\n", measure->name,
+            (double)measure->emulatedTime / (double)HOST_TIME_US / CARD_CRC_SECTORS,
+            ((double)CARD_CRC_SECTORS * CARD_SECTOR_SIZE) / (seconds * 1e6), added);
+    }
+
+    // The single block reads wait for the whole CRC, the multiple block reads only for the one of the last block
+    UInt64 singleAdded = measures[1].emulatedTime - measures[0].emulatedTime;
+    UInt64 multipleAdded = measures[3].emulatedTime - measures[2].emulatedTime;
+    TEST_CHECK(singleAdded >= CARD_CRC_SECTORS * blockCost * 9 / 10,
+        "the single block reads do not pay the CRC cost of each block");
+    TEST_CHECK(multipleAdded <= measures[3].commands * blockCost * 3 / 2,
+        "the CRC of the multiple block reads is not overlapped with the transfers");
+}
+
+void BenchReadAhead() {
+    StreamMeasure measures[] = {
+        { .name = "on demand" },
+        { .name = "on demand, client work", .clientWork = CARD_CLIENT_WORK },
+        { .name = "read-ahead", .readAhead = true },
+        { .name = "read-ahead, client work", .readAhead = true, .clientWork = CARD_CLIENT_WORK },
+    };
+    size_t count = sizeof(measures) / sizeof(measures[0]);
+    for (size_t m = 0; m < count; m++) {
+        // The window is allocated once: the measures on demand come first. Each measure reads another part of the
+        // file, so that the sector cache does not serve it
+        if (measures[m].readAhead && (m == 0 || !measures[m - 1].readAhead)) {
+            ReadAheadInitialize();
+        }
+        RunStreamMeasure(&measures[m], (FSIZE_t)m * (CARD_STREAM_FILE_SIZE / count));
+    }
+
+    printf("\nSequential 512 byte reads, %d reads, client work %llu us after each read\n", CARD_STREAM_READS,
+        (unsigned long long)(CARD_CLIENT_WORK / HOST_TIME_US));
+    printf("  %-26s %8s %8s %8s %6s %6s %6s\n", "", "avg us", "max us", "total ms", "hits", "misses", "ready");
+    for (size_t m = 0; m < count; m++) {
+        const StreamMeasure* measure = &measures[m];
+        printf("  %-26s %8.1f %8.1f %8.2f %6" PRIu32 " %6" PRIu32 " %6" PRIu32 "\n", measure->name,
+            (double)measure->totalLatency / (double)HOST_TIME_US / CARD_STREAM_READS,
+            (double)measure->maxLatency / (double)HOST_TIME_US,
+            (double)measure->emulatedTime / (double)HOST_TIME_MS,
+            measure->statistics.hitSectors, measure->statistics.missSectors, measure->statistics.readyPrefetches);
+    }
+
+    TEST_CHECK_EQUAL(0, measures[1].statistics.hitSectors + measures[1].statistics.missSectors,
+        "reads on demand went through the window");
+    TEST_CHECK(measures[3].statistics.hitSectors > CARD_STREAM_READS / 2, "the sequential reads miss the window");
+    TEST_CHECK(measures[3].statistics.readyPrefetches > 0, "no prefetch overlapped the client work");
+    TEST_CHECK(measures[3].totalLatency < measures[1].totalLatency / 2,
+        "the prefetch does not hide the latency of the reads");
+    TEST_CHECK(measures[3].emulatedTime < measures[1].emulatedTime, "the read-ahead slows the stream down");
+}
+
+void BenchFastSeek() {
+    SeekMeasure measures[] = {
+        { .name = "cluster chain" },
+        { .name = "link map", .linkMap = true },
+    };
+    size_t count = sizeof(measures) / sizeof(measures[0]);
+    for (size_t m = 0; m < count; m++) {
+        RunSeekMeasure(&measures[m]);
+    }
+
+    printf("\nRandom seeks and 1 byte reads, %d seeks in a 2MB file of %d cluster fragments\n", CARD_SEEKS,
+        CARD_FRAGMENT_CLUSTERS);
+    printf("  %-26s %8s %12s %10s\n", "", "us/seek", "cycles/seek", "FAT/seek");
+    for (size_t m = 0; m < count; m++) {
+        const SeekMeasure* measure = &measures[m];
+        printf("  %-26s %8.1f %12llu %10.2f\n", measure->name,
+            (double)measure->emulatedTime / (double)HOST_TIME_US / CARD_SEEKS,
+            (unsigned long long)(measure->seekCycles / CARD_SEEKS), (double)measure->fatReads / CARD_SEEKS);
+    }
+
+    TEST_CHECK(measures[0].fatReads > 0, "the seeks did not follow the cluster chain");
+    TEST_CHECK_EQUAL(0, measures[1].fatReads, "FAT sectors read by the seeks with the link map");
+}
+
+// ##### Public function definitions #####
+
+BOOL BenchCardOpen() {
+    _streamData = (BYTE*)malloc(CARD_STREAM_FILE_SIZE);
+    _seekData = (BYTE*)malloc(CARD_SEEK_FILE_SIZE);
+    UInt32 state = 3;
+    for (UInt32 i = 0; i < CARD_STREAM_FILE_SIZE; i++) {
+        _streamData[i] = (BYTE)HostRandom(&state);
+    }
+    for (UInt32 i = 0; i < CARD_SEEK_FILE_SIZE; i++) {
+        _seekData[i] = (BYTE)HostRandom(&state);
+    }
+
+    HostFatFile files[] = {
+        { .name = CARD_STREAM_FILE_NAME, .data = _streamData, .size = CARD_STREAM_FILE_SIZE },
+        { .name = CARD_SEEK_FILE_NAME, .data = _seekData, .size = CARD_SEEK_FILE_SIZE },
+    };
+    return HostFatBuildImage(CARD_IMAGE_PATH, CARD_IMAGE_SECTORS, files, 2, CARD_FRAGMENT_CLUSTERS) &&
+        SdCardEmulatorOpen(&_card, CARD_IMAGE_PATH, NULL);
+}
+
+void BenchCardClose() {
+    SdCardEmulatorClose(&_card);
+    free(_streamData);
+    free(_seekData);
+}
+
+void BenchCardRun() {
+    // The mount connects the card, the FAT sectors are counted as they are loaded in the file system window
+    TEST_CHECK_EQUAL(FR_OK, f_mount(&USERFatFS, USERPath, 1), "card mount");
+    SectorCacheSetMetadataWindow(USERFatFS.win);
+
+    BenchCrc();
+    BenchReadAhead();
+    BenchFastSeek();
+}
@@ -0,0 +1,455 @@
+/*
+ * Raster paths of the 8bpp VGA screen buffer, measured in host cycles per pixel
+ *
+ * -> Fill, text and images drawn through the span callbacks, against the per-pixel (and pixel pack) callbacks
+ *    used before the spans were introduced
+ * -> Blended glyph coverage through the per-color blend tables, against the blend arithmetic that computed each
+ *    translucent pixel
+ * -> The file names of an explorer page measured with the precomputed font metrics, against the glyph lookups of
+ *    every character
+ */
+
+// The driver is included to reach its frame buffer and its blend macros
+#include <vga/vgascreenbuffer.c>
+#include <bench.h>
+#include <hosttest.h>
+#include <fonts/glyph.h>
+
+/// Times each workload is drawn
+#define RASTER_REPEATS 20
+/// Unaligned rectangle of the fill workload: the edges are not on a pixel pack boundary
+#define RASTER_FILL_LEFT 3
+#define RASTER_FILL_TOP 2
+#define RASTER_FILL_WIDTH 390
+#define RASTER_FILL_HEIGHT 290
+/// Redraws of the explorer page in the font metrics workload
+#define RASTER_PAGE_REDRAWS 2000
+
+/// Measure of a drawing path
+typedef struct _RasterMeasure {
+    const char* name;
+    /// Pixels (or strings) processed
+    UInt64 items;
+    UInt64 cycles;
+} RasterMeasure;
+
+// ##### Private forward declarations #####
+
+/// Fills the rectangle with a call of the per-pixel callback for each pixel
+static void FillPerPixel(const Pen* pen);
+/// Fills the rectangle as ScreenFillRectangle did before the spans: single pixels up to the pack alignment, then
+/// pixel packs
+static void FillWithPacks(const Pen* pen);
+/// Draws a string with a call of the per-pixel callback for each covered glyph pixel, as the glyph renderer did
+/// before the spans. The translucent pixels are blended with the arithmetic of BlendPixelArithmetic
+/// @return Number of covered pixels
+static UInt32 DrawStringPerPixel(const char* str, PointS point, const Pen* pen);
+/// Blends a color over a native pixel with the integer arithmetic used before the blend tables
+static void BlendPixelArithmetic(BYTE* pixelPtr, ARGB8Color color);
+/// Blends the glyph rows of a string with BlendPixelArithmetic (tables == false) or with ScreenBlendSpan
+/// @return Number of blended pixels
+static UInt32 BlendStringRows(const char* str, PointS point, const Pen* pen, BOOL tables);
+/// Returns the max glyph height scanning the whole font, as ScreenGetCharMaxHeight did before the font metrics
+static UInt16 GetCharMaxHeightFromGlyphs();
+/// Measures a string looking up the glyph of every character, as ScreenMeasureString did before the font metrics
+static void MeasureStringFromGlyphs(const char* str, SizeS* size);
+static void PrintMeasures(const char* title, const char* unit, const RasterMeasure* measures, size_t count);
+static void BenchFill();
+static void BenchText();
+static void BenchImage();
+static void BenchBlend();
+static void BenchFontMetrics();
+
+// ##### Private fields #####
+
+static TIM_HandleTypeDef _mainTimer = { .Instance = TIM4 };
+static TIM_HandleTypeDef _hSyncTimer = { .Instance = TIM1 };
+static TIM_HandleTypeDef _vSyncTimer = { .Instance = TIM3 };
+static DMA_HandleTypeDef _lineDMA = { .Instance = DMA2_Stream0 };
+static ScreenBuffer* _screen;
+
+/// Lines of the text workloads: the per-pixel renderer does not clip, so they fit in the screen
+static const char* _textLines[] = {
+    "The quick brown fox jumps over the dog",
+    "PACK MY BOX WITH FIVE DOZEN JUGS 0123",
+    "Sphinx of black quartz, judge my vow!",
+};
+/// Page of the explorer, as returned by the directory listing
+static const char* _fileNames[] = {
+    "..", "DCIM", "Wallpapers", "holiday_2021_beach.bmp", "IMG_0001.BMP", "IMG_0002.BMP", "IMG_0003.BMP",
+    "mountain sunrise.bmp", "Screenshot 2022-01-15 183412.bmp", "logo.raw", "test pattern 400x300.bmp",
+    "README.TXT", "gradient_horizontal.bmp", "gradient_vertical.bmp", "CAT.BMP", "family portrait (scan).bmp",
+};
+
+// ##### Private function definitions #####
+
+void FillPerPixel(const Pen* pen) {
+    for (Int16 y = RASTER_FILL_TOP; y < RASTER_FILL_TOP + RASTER_FILL_HEIGHT; y++) {
+        for (Int16 x = RASTER_FILL_LEFT; x < RASTER_FILL_LEFT + RASTER_FILL_WIDTH; x++) {
+            ScreenDrawPixel(_screen, (PointS){ x, y }, pen);
+        }
+    }
+}
+
+void FillWithPacks(const Pen* pen) {
+    Int16 packSize = (Int16)(1 << _screen->packSizePower);
+    Int16 alignmentMask = (Int16)(packSize - 1);
+    Int16 hEnd = RASTER_FILL_LEFT + RASTER_FILL_WIDTH;
+    for (Int16 y = RASTER_FILL_TOP; y < RASTER_FILL_TOP + RASTER_FILL_HEIGHT; y++) {
+        Int16 x = RASTER_FILL_LEFT;
+        for (; (x & alignmentMask) != 0; x++) {
+            ScreenDrawPixel(_screen, (PointS){ x, y }, pen);
+        }
+        for (; x < (hEnd & ~alignmentMask); x = (Int16)(x + packSize)) {
+            ScreenDrawPixelPack(_screen, (PointS){ x, y }, pen);
+        }
+        for (; x < hEnd; x++) {
+            ScreenDrawPixel(_screen, (PointS){ x, y }, pen);
+        }
+    }
+}
+
+UInt32 DrawStringPerPixel(const char* str, PointS point, const Pen* pen) {
+    UInt32 pixels = 0;
+    for (; *str != '\0'; str++) {
+        GlyphMetrics metrics;
+        PCBYTE glyph;
+        GetGlyphOutline(*str, &metrics, &glyph);
+
+        int rowWidth = (metrics.blackBoxX + 3) & ~0x3;
+        for (int row = 0; row < metrics.blackBoxY && metrics.bufferSize > 0; row++) {
+            for (int column = 0; column < metrics.blackBoxX; column++) {
+                BYTE level = glyph[row * rowWidth + column];
+                if (level == 0) {
+                    continue;
+                }
+                // The glyph level scales the pen alpha
+                Pen pixelPen = *pen;
+                pixelPen.color.components.A = (BYTE)((pen->color.components.A * level) / SCREEN_COVERAGE_MAX);
+                PointS pixel = { (Int16)(point.x + metrics.glyphOrigin.x + column), (Int16)(point.y + metrics.glyphOrigin.y + row) };
+                if (pixelPen.color.components.A == 0xFF) {
+                    ScreenDrawPixel(_screen, pixel, &pixelPen);
+                }
+                else {
+                    BlendPixelArithmetic(Get8bppPixelAddress(_activeScreenBuffer, pixel.x, pixel.y), pixelPen.color);
+                }
+                pixels++;
+            }
+        }
+        point.x = (Int16)(point.x + metrics.cellIncX);
+    }
+    return pixels;
+}
+
+void BlendPixelArithmetic(BYTE* pixelPtr, ARGB8Color color) {
+    int currentPixelColor = *pixelPtr;
+    int alpha = color.components.A;
+    int bgAlpha = 255 - alpha;
+
+    int r = ((color.components.R * alpha) + (MASKI2BYTE(currentPixelColor << 6) * bgAlpha)) / 255;
+    int g = ((color.components.G * alpha) + (MASKI2BYTE((currentPixelColor & 0x1c) << 3) * bgAlpha)) / 255;
+    int b = ((color.components.B * alpha) + (MASKI2BYTE(currentPixelColor & 0xE0) * bgAlpha)) / 255;
+    *pixelPtr = (BYTE)RGB_TO_8BPP(r, g, b);
+}
+
+UInt32 BlendStringRows(const char* str, PointS point, const Pen* pen, BOOL tables) {
+    UInt32 pixels = 0;
+    for (; *str != '\0'; str++) {
+        GlyphMetrics metrics;
+        PCBYTE glyph;
+        GetGlyphOutline(*str, &metrics, &glyph);
+
+        int rowWidth = (metrics.blackBoxX + 3) & ~0x3;
+        Int16 x = (Int16)(point.x + metrics.glyphOrigin.x);
+        for (int row = 0; row < metrics.blackBoxY && metrics.bufferSize > 0; row++) {
+            Int16 y = (Int16)(point.y + metrics.glyphOrigin.y + row);
+            PCBYTE coverage = &glyph[row * rowWidth];
+            if (tables) {
+                ScreenBlendSpan(_screen, y, x, coverage, (Int16)metrics.blackBoxX, pen);
+            }
+            else {
+                BYTE* pixelPtr = Get8bppPixelAddress(_activeScreenBuffer, x, y);
+                for (int column = 0; column < metrics.blackBoxX; column++) {
+                    if (coverage[column] != 0) {
+                        ARGB8Color color = pen->color;
+                        color.components.A = (BYTE)((color.components.A * coverage[column]) / SCREEN_COVERAGE_MAX);
+                        BlendPixelArithmetic(&pixelPtr[column], color);
+                    }
+                }
+            }
+            pixels += metrics.blackBoxX;
+        }
+        point.x = (Int16)(point.x + metrics.cellIncX);
+    }
+    return pixels;
+}
+
+UInt16 GetCharMaxHeightFromGlyphs() {
+    UInt16 size = 0;
+    GlyphMetrics metrics;
+    PCBYTE glyph;
+    for (int i = 0; i < 0x80; i++) {
+        GetGlyphOutline((char)i, &metrics, &glyph);
+        size = MAX(size, metrics.blackBoxY);
+    }
+    return size;
+}
+
+void MeasureStringFromGlyphs(const char* str, SizeS* size) {
+    size->height = 0;
+    size->width = 0;
+    GlyphMetrics metrics;
+    PCBYTE glyph;
+    for (size_t i = 0; i < strlen(str); i++) {
+        GetGlyphOutline(str[i], &metrics, &glyph);
+        size->height = (Int16)MAX(size->height, metrics.blackBoxY + metrics.glyphOrigin.y);
+        size->width = (Int16)(size->width + metrics.cellIncX);
+    }
+}
+
+void PrintMeasures(const char* title, const char* unit, const RasterMeasure* measures, size_t count) {
+    printf("\n%s\n", title);
+    printf("  %-40s %12s %10s\n", "", unit, "speedup");
+    for (size_t i = 0; i < count; i++) {
+        double cyclesPerItem = (double)measures[i].cycles / (double)measures[i].items;
+        double baseline = (double)measures[0].cycles / (double)measures[0].items;
+        printf("  %-40s %12.2f %9.1fx\n", measures[i].name, cyclesPerItem, baseline / cyclesPerItem);
+    }
+}
+
+void BenchFill() {
+    Pen pens[2] = { { .color.argb = SCREEN_RGB(0x20, 0x80, 0xE0) }, { .color.argb = SCREEN_RGB(0xFF, 0xC0, 0x40) } };
+    Pen black = { .color.argb = SCREEN_RGB(0, 0, 0) };
+    RasterMeasure measures[] = {
+        { .name = "per-pixel callback" },
+        { .name = "single pixels and packs" },
+        { .name = "spans (ScreenFillRectangle)" },
+    };
+    BYTE* frames[3];
+
+    for (size_t m = 0; m < 3; m++) {
+        ScreenClear(_screen, &black);
+        UInt64 start = HostCycles();
+        for (int i = 0; i < RASTER_REPEATS; i++) {
+            const Pen* pen = &pens[i % 2];
+            if (m == 0) {
+                FillPerPixel(pen);
+            }
+            else if (m == 1) {
+                FillWithPacks(pen);
+            }
+            else {
+                ScreenFillRectangle(_screen, (PointS){ RASTER_FILL_LEFT, RASTER_FILL_TOP },
+                    (SizeS){ RASTER_FILL_WIDTH, RASTER_FILL_HEIGHT }, pen);
+            }
+        }
+        measures[m].cycles = HostCycles() - start;
+        measures[m].items = (UInt64)RASTER_REPEATS * RASTER_FILL_WIDTH * RASTER_FILL_HEIGHT;
+        frames[m] = (BYTE*)malloc(BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT);
+        memcpy(frames[m], BenchScreenGetPixels(), BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT);
+    }
+
+    PrintMeasures("Fill of a 390x290 unaligned rectangle", "cycles/px", measures, 3);
+    TEST_CHECK(memcmp(frames[0], frames[2], BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT) == 0, "span fill differs from the pixel fill");
+    TEST_CHECK(memcmp(frames[1], frames[2], BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT) == 0, "span fill differs from the pack fill");
+    for (size_t m = 0; m < 3; m++) {
+        free(frames[m]);
+    }
+}
+
+void BenchText() {
+    Pen background = { .color.argb = SCREEN_RGB(0x10, 0x10, 0x40) };
+    Pen pen = { .color.argb = SCREEN_RGB(0xFF, 0xFF, 0xFF) };
+    UInt16 lineHeight = ScreenGetCharMaxHeight();
+    size_t lineCount = sizeof(_textLines) / sizeof(_textLines[0]);
+    RasterMeasure measures[] = {
+        { .name = "per-pixel callback, blend arithmetic" },
+        { .name = "glyph runs and spans, blend tables" },
+    };
+
+    for (size_t line = 0; line < lineCount; line++) {
+        SizeS size;
+        ScreenMeasureString(_textLines[line], &size);
+        DebugAssert(size.width < BENCH_SCREEN_WIDTH - 8);
+    }
+
+    for (size_t m = 0; m < 2; m++) {
+        ScreenClear(_screen, &background);
+        UInt64 start = HostCycles();
+        for (int i = 0; i < RASTER_REPEATS; i++) {
+            for (size_t line = 0; line < lineCount; line++) {
+                PointS point = { 4, (Int16)(4 + (((size_t)i * lineCount + line) % 12) * lineHeight) };
+                if (m == 0) {
+                    DrawStringPerPixel(_textLines[line], point, &pen);
+                }
+                else {
+                    ScreenDrawString(_screen, _textLines[line], point, &pen);
+                }
+            }
+        }
+        measures[m].cycles = HostCycles() - start;
+    }
+
+    // Both paths are measured per covered glyph pixel
+    UInt32 coveredPixels = 0;
+    for (size_t line = 0; line < lineCount; line++) {
+        coveredPixels += DrawStringPerPixel(_textLines[line], (PointS){ 4, 4 }, &pen);
+    }
+    measures[0].items = measures[1].items = (UInt64)coveredPixels * RASTER_REPEATS;
+
+    PrintMeasures("Text lines, opaque pen (per covered glyph pixel)", "cycles/px", measures, 2);
+}
+
+void BenchImage() {
+    BYTE* image = (BYTE*)malloc(BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT * 3);
+    UInt32 state = 7;
+    for (size_t i = 0; i < BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT * 3; i++) {
+        image[i] = (BYTE)HostRandom(&state);
+    }
+    RasterMeasure measures[] = {
+        { .name = "per-pixel callback" },
+        { .name = "spans (ScreenBlitSpan)" },
+    };
+    BYTE* frames[2];
+
+    for (size_t m = 0; m < 2; m++) {
+        UInt64 start = HostCycles();
+        for (int i = 0; i < RASTER_REPEATS; i++) {
+            for (Int16 y = 0; y < BENCH_SCREEN_HEIGHT; y++) {
+                PCBYTE row = &image[(size_t)y * BENCH_SCREEN_WIDTH * 3];
+                if (m == 0) {
+                    for (Int16 x = 0; x < BENCH_SCREEN_WIDTH; x++) {
+                        Pen pen = { .color.argb = SCREEN_RGB(row[x * 3 + 2], row[x * 3 + 1], row[x * 3]) };
+                        ScreenDrawPixel(_screen, (PointS){ x, y }, &pen);
+                    }
+                }
+                else {
+                    ScreenBlitSpan(_screen, y, 0, row, BENCH_SCREEN_WIDTH, ScreenDitherNone);
+                }
+            }
+        }
+        measures[m].cycles = HostCycles() - start;
+        measures[m].items = (UInt64)RASTER_REPEATS * BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT;
+        frames[m] = (BYTE*)malloc(BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT);
+        memcpy(frames[m], BenchScreenGetPixels(), BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT);
+    }
+
+    PrintMeasures("24bit image, 400x300, no dithering", "cycles/px", measures, 2);
+    TEST_CHECK(memcmp(frames[0], frames[1], BENCH_SCREEN_WIDTH * BENCH_SCREEN_HEIGHT) == 0, "blitted image differs from the pixel image");
+    free(frames[0]);
+    free(frames[1]);
+    free(image);
+}
+
+void BenchBlend() {
+    // The explorer alternates two colors (normal and selected entries), so the tables are rebuilt at each change
+    Pen pens[2] = { { .color.argb = SCREEN_RGB(0xFF, 0xFF, 0xFF) }, { .color.argb = SCREEN_RGB(0xFF, 0xD0, 0x20) } };
+    Pen background = { .color.argb = SCREEN_RGB(0x30, 0x50, 0x90) };
+    size_t lineCount = sizeof(_textLines) / sizeof(_textLines[0]);
+    RasterMeasure measures[] = {
+        { .name = "blend arithmetic per pixel" },
+        { .name = "blend tables (ScreenBlendSpan)" },
+    };
+
+    for (size_t m = 0; m < 2; m++) {
+        ScreenClear(_screen, &background);
+        UInt64 pixels = 0;
+        UInt64 start = HostCycles();
+        for (int i = 0; i < RASTER_REPEATS; i++) {
+            for (size_t line = 0; line < lineCount; line++) {
+                PointS point = { 4, (Int16)(20 + line * 24) };
+                pixels += BlendStringRows(_textLines[line], point, &pens[(i + line) % 2], m == 1);
+            }
+        }
+        measures[m].cycles = HostCycles() - start;
+        measures[m].items = pixels;
+    }
+    PrintMeasures("Blended glyph rows, two alternating colors (per glyph box pixel)", "cycles/px", measures, 2);
+
+    // At the coverage levels of the tables the two blends are the same
+    for (BYTE level = 1; level <= BLEND_LEVELS; level++) {
+        for (size_t p = 0; p < 2; p++) {
+            const BYTE* table = GetBlendTable(pens[p].color, level);
+            ARGB8Color color = pens[p].color;
+            color.components.A = (BYTE)((color.components.A * level) / BLEND_LEVELS);
+            UInt32 differences = 0;
+            for (int pixel = 0; pixel < 256; pixel++) {
+                BYTE expected = (BYTE)pixel;
+                BlendPixelArithmetic(&expected, color);
+                differences += table[pixel] != expected;
+            }
+            TEST_CHECK_EQUAL(0, differences, "blend table of level %d differs from the arithmetic", level);
+        }
+    }
+}
+
+void BenchFontMetrics() {
+    size_t nameCount = sizeof(_fileNames) / sizeof(_fileNames[0]);
+    SizeS glyphSizes[sizeof(_fileNames) / sizeof(_fileNames[0])];
+    SizeS tableSizes[sizeof(_fileNames) / sizeof(_fileNames[0])];
+    UInt16 glyphHeight = 0, tableHeight = 0;
+    RasterMeasure measures[] = {
+        { .name = "glyph lookups" },
+        { .name = "precomputed metrics" },
+    };
+
+    // Each redraw of the file list reads the row height and measures every name to clip it
+    UInt64 start = HostCycles();
+    for (int i = 0; i < RASTER_PAGE_REDRAWS; i++) {
+        glyphHeight = GetCharMaxHeightFromGlyphs();
+        for (size_t n = 0; n < nameCount; n++) {
+            MeasureStringFromGlyphs(_fileNames[n], &glyphSizes[n]);
+        }
+    }
+    measures[0].cycles = HostCycles() - start;
+    start = HostCycles();
+    for (int i = 0; i < RASTER_PAGE_REDRAWS; i++) {
+        tableHeight = ScreenGetCharMaxHeight();
+        for (size_t n = 0; n < nameCount; n++) {
+            ScreenMeasureString(_fileNames[n], &tableSizes[n]);
+        }
+    }
+    measures[1].cycles = HostCycles() - start;
+    measures[0].items = measures[1].items = RASTER_PAGE_REDRAWS;
+
+    PrintMeasures("Explorer page of 16 file names: row height and name sizes", "cycles/page", measures, 2);
+    TEST_CHECK_EQUAL(glyphHeight, tableHeight, "max character height");
+    for (size_t n = 0; n < nameCount; n++) {
+        TEST_CHECK(glyphSizes[n].width == tableSizes[n].width && glyphSizes[n].height == tableSizes[n].height,
+            "size of \"%s\"", _fileNames[n]);
+    }
+}
+
+// ##### Public function definitions #####
+
+const ScreenBuffer* BenchScreenCreate() {
+    // 800x600 at 60Hz halved, the default mode of the board
+    VgaVisualizationInfo info = {
+        .FrameSignals = VideoFrame800x600at60Hz,
+        .Scaling = 2,
+        .BitsPerPixel = Bpp8,
+        .mainTimer = &_mainTimer,
+        .hSyncTimer = &_hSyncTimer,
+        .vSyncTimer = &_vSyncTimer,
+        .lineDMA = &_lineDMA,
+    };
+    if (VgaCreateScreenBuffer(&info, &_screen) != VgaErrorNone) {
+        printf("Cannot create the screen buffer\n");
+        abort();
+    }
+    DebugAssert(_screen->screenSize.width == BENCH_SCREEN_WIDTH && _screen->screenSize.height == BENCH_SCREEN_HEIGHT);
+    DebugAssert(_activeScreenBuffer->displayState.Bpp8.linePixels == BENCH_SCREEN_WIDTH);
+    return _screen;
+}
+
+PCBYTE BenchScreenGetPixels() {
+    return _activeScreenBuffer->BackBufferPtr;
+}
+
+void BenchRasterRun() {
+    BenchFill();
+    BenchText();
+    BenchImage();
+    BenchBlend();
+    BenchFontMetrics();
+}
@@ -0,0 +1,59 @@
+/*
+ * Host benchmark of the firmware paths: each unit compares the current path with the one it replaced (see bench.h)
+ *
+ * The raster and bitmap units run before the kernel, the card unit in the kernel with the DMA and the storage task
+ */
+
+#include <bench.h>
+#include <hostboard.h>
+#include <hosttest.h>
+#include <assertion.h>
+#include <sd/sd.h>
+#include <crc/crc7.h>
+#include <crc/crc16.h>
+#include <disk/storage.h>
+#include <fatfs.h>
+#include <stdio.h>
+
+// ##### Private forward declarations #####
+
+static void KernelBenchmarks(void* argument);
+
+// ##### Private function definitions #####
+
+void KernelBenchmarks(void* argument) {
+    SUPPRESS_WARNING(argument);
+    BenchCardRun();
+}
+
+// ##### Public function definitions #####
+
+int main() {
+    HostBoardInitialize();
+    // The frame buffer is the first allocation of the DMA-reachable RAM, like in the firmware
+    const ScreenBuffer* screen = BenchScreenCreate();
+    ScreenInitializeFont();
+
+    if (!BenchCardOpen()) {
+        printf("Cannot create the card\n");
+        return 1;
+    }
+
+    // Same initialization order of main
+    Crc7Initialize();
+    Crc16Initialize();
+    MX_FATFS_Init();
+    TEST_CHECK_EQUAL(SdStatusOk, SdInitialize(GPIOC, GPIO_PIN_1, HostSpiGetHandle()), "driver initialization");
+    StorageInitialize();
+
+    BenchRasterRun();
+    BenchBitmapRun(screen);
+    HostKernelRun(KernelBenchmarks, NULL);
+
+    HostSpiStatistics statistics;
+    HostSpiGetStatistics(&statistics);
+    TEST_CHECK_EQUAL(0, statistics.protocolErrors, "register sequences refused by the peripherals");
+
+    BenchCardClose();
+    return TestResult();
+}
@@ -0,0 +1,182 @@
+/*
+ * Cross-checks the bulk CRC functions against the per-byte ones and against a bitwise reference,
+ * then reports the throughput of each variant in bytes per host cycle
+ */
+
+#include <crc/crc16.h>
+#include <crc/crc7.h>
+#include <hosttest.h>
+#include <string.h>
+
+/// Largest buffer checked for each alignment: a data block with its CRC and a few more bytes
+#define CRC_TEST_MAX_LENGTH 520
+/// Number of data blocks processed by each throughput measure
+#define CRC_BENCH_BLOCKS 20000
+#define CRC_BENCH_BLOCK_SIZE 512
+
+// ##### Private forward declarations #####
+
+/// Bitwise CRC16 (CCITT polynomial, zero initial value), independent from the tables of the module
+static UInt16 ReferenceCrc16(UInt16 crc, PCBYTE data, size_t count);
+/// Bitwise CRC7 of the SD commands, independent from the table of the module
+static BYTE ReferenceCrc7(BYTE crc, PCBYTE data, size_t count);
+static void CheckKnownValues();
+static void CheckCrc16Alignments(PCBYTE data);
+static void CheckCrc7Alignments(PCBYTE data);
+static void ReportThroughput(PCBYTE data);
+
+// ##### Private function definitions #####
+
+UInt16 ReferenceCrc16(UInt16 crc, PCBYTE data, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        crc ^= (UInt16)(data[i] << 8);
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (UInt16)((crc & 0x8000) != 0 ? (crc << 1) ^ 0x1021 : crc << 1);
+        }
+    }
+    return crc;
+}
+
+BYTE ReferenceCrc7(BYTE crc, PCBYTE data, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            BYTE feedback = (BYTE)(((crc >> 6) ^ (data[i] >> bit)) & 0x1);
+            crc = (BYTE)((crc << 1) & 0x7F);
+            if (feedback != 0) {
+                crc ^= 0x09;
+            }
+        }
+    }
+    return crc;
+}
+
+void CheckKnownValues() {
+    // CRC-16/XMODEM check value
+    const char* check = "123456789";
+    TEST_CHECK_EQUAL(0x31C3, Crc16Update(CRC16_ZERO, (PCBYTE)check, strlen(check)), "CRC16 check value");
+
+    // CMD0 and CMD8 frames have well known CRCs (0x95 and 0x87 once shifted with the end bit)
+    const BYTE cmd0[] = { 0x40, 0x00, 0x00, 0x00, 0x00 };
+    const BYTE cmd8[] = { 0x48, 0x00, 0x00, 0x01, 0xAA };
+    TEST_CHECK_EQUAL(0x95, (Crc7Calculate(cmd0, sizeof(cmd0)) << 1) | 1, "CMD0 CRC7");
+    TEST_CHECK_EQUAL(0x87, (Crc7Calculate(cmd8, sizeof(cmd8)) << 1) | 1, "CMD8 CRC7");
+
+    // A block followed by its CRC (big endian) has a zero CRC: this is how the driver verifies the blocks
+    BYTE block[CRC_BENCH_BLOCK_SIZE + 2];
+    for (size_t i = 0; i < CRC_BENCH_BLOCK_SIZE; i++) {
+        block[i] = (BYTE)(i * 7);
+    }
+    UInt16 crc = Crc16Update(CRC16_ZERO, block, CRC_BENCH_BLOCK_SIZE);
+    block[CRC_BENCH_BLOCK_SIZE] = (BYTE)(crc >> 8);
+    block[CRC_BENCH_BLOCK_SIZE + 1] = (BYTE)crc;
+    TEST_CHECK_EQUAL(0, Crc16Update(CRC16_ZERO, block, sizeof(block)), "block followed by its CRC");
+}
+
+void CheckCrc16Alignments(PCBYTE data) {
+    // Every start alignment and every length exercises the head, word and tail loops in all combinations
+    for (size_t offset = 0; offset < 4; offset++) {
+        for (size_t length = 0; length <= CRC_TEST_MAX_LENGTH; length++) {
+            PCBYTE start = data + offset;
+            UInt16 initial = (UInt16)(length * 0x9E37);
+
+            UInt16 perByte = initial;
+            for (size_t i = 0; i < length; i++) {
+                perByte = Crc16Add(perByte, start[i]);
+            }
+            UInt16 bulk = Crc16Update(initial, start, length);
+            UInt16 reference = ReferenceCrc16(initial, start, length);
+
+            TEST_CHECK_EQUAL(reference, perByte, "Crc16Add offset %zu length %zu", offset, length);
+            TEST_CHECK_EQUAL(reference, bulk, "Crc16Update offset %zu length %zu", offset, length);
+        }
+    }
+}
+
+void CheckCrc7Alignments(PCBYTE data) {
+    for (size_t offset = 0; offset < 4; offset++) {
+        for (size_t length = 0; length <= CRC_TEST_MAX_LENGTH; length++) {
+            PCBYTE start = data + offset;
+            BYTE initial = (BYTE)(length & 0x7F);
+
+            BYTE perByte = initial;
+            for (size_t i = 0; i < length; i++) {
+                perByte = Crc7Add(perByte, start[i]);
+            }
+            BYTE bulk = Crc7Update(initial, start, length);
+            BYTE reference = ReferenceCrc7(initial, start, length);
+
+            TEST_CHECK_EQUAL(reference, perByte, "Crc7Add offset %zu length %zu", offset, length);
+            TEST_CHECK_EQUAL(reference, bulk, "Crc7Update offset %zu length %zu", offset, length);
+            if (length > 0) {
+                TEST_CHECK_EQUAL(ReferenceCrc7(CRC7_ZERO, start, length), Crc7Calculate(start, length),
+                    "Crc7Calculate offset %zu length %zu", offset, length);
+            }
+        }
+    }
+}
+
+void ReportThroughput(PCBYTE data) {
+    const UInt64 totalBytes = (UInt64)CRC_BENCH_BLOCKS * CRC_BENCH_BLOCK_SIZE;
+
+    // The result is accumulated and printed, so the compiler cannot drop the loops
+    UInt32 sink = 0;
+    UInt64 start = HostCycles();
+    for (int block = 0; block < CRC_BENCH_BLOCKS; block++) {
+        UInt16 crc = CRC16_ZERO;
+        for (size_t i = 0; i < CRC_BENCH_BLOCK_SIZE; i++) {
+            crc = Crc16Add(crc, data[i]);
+        }
+        sink += crc;
+    }
+    UInt64 perByteCycles = HostCycles() - start;
+
+    start = HostCycles();
+    for (int block = 0; block < CRC_BENCH_BLOCKS; block++) {
+        sink += Crc16Update(CRC16_ZERO, data, CRC_BENCH_BLOCK_SIZE);
+    }
+    UInt64 bulkCycles = HostCycles() - start;
+
+    start = HostCycles();
+    for (int block = 0; block < CRC_BENCH_BLOCKS; block++) {
+        BYTE crc = CRC7_ZERO;
+        for (size_t i = 0; i < CRC_BENCH_BLOCK_SIZE; i++) {
+            crc = Crc7Add(crc, data[i]);
+        }
+        sink += crc;
+    }
+    UInt64 crc7PerByteCycles = HostCycles() - start;
+
+    start = HostCycles();
+    for (int block = 0; block < CRC_BENCH_BLOCKS; block++) {
+        sink += Crc7Update(CRC7_ZERO, data, CRC_BENCH_BLOCK_SIZE);
+    }
+    UInt64 crc7BulkCycles = HostCycles() - start;
+
+    printf("Throughput over %d blocks of %d bytes (host cycles, checksum %" PRIu32 "):\n", CRC_BENCH_BLOCKS,
+        CRC_BENCH_BLOCK_SIZE, sink);
+    printf("  Crc16Add    %.3f bytes/cycle\n", (double)totalBytes / (double)perByteCycles);
+    printf("  Crc16Update %.3f bytes/cycle (%.2fx)\n", (double)totalBytes / (double)bulkCycles,
+        (double)perByteCycles / (double)bulkCycles);
+    printf("  Crc7Add     %.3f bytes/cycle\n", (double)totalBytes / (double)crc7PerByteCycles);
+    printf("  Crc7Update  %.3f bytes/cycle (%.2fx)\n", (double)totalBytes / (double)crc7BulkCycles,
+        (double)crc7PerByteCycles / (double)crc7BulkCycles);
+}
+
+int main() {
+    Crc16Initialize();
+    Crc7Initialize();
+
+    // Word aligned buffer, so that the offsets select the alignment of the data
+    static UInt32 words[(CRC_TEST_MAX_LENGTH + 8) / 4];
+    BYTE* data = (BYTE*)words;
+    UInt32 seed = 0x13572468;
+    for (size_t i = 0; i < sizeof(words); i++) {
+        data[i] = (BYTE)HostRandom(&seed);
+    }
+
+    CheckKnownValues();
+    CheckCrc16Alignments(data);
+    CheckCrc7Alignments(data);
+    ReportThroughput(data);
+    return TestResult();
+}
@@ -0,0 +1,216 @@
+/*
+ * Drives the SD clock governor with scripted read outcomes and with a fake card that fails the reads above
+ * its reliable bus speed, checking the fallback, the probes and the doubling of the probe interval
+ */
+
+#include <sd/clockgovernor.h>
+#include <hosttest.h>
+
+/// Same values of clockgovernor.c: the test checks the documented behavior, so it does not include the module
+#define GOVERNOR_WINDOW 64
+#define GOVERNOR_PROBE_INTERVAL 1024
+#define GOVERNOR_MAX_PROBE_INTERVAL (GOVERNOR_PROBE_INTERVAL * 32)
+/// SPI2 is on the 30MHz APB1 bus of the board
+#define BUS_FREQUENCY 30000000U
+
+/// Fake error source: a card that corrupts one read out of errorPeriod when the bus is faster than it can sustain
+typedef struct _FakeCard {
+    /// Slowest prescaler that causes errors. Prescalers above it are always clean
+    BYTE unreliablePrescaler;
+    /// One read out of errorPeriod fails at an unreliable rate
+    UInt32 errorPeriod;
+    /// Reads performed by the card
+    UInt32 reads;
+} FakeCard;
+
+// ##### Private forward declarations #####
+
+/// Reports the same outcome a number of times
+/// @return Number of reports that changed the prescaler
+static UInt32 ReportReads(SdClockGovernor* governor, BOOL failed, UInt32 count);
+/// Reads from the fake card with the current governor rate and reports the outcome
+/// @return True if the prescaler has changed
+static BOOL ReadFakeCard(SdClockGovernor* governor, FakeCard* card);
+static void CheckInitialization();
+static void CheckFallback();
+static void CheckWindow();
+static void CheckProbe();
+static void CheckProbeIntervalLimit();
+static void CheckSlowestRate();
+static void CheckFakeCard();
+
+// ##### Private function definitions #####
+
+UInt32 ReportReads(SdClockGovernor* governor, BOOL failed, UInt32 count) {
+    UInt32 changes = 0;
+    for (UInt32 i = 0; i < count; i++) {
+        if (SdClockGovernorReportRead(governor, failed)) {
+            changes++;
+        }
+    }
+    return changes;
+}
+
+BOOL ReadFakeCard(SdClockGovernor* governor, FakeCard* card) {
+    card->reads++;
+    BOOL failed = governor->prescaler <= card->unreliablePrescaler && (card->reads % card->errorPeriod) == 0;
+    return SdClockGovernorReportRead(governor, failed);
+}
+
+void CheckInitialization() {
+    SdClockGovernor governor;
+
+    // 15MHz (prescaler 0, divide by 2) is within a 25MHz card
+    SdClockGovernorInitialize(&governor, BUS_FREQUENCY, 25000000U);
+    TEST_CHECK_EQUAL(0, governor.prescaler, "25MHz card");
+    TEST_CHECK_EQUAL(0, governor.fastestPrescaler, "25MHz card");
+    TEST_CHECK(!governor.probing, "a new governor is not probing");
+
+    // 15MHz exceeds 12.5MHz: the next step is 7.5MHz
+    SdClockGovernorInitialize(&governor, BUS_FREQUENCY, 12500000U);
+    TEST_CHECK_EQUAL(1, governor.prescaler, "12.5MHz card");
+
+    // An exact match is allowed
+    SdClockGovernorInitialize(&governor, BUS_FREQUENCY, 7500000U);
+    TEST_CHECK_EQUAL(1, governor.prescaler, "7.5MHz card");
+
+    // Nothing is slow enough: the slowest rate is used anyway
+    SdClockGovernorInitialize(&governor, BUS_FREQUENCY, 1000U);
+    TEST_CHECK_EQUAL(SD_GOVERNOR_SLOWEST_PRESCALER, governor.prescaler, "1kHz card");
+}
+
+void CheckFallback() {
+    SdClockGovernor governor;
+    SdClockGovernorInitialize(&governor, BUS_FREQUENCY, 25000000U);
+
+    // A single error is tolerated
+    TEST_CHECK(!SdClockGovernorReportRead(&governor, true), "first error");
+    TEST_CHECK_EQUAL(0, governor.prescaler, "after the first error");
+
+    // The second error of the window slows the clock down
+    TEST_CHECK(SdClockGovernorReportRead(&governor, true), "second error");
+    TEST_CHECK_EQUAL(1, governor.prescaler, "after the second error");
+    TEST_CHECK(!governor.probing, "a fallback is not a probe");
+
+    // The new rate starts with a clean window
+    TEST_CHECK(!SdClockGovernorReportRead(&governor, true), "first error at the new rate");
+    TEST_CHECK(SdClockGovernorReportRead(&governor, true), "second error at the new rate");
+    TEST_CHECK_EQUAL(2, governor.prescaler, "after the second fallback");
+}
+
+void CheckWindow() {
+    SdClockGovernor governor;
+    SdClockGovernorInitialize(&governor, BUS_FREQUENCY, 25000000U);
+
+    // Errors in two different windows do not add up
+    TEST_CHECK(!SdClockGovernorReportRead(&governor, true), "error in the first window");
+    TEST_CHECK_EQUAL(0, ReportReads(&governor, false, GOVERNOR_WINDOW - 1), "end of the first window");
+    TEST_CHECK(!SdClockGovernorReportRead(&governor, true), "error in the second window");
+    TEST_CHECK_EQUAL(0, governor.prescaler, "errors in different windows");
+
+    // But two errors far apart in the same window do
+    TEST_CHECK_EQUAL(0, ReportReads(&governor, false, GOVERNOR_WINDOW - 3), "clean reads of the second window");
+    TEST_CHECK(SdClockGovernorReportRead(&governor, true), "last read of the second window");
+    TEST_CHECK_EQUAL(1, governor.prescaler, "errors in the same window");
+}
+
+void CheckProbe() {
+    SdClockGovernor governor;
+    SdClockGovernorInitialize(&governor, BUS_FREQUENCY, 25000000U);
+    ReportReads(&governor, true, 2);
+    TEST_CHECK_EQUAL(1, governor.prescaler, "fallback before the probe");
+
+    // The fastest rate is probed again after the probe interval
+    TEST_CHECK_EQUAL(0, ReportReads(&governor, false, GOVERNOR_PROBE_INTERVAL - 1), "clean reads before the probe");
+    TEST_CHECK(SdClockGovernorReportRead(&governor, false), "probe");
+    TEST_CHECK_EQUAL(0, governor.prescaler, "probed rate");
+    TEST_CHECK(governor.probing, "probing");
+
+    // A single error while probing falls back immediately and doubles the interval
+    TEST_CHECK(SdClockGovernorReportRead(&governor, true), "failed probe");
+    TEST_CHECK_EQUAL(1, governor.prescaler, "after the failed probe");
+    TEST_CHECK(!governor.probing, "after the failed probe");
+    TEST_CHECK_EQUAL(GOVERNOR_PROBE_INTERVAL * 2, governor.probeInterval, "interval after the failed probe");
+
+    // The next probe waits for the doubled interval
+    TEST_CHECK_EQUAL(0, ReportReads(&governor, false, (GOVERNOR_PROBE_INTERVAL * 2) - 1), "doubled interval");
+    TEST_CHECK(SdClockGovernorReportRead(&governor, false), "second probe");
+    TEST_CHECK(governor.probing, "second probe");
+
+    // A whole clean window confirms the probed rate: a later single error is tolerated again
+    TEST_CHECK_EQUAL(0, ReportReads(&governor, false, GOVERNOR_WINDOW), "confirmation window");
+    TEST_CHECK(!governor.probing, "confirmed rate");
+    TEST_CHECK(!SdClockGovernorReportRead(&governor, true), "single error at the confirmed rate");
+    TEST_CHECK_EQUAL(0, governor.prescaler, "single error at the confirmed rate");
+
+    // The fastest rate is never exceeded
+    TEST_CHECK_EQUAL(0, ReportReads(&governor, false, GOVERNOR_MAX_PROBE_INTERVAL * 2), "clean reads at the fastest rate");
+    TEST_CHECK_EQUAL(0, governor.prescaler, "fastest rate");
+}
+
+void CheckProbeIntervalLimit() {
+    SdClockGovernor governor;
+    SdClockGovernorInitialize(&governor, BUS_FREQUENCY, 25000000U);
+    ReportReads(&governor, true, 2);
+
+    // Each failed probe doubles the interval, up to the limit
+    UInt32 expectedInterval = GOVERNOR_PROBE_INTERVAL;
+    for (int probe = 0; probe < 8; probe++) {
+        TEST_CHECK_EQUAL(1, ReportReads(&governor, false, governor.probeInterval), "probe %d", probe);
+        TEST_CHECK(governor.probing, "probe %d", probe);
+        TEST_CHECK(SdClockGovernorReportRead(&governor, true), "failed probe %d", probe);
+
+        expectedInterval = expectedInterval * 2 > GOVERNOR_MAX_PROBE_INTERVAL ? GOVERNOR_MAX_PROBE_INTERVAL : expectedInterval * 2;
+        TEST_CHECK_EQUAL(expectedInterval, governor.probeInterval, "interval after the failed probe %d", probe);
+        TEST_CHECK_EQUAL(1, governor.prescaler, "rate after the failed probe %d", probe);
+    }
+}
+
+void CheckSlowestRate() {
+    SdClockGovernor governor;
+    SdClockGovernorInitialize(&governor, BUS_FREQUENCY, 1000U);
+
+    // Errors at the slowest rate are not caused by the bus: nothing changes
+    TEST_CHECK_EQUAL(0, ReportReads(&governor, true, GOVERNOR_WINDOW * 4), "errors at the slowest rate");
+    TEST_CHECK_EQUAL(SD_GOVERNOR_SLOWEST_PRESCALER, governor.prescaler, "errors at the slowest rate");
+}
+
+void CheckFakeCard() {
+    // The card sustains 7.5MHz (prescaler 1) but fails one read out of 16 at 15MHz
+    FakeCard card = { .unreliablePrescaler = 0, .errorPeriod = 16, .reads = 0 };
+    SdClockGovernor governor;
+    SdClockGovernorInitialize(&governor, BUS_FREQUENCY, 25000000U);
+
+    UInt32 probes = 0;
+    UInt32 fastReads = 0;
+    const UInt32 totalReads = 200000;
+    for (UInt32 i = 0; i < totalReads; i++) {
+        BOOL wasProbing = governor.probing;
+        if (ReadFakeCard(&governor, &card) && governor.probing && !wasProbing) {
+            probes++;
+        }
+        if (governor.prescaler == 0) {
+            fastReads++;
+        }
+        TEST_CHECK(governor.prescaler <= 1, "the governor never goes below the reliable rate (read %" PRIu32 ")", i);
+    }
+
+    // The probe intervals grow 1024, 2048, ... 32768: the governor settles at the reliable rate and spends
+    // only a small fraction of the reads probing the unreliable one
+    TEST_CHECK_EQUAL(1, governor.prescaler, "settled rate");
+    TEST_CHECK(probes >= 6 && probes <= 12, "probes %" PRIu32, probes);
+    TEST_CHECK(fastReads < totalReads / 100, "reads at the unreliable rate %" PRIu32, fastReads);
+    printf("Fake card: %" PRIu32 " probes, %" PRIu32 " of %" PRIu32 " reads at the unreliable rate\n", probes,
+        fastReads, totalReads);
+}
+
+int main() {
+    CheckInitialization();
+    CheckFallback();
+    CheckWindow();
+    CheckProbe();
+    CheckProbeIntervalLimit();
+    CheckSlowestRate();
+    CheckFakeCard();
+    return TestResult();
+}
@@ -0,0 +1,189 @@
+/*
+ * Measures the SD driver against the emulated card: single block reads versus multiple block reads of growing
+ * length, polled (before the kernel starts) and with the DMA, and multiple block reads with corrupted blocks
+ *
+ * The commands per second and the MB/s follow the emulated bus time: the SPI clock, the card access time before
+ * the first block, the gap between the blocks and the busy time after the stop command. The CPU time per sector is
+ * the emulated time when the CPU is not idle: polling the SPI registers keeps it busy, while it is free during the
+ * DMA transfers. The emulated instructions take no time, so it is a lower bound of the board CPU time. The host
+ * time per sector is the cost of the emulation (mostly the trapped register accesses), not a board figure
+ */
+
+#include <sdcardemulator.h>
+#include <hostboard.h>
+#include <hostfat.h>
+#include <hosttest.h>
+#include <assertion.h>
+#include <sd/sd.h>
+#include <crc/crc7.h>
+#include <crc/crc16.h>
+#include <time.h>
+
+#define BENCH_IMAGE_PATH "sd_bench.img"
+#define BENCH_IMAGE_SECTORS HOST_FAT_MIN_SECTORS
+#define BENCH_SECTOR_SIZE 512
+/// Sectors read by each measure
+#define BENCH_SECTORS 128
+#define BENCH_MAX_SECTORS_PER_READ 32
+/// Probability of a corrupted block in the fault measure, in 1/65536 units (1 block out of 64)
+#define BENCH_CORRUPTION_RATE 1024
+
+/// Measure of a read pattern
+typedef struct _BenchMeasure {
+    const char* name;
+    /// Sectors of each read, 1 for the single block reads
+    UInt32 sectorsPerRead;
+    /// Rate of the corrupted blocks
+    UInt32 corruptionRate;
+    /// Results
+    UInt32 commands;
+    UInt32 failedReads;
+    UInt32 sectors;
+    UInt64 emulatedTime;
+    /// Emulated time with the CPU busy
+    UInt64 cpuTime;
+    double hostSeconds;
+} BenchMeasure;
+
+// ##### Private forward declarations #####
+
+/// Returns the CPU time used by the process, in seconds
+static double GetHostCpuTime();
+/// Reads BENCH_SECTORS sectors with the pattern of the measure
+static void RunMeasure(BenchMeasure* measure);
+static void PrintMeasure(const BenchMeasure* measure);
+static void KernelMeasures(void* argument);
+
+// ##### Private fields #####
+
+static SdCardEmulator _card;
+static BYTE _buffer[BENCH_MAX_SECTORS_PER_READ * BENCH_SECTOR_SIZE];
+
+static BenchMeasure _polledMeasures[] = {
+    { .name = "polled, single block", .sectorsPerRead = 1 },
+    { .name = "polled, multiple x8", .sectorsPerRead = 8 },
+};
+static BenchMeasure _dmaMeasures[] = {
+    { .name = "DMA, single block", .sectorsPerRead = 1 },
+    { .name = "DMA, multiple x2", .sectorsPerRead = 2 },
+    { .name = "DMA, multiple x8", .sectorsPerRead = 8 },
+    { .name = "DMA, multiple x32", .sectorsPerRead = 32 },
+    { .name = "DMA, x32, 1/64 corrupted", .sectorsPerRead = 32, .corruptionRate = BENCH_CORRUPTION_RATE },
+};
+
+// ##### Private function definitions #####
+
+double GetHostCpuTime() {
+    struct timespec time;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &time);
+    return (double)time.tv_sec + (double)time.tv_nsec * 1e-9;
+}
+
+void RunMeasure(BenchMeasure* measure) {
+    SdCardEmulatorSetCorruptionRate(&_card, measure->corruptionRate, 12345);
+    SdStatistics sdBefore;
+    SdGetStatistics(&sdBefore);
+    UInt64 timeBefore = HostTimeNow();
+    UInt64 idleBefore = HostTimeIdle();
+    double hostBefore = GetHostCpuTime();
+
+    // Consecutive sectors, each read starting where the previous one ended
+    UInt32 sector = 1000;
+    for (UInt32 read = 0; read < BENCH_SECTORS / measure->sectorsPerRead; read++) {
+        SdStatus status = measure->sectorsPerRead == 1 ? SdReadSector(_buffer, sector) :
+            SdReadSectors(_buffer, sector, measure->sectorsPerRead);
+        if (status != SdStatusOk) {
+            measure->failedReads++;
+        }
+        sector += measure->sectorsPerRead;
+    }
+
+    measure->hostSeconds = GetHostCpuTime() - hostBefore;
+    measure->emulatedTime = HostTimeNow() - timeBefore;
+    measure->cpuTime = measure->emulatedTime - (HostTimeIdle() - idleBefore);
+    SdStatistics sdAfter;
+    SdGetStatistics(&sdAfter);
+    measure->commands = sdAfter.commands - sdBefore.commands;
+    measure->sectors = sdAfter.sectors - sdBefore.sectors;
+    SdCardEmulatorSetCorruptionRate(&_card, 0, 1);
+
+    // Without faults every sector must be read
+    if (measure->corruptionRate == 0) {
+        TEST_CHECK_EQUAL(0, measure->failedReads, "%s: failed reads", measure->name);
+        TEST_CHECK_EQUAL(BENCH_SECTORS, measure->sectors, "%s: sectors read", measure->name);
+    }
+}
+
+void PrintMeasure(const BenchMeasure* measure) {
+    double emulatedSeconds = (double)measure->emulatedTime / (double)HOST_TIME_S;
+    printf("  %-26s %8.0f %8.3f %8.1f %8.1f %8.0f %6" PRIu32 "\n", measure->name,
+        (double)measure->commands / emulatedSeconds,
+        ((double)measure->sectors * BENCH_SECTOR_SIZE) / (emulatedSeconds * 1e6),
+        ((double)measure->emulatedTime / (double)HOST_TIME_US) / (double)BENCH_SECTORS,
+        ((double)measure->cpuTime / (double)HOST_TIME_US) / (double)BENCH_SECTORS,
+        measure->hostSeconds * 1e6 / (double)BENCH_SECTORS,
+        measure->failedReads);
+}
+
+void KernelMeasures(void* argument) {
+    SUPPRESS_WARNING(argument);
+    for (size_t i = 0; i < sizeof(_dmaMeasures) / sizeof(_dmaMeasures[0]); i++) {
+        RunMeasure(&_dmaMeasures[i]);
+    }
+}
+
+// ##### Public function definitions #####
+
+int main() {
+    HostBoardInitialize();
+
+    // The content of the card does not matter, an empty volume is enough
+    if (!HostFatBuildImage(BENCH_IMAGE_PATH, BENCH_IMAGE_SECTORS, NULL, 0, 0) ||
+        !SdCardEmulatorOpen(&_card, BENCH_IMAGE_PATH, NULL)) {
+        printf("Cannot create the card\n");
+        return 1;
+    }
+
+    Crc7Initialize();
+    Crc16Initialize();
+    TEST_CHECK_EQUAL(SdStatusOk, SdInitialize(GPIOC, GPIO_PIN_1, HostSpiGetHandle()), "driver initialization");
+    TEST_CHECK_EQUAL(SdStatusOk, SdPerformPowerCycle(), "power cycle");
+    TEST_CHECK_EQUAL(SdStatusOk, SdTryConnect(), "connection");
+
+    for (size_t i = 0; i < sizeof(_polledMeasures) / sizeof(_polledMeasures[0]); i++) {
+        RunMeasure(&_polledMeasures[i]);
+    }
+    HostKernelRun(KernelMeasures, NULL);
+
+    SdCardTiming timing = _card.timing;
+    printf("\nReads of %d sectors, SPI at 15MHz, card access %llu us, block gap %llu us, stop busy %llu us\n",
+        BENCH_SECTORS, (unsigned long long)(timing.readAccessTime / HOST_TIME_US),
+        (unsigned long long)(timing.blockGapTime / HOST_TIME_US), (unsigned long long)(timing.stopBusyTime / HOST_TIME_US));
+    printf("Times per sector: elapsed, CPU busy (emulated) and emulation cost (host CPU)\n");
+    printf("  %-26s %8s %8s %8s %8s %8s %6s\n", "", "cmds/s", "MB/s", "us", "CPU us", "host us", "failed");
+    for (size_t i = 0; i < sizeof(_polledMeasures) / sizeof(_polledMeasures[0]); i++) {
+        PrintMeasure(&_polledMeasures[i]);
+    }
+    for (size_t i = 0; i < sizeof(_dmaMeasures) / sizeof(_dmaMeasures[0]); i++) {
+        PrintMeasure(&_dmaMeasures[i]);
+    }
+
+    // The access time is paid once per multiple block read, the other blocks only wait the gap
+    UInt64 saving = (BENCH_SECTORS / 2) * (timing.readAccessTime - timing.blockGapTime);
+    TEST_CHECK(_dmaMeasures[3].emulatedTime + saving < _dmaMeasures[0].emulatedTime,
+        "multiple block reads are not faster than the single block ones");
+    // The DMA frees the CPU while the blocks are clocked
+    TEST_CHECK(_dmaMeasures[2].cpuTime < _polledMeasures[1].cpuTime / 2, "the DMA does not free the CPU");
+    TEST_CHECK(_dmaMeasures[4].failedReads > 0, "no fault was injected");
+
+    SdStatistics sdStatistics;
+    SdGetStatistics(&sdStatistics);
+    printf("Clock governor changes (after the corrupted blocks): %" PRIu32 "\n", sdStatistics.clockChanges);
+
+    HostSpiStatistics statistics;
+    HostSpiGetStatistics(&statistics);
+    TEST_CHECK_EQUAL(0, statistics.protocolErrors, "register sequences refused by the peripherals");
+
+    SdCardEmulatorClose(&_card);
+    return TestResult();
+}
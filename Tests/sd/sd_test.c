@@ -0,0 +1,284 @@
+/*
+ * Runs the SD driver, the storage task, the read-ahead layer and FatFs, unmodified, against the emulated card
+ *
+ * The card serves a FAT16 image built by the test through the trapped SPI2 and DMA1 registers. The reads are
+ * compared with the image, polled before the kernel starts and with the DMA afterwards (into the main RAM and
+ * through the bounce buffers for the core coupled memory). Faults injected on the wire must be reported with
+ * their status, and the next read must succeed: a multiple block read interrupted by a corrupted block is
+ * always closed by the stop command. The register sequences are checked by the SPI and DMA models
+ */
+
+#include <sdcardemulator.h>
+#include <hostboard.h>
+#include <hostfat.h>
+#include <hosttest.h>
+#include <assertion.h>
+#include <sd/sd.h>
+#include <crc/crc7.h>
+#include <crc/crc16.h>
+#include <disk/storage.h>
+#include <disk/readahead.h>
+#include <fatfs.h>
+#include <ram.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_IMAGE_PATH "sd_test.img"
+#define TEST_IMAGE_SECTORS HOST_FAT_MIN_SECTORS
+#define TEST_FILE_NAME "DATA.BIN"
+/// Not a multiple of the cluster size, so that the last cluster is partially used
+#define TEST_FILE_SIZE (300 * 1024 + 123)
+#define TEST_SECTOR_SIZE 512
+#define TEST_MAX_SECTORS 32
+
+// ##### Private forward declarations #####
+
+/// Returns the content of a sector of the image
+static PCBYTE GetImageSector(UInt32 sector);
+/// Checks that a buffer contains the image sectors
+static void CheckSectors(PCBYTE buffer, UInt32 sector, UInt32 count, const char* path);
+static void CheckConnection();
+static void CheckPolledReads();
+/// Runs in the kernel: DMA reads, fault injection and FatFs
+static void KernelChecks(void* argument);
+static void CheckDMAReads();
+static void CheckCoreCoupledReads();
+static void CheckCorruptedBlocks();
+static void CheckCommandErrors();
+static void CheckAccessTime();
+static void CheckFileSystem();
+
+// ##### Private fields #####
+
+static SdCardEmulator _card;
+static BYTE* _fileData;
+/// Destination of the DMA reads in the main RAM
+static BYTE _buffer[TEST_MAX_SECTORS * TEST_SECTOR_SIZE];
+
+// ##### Private function definitions #####
+
+PCBYTE GetImageSector(UInt32 sector) {
+    return _card.image + (size_t)sector * TEST_SECTOR_SIZE;
+}
+
+void CheckSectors(PCBYTE buffer, UInt32 sector, UInt32 count, const char* path) {
+    TEST_CHECK(memcmp(buffer, GetImageSector(sector), (size_t)count * TEST_SECTOR_SIZE) == 0,
+        "%s: sectors %u-%u differ from the image", path, sector, sector + count - 1);
+}
+
+void CheckConnection() {
+    TEST_CHECK_EQUAL(SdStatusOk, SdPerformPowerCycle(), "power cycle");
+    TEST_CHECK_EQUAL(SdStatusOk, SdTryConnect(), "connection");
+
+    PCSDDescription description = SdGetCardDescription();
+    TEST_CHECK_EQUAL(SdVer2p0OrLater, description->Version, "card version");
+    TEST_CHECK_EQUAL(SdCapacityExtended, description->Capacity, "card capacity");
+    TEST_CHECK_EQUAL(SDAddressingModeSector, description->AddressingMode, "addressing mode");
+    TEST_CHECK_EQUAL(TEST_IMAGE_SECTORS, description->SectorCount, "sector count from the CSD");
+    TEST_CHECK_EQUAL(TEST_SECTOR_SIZE, description->BlockLen, "block length from the CSD");
+    TEST_CHECK(_card.crcEnabled, "the command CRC is enabled by the driver");
+    TEST_CHECK(!_card.idle, "the card left the idle state");
+    TEST_CHECK_EQUAL(0, _card.statistics.commandCrcErrors, "command CRC errors during the connection");
+}
+
+void CheckPolledReads() {
+    HostSpiStatistics before;
+    HostSpiGetStatistics(&before);
+
+    // Before the kernel starts every byte is polled, also by the storage layer
+    TEST_CHECK_EQUAL(SdStatusOk, SdReadSector(_buffer, 0), "polled single block read");
+    CheckSectors(_buffer, 0, 1, "polled single block");
+    TEST_CHECK_EQUAL(SdStatusOk, StorageRead(_buffer, 100, 7), "polled multiple block read");
+    CheckSectors(_buffer, 100, 7, "polled multiple block");
+
+    HostSpiStatistics after;
+    HostSpiGetStatistics(&after);
+    TEST_CHECK_EQUAL(0, after.dmaTransfers - before.dmaTransfers, "no DMA before the kernel starts");
+}
+
+void KernelChecks(void* argument) {
+    SUPPRESS_WARNING(argument);
+    CheckDMAReads();
+    CheckCoreCoupledReads();
+    CheckCorruptedBlocks();
+    CheckCommandErrors();
+    CheckAccessTime();
+    CheckFileSystem();
+}
+
+void CheckDMAReads() {
+    HostSpiStatistics before;
+    HostSpiGetStatistics(&before);
+
+    TEST_CHECK_EQUAL(SdStatusOk, SdReadSector(_buffer, 1), "DMA single block read");
+    CheckSectors(_buffer, 1, 1, "DMA single block");
+    TEST_CHECK_EQUAL(SdStatusOk, SdReadSectors(_buffer, 200, TEST_MAX_SECTORS), "DMA multiple block read");
+    CheckSectors(_buffer, 200, TEST_MAX_SECTORS, "DMA multiple block");
+
+    // Through the storage task, from the last sector of the card
+    TEST_CHECK_EQUAL(SdStatusOk, StorageRead(_buffer, TEST_IMAGE_SECTORS - 3, 3), "storage read at the end");
+    CheckSectors(_buffer, TEST_IMAGE_SECTORS - 3, 3, "storage read at the end");
+
+    // A stream split in several steps, like the read-ahead prefetches
+    TEST_CHECK_EQUAL(SdStatusOk, SdReadSectorsBegin(300), "stream begin");
+    TEST_CHECK_EQUAL(SdStatusOk, SdReadSectorsNext(_buffer, 3), "stream first step");
+    TEST_CHECK_EQUAL(SdStatusOk, SdReadSectorsNext(_buffer + 3 * TEST_SECTOR_SIZE, 5), "stream second step");
+    TEST_CHECK_EQUAL(SdStatusOk, SdReadSectorsEnd(), "stream end");
+    CheckSectors(_buffer, 300, 8, "stream");
+
+    HostSpiStatistics after;
+    HostSpiGetStatistics(&after);
+    TEST_CHECK_EQUAL(1 + TEST_MAX_SECTORS + 3 + 8, after.dmaTransfers - before.dmaTransfers, "one DMA transfer per block");
+}
+
+void CheckCoreCoupledReads() {
+    // The FatFs window and the read-ahead window are in the core coupled memory on the board
+    BYTE* coreCoupled = (BYTE*)(uintptr_t)HOST_CCMRAM_START;
+    TEST_CHECK_EQUAL(SdStatusOk, SdReadSector(coreCoupled, 5), "single block read into the CCM");
+    CheckSectors(coreCoupled, 5, 1, "single block into the CCM");
+    TEST_CHECK_EQUAL(SdStatusOk, SdReadSectors(coreCoupled, 400, 9), "multiple block read into the CCM");
+    CheckSectors(coreCoupled, 400, 9, "multiple block into the CCM");
+}
+
+void CheckCorruptedBlocks() {
+    UInt32 corruptedBefore = _card.statistics.corruptedBlocks;
+
+    SdCardEmulatorCorruptBlock(&_card, 0);
+    TEST_CHECK_EQUAL(SdStatusReadCorrupted, SdReadSector(_buffer, 10), "corrupted single block");
+    TEST_CHECK_EQUAL(SdStatusOk, SdReadSector(_buffer, 10), "single block after the corrupted one");
+    CheckSectors(_buffer, 10, 1, "single block after the corrupted one");
+
+    // The corrupted block is detected while the DMA receives the next one
+    SdCardEmulatorCorruptBlock(&_card, 3);
+    TEST_CHECK_EQUAL(SdStatusReadCorrupted, SdReadSectors(_buffer, 500, 8), "corrupted block in a stream");
+    TEST_CHECK_EQUAL(SdCardOutputIdle, _card.output, "the stop command ended the stream");
+    TEST_CHECK_EQUAL(SdStatusOk, SdReadSectors(_buffer, 500, 8), "stream after the corrupted one");
+    CheckSectors(_buffer, 500, 8, "stream after the corrupted one");
+
+    // Blocks received in the bounce buffers are verified the same way
+    SdCardEmulatorCorruptBlock(&_card, 1);
+    TEST_CHECK_EQUAL(SdStatusReadCorrupted, SdReadSectors((BYTE*)(uintptr_t)HOST_CCMRAM_START + 0x8000, 600, 4),
+        "corrupted block through the bounce buffers");
+
+    TEST_CHECK_EQUAL(3, _card.statistics.corruptedBlocks - corruptedBefore, "injected faults");
+    TEST_CHECK_EQUAL(0, _card.statistics.unexpectedCommands, "commands sent in the middle of the data");
+}
+
+void CheckCommandErrors() {
+    UInt32 crcErrorsBefore = _card.statistics.commandCrcErrors;
+
+    SdCardEmulatorCorruptCommand(&_card, 0);
+    TEST_CHECK_EQUAL(SdStatusCRCError, SdReadSector(_buffer, 20), "corrupted read command");
+    TEST_CHECK_EQUAL(SdStatusOk, SdReadSector(_buffer, 20), "read after the corrupted command");
+    CheckSectors(_buffer, 20, 1, "read after the corrupted command");
+    TEST_CHECK_EQUAL(1, _card.statistics.commandCrcErrors - crcErrorsBefore, "command CRC errors");
+
+    TEST_CHECK_EQUAL(SdStatusParameterOutOfRange, SdReadSector(_buffer, TEST_IMAGE_SECTORS), "read past the end");
+    TEST_CHECK_EQUAL(SdStatusOk, SdReadSector(_buffer, 21), "read after the out of range one");
+    CheckSectors(_buffer, 21, 1, "read after the out of range one");
+}
+
+void CheckAccessTime() {
+    // Single block reads wait the access time of each block, a stream only the gap between the blocks
+    UInt64 start = HostTimeNow();
+    TEST_CHECK_EQUAL(SdStatusOk, SdReadSector(_buffer, 30), "timed single block read");
+    UInt64 singleTime = HostTimeNow() - start;
+    TEST_CHECK(singleTime >= _card.timing.readAccessTime, "single block read in %llu ns",
+        (unsigned long long)(singleTime / HOST_TIME_NS));
+
+    start = HostTimeNow();
+    TEST_CHECK_EQUAL(SdStatusOk, SdReadSectors(_buffer, 30, 16), "timed multiple block read");
+    UInt64 streamTime = HostTimeNow() - start;
+    TEST_CHECK(streamTime >= _card.timing.readAccessTime + 15 * _card.timing.blockGapTime && streamTime < 16 * singleTime,
+        "16 block stream in %llu ns, single block in %llu ns", (unsigned long long)(streamTime / HOST_TIME_NS),
+        (unsigned long long)(singleTime / HOST_TIME_NS));
+}
+
+void CheckFileSystem() {
+    TEST_CHECK_EQUAL(FR_OK, f_mount(&USERFatFS, USERPath, 1), "mount");
+
+    FIL* file = &USERFile;
+    TEST_CHECK_EQUAL(FR_OK, f_open(file, TEST_FILE_NAME, FA_READ), "open");
+    TEST_CHECK_EQUAL(TEST_FILE_SIZE, f_size(file), "file size");
+
+    // Sequential reads of uneven sizes: partial sectors through the FatFs window, whole sectors in between
+    BYTE* data = (BYTE*)malloc(TEST_FILE_SIZE);
+    UInt32 position = 0;
+    UInt32 state = 7;
+    while (position < TEST_FILE_SIZE) {
+        UInt32 length = 1 + HostRandom(&state) % 9000;
+        UINT read = 0;
+        TEST_CHECK_EQUAL(FR_OK, f_read(file, data + position, length, &read), "read at %u", position);
+        if (read == 0) {
+            break;
+        }
+        position += read;
+    }
+    TEST_CHECK_EQUAL(TEST_FILE_SIZE, position, "bytes read");
+    TEST_CHECK(memcmp(data, _fileData, TEST_FILE_SIZE) == 0, "file content");
+
+    // Random accesses drop the prefetched sectors
+    for (int i = 0; i < 20; i++) {
+        UInt32 offset = HostRandom(&state) % TEST_FILE_SIZE;
+        BYTE value = 0;
+        UINT read = 0;
+        TEST_CHECK_EQUAL(FR_OK, f_lseek(file, offset), "seek to %u", offset);
+        TEST_CHECK_EQUAL(FR_OK, f_read(file, &value, 1, &read), "byte read at %u", offset);
+        TEST_CHECK_EQUAL(_fileData[offset], value, "byte at %u", offset);
+    }
+
+    // Whole sectors into a DMA-reachable buffer bypass the read-ahead window
+    BYTE* direct = (BYTE*)ralloc(8 * TEST_SECTOR_SIZE);
+    TEST_CHECK(direct != NULL, "direct buffer allocation");
+    if (direct != NULL) {
+        UINT read = 0;
+        TEST_CHECK_EQUAL(FR_OK, f_lseek(file, 16 * 1024), "seek to the direct read");
+        TEST_CHECK_EQUAL(FR_OK, f_read(file, direct, 8 * TEST_SECTOR_SIZE, &read), "direct read");
+        TEST_CHECK(memcmp(direct, _fileData + 16 * 1024, 8 * TEST_SECTOR_SIZE) == 0, "direct read content");
+        rfree(direct, 8 * TEST_SECTOR_SIZE);
+    }
+
+    TEST_CHECK_EQUAL(FR_OK, f_close(file), "close");
+    free(data);
+}
+
+// ##### Public function definitions #####
+
+int main() {
+    HostBoardInitialize();
+
+    _fileData = (BYTE*)malloc(TEST_FILE_SIZE);
+    UInt32 state = 1;
+    for (UInt32 i = 0; i < TEST_FILE_SIZE; i++) {
+        _fileData[i] = (BYTE)HostRandom(&state);
+    }
+    HostFatFile file = { .name = TEST_FILE_NAME, .data = _fileData, .size = TEST_FILE_SIZE };
+    if (!HostFatBuildImage(TEST_IMAGE_PATH, TEST_IMAGE_SECTORS, &file, 1, 0) ||
+        !SdCardEmulatorOpen(&_card, TEST_IMAGE_PATH, NULL)) {
+        printf("Cannot create the card\n");
+        return 1;
+    }
+
+    // Same initialization order of main
+    Crc7Initialize();
+    Crc16Initialize();
+    MX_FATFS_Init();
+    TEST_CHECK_EQUAL(SdStatusOk, SdInitialize(GPIOC, GPIO_PIN_1, HostSpiGetHandle()), "driver initialization");
+    StorageInitialize();
+    ReadAheadInitialize();
+
+    CheckConnection();
+    CheckPolledReads();
+    HostKernelRun(KernelChecks, NULL);
+
+    HostSpiStatistics statistics;
+    HostSpiGetStatistics(&statistics);
+    TEST_CHECK_EQUAL(0, statistics.protocolErrors, "register sequences refused by the peripherals");
+    printf("%llu bytes polled, %llu bytes in %u DMA transfers, %llu register accesses, %.1f ms emulated\n",
+        (unsigned long long)statistics.cpuBytes, (unsigned long long)statistics.dmaBytes, statistics.dmaTransfers,
+        (unsigned long long)statistics.registerAccesses, (double)HostTimeNow() / (double)HOST_TIME_MS);
+
+    SdCardEmulatorClose(&_card);
+    free(_fileData);
+    return TestResult();
+}
@@ -0,0 +1,436 @@
+#include "sdcardemulator.h"
+#include <assertion.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// The card CRCs are computed bit by bit, independently of the firmware tables that they check
+
+#define SD_EMULATOR_DUMMY_BYTE 0xFF
+#define SD_EMULATOR_START_BLOCK_TOKEN 0xFE
+#define SD_EMULATOR_OUT_OF_RANGE_TOKEN 0x08
+#define SD_EMULATOR_CRC_SIZE 2
+#define SD_EMULATOR_CSD_SIZE 16
+/// Capacity unit of the CSD version 2.0 (C_SIZE + 1 units of 512KB)
+#define SD_EMULATOR_CAPACITY_UNIT 1024U
+
+/// R1 response bits [Physical Layer Simplified Specification - Section 7.3.2.1]
+#define SD_R1_IDLE 0x01
+#define SD_R1_ILLEGAL_COMMAND 0x04
+#define SD_R1_CRC_ERROR 0x08
+#define SD_R1_PARAMETER_ERROR 0x40
+
+/// OCR bits: power up status, card capacity status and the 2.7-3.6V window
+#define SD_OCR_POWER_UP 0x80000000U
+#define SD_OCR_CCS 0x40000000U
+#define SD_OCR_VOLTAGE_WINDOW 0x00FF8000U
+#define SD_ACMD41_HCS 0x40000000U
+
+// ##### Private forward declarations #####
+
+static BYTE Crc7(PCBYTE data, UInt32 length);
+static UInt16 Crc16(PCBYTE data, UInt32 length);
+/// Returns the next value of the fault generator (xorshift32)
+static UInt32 NextRandom(SdCardEmulator* card);
+/// Restores the state of a card that has just been powered
+static void Reset(SdCardEmulator* card);
+/// Queues a response of the given bytes after the NCR bytes
+static void Respond(SdCardEmulator* card, PCBYTE response, BYTE length, SdCardOutput afterResponse);
+static void RespondR1(SdCardEmulator* card, BYTE r1, SdCardOutput afterResponse);
+/// Prepares a data block (token, data, CRC16) eventually injecting a fault in its data
+static void LoadBlock(SdCardEmulator* card, PCBYTE data, UInt16 length);
+static void LoadCsd(SdCardEmulator* card);
+/// Starts a block read: the start token is sent after the access time
+static void StartRead(SdCardEmulator* card, UInt32 sector, BOOL multiple, UInt64 time);
+/// Executes a received command
+static void ExecuteCommand(SdCardEmulator* card, UInt64 time);
+/// Returns the byte sent on MISO at the given time
+static BYTE NextOutput(SdCardEmulator* card, UInt64 time);
+static BYTE Exchange(void* context, BYTE mosi, UInt64 time);
+static void Select(void* context, BOOL selected, UInt64 time);
+static void Power(void* context, BOOL powered, UInt64 time);
+
+// ##### Private function definitions #####
+
+BYTE Crc7(PCBYTE data, UInt32 length) {
+    // Polynomial x^7 + x^3 + 1
+    BYTE crc = 0;
+    for (UInt32 i = 0; i < length; i++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            BYTE feedback = (BYTE)(((crc >> 6) ^ (data[i] >> bit)) & 0x1);
+            crc = (BYTE)((crc << 1) & 0x7F);
+            if (feedback) {
+                crc ^= 0x09;
+            }
+        }
+    }
+    return crc;
+}
+
+UInt16 Crc16(PCBYTE data, UInt32 length) {
+    // Polynomial x^16 + x^12 + x^5 + 1
+    UInt16 crc = 0;
+    for (UInt32 i = 0; i < length; i++) {
+        for (int bit = 7; bit >= 0; bit--) {
+            BOOL feedback = (((crc >> 15) ^ (data[i] >> bit)) & 0x1) != 0;
+            crc = (UInt16)(crc << 1);
+            if (feedback) {
+                crc ^= 0x1021;
+            }
+        }
+    }
+    return crc;
+}
+
+UInt32 NextRandom(SdCardEmulator* card) {
+    UInt32 x = card->randomState;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    card->randomState = x;
+    return x;
+}
+
+void Reset(SdCardEmulator* card) {
+    card->idle = true;
+    card->initializing = false;
+    card->applicationCommand = false;
+    card->crcEnabled = false;
+    card->commandLength = 0;
+    card->output = SdCardOutputIdle;
+    card->multipleBlockRead = false;
+}
+
+void Respond(SdCardEmulator* card, PCBYTE response, BYTE length, SdCardOutput afterResponse) {
+    DebugAssert(length <= sizeof(card->response));
+    memcpy(card->response, response, length);
+    card->responseLength = length;
+    card->responsePosition = 0;
+    card->responseDelay = card->timing.responseBytes;
+    card->afterResponse = afterResponse;
+    card->output = SdCardOutputResponse;
+}
+
+void RespondR1(SdCardEmulator* card, BYTE r1, SdCardOutput afterResponse) {
+    if (card->idle) {
+        r1 |= SD_R1_IDLE;
+    }
+    Respond(card, &r1, 1, afterResponse);
+}
+
+void LoadBlock(SdCardEmulator* card, PCBYTE data, UInt16 length) {
+    card->block[0] = SD_EMULATOR_START_BLOCK_TOKEN;
+    memcpy(&card->block[1], data, length);
+    UInt16 crc = Crc16(data, length);
+    card->block[1 + length] = (BYTE)(crc >> 8);
+    card->block[2 + length] = (BYTE)crc;
+    card->blockLength = (UInt16)(1 + length + SD_EMULATOR_CRC_SIZE);
+    card->blockPosition = 0;
+    card->statistics.blocks++;
+
+    BOOL corrupt = false;
+    if (card->corruptBlockCountdown == 0) {
+        corrupt = true;
+    }
+    if (card->corruptBlockCountdown >= 0) {
+        card->corruptBlockCountdown--;
+    }
+    if (card->corruptBlockRate != 0 && (NextRandom(card) & 0xFFFF) < card->corruptBlockRate) {
+        corrupt = true;
+    }
+    if (corrupt) {
+        // The CRC is the one of the original data, like after a glitch on the line
+        UInt32 bit = NextRandom(card) % (length * 8U);
+        card->block[1 + bit / 8] ^= (BYTE)(1U << (bit % 8));
+        card->statistics.corruptedBlocks++;
+    }
+}
+
+void LoadCsd(SdCardEmulator* card) {
+    // CSD version 2.0: 25MHz, 512 byte blocks, (C_SIZE + 1) * 512KB [Section 5.3.3]
+    UInt32 size = card->sectorCount / SD_EMULATOR_CAPACITY_UNIT - 1;
+    BYTE csd[SD_EMULATOR_CSD_SIZE] = {
+        0x40, 0x0E, 0x00, 0x32, 0x5B, 0x59, 0x00,
+        (BYTE)((size >> 16) & 0x3F), (BYTE)(size >> 8), (BYTE)size,
+        0x7F, 0x80, 0x0A, 0x40, 0x00, 0x00
+    };
+    csd[15] = (BYTE)((Crc7(csd, SD_EMULATOR_CSD_SIZE - 1) << 1) | 0x1);
+    LoadBlock(card, csd, SD_EMULATOR_CSD_SIZE);
+}
+
+void StartRead(SdCardEmulator* card, UInt32 sector, BOOL multiple, UInt64 time) {
+    card->nextSector = sector;
+    card->multipleBlockRead = multiple;
+    card->readyTime = time + card->timing.readAccessTime;
+    RespondR1(card, 0x00, SdCardOutputAccess);
+}
+
+void ExecuteCommand(SdCardEmulator* card, UInt64 time) {
+    if (card->corruptCommandCountdown == 0) {
+        card->command[1 + NextRandom(card) % 4] ^= (BYTE)(1U << (NextRandom(card) % 8));
+    }
+    if (card->corruptCommandCountdown >= 0) {
+        card->corruptCommandCountdown--;
+    }
+
+    BYTE index = card->command[0] & 0x3F;
+    UInt32 argument = ((UInt32)card->command[1] << 24) | ((UInt32)card->command[2] << 16) |
+        ((UInt32)card->command[3] << 8) | card->command[4];
+    BOOL applicationCommand = card->applicationCommand;
+    card->applicationCommand = false;
+
+    // CMD0 and CMD8 are always protected, the others once the CRC is enabled [Section 7.2.2]
+    BOOL crcValid = card->command[5] == (BYTE)((Crc7(card->command, 5) << 1) | 0x1);
+    if (!crcValid && (card->crcEnabled || index == 0 || index == 8)) {
+        card->statistics.commandCrcErrors++;
+        RespondR1(card, SD_R1_CRC_ERROR, SdCardOutputIdle);
+        return;
+    }
+
+    // A command aborts the data being sent. Only the stop command is expected there
+    if (card->output == SdCardOutputAccess || card->output == SdCardOutputData) {
+        if (index != 12) {
+            card->statistics.unexpectedCommands++;
+        }
+        card->output = SdCardOutputIdle;
+        card->multipleBlockRead = false;
+    }
+
+    // Only the initialization commands are accepted in the idle state [Section 7.3.1.3]
+    BOOL initializationCommand = index == 0 || index == 8 || index == 55 || index == 58 || index == 59 ||
+        (index == 41 && applicationCommand);
+    if (card->idle && !initializationCommand) {
+        RespondR1(card, SD_R1_ILLEGAL_COMMAND, SdCardOutputIdle);
+        return;
+    }
+
+    card->statistics.commands[index]++;
+    switch (index) {
+    case 0:
+        Reset(card);
+        RespondR1(card, 0x00, SdCardOutputIdle);
+        break;
+    case 8: {
+        // R7 echoes the accepted voltage and the check pattern
+        BYTE r7[5] = { card->idle ? SD_R1_IDLE : 0x00, 0x00, 0x00, (BYTE)((argument >> 8) & 0x0F), (BYTE)argument };
+        Respond(card, r7, sizeof(r7), SdCardOutputIdle);
+        break;
+    }
+    case 9:
+        LoadCsd(card);
+        card->readyTime = time;
+        card->multipleBlockRead = false;
+        RespondR1(card, 0x00, SdCardOutputData);
+        break;
+    case 12: {
+        // A stuff byte precedes the response, then the card is busy [Section 7.5.2.2]
+        BYTE r1[2] = { SD_EMULATOR_DUMMY_BYTE, 0x00 };
+        card->readyTime = time + card->timing.stopBusyTime;
+        Respond(card, r1, sizeof(r1), SdCardOutputBusy);
+        break;
+    }
+    case 16:
+        RespondR1(card, argument == SD_EMULATOR_BLOCK_SIZE ? 0x00 : SD_R1_PARAMETER_ERROR, SdCardOutputIdle);
+        break;
+    case 17:
+    case 18:
+        if (argument >= card->sectorCount) {
+            RespondR1(card, SD_R1_PARAMETER_ERROR, SdCardOutputIdle);
+        }
+        else {
+            StartRead(card, argument, index == 18, time);
+        }
+        break;
+    case 41:
+        if (!applicationCommand) {
+            RespondR1(card, SD_R1_ILLEGAL_COMMAND, SdCardOutputIdle);
+            break;
+        }
+        // A high capacity card never leaves the idle state if the host does not support it
+        if (!card->initializing && (argument & SD_ACMD41_HCS) != 0) {
+            card->initializing = true;
+            card->initializationEnd = time + card->timing.initializationTime;
+        }
+        if (card->initializing && time >= card->initializationEnd) {
+            card->idle = false;
+        }
+        RespondR1(card, 0x00, SdCardOutputIdle);
+        break;
+    case 55:
+        card->applicationCommand = true;
+        RespondR1(card, 0x00, SdCardOutputIdle);
+        break;
+    case 58: {
+        UInt32 ocr = SD_OCR_VOLTAGE_WINDOW | (card->idle ? 0 : SD_OCR_POWER_UP | SD_OCR_CCS);
+        BYTE r3[5] = { card->idle ? SD_R1_IDLE : 0x00, (BYTE)(ocr >> 24), (BYTE)(ocr >> 16), (BYTE)(ocr >> 8), (BYTE)ocr };
+        Respond(card, r3, sizeof(r3), SdCardOutputIdle);
+        break;
+    }
+    case 59:
+        // The driver sends it as an application command: the card accepts both forms
+        card->crcEnabled = (argument & 0x1) != 0;
+        RespondR1(card, 0x00, SdCardOutputIdle);
+        break;
+    default:
+        card->statistics.commands[index]--;
+        RespondR1(card, SD_R1_ILLEGAL_COMMAND, SdCardOutputIdle);
+        break;
+    }
+}
+
+BYTE NextOutput(SdCardEmulator* card, UInt64 time) {
+    switch (card->output) {
+    case SdCardOutputResponse:
+        if (card->responseDelay > 0) {
+            card->responseDelay--;
+            return SD_EMULATOR_DUMMY_BYTE;
+        }
+        BYTE response = card->response[card->responsePosition++];
+        if (card->responsePosition == card->responseLength) {
+            card->output = card->afterResponse;
+        }
+        return response;
+    case SdCardOutputAccess:
+        if (time < card->readyTime) {
+            return SD_EMULATOR_DUMMY_BYTE;
+        }
+        if (card->nextSector >= card->sectorCount) {
+            // A multiple block read that runs past the end of the card
+            card->output = SdCardOutputIdle;
+            card->multipleBlockRead = false;
+            return SD_EMULATOR_OUT_OF_RANGE_TOKEN;
+        }
+        LoadBlock(card, card->image + (size_t)card->nextSector * SD_EMULATOR_BLOCK_SIZE, SD_EMULATOR_BLOCK_SIZE);
+        card->nextSector++;
+        card->output = SdCardOutputData;
+        // Fall through: the start block token is the first byte of the block
+    case SdCardOutputData: {
+        BYTE data = card->block[card->blockPosition++];
+        if (card->blockPosition == card->blockLength) {
+            card->output = card->multipleBlockRead ? SdCardOutputAccess : SdCardOutputIdle;
+            card->readyTime = time + card->timing.blockGapTime;
+        }
+        return data;
+    }
+    case SdCardOutputBusy:
+        if (time < card->readyTime) {
+            return 0x00;
+        }
+        card->output = SdCardOutputIdle;
+        return SD_EMULATOR_DUMMY_BYTE;
+    case SdCardOutputIdle:
+    default:
+        return SD_EMULATOR_DUMMY_BYTE;
+    }
+}
+
+BYTE Exchange(void* context, BYTE mosi, UInt64 time) {
+    SdCardEmulator* card = (SdCardEmulator*)context;
+    if (!card->powered || !card->selected) {
+        return SD_EMULATOR_DUMMY_BYTE;
+    }
+
+    // Full duplex: the output of the byte does not depend on the command being received
+    BYTE miso = NextOutput(card, time);
+
+    // A command starts with the bits 01, the host sends ones between the commands [Section 7.3.1.1]
+    if (card->commandLength > 0 || (mosi & 0xC0) == 0x40) {
+        card->command[card->commandLength++] = mosi;
+        if (card->commandLength == sizeof(card->command)) {
+            card->commandLength = 0;
+            ExecuteCommand(card, time);
+        }
+    }
+    return miso;
+}
+
+void Select(void* context, BOOL selected, UInt64 time) {
+    SUPPRESS_WARNING(time);
+    SdCardEmulator* card = (SdCardEmulator*)context;
+    card->selected = selected;
+    // A command cannot continue across a deselection
+    card->commandLength = 0;
+}
+
+void Power(void* context, BOOL powered, UInt64 time) {
+    SUPPRESS_WARNING(time);
+    SdCardEmulator* card = (SdCardEmulator*)context;
+    if (powered && !card->powered) {
+        Reset(card);
+    }
+    card->powered = powered;
+}
+
+// ##### Public function definitions #####
+
+BOOL SdCardEmulatorOpen(SdCardEmulator* card, const char* imagePath, const SdCardTiming* timing) {
+    memset(card, 0, sizeof(SdCardEmulator));
+    card->corruptBlockCountdown = -1;
+    card->corruptCommandCountdown = -1;
+    card->randomState = 1;
+    if (timing != NULL) {
+        card->timing = *timing;
+    }
+    else {
+        SdCardEmulatorGetDefaultTiming(&card->timing);
+    }
+
+    int file = open(imagePath, O_RDONLY);
+    if (file < 0) {
+        printf("Cannot open the card image %s\n", imagePath);
+        return false;
+    }
+    struct stat status;
+    if (fstat(file, &status) != 0 || status.st_size == 0 ||
+        (status.st_size % (SD_EMULATOR_CAPACITY_UNIT * SD_EMULATOR_BLOCK_SIZE)) != 0) {
+        printf("The size of the card image %s is not a multiple of 512KB\n", imagePath);
+        close(file);
+        return false;
+    }
+
+    void* image = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    close(file);
+    if (image == MAP_FAILED) {
+        printf("Cannot map the card image %s\n", imagePath);
+        return false;
+    }
+    card->image = (PCBYTE)image;
+    card->imageSize = (size_t)status.st_size;
+    card->sectorCount = (UInt32)(card->imageSize / SD_EMULATOR_BLOCK_SIZE);
+    Reset(card);
+
+    HostSpiDevice device = { .exchange = Exchange, .select = Select, .power = Power, .context = card };
+    HostSpiAttach(&device, GPIOC, GPIO_PIN_1);
+    return true;
+}
+
+void SdCardEmulatorClose(SdCardEmulator* card) {
+    if (card->image != NULL) {
+        munmap((void*)card->image, card->imageSize);
+        card->image = NULL;
+    }
+}
+
+void SdCardEmulatorGetDefaultTiming(SdCardTiming* timing) {
+    timing->responseBytes = 1;
+    timing->readAccessTime = 100 * HOST_TIME_US;
+    timing->blockGapTime = 20 * HOST_TIME_US;
+    timing->stopBusyTime = 10 * HOST_TIME_US;
+    timing->initializationTime = 50 * HOST_TIME_MS;
+}
+
+void SdCardEmulatorCorruptBlock(SdCardEmulator* card, UInt32 blocksBefore) {
+    card->corruptBlockCountdown = (Int32)blocksBefore;
+}
+
+void SdCardEmulatorCorruptCommand(SdCardEmulator* card, UInt32 commandsBefore) {
+    card->corruptCommandCountdown = (Int32)commandsBefore;
+}
+
+void SdCardEmulatorSetCorruptionRate(SdCardEmulator* card, UInt32 rate, UInt32 seed) {
+    card->corruptBlockRate = rate;
+    card->randomState = seed != 0 ? seed : 1;
+}
@@ -0,0 +1,135 @@
+/*
+ * SD card emulator for the host tests: a high capacity card in SPI mode, backed by a disk image file
+ *
+ * The card answers CMD0, CMD8, CMD55, ACMD41, CMD58, CMD59, CMD9, CMD16, CMD17, CMD18 and CMD12 like the SD
+ * Physical Layer Simplified Specification describes them, and checks the CRC7 of the commands (always for CMD0
+ * and CMD8, for all of them once CMD59 enables it). Its timing follows the emulated time of the bus: a read
+ * returns the start block token only after the access latency, the blocks of a multiple block read are
+ * separated by the block gap and the line stays busy after the stop command.
+ *
+ * Faults are injected on the wire: a data block can be sent with a flipped bit (the card CRC16 is the one of the
+ * original data) and a command can be received with a flipped bit (the card answers with a CRC error)
+ *
+ * @remarks The image size must be a multiple of 512KB, the capacity unit of the CSD version 2.0
+ */
+
+#ifndef TESTS_SD_SDCARDEMULATOR_H_
+#define TESTS_SD_SDCARDEMULATOR_H_
+
+#include <hostboard.h>
+
+/// Size of the card blocks
+#define SD_EMULATOR_BLOCK_SIZE 512
+/// Number of commands of the SPI mode (6 bit index)
+#define SD_EMULATOR_COMMANDS 64
+
+/// Timing of the card
+typedef struct _SdCardTiming {
+    /// Bytes between the end of a command and its response (NCR, 1 to 8)
+    BYTE responseBytes;
+    /// Time from a read command to the start block token of the first block (NAC)
+    UInt64 readAccessTime;
+    /// Time between the end of a block and the start block token of the next one in a multiple block read
+    UInt64 blockGapTime;
+    /// Time the line stays busy after the stop command
+    UInt64 stopBusyTime;
+    /// Time from the first ACMD41 to the end of the card initialization
+    UInt64 initializationTime;
+} SdCardTiming;
+
+/// Counters of the card activity
+typedef struct _SdCardStatistics {
+    /// Valid commands received, by index (application commands included)
+    UInt32 commands[SD_EMULATOR_COMMANDS];
+    /// Commands rejected because of their CRC
+    UInt32 commandCrcErrors;
+    /// Data blocks sent (registers included)
+    UInt32 blocks;
+    /// Data blocks sent with an injected fault
+    UInt32 corruptedBlocks;
+    /// Commands received in the middle of another one or of a data block
+    UInt32 unexpectedCommands;
+} SdCardStatistics;
+
+typedef enum _SdCardOutput {
+    /// Nothing to send: the card waits for a command
+    SdCardOutputIdle,
+    /// Response of the last command, after NCR bytes
+    SdCardOutputResponse,
+    /// Waiting for the data access before the start block token
+    SdCardOutputAccess,
+    /// Data block and its CRC
+    SdCardOutputData,
+    /// Busy line after the stop command
+    SdCardOutputBusy
+} SdCardOutput;
+
+typedef struct _SdCardEmulator {
+    /// Disk image (read only mapping)
+    PCBYTE image;
+    size_t imageSize;
+    UInt32 sectorCount;
+    SdCardTiming timing;
+    SdCardStatistics statistics;
+
+    BOOL powered;
+    BOOL selected;
+    /// Idle state: only the initialization commands are accepted
+    BOOL idle;
+    /// Set by the first ACMD41, the card is initialized after the initialization time
+    BOOL initializing;
+    UInt64 initializationEnd;
+    /// The last command was CMD55
+    BOOL applicationCommand;
+    BOOL crcEnabled;
+
+    /// Command being received
+    BYTE command[6];
+    BYTE commandLength;
+
+    SdCardOutput output;
+    /// Bytes of the response and NCR bytes still to send
+    BYTE response[5];
+    BYTE responseLength;
+    BYTE responsePosition;
+    BYTE responseDelay;
+    /// Output that follows the response
+    SdCardOutput afterResponse;
+    /// Time when the access ends (SdCardOutputAccess) or the line becomes free (SdCardOutputBusy)
+    UInt64 readyTime;
+    /// Block being sent: start token, data and CRC16
+    BYTE block[1 + SD_EMULATOR_BLOCK_SIZE + 2];
+    UInt16 blockLength;
+    UInt16 blockPosition;
+    /// Next sector of a multiple block read
+    UInt32 nextSector;
+    BOOL multipleBlockRead;
+
+    /// Data blocks to send before the one that is corrupted (-1 disables the fault)
+    Int32 corruptBlockCountdown;
+    /// Commands to receive before the one that is corrupted (-1 disables the fault)
+    Int32 corruptCommandCountdown;
+    /// Probability of a corrupted data block, in 1/65536 units
+    UInt32 corruptBlockRate;
+    UInt32 randomState;
+} SdCardEmulator;
+
+/// Opens the disk image and connects the card to the SPI2 bus of the emulated board, powered by GPIOC pin 1
+/// @param timing Timing of the card. NULL selects a typical card
+/// @return False if the image cannot be opened or its size is not valid
+BOOL SdCardEmulatorOpen(SdCardEmulator* card, const char* imagePath, const SdCardTiming* timing);
+/// Closes the disk image
+void SdCardEmulatorClose(SdCardEmulator* card);
+/// Returns the timing of a typical card
+void SdCardEmulatorGetDefaultTiming(SdCardTiming* timing);
+
+/// Sends the data block after the given number of blocks with a flipped bit
+void SdCardEmulatorCorruptBlock(SdCardEmulator* card, UInt32 blocksBefore);
+/// Receives the command after the given number of commands with a flipped bit
+void SdCardEmulatorCorruptCommand(SdCardEmulator* card, UInt32 commandsBefore);
+/// Corrupts the data blocks at random
+/// @param rate Probability of a corrupted block, in 1/65536 units
+/// @param seed Seed of the generator, so that the faults can be reproduced
+void SdCardEmulatorSetCorruptionRate(SdCardEmulator* card, UInt32 rate, UInt32 seed);
+
+#endif /* TESTS_SD_SDCARDEMULATOR_H_ */
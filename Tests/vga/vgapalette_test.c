@@ -0,0 +1,256 @@
+/*
+ * Palettized frame buffers of the VGA driver against the 8bpp frame buffer, on the emulated board
+ *
+ * The same scene (opaque and translucent fills, single pixels, undithered and dithered blits, blended text) is drawn
+ * on an 8bpp buffer and on the 4bpp and 2bpp buffers. Each palettized pixel must be the palette entry nearest to the
+ * 8bpp pixel: the scene is drawn over palette colors, so the palettized paths must only quantize the 8bpp result
+ * -> The native lines rendered by UnpackLine for the line DMA, also after a swap of a double buffered screen
+ * -> The spans unpacked and packed again by the drawing functions
+ * -> The palette changes, that recolor the rendered lines without touching the frame buffer
+ */
+
+// The driver is included to reach its line renderer and its span conversions
+#include <vga/vgascreenbuffer.c>
+#include <hostboard.h>
+#include <hosttest.h>
+
+/// 800x600 @ 60Hz scaled by 4: 200x150
+#define PALETTE_TEST_SCALING 4
+#define PALETTE_TEST_WIDTH 200
+#define PALETTE_TEST_HEIGHT 150
+/// Unpacked spans checked for each line
+#define PALETTE_TEST_SPANS 8
+
+// ##### Private forward declarations #####
+
+/// Creates a buffer of the 200x150 frame with the timers of the board
+static VgaScreenBuffer* CreateBuffer(Bpp bpp, BOOL doubleBuffered);
+/// Draws the scene with the public drawing API
+static void DrawScene(const ScreenBuffer* screen);
+/// Draws the scene on an 8bpp buffer and copies its pixels in _reference
+static void DrawReference();
+/// Checks the native lines rendered by UnpackLine against the reference quantized with the buffer palette
+static void CheckRenderedLines(const VgaScreenBuffer* buffer, const char* name);
+/// Checks the spans unpacked from the back buffer against the quantized reference, and that packing them back
+/// leaves the buffer unchanged
+static void CheckSpans(const VgaScreenBuffer* buffer, const char* name);
+/// Checks that a palette change recolors every rendered pixel and leaves the stored indexes unchanged
+static void CheckPaletteChange(VgaScreenBuffer* buffer, const char* name);
+/// Runs all the checks on a palettized buffer
+static void CheckPalettized(Bpp bpp, BOOL doubleBuffered, const char* name);
+
+// ##### Private fields #####
+
+static TIM_HandleTypeDef _mainTimer = { .Instance = TIM4 };
+static TIM_HandleTypeDef _hSyncTimer = { .Instance = TIM1 };
+static TIM_HandleTypeDef _vSyncTimer = { .Instance = TIM3 };
+static DMA_HandleTypeDef _lineDma = { .Instance = DMA2_Stream0 };
+/// Native pixels of the scene drawn on the 8bpp buffer
+static BYTE _reference[PALETTE_TEST_HEIGHT][PALETTE_TEST_WIDTH];
+/// Native line rendered by UnpackLine (large enough for the padding of the 2bpp lines)
+static BYTE _renderedLine[PALETTE_TEST_WIDTH + 16];
+
+// ##### Private function definitions #####
+
+VgaScreenBuffer* CreateBuffer(Bpp bpp, BOOL doubleBuffered) {
+    VgaVisualizationInfo info = { 0 };
+    info.BitsPerPixel = bpp;
+    info.DoubleBuffered = doubleBuffered;
+    info.FrameSignals = VideoFrame800x600at60Hz;
+    info.Scaling = PALETTE_TEST_SCALING;
+    info.mainTimer = &_mainTimer;
+    info.hSyncTimer = &_hSyncTimer;
+    info.vSyncTimer = &_vSyncTimer;
+    info.lineDMA = &_lineDma;
+
+    ScreenBuffer* screen = NULL;
+    TEST_CHECK_EQUAL(VgaErrorNone, VgaCreateScreenBuffer(&info, &screen), "creation of the bpp %d buffer", bpp);
+    if (screen != NULL) {
+        TEST_CHECK_EQUAL(PALETTE_TEST_WIDTH, screen->screenSize.width, "width of the bpp %d buffer", bpp);
+        TEST_CHECK_EQUAL(PALETTE_TEST_HEIGHT, screen->screenSize.height, "height of the bpp %d buffer", bpp);
+    }
+    return (VgaScreenBuffer*)screen;
+}
+
+void DrawScene(const ScreenBuffer* screen) {
+    Pen pen = { 0 };
+    // Background and opaque fills with the colors of the default 4bpp palette. The edges are not on a word of
+    // pixels, and a single pixel column ends on the last byte of the line
+    pen.color.argb = SCREEN_RGB(0, 0, 170);
+    ScreenClear(screen, &pen);
+    pen.color.argb = SCREEN_RGB(255, 85, 85);
+    ScreenFillRectangle(screen, (PointS){ 3, 5 }, (SizeS){ 37, 20 }, &pen);
+    pen.color.argb = SCREEN_RGB(255, 255, 255);
+    ScreenFillRectangle(screen, (PointS){ 17, 30 }, (SizeS){ 1, 40 }, &pen);
+    ScreenFillRectangle(screen, (PointS){ PALETTE_TEST_WIDTH - 1, 0 }, (SizeS){ 1, PALETTE_TEST_HEIGHT }, &pen);
+    pen.color.argb = SCREEN_RGB(0, 170, 0);
+    ScreenFillRectangle(screen, (PointS){ 101, 5 }, (SizeS){ 90, 3 }, &pen);
+
+    // Single pixels
+    pen.color.argb = SCREEN_RGB(255, 255, 85);
+    for (Int16 i = 0; i < 20; i++) {
+        ScreenDrawPixel(screen, (PointS){ (Int16)(45 + (i * 3)), (Int16)(10 + i) }, &pen);
+    }
+
+    // Translucent fill and antialiased text over black, that is an entry of both the palettes: the blended pixels
+    // must come from the same background as in the 8bpp buffer
+    pen.color.argb = SCREEN_RGB(0, 0, 0);
+    ScreenFillRectangle(screen, (PointS){ 110, 15 }, (SizeS){ 80, 25 }, &pen);
+    ScreenFillRectangle(screen, (PointS){ 0, 105 }, (SizeS){ PALETTE_TEST_WIDTH, 30 }, &pen);
+    pen.color.argb = SCREEN_ARGB(0x80, 255, 255, 255);
+    ScreenFillRectangle(screen, (PointS){ 120, 20 }, (SizeS){ 50, 15 }, &pen);
+
+    // Blits of a gradient: the undithered line only has palette colors, the dithered lines do not
+    BYTE source[PALETTE_TEST_WIDTH * 3];
+    for (Int16 x = 0; x < PALETTE_TEST_WIDTH; x++) {
+        source[(x * 3) + 0] = (BYTE)((x & 1) != 0 ? 255 : 0);
+        source[(x * 3) + 1] = (BYTE)((x & 2) != 0 ? 255 : 85);
+        source[(x * 3) + 2] = (BYTE)((x & 4) != 0 ? 255 : 85);
+    }
+    for (Int16 y = 75; y < 80; y++) {
+        ScreenBlitSpan(screen, y, 7, source, 181, ScreenDitherNone);
+    }
+    for (Int16 x = 0; x < PALETTE_TEST_WIDTH; x++) {
+        source[(x * 3) + 0] = (BYTE)x;
+        source[(x * 3) + 1] = (BYTE)(255 - x);
+        source[(x * 3) + 2] = (BYTE)(x / 2);
+    }
+    for (Int16 y = 80; y < 90; y++) {
+        ScreenBlitSpan(screen, y, 0, source, PALETTE_TEST_WIDTH, ScreenDitherOrdered);
+    }
+    for (Int16 y = 90; y < 100; y++) {
+        ScreenBlitSpan(screen, y, 5, source, 190, ScreenDitherErrorDiffusion);
+    }
+
+    pen.color.argb = SCREEN_RGB(255, 255, 255);
+    ScreenDrawString(screen, "Palette 0123", (PointS){ 9, 110 }, &pen);
+}
+
+void DrawReference() {
+    VgaScreenBuffer* buffer = CreateBuffer(Bpp8, false);
+    if (buffer == NULL) {
+        return;
+    }
+    DrawScene(&buffer->base);
+    for (UInt16 y = 0; y < PALETTE_TEST_HEIGHT; y++) {
+        memcpy(_reference[y], buffer->BufferPtr + ((UInt32)y * buffer->lineBytes), PALETTE_TEST_WIDTH);
+    }
+    TEST_CHECK_EQUAL(VgaErrorNotSupported, VgaSetPalette(NULL, 0), "palette of an 8bpp buffer");
+    VgaReleaseScreenBuffer(&buffer->base);
+}
+
+void CheckRenderedLines(const VgaScreenBuffer* buffer, const char* name) {
+    const PalettizedState* state = &buffer->palettized;
+    UInt32 mismatches = 0;
+    for (UInt16 y = 0; y < PALETTE_TEST_HEIGHT; y++) {
+        UnpackLine(buffer, y, _renderedLine);
+        for (UInt16 x = 0; x < PALETTE_TEST_WIDTH; x++) {
+            BYTE expected = state->palette[state->nativeToIndex[_reference[y][x]]];
+            if (_renderedLine[x] != expected && mismatches++ < 5) {
+                printf("%s: pixel (%d, %d) is 0x%02X, expected 0x%02X\n", name, x, y, _renderedLine[x], expected);
+            }
+        }
+    }
+    TEST_CHECK_EQUAL(0, mismatches, "%s rendered pixels different from the quantized 8bpp pixels", name);
+}
+
+void CheckSpans(const VgaScreenBuffer* buffer, const char* name) {
+    const PalettizedState* state = &buffer->palettized;
+    UInt32 seed = 0x5EED;
+    UInt32 unpackMismatches = 0;
+    UInt32 packMismatches = 0;
+    BYTE packedLine[PALETTE_TEST_WIDTH];
+    for (UInt16 y = 0; y < PALETTE_TEST_HEIGHT; y++) {
+        // The drawing functions work on the back buffer, that still has the scene before a swap
+        const BYTE* backLine = buffer->BackBufferPtr + ((UInt32)y * buffer->lineBytes);
+        memcpy(packedLine, backLine, buffer->lineBytes);
+
+        for (int i = 0; i < PALETTE_TEST_SPANS; i++) {
+            Int16 x = (Int16)(HostRandom(&seed) % PALETTE_TEST_WIDTH);
+            Int16 count = (Int16)(1 + (HostRandom(&seed) % (UInt32)(PALETTE_TEST_WIDTH - x)));
+            BYTE* native = UnpackSpan(buffer, (Int16)y, x, count);
+            for (Int16 j = 0; j < count; j++) {
+                if (native[j] != state->palette[state->nativeToIndex[_reference[y][x + j]]]) {
+                    unpackMismatches++;
+                }
+            }
+            PackSpan(buffer, (Int16)y, x, native, count);
+            if (memcmp(packedLine, backLine, buffer->lineBytes) != 0) {
+                packMismatches++;
+            }
+        }
+    }
+    TEST_CHECK_EQUAL(0, unpackMismatches, "%s unpacked pixels different from the quantized 8bpp pixels", name);
+    TEST_CHECK_EQUAL(0, packMismatches, "%s lines changed by packing their unpacked spans", name);
+}
+
+void CheckPaletteChange(VgaScreenBuffer* buffer, const char* name) {
+    PalettizedState* state = &buffer->palettized;
+    BYTE paletteSize = state->paletteSize;
+    TEST_CHECK_EQUAL(VgaErrorInvalidParameter, VgaSetPalette(NULL, paletteSize), "%s palette without colors", name);
+    ARGB8Color colors[16] = { 0 };
+    TEST_CHECK_EQUAL(VgaErrorInvalidParameter, VgaSetPalette(colors, (BYTE)(paletteSize - 1)), "%s palette size", name);
+
+    // The palette colors are distinct, so each rendered pixel gives its stored index
+    BYTE oldPalette[16];
+    memcpy(oldPalette, state->palette, sizeof(oldPalette));
+    for (BYTE i = 0; i < paletteSize; i++) {
+        TEST_CHECK_EQUAL(i, state->nativeToIndex[oldPalette[i]], "%s index of the palette entry %d", name, i);
+    }
+    BYTE indexes[PALETTE_TEST_HEIGHT][PALETTE_TEST_WIDTH];
+    for (UInt16 y = 0; y < PALETTE_TEST_HEIGHT; y++) {
+        UnpackLine(buffer, y, _renderedLine);
+        for (UInt16 x = 0; x < PALETTE_TEST_WIDTH; x++) {
+            indexes[y][x] = state->nativeToIndex[_renderedLine[x]];
+        }
+    }
+
+    // Gradient from red to green, different from both default palettes
+    for (BYTE i = 0; i < paletteSize; i++) {
+        colors[i].argb = SCREEN_RGB(255 - (i * 16), i * 16, 128);
+    }
+    TEST_CHECK_EQUAL(VgaErrorNone, VgaSetPalette(colors, paletteSize), "%s palette change", name);
+
+    UInt32 mismatches = 0;
+    for (UInt16 y = 0; y < PALETTE_TEST_HEIGHT; y++) {
+        UnpackLine(buffer, y, _renderedLine);
+        for (UInt16 x = 0; x < PALETTE_TEST_WIDTH; x++) {
+            BYTE index = indexes[y][x];
+            BYTE expected = (BYTE)RGB_TO_8BPP(colors[index].components.R, colors[index].components.G, colors[index].components.B);
+            if (_renderedLine[x] != expected) {
+                mismatches++;
+            }
+        }
+    }
+    TEST_CHECK_EQUAL(0, mismatches, "%s pixels not recolored by the palette change", name);
+}
+
+void CheckPalettized(Bpp bpp, BOOL doubleBuffered, const char* name) {
+    VgaScreenBuffer* buffer = CreateBuffer(bpp, doubleBuffered);
+    if (buffer == NULL) {
+        return;
+    }
+    TEST_CHECK_EQUAL(doubleBuffered ? 2 : 1, buffer->bufferCount, "%s buffers", name);
+
+    DrawScene(&buffer->base);
+    CheckSpans(buffer, name);
+    // The scene is displayed after the swap, and with the output stopped the swap is immediate. The palette app
+    // presents its frames in the same way
+    TEST_CHECK_EQUAL(VgaErrorNone, VgaSwapBuffers(), "%s swap", name);
+    CheckRenderedLines(buffer, name);
+    CheckPaletteChange(buffer, name);
+    VgaReleaseScreenBuffer(&buffer->base);
+}
+
+// ##### Public function definitions #####
+
+int main() {
+    HostBoardInitialize();
+    ScreenInitializeFont();
+
+    DrawReference();
+    CheckPalettized(Bpp4, false, "4bpp");
+    CheckPalettized(Bpp4, true, "double buffered 4bpp");
+    CheckPalettized(Bpp2, false, "2bpp");
+    return TestResult();
+}
@@ -0,0 +1,256 @@
+/*
+ * Text mode of the VGA driver against the bitmap path, on the emulated board
+ *
+ * A character grid is scanned out line by line through the interrupt handlers of the driver: the vertical blanking
+ * prepares the first line, each line start renders the next line in the free line buffer and each line end points
+ * the line DMA to it. The lines read by the DMA are compared with an 8bpp frame buffer where the same cells are
+ * drawn with the public drawing API: the background filled with the palette color and each lit pixel of the
+ * character cell drawn with the foreground color
+ * -> Cell size, grid size and the lines below the last row
+ * -> Attribute nibbles, palette colors, glyph bit order and characters outside the font
+ * -> The double line buffer: every buffer line is rendered once per frame, while the previous one is displayed
+ * -> The palette changes and the grid changes, displayed from the next frame
+ */
+
+// The driver is included to reach its interrupt handlers and its line buffers
+#include <vga/vgascreenbuffer.c>
+#include <hostboard.h>
+#include <hosttest.h>
+
+/// 800x600 @ 60Hz scaled by 2 (400 pixels, 50 columns) with 290 lines: 14 rows and 10 lines below the grid
+#define TEXT_TEST_SCALING 2
+#define TEXT_TEST_HEIGHT 290
+#define TEXT_TEST_WIDTH 400
+#define TEXT_TEST_COLUMNS 50
+#define TEXT_TEST_ROWS 14
+
+// ##### Private forward declarations #####
+
+/// Returns the visualization parameters of the test with the timers of the board
+static VgaVisualizationInfo GetVisualizationInfo(Bpp bpp);
+/// Fills the grid with all the characters, some outside the font, and with all the attributes
+static void FillGrid(VgaTextBuffer* grid);
+/// Renders a frame through the interrupt handlers and copies each buffer line read by the line DMA in _scanout
+static void ScanoutFrame(VgaScreenBuffer* buffer);
+/// Renders a line and counts the rendered lines
+static void CountingRenderTextLine(const VgaScreenBuffer* screenBuffer, UInt16 line, BYTE* dest);
+/// Draws the cells with the bitmap path on an 8bpp buffer and compares its lines with _scanout
+static void CheckAgainstBitmap(const VgaTextCell* cells, const UInt32* palette, const char* name);
+/// Displays the cells with the palette and checks the frame against the bitmap path
+static void CheckTextFrame(const VgaTextCell* cells, const UInt32* palette, const char* name);
+static void CheckGrid();
+static void CheckTextFrames();
+
+// ##### Private fields #####
+
+static TIM_HandleTypeDef _mainTimer = { .Instance = TIM4 };
+static TIM_HandleTypeDef _hSyncTimer = { .Instance = TIM1 };
+static TIM_HandleTypeDef _vSyncTimer = { .Instance = TIM3 };
+static DMA_HandleTypeDef _lineDma = { .Instance = DMA2_Stream0 };
+/// Buffer lines read by the line DMA during the last frame
+static BYTE _scanout[TEXT_TEST_HEIGHT][TEXT_TEST_WIDTH];
+/// Buffer lines displayed during the last frame, that do not match the line of their scanline
+static UInt32 _scanoutErrors;
+/// Lines rendered during the last frame
+static UInt32 _renderedLines;
+/// 1bpp character cells of the text font
+static BYTE _glyphCells[TEXT_FONT_CELLS_SIZE];
+
+// ##### Private function definitions #####
+
+VgaVisualizationInfo GetVisualizationInfo(Bpp bpp) {
+    VgaVisualizationInfo info = { 0 };
+    info.BitsPerPixel = bpp;
+    info.FrameSignals = VideoFrame800x600at60Hz;
+    info.Scaling = TEXT_TEST_SCALING;
+    info.Height = TEXT_TEST_HEIGHT;
+    info.mainTimer = &_mainTimer;
+    info.hSyncTimer = &_hSyncTimer;
+    info.vSyncTimer = &_vSyncTimer;
+    info.lineDMA = &_lineDma;
+    return info;
+}
+
+void FillGrid(VgaTextBuffer* grid) {
+    for (UInt16 row = 0; row < grid->Rows; row++) {
+        for (UInt16 column = 0; column < grid->Columns; column++) {
+            int i = (row * grid->Columns) + column;
+            VgaTextCell* cell = &grid->Cells[i];
+            // The last rows repeat the characters above 127, that are displayed as their 7 bit counterpart
+            cell->Character = (char)(i % 256);
+            cell->Attribute = VGA_TEXT_ATTRIBUTE(i % 16, (i / 16) + row);
+        }
+    }
+}
+
+void CountingRenderTextLine(const VgaScreenBuffer* screenBuffer, UInt16 line, BYTE* dest) {
+    _renderedLines++;
+    RenderTextLine(screenBuffer, line, dest);
+}
+
+void ScanoutFrame(VgaScreenBuffer* buffer) {
+    DMA_Stream_TypeDef* dmaStream = buffer->displayState.Bpp8.screenLineDMAStream;
+    UInt16 linePixels = buffer->displayState.Bpp8.linePixels;
+    TEST_CHECK_EQUAL(TEXT_TEST_WIDTH, linePixels, "line pixels");
+    memset(_scanout, 0xCC, sizeof(_scanout));
+    _scanoutErrors = 0;
+    _renderedLines = 0;
+
+    // The vertical blanking prepares the line of the first scanline
+    buffer->vSyncing = true;
+    HandleHSyncInterruptFor8bpp(buffer, 0);
+    buffer->vSyncing = false;
+
+    for (UInt16 scanline = 0; scanline < buffer->scanlineCount; scanline++) {
+        TEST_CHECK_EQUAL(scanline, buffer->scanline, "scanline of the interrupts");
+        HandleHSyncInterruptFor8bpp(buffer, TIM_FLAG_CC3);
+        // The DMA reads the whole line while the next one is rendered
+        UInt16 line = buffer->lineTable[scanline];
+        const BYTE* displayed = (const BYTE*)(uintptr_t)dmaStream->M0AR;
+        if (displayed != buffer->palettized.lineBuffers[0] && displayed != buffer->palettized.lineBuffers[1]) {
+            _scanoutErrors++;
+        }
+        else if (scanline > 0 && line == buffer->lineTable[scanline - 1]) {
+            // A repeated line must be displayed again unchanged
+            if (memcmp(_scanout[line], displayed, linePixels) != 0) {
+                _scanoutErrors++;
+            }
+        }
+        else {
+            memcpy(_scanout[line], displayed, linePixels);
+        }
+        HandleHSyncInterruptFor8bpp(buffer, 0);
+    }
+}
+
+void CheckAgainstBitmap(const VgaTextCell* cells, const UInt32* palette, const char* name) {
+    VgaVisualizationInfo info = GetVisualizationInfo(Bpp8);
+    ScreenBuffer* screen = NULL;
+    TEST_CHECK_EQUAL(VgaErrorNone, VgaCreateScreenBuffer(&info, &screen), "%s 8bpp buffer", name);
+    if (screen == NULL) {
+        return;
+    }
+    TEST_CHECK_EQUAL(TEXT_TEST_WIDTH, screen->screenSize.width, "%s 8bpp width", name);
+    TEST_CHECK_EQUAL(TEXT_TEST_HEIGHT, screen->screenSize.height, "%s 8bpp height", name);
+
+    // The lines below the grid are black
+    Pen pen = { 0 };
+    pen.color.argb = SCREEN_RGB(0, 0, 0);
+    ScreenClear(screen, &pen);
+    for (Int16 row = 0; row < TEXT_TEST_ROWS; row++) {
+        for (Int16 column = 0; column < TEXT_TEST_COLUMNS; column++) {
+            const VgaTextCell* cell = &cells[(row * TEXT_TEST_COLUMNS) + column];
+            PointS origin = { (Int16)(column * TEXT_FONT_CELL_WIDTH), (Int16)(row * TEXT_FONT_CELL_HEIGHT) };
+            pen.color.argb = palette[cell->Attribute >> 4];
+            ScreenFillRectangle(screen, origin, (SizeS){ TEXT_FONT_CELL_WIDTH, TEXT_FONT_CELL_HEIGHT }, &pen);
+
+            pen.color.argb = palette[cell->Attribute & 0x0F];
+            const BYTE* glyphRows = &_glyphCells[((BYTE)cell->Character % TEXT_FONT_CHARACTERS) * TEXT_FONT_CELL_HEIGHT];
+            for (Int16 y = 0; y < TEXT_FONT_CELL_HEIGHT; y++) {
+                for (Int16 x = 0; x < TEXT_FONT_CELL_WIDTH; x++) {
+                    if ((glyphRows[y] & (1 << x)) != 0) {
+                        ScreenDrawPixel(screen, (PointS){ (Int16)(origin.x + x), (Int16)(origin.y + y) }, &pen);
+                    }
+                }
+            }
+        }
+    }
+
+    const VgaScreenBuffer* buffer = (const VgaScreenBuffer*)screen;
+    UInt32 mismatches = 0;
+    for (UInt16 y = 0; y < TEXT_TEST_HEIGHT; y++) {
+        const BYTE* bitmapLine = buffer->BufferPtr + ((UInt32)y * buffer->lineBytes);
+        for (UInt16 x = 0; x < TEXT_TEST_WIDTH; x++) {
+            if (_scanout[y][x] != bitmapLine[x] && mismatches++ < 5) {
+                printf("%s: pixel (%d, %d) is 0x%02X, expected 0x%02X\n", name, x, y, _scanout[y][x], bitmapLine[x]);
+            }
+        }
+    }
+    TEST_CHECK_EQUAL(0, mismatches, "%s text pixels different from the bitmap pixels", name);
+    VgaReleaseScreenBuffer(screen);
+}
+
+void CheckGrid() {
+    VgaVisualizationInfo info = GetVisualizationInfo(Bpp8);
+    VgaTextBuffer* grid = NULL;
+    TEST_CHECK_EQUAL(VgaErrorNone, VgaCreateTextBuffer(&info, &grid), "text buffer creation");
+    if (grid == NULL) {
+        return;
+    }
+    TEST_CHECK_EQUAL(TEXT_TEST_COLUMNS, grid->Columns, "columns");
+    TEST_CHECK_EQUAL(TEXT_TEST_ROWS, grid->Rows, "rows");
+    UInt32 uncleared = 0;
+    for (int i = 0; i < grid->Columns * grid->Rows; i++) {
+        if (grid->Cells[i].Character != ' ' || grid->Cells[i].Attribute != VGA_TEXT_ATTRIBUTE(7, 0)) {
+            uncleared++;
+        }
+    }
+    TEST_CHECK_EQUAL(0, uncleared, "cells not cleared");
+
+    // Only the registered grid can be released
+    VgaTextBuffer otherGrid = *grid;
+    TEST_CHECK_EQUAL(VgaErrorInvalidParameter, VgaReleaseTextBuffer(&otherGrid), "release of another grid");
+    TEST_CHECK_EQUAL(VgaErrorNone, VgaReleaseTextBuffer(grid), "text buffer release");
+}
+
+void CheckTextFrame(const VgaTextCell* cells, const UInt32* palette, const char* name) {
+    VgaVisualizationInfo info = GetVisualizationInfo(Bpp8);
+    VgaTextBuffer* grid = NULL;
+    TEST_CHECK_EQUAL(VgaErrorNone, VgaCreateTextBuffer(&info, &grid), "%s text buffer creation", name);
+    if (grid == NULL) {
+        return;
+    }
+    VgaScreenBuffer* buffer = _activeScreenBuffer;
+    buffer->renderLine = &CountingRenderTextLine;
+
+    // A first frame of the cleared grid, then the cells and the palette are changed: the next frame must display
+    // them, no line can be reused from the previous frame
+    ScanoutFrame(buffer);
+    memcpy(grid->Cells, cells, sizeof(VgaTextCell) * TEXT_TEST_COLUMNS * TEXT_TEST_ROWS);
+    ARGB8Color colors[16];
+    for (int i = 0; i < 16; i++) {
+        colors[i].argb = palette[i];
+    }
+    TEST_CHECK_EQUAL(VgaErrorNone, VgaSetPalette(colors, 16), "%s palette", name);
+    ScanoutFrame(buffer);
+    TEST_CHECK_EQUAL(0, _scanoutErrors, "%s lines not displayed from the line buffers", name);
+    // Each line is rendered once, even if it is displayed in two scanlines
+    TEST_CHECK_EQUAL(TEXT_TEST_HEIGHT, _renderedLines, "%s lines rendered in a frame", name);
+
+    // The bitmap buffer can be created only when the grid has been released
+    TEST_CHECK_EQUAL(VgaErrorNone, VgaReleaseTextBuffer(grid), "%s text buffer release", name);
+    CheckAgainstBitmap(cells, palette, name);
+}
+
+void CheckTextFrames() {
+    static VgaTextBuffer grid = { TEXT_TEST_COLUMNS, TEXT_TEST_ROWS, NULL };
+    static VgaTextCell cells[TEXT_TEST_COLUMNS * TEXT_TEST_ROWS];
+    grid.Cells = cells;
+
+    // All the characters and attributes with the default palette
+    FillGrid(&grid);
+    CheckTextFrame(cells, _defaultPalette4bpp, "default palette");
+
+    // A title bar and a different palette
+    for (int i = 0; i < TEXT_TEST_COLUMNS; i++) {
+        cells[i].Character = (char)('A' + (i % 26));
+        cells[i].Attribute = VGA_TEXT_ATTRIBUTE(0, 15);
+    }
+    UInt32 palette[16];
+    for (int i = 0; i < 16; i++) {
+        palette[i] = SCREEN_RGB(255 - (i * 16), i * 16, (i & 1) * 255);
+    }
+    CheckTextFrame(cells, palette, "changed palette");
+}
+
+// ##### Public function definitions #####
+
+int main() {
+    HostBoardInitialize();
+    ScreenInitializeFont();
+    TextFontBuildCells(_glyphCells);
+
+    CheckGrid();
+    CheckTextFrames();
+    return TestResult();
+}
@@ -0,0 +1,227 @@
+/*
+ * Pixel clock and mode selection of the VGA driver, on the emulated board
+ *
+ * -> Main timer periods generated from the board default timers clock, and the rows of the mode table that need
+ *    a different clock tree
+ * -> The clock trees planned for every row: PLL, bus and flash limits and pixel clock error
+ * -> The mode selected from the free RAM and from the timings reported in the EDID
+ * -> The clock tree programmed when a buffer is created, and the timer registers that generate the pixel clock
+ */
+
+// The driver is included to reach its clock planner and its mode table
+#include <vga/vgascreenbuffer.c>
+#include <hostboard.h>
+#include <hosttest.h>
+
+/// Timers clock of the board default clock tree (APB1 30MHz)
+#define DEFAULT_TIMERS_CLOCK 60000000U
+
+// ##### Private forward declarations #####
+
+/// Returns an EDID that reports only one established timing
+static Edid GetEdidWithTiming(EdidTiming timing);
+/// Creates an 8bpp buffer with the timers of the board and checks that the main timer generates its pixel clock
+static void CreateAndCheckBuffer(const VgaVideoFrameInfo* frame, BYTE scaling);
+static void CheckPixelClockPeriod();
+static void CheckClockTreePlans();
+static void CheckModeSelection();
+static void CheckClockTreeChange();
+
+// ##### Private fields #####
+
+static TIM_HandleTypeDef _mainTimer = { .Instance = TIM4 };
+static TIM_HandleTypeDef _hSyncTimer = { .Instance = TIM1 };
+static TIM_HandleTypeDef _vSyncTimer = { .Instance = TIM3 };
+static DMA_HandleTypeDef _lineDma = { .Instance = DMA2_Stream0 };
+
+// ##### Private function definitions #####
+
+Edid GetEdidWithTiming(EdidTiming timing) {
+    Edid edid = { 0 };
+    edid.EstablishedTimingBitmap.Data[timing / 8] = (BYTE)(1 << (timing % 8));
+    return edid;
+}
+
+void CreateAndCheckBuffer(const VgaVideoFrameInfo* frame, BYTE scaling) {
+    VgaVisualizationInfo info = { 0 };
+    info.BitsPerPixel = Bpp8;
+    info.FrameSignals = *frame;
+    info.Scaling = scaling;
+    info.mainTimer = &_mainTimer;
+    info.hSyncTimer = &_hSyncTimer;
+    info.vSyncTimer = &_vSyncTimer;
+    info.lineDMA = &_lineDma;
+
+    ScreenBuffer* screenBuffer;
+    TEST_CHECK_EQUAL(VgaErrorNone, VgaCreateScreenBuffer(&info, &screenBuffer), "creation of the %.3fMHz / %d buffer",
+        (double)frame->PixelFrequencyMHz, scaling);
+    if (screenBuffer == NULL) {
+        return;
+    }
+
+    UInt32 pixelFreq = (UInt32)((frame->PixelFrequencyMHz / scaling) * 1000000.0f);
+    UInt32 generatedFreq = GetTimersClock() / (_mainTimer.Instance->ARR + 1U);
+    UInt32 error = generatedFreq > pixelFreq ? generatedFreq - pixelFreq : pixelFreq - generatedFreq;
+    TEST_CHECK((UInt64)error * 1000000U <= (UInt64)pixelFreq * VGA_PIXEL_CLOCK_TOLERANCE_PPM,
+        "pixel clock %" PRIu32 "Hz generated for %" PRIu32 "Hz", generatedFreq, pixelFreq);
+    TEST_CHECK(SystemCoreClock >= pixelFreq * VGA_MIN_CYCLES_PER_PIXEL, "core clock %" PRIu32 "Hz", SystemCoreClock);
+    TEST_CHECK(HAL_RCC_GetPCLK1Freq() <= VGA_MAX_APB1_FREQUENCY, "APB1 clock %" PRIu32 "Hz", HAL_RCC_GetPCLK1Freq());
+
+    TEST_CHECK_EQUAL(VgaErrorNone, VgaReleaseScreenBuffer(screenBuffer), "release");
+}
+
+void CheckPixelClockPeriod() {
+    // 800x600 @ 60Hz / 2 and 800x600 @ 56Hz / 3 are generated by the board default clocks
+    TEST_CHECK_EQUAL(3, GetPixelClockPeriod(VideoFrame800x600at60Hz.PixelFrequencyMHz / 2, DEFAULT_TIMERS_CLOCK), "20MHz");
+    TEST_CHECK_EQUAL(5, GetPixelClockPeriod(VideoFrame800x600at56Hz.PixelFrequencyMHz / 3, DEFAULT_TIMERS_CLOCK), "12MHz");
+    // 60MHz / 5 is 0.7% away from 640x480 / 2, 800x600 @ 72Hz / 3 falls between two periods
+    TEST_CHECK_EQUAL(0, GetPixelClockPeriod(VideoFrame640x480at60Hz.PixelFrequencyMHz / 2, DEFAULT_TIMERS_CLOCK), "12.5875MHz");
+    TEST_CHECK_EQUAL(0, GetPixelClockPeriod(VideoFrame800x600at72Hz.PixelFrequencyMHz / 3, DEFAULT_TIMERS_CLOCK), "16.667MHz");
+    // Limits: the line DMA rate, the single count period and the 8 bit period
+    TEST_CHECK_EQUAL(0, GetPixelClockPeriod(25.0f, DEFAULT_TIMERS_CLOCK), "above the line DMA rate");
+    TEST_CHECK_EQUAL(0, GetPixelClockPeriod(20.0f, 30000000U), "period of a single count");
+    TEST_CHECK_EQUAL(0, GetPixelClockPeriod(0.2f, DEFAULT_TIMERS_CLOCK), "period above 255");
+    TEST_CHECK_EQUAL(0, GetPixelClockPeriod(0.0f, DEFAULT_TIMERS_CLOCK), "no pixel clock");
+}
+
+void CheckClockTreePlans() {
+    for (size_t i = 0; i < sizeof(_modes) / sizeof(_modes[0]); i++) {
+        const VgaMode* mode = &_modes[i];
+        UInt32 plannedScalings = 0;
+        for (BYTE scaling = 1; scaling <= VGA_MAX_SCALING; scaling++) {
+            float pixelMHzFreq = mode->frame->PixelFrequencyMHz / scaling;
+            UInt32 pixelFreq = (UInt32)(pixelMHzFreq * 1000000.0f);
+            VgaClockTree tree;
+            if (!PlanMainClockTree(pixelMHzFreq, &tree)) {
+                TEST_CHECK(pixelFreq > VGA_MAX_PIXEL_FREQUENCY, "%s / %d has no clock tree", mode->name, scaling);
+                continue;
+            }
+            plannedScalings++;
+
+            UInt32 vco = (UInt32)(((UInt64)HSE_VALUE * tree.pllN) / tree.pllM);
+            TEST_CHECK(HSE_VALUE / tree.pllM >= VGA_PLL_MIN_INPUT && HSE_VALUE / tree.pllM <= VGA_PLL_MAX_INPUT,
+                "%s / %d PLL input", mode->name, scaling);
+            TEST_CHECK(vco >= VGA_PLL_MIN_VCO && vco <= VGA_PLL_MAX_VCO, "%s / %d VCO %" PRIu32 "Hz", mode->name, scaling, vco);
+            TEST_CHECK(tree.pllQ >= 2 && tree.pllQ <= VGA_PLL_MAX_Q && vco / tree.pllQ <= VGA_PLL_MAX_Q_OUTPUT,
+                "%s / %d PLLQ %" PRIu32, mode->name, scaling, tree.pllQ);
+            TEST_CHECK_EQUAL(vco / tree.pllP, tree.systemClock, "%s / %d system clock", mode->name, scaling);
+            TEST_CHECK(tree.systemClock <= VGA_MAX_SYSTEM_CLOCK && tree.systemClock >= pixelFreq * VGA_MIN_CYCLES_PER_PIXEL,
+                "%s / %d system clock %" PRIu32 "Hz", mode->name, scaling, tree.systemClock);
+            TEST_CHECK(tree.apbShift >= 1 && (tree.systemClock >> tree.apbShift) <= VGA_MAX_APB1_FREQUENCY,
+                "%s / %d APB divider %d", mode->name, scaling, 1 << tree.apbShift);
+            TEST_CHECK_EQUAL((tree.systemClock >> tree.apbShift) * 2U, tree.timersClock, "%s / %d timers clock", mode->name, scaling);
+            TEST_CHECK((UInt64)tree.flashLatency * VGA_FLASH_WAIT_STATE_FREQUENCY < tree.systemClock
+                && (UInt64)(tree.flashLatency + 1U) * VGA_FLASH_WAIT_STATE_FREQUENCY >= tree.systemClock,
+                "%s / %d flash latency %" PRIu32, mode->name, scaling, tree.flashLatency);
+            TEST_CHECK_EQUAL(GetPixelClockPeriod(pixelMHzFreq, tree.timersClock), tree.pixelClockPeriod,
+                "%s / %d period", mode->name, scaling);
+        }
+        // No row of the table is dead
+        TEST_CHECK(plannedScalings > 0, "%s has no clock tree", mode->name);
+    }
+
+    // The board default is kept when it generates the pixel clock
+    VgaClockTree tree;
+    TEST_CHECK(PlanMainClockTree(20.0f, &tree), "plan of 800x600 @ 60Hz / 2");
+    TEST_CHECK_EQUAL(VGA_DEFAULT_PLL_N, tree.pllN, "800x600 @ 60Hz / 2 PLLN");
+    TEST_CHECK_EQUAL(VGA_DEFAULT_APB_SHIFT, tree.apbShift, "800x600 @ 60Hz / 2 APB divider");
+    TEST_CHECK_EQUAL(3, tree.flashLatency, "800x600 @ 60Hz / 2 flash latency");
+}
+
+void CheckModeSelection() {
+    BYTE scaling;
+    size_t size;
+    // The 128KB of the DMA-reachable RAM fit the 400x300 single buffer
+    const VgaMode* mode = FindLargestMode(NULL, Bpp8, 1, &scaling, &size);
+    TEST_CHECK(mode != NULL && mode->frame == &VideoFrame800x600at60Hz, "single 8bpp buffer mode");
+    TEST_CHECK_EQUAL(2, scaling, "single 8bpp buffer scaling");
+    TEST_CHECK_EQUAL(400 * 300, size, "single 8bpp buffer size");
+
+    // Two 8bpp buffers only fit at 266x200: of the three 800x600 rows, the one of the default clocks is preferred
+    mode = FindLargestMode(NULL, Bpp8, 2, &scaling, &size);
+    TEST_CHECK(mode != NULL && mode->frame == &VideoFrame800x600at56Hz, "double 8bpp buffer mode");
+    TEST_CHECK_EQUAL(3, scaling, "double 8bpp buffer scaling");
+    TEST_CHECK_EQUAL(268 * 200 * 2, size, "double 8bpp buffer size");
+
+    // Two 4bpp buffers fit at 400x300
+    mode = FindLargestMode(NULL, Bpp4, 2, &scaling, &size);
+    TEST_CHECK(mode != NULL && mode->frame == &VideoFrame800x600at60Hz, "double 4bpp buffer mode");
+    TEST_CHECK_EQUAL(2, scaling, "double 4bpp buffer scaling");
+
+    // Monitors that report only the rows generated by a planned clock tree
+    Edid edid = GetEdidWithTiming(EdidTiming640x480At60Hz);
+    mode = FindLargestMode(&edid, Bpp8, 1, &scaling, &size);
+    TEST_CHECK(mode != NULL && mode->frame == &VideoFrame640x480at60Hz, "640x480 monitor");
+    TEST_CHECK_EQUAL(2, scaling, "640x480 monitor scaling");
+
+    edid = GetEdidWithTiming(EdidTiming800x600At72Hz);
+    mode = FindLargestMode(&edid, Bpp8, 1, &scaling, &size);
+    TEST_CHECK(mode != NULL && mode->frame == &VideoFrame800x600at72Hz, "800x600 @ 72Hz monitor");
+    TEST_CHECK_EQUAL(3, scaling, "800x600 @ 72Hz monitor scaling");
+
+    edid = GetEdidWithTiming(EdidTiming1024x768At60Hz);
+    mode = FindLargestMode(&edid, Bpp8, 1, &scaling, &size);
+    TEST_CHECK(mode != NULL && mode->frame == &VideoFrame1024x768at60Hz, "1024x768 monitor");
+    TEST_CHECK_EQUAL(4, scaling, "1024x768 monitor scaling");
+
+    // A monitor without any known timing
+    edid = GetEdidWithTiming(EdidTiming720x400At70Hz);
+    TEST_CHECK(FindLargestMode(&edid, Bpp8, 1, &scaling, &size) == NULL, "monitor without known timings");
+}
+
+void CheckClockTreeChange() {
+    TEST_CHECK_EQUAL(DEFAULT_TIMERS_CLOCK, GetTimersClock(), "board default timers clock");
+
+    // 640x480 needs a new clock tree
+    CreateAndCheckBuffer(&VideoFrame640x480at60Hz, 2);
+    TEST_CHECK(GetTimersClock() != DEFAULT_TIMERS_CLOCK, "640x480 timers clock");
+    VgaClockTree tree;
+    TEST_CHECK(PlanMainClockTree(VideoFrame640x480at60Hz.PixelFrequencyMHz / 2, &tree), "640x480 plan");
+    TEST_CHECK_EQUAL(tree.systemClock, SystemCoreClock, "640x480 core clock");
+    TEST_CHECK_EQUAL(tree.pixelClockPeriod, _mainTimer.Instance->ARR + 1U, "640x480 main timer period");
+    RCC_ClkInitTypeDef clocks;
+    uint32_t latency;
+    HAL_RCC_GetClockConfig(&clocks, &latency);
+    TEST_CHECK_EQUAL(RCC_SYSCLKSOURCE_PLLCLK, clocks.SYSCLKSource, "640x480 system clock source");
+    TEST_CHECK_EQUAL(tree.flashLatency, latency, "640x480 flash latency");
+
+    // A row of the planned tree keeps it
+    UInt32 plannedTimersClock = GetTimersClock();
+    CreateAndCheckBuffer(&VideoFrame640x480at60Hz, 4);
+    TEST_CHECK_EQUAL(plannedTimersClock, GetTimersClock(), "640x480 / 4 timers clock");
+
+    // The 400x300 main screen goes back to the board default
+    CreateAndCheckBuffer(&VideoFrame800x600at60Hz, 2);
+    TEST_CHECK_EQUAL(DEFAULT_TIMERS_CLOCK, GetTimersClock(), "400x300 timers clock");
+    TEST_CHECK_EQUAL(120000000U, SystemCoreClock, "400x300 core clock");
+    TEST_CHECK_EQUAL(3, _mainTimer.Instance->ARR + 1U, "400x300 main timer period");
+
+    // 1024x768 / 4 and 800x600 @ 72Hz / 3, the other rows of a planned clock tree
+    CreateAndCheckBuffer(&VideoFrame1024x768at60Hz, 4);
+    CreateAndCheckBuffer(&VideoFrame800x600at72Hz, 3);
+
+    // The frequencies above the line DMA rate are refused before any change
+    UInt32 timersClock = GetTimersClock();
+    VgaVisualizationInfo info = { 0 };
+    info.BitsPerPixel = Bpp8;
+    info.FrameSignals = VideoFrame800x600at72Hz;
+    info.Scaling = 2;
+    info.mainTimer = &_mainTimer;
+    info.hSyncTimer = &_hSyncTimer;
+    info.vSyncTimer = &_vSyncTimer;
+    info.lineDMA = &_lineDma;
+    ScreenBuffer* screenBuffer;
+    TEST_CHECK_EQUAL(VgaErrorNotSupported, VgaCreateScreenBuffer(&info, &screenBuffer), "800x600 @ 72Hz / 2");
+    TEST_CHECK_EQUAL(timersClock, GetTimersClock(), "timers clock after a refused mode");
+}
+
+// ##### Public function definitions #####
+
+int main() {
+    HostBoardInitialize();
+    CheckPixelClockPeriod();
+    CheckClockTreePlans();
+    CheckModeSelection();
+    CheckClockTreeChange();
+    return TestResult();
+}